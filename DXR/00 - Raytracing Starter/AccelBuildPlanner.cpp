@@ -0,0 +1,130 @@
+#include "AccelBuildPlanner.h"
+
+#include <algorithm>
+
+namespace AccelBuildPlanner
+{
+	// Annonymous namespace to hold helpers
+	// only accessible in this file
+	namespace
+	{
+		unsigned long long AlignUp(unsigned long long value)
+		{
+			return (value + Alignment - 1) / Alignment * Alignment;
+		}
+
+		// Do [startA, startA + sizeA) and [startB, startB + sizeB) share any bytes?
+		bool Overlaps(unsigned long long startA, unsigned long long sizeA, unsigned long long startB, unsigned long long sizeB)
+		{
+			return sizeA > 0 && sizeB > 0 && startA < startB + sizeB && startB < startA + sizeA;
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Places every build's result and scratch memory
+//
+// builds        - What each build needs (sizes are aligned
+//                 here, so can come straight from prebuild info)
+// scratchBudget - Scratch memory to aim for, which is only
+//                 exceeded if one build needs more by itself
+// --------------------------------------------------------
+AccelBuildPlan AccelBuildPlanner::Plan(const std::vector<AccelBuildSizes>& builds, unsigned long long scratchBudget)
+{
+	AccelBuildPlan plan = {};
+	plan.Builds.resize(builds.size());
+
+	// Results simply go one after another
+	unsigned long long largestScratch = 0;
+	for (size_t i = 0; i < builds.size(); i++)
+	{
+		plan.Builds[i].ResultOffset = plan.ResultBytes;
+		plan.ResultBytes += AlignUp(builds[i].ResultBytes);
+		plan.SeparateScratchBytes += AlignUp(builds[i].ScratchBytes);
+		largestScratch = std::max(largestScratch, AlignUp(builds[i].ScratchBytes));
+	}
+
+	plan.ScratchBytes = std::min(std::max(AlignUp(scratchBudget), largestScratch), plan.SeparateScratchBytes);
+
+	// First fit, biggest first: each build joins the earliest batch with room left
+	std::vector<size_t> order(builds.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(),
+		[&](size_t a, size_t b) { return builds[a].ScratchBytes > builds[b].ScratchBytes; });
+
+	std::vector<unsigned long long> batchUsed;
+	for (size_t i : order)
+	{
+		unsigned long long scratch = AlignUp(builds[i].ScratchBytes);
+		unsigned int batch = 0;
+		while (batch < batchUsed.size() && batchUsed[batch] + scratch > plan.ScratchBytes)
+			batch++;
+		if (batch == batchUsed.size())
+			batchUsed.push_back(0);
+
+		plan.Builds[i].Batch = batch;
+		plan.Builds[i].ScratchOffset = batchUsed[batch];
+		batchUsed[batch] += scratch;
+	}
+
+	plan.BatchCount = (unsigned int)batchUsed.size();
+	return plan;
+}
+
+
+// --------------------------------------------------------
+// Checks a plan against the builds it was made for
+// --------------------------------------------------------
+bool AccelBuildPlanner::Validate(const std::vector<AccelBuildSizes>& builds, const AccelBuildPlan& plan, std::string& error)
+{
+	if (plan.Builds.size() != builds.size())
+	{
+		error = "plan has " + std::to_string(plan.Builds.size()) + " builds, expected " + std::to_string(builds.size());
+		return false;
+	}
+
+	for (size_t i = 0; i < builds.size(); i++)
+	{
+		const AccelBuildPlacement& a = plan.Builds[i];
+		std::string name = "build " + std::to_string(i);
+
+		if (a.ScratchOffset % Alignment != 0 || a.ResultOffset % Alignment != 0)
+		{
+			error = name + " is misaligned";
+			return false;
+		}
+		if (a.Batch >= plan.BatchCount)
+		{
+			error = name + " is in batch " + std::to_string(a.Batch) + " of " + std::to_string(plan.BatchCount);
+			return false;
+		}
+		if (a.ScratchOffset + builds[i].ScratchBytes > plan.ScratchBytes)
+		{
+			error = name + " runs past the end of the scratch buffer";
+			return false;
+		}
+		if (a.ResultOffset + builds[i].ResultBytes > plan.ResultBytes)
+		{
+			error = name + " runs past the end of the result buffer";
+			return false;
+		}
+
+		for (size_t j = 0; j < i; j++)
+		{
+			const AccelBuildPlacement& b = plan.Builds[j];
+			if (Overlaps(a.ResultOffset, builds[i].ResultBytes, b.ResultOffset, builds[j].ResultBytes))
+			{
+				error = name + " shares result memory with build " + std::to_string(j);
+				return false;
+			}
+			if (a.Batch == b.Batch && Overlaps(a.ScratchOffset, builds[i].ScratchBytes, b.ScratchOffset, builds[j].ScratchBytes))
+			{
+				error = name + " shares scratch memory with build " + std::to_string(j) + " in the same batch";
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Memory one acceleration structure build needs, as given by
+// GetRaytracingAccelerationStructurePrebuildInfo()
+struct AccelBuildSizes
+{
+	unsigned long long ScratchBytes;
+	unsigned long long ResultBytes;
+};
+
+// Where one build goes
+struct AccelBuildPlacement
+{
+	unsigned int Batch;						// Builds in the same batch run together
+	unsigned long long ScratchOffset;		// Within the shared scratch buffer
+	unsigned long long ResultOffset;		// Within the shared result buffer
+};
+
+struct AccelBuildPlan
+{
+	std::vector<AccelBuildPlacement> Builds;	// In the same order as the sizes given
+	unsigned int BatchCount;
+	unsigned long long ScratchBytes;			// Size of the shared scratch buffer
+	unsigned long long ResultBytes;				// Size of the shared result buffer
+	unsigned long long SeparateScratchBytes;	// Scratch needed with one buffer per build
+};
+
+// --------------------------------------------------------
+// Plans how a set of acceleration structure builds share
+// memory, without touching D3D12, so it can be checked on
+// its own.
+//
+// Every result gets its own aligned range of one buffer.
+// Scratch memory is one buffer as well, sized to the larger
+// of the budget and the biggest single build (and no more
+// than every build needs at once).  Builds are packed into
+// batches that each fit in it, biggest first, and each
+// build in a batch gets its own range of the buffer, so a
+// whole batch can run at once.  The batches then reuse the
+// same memory one after another, with a UAV barrier on the
+// scratch buffer between them.
+// --------------------------------------------------------
+namespace AccelBuildPlanner
+{
+	// Matches D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT
+	const unsigned long long Alignment = 256;
+
+	AccelBuildPlan Plan(const std::vector<AccelBuildSizes>& builds, unsigned long long scratchBudget);
+
+	// Checks that a plan is usable for these builds: everything aligned
+	// and in bounds, results never overlapping, and scratch ranges never
+	// overlapping within a batch.  Describes the first problem found.
+	bool Validate(const std::vector<AccelBuildSizes>& builds, const AccelBuildPlan& plan, std::string& error);
+}
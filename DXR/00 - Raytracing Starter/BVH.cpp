@@ -0,0 +1,926 @@
+#include "BVH.h"
+#include "Parallel.h"
+#include "RayIntersection.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Relative costs of visiting a node and testing a triangle
+	const float TraversalCost = 1.0f;
+	const float IntersectionCost = 1.0f;
+
+	// Split candidates per axis, and the largest leaf allowed
+	// when a split isn't worth it according to the SAH
+	const unsigned int BinCount = 16;
+	const unsigned int MaxLeafSize = 8;
+
+	// Deeper ranges become leaves, which bounds the traversal stack
+	const unsigned int MaxTreeDepth = 64;
+
+	// Below this many triangles a range is built as a single task, and
+	// above this many the binning itself is split across threads
+	const unsigned int MinSubtreeTriangles = 1024;
+	const unsigned int MinParallelBinTriangles = 64 * 1024;
+
+	// Marks a node whose subtree is built later as a parallel task
+	const unsigned int SubtreePlaceholder = 0xFFFFFFFF;
+
+	// Growable axis-aligned box
+	struct Bounds
+	{
+		XMFLOAT3 Min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+		XMFLOAT3 Max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+		void Grow(const XMFLOAT3& p)
+		{
+			Min = XMFLOAT3(std::min(Min.x, p.x), std::min(Min.y, p.y), std::min(Min.z, p.z));
+			Max = XMFLOAT3(std::max(Max.x, p.x), std::max(Max.y, p.y), std::max(Max.z, p.z));
+		}
+
+		void Grow(const Bounds& b)
+		{
+			Min = XMFLOAT3(std::min(Min.x, b.Min.x), std::min(Min.y, b.Min.y), std::min(Min.z, b.Min.z));
+			Max = XMFLOAT3(std::max(Max.x, b.Max.x), std::max(Max.y, b.Max.y), std::max(Max.z, b.Max.z));
+		}
+
+		float Area() const
+		{
+			if (Min.x > Max.x) return 0.0f;
+			float x = Max.x - Min.x;
+			float y = Max.y - Min.y;
+			float z = Max.z - Min.z;
+			return 2.0f * (x * y + y * z + z * x);
+		}
+	};
+
+	float Axis(const XMFLOAT3& v, unsigned int axis) { return (&v.x)[axis]; }
+
+	// A contiguous range of triangle references still to be built
+	struct BuildRange
+	{
+		unsigned int Start;
+		unsigned int End;
+		Bounds TriangleBounds;
+		Bounds CentroidBounds;
+		unsigned int Depth;
+	};
+
+	struct Bin
+	{
+		unsigned int Count = 0;
+		Bounds TriangleBounds;
+		Bounds CentroidBounds;
+	};
+
+	struct Bins
+	{
+		Bin Axes[3][BinCount];
+	};
+
+	// A triangle being built into the tree.  These are partitioned
+	// in place, so everything binning needs travels together.
+	struct BuildRef
+	{
+		Bounds TriangleBounds;
+		XMFLOAT3 Centroid;
+		unsigned int Triangle;
+	};
+
+	// Everything shared by the whole build
+	struct BuildContext
+	{
+		std::vector<BuildRef> Refs;
+	};
+
+	// Which bin a centroid falls into (must match between binning and partitioning)
+	unsigned int BinIndex(float centroid, float rangeMin, float scale)
+	{
+		int bin = (int)((centroid - rangeMin) * scale);
+		return (unsigned int)std::min(std::max(bin, 0), (int)BinCount - 1);
+	}
+
+	// Bins the triangles of [start, end) along all three axes
+	void BinTriangles(const BuildContext& ctx, unsigned int start, unsigned int end, const Bounds& centroidBounds, Bins& bins)
+	{
+		float scale[3];
+		for (unsigned int axis = 0; axis < 3; axis++)
+		{
+			float extent = Axis(centroidBounds.Max, axis) - Axis(centroidBounds.Min, axis);
+			scale[axis] = extent > 0.0f ? BinCount / extent : 0.0f;
+		}
+
+		for (unsigned int i = start; i < end; i++)
+		{
+			const BuildRef& ref = ctx.Refs[i];
+			for (unsigned int axis = 0; axis < 3; axis++)
+			{
+				Bin& bin = bins.Axes[axis][BinIndex(Axis(ref.Centroid, axis), Axis(centroidBounds.Min, axis), scale[axis])];
+				bin.Count++;
+				bin.TriangleBounds.Grow(ref.TriangleBounds);
+				bin.CentroidBounds.Grow(ref.Centroid);
+			}
+		}
+	}
+
+	// --------------------------------------------------------
+	// Finds the cheapest split of a range between bins, along
+	// any axis, according to the SAH.  Large ranges are binned
+	// in parallel, with each thread filling its own bins.
+	// --------------------------------------------------------
+	bool FindBestSplit(const BuildContext& ctx, const BuildRange& range, unsigned int& bestAxis, unsigned int& bestSplit, float& bestCost, BuildRange& left, BuildRange& right)
+	{
+		unsigned int count = range.End - range.Start;
+		Bins bins;
+		unsigned int threads = count >= MinParallelBinTriangles ? Parallel::ThreadCountFor(count, MinParallelBinTriangles / 4) : 1;
+		if (threads > 1)
+		{
+			std::vector<Bins> threadBins(threads);
+			Parallel::ForRanges(count, threads, [&](unsigned int t, size_t start, size_t end)
+				{
+					BinTriangles(ctx, range.Start + (unsigned int)start, range.Start + (unsigned int)end, range.CentroidBounds, threadBins[t]);
+				});
+
+			for (unsigned int axis = 0; axis < 3; axis++)
+				for (unsigned int b = 0; b < BinCount; b++)
+					for (const Bins& tb : threadBins)
+					{
+						bins.Axes[axis][b].Count += tb.Axes[axis][b].Count;
+						bins.Axes[axis][b].TriangleBounds.Grow(tb.Axes[axis][b].TriangleBounds);
+						bins.Axes[axis][b].CentroidBounds.Grow(tb.Axes[axis][b].CentroidBounds);
+					}
+		}
+		else
+		{
+			BinTriangles(ctx, range.Start, range.End, range.CentroidBounds, bins);
+		}
+
+		// Sweep each axis from both ends to get the cost of every split plane
+		bool found = false;
+		float invArea = 1.0f / std::max(range.TriangleBounds.Area(), FLT_MIN);
+		for (unsigned int axis = 0; axis < 3; axis++)
+		{
+			if (Axis(range.CentroidBounds.Max, axis) <= Axis(range.CentroidBounds.Min, axis))
+				continue;
+
+			const Bin* axisBins = bins.Axes[axis];
+			float rightArea[BinCount];
+			unsigned int rightCount[BinCount];
+			Bounds accum;
+			unsigned int accumCount = 0;
+			for (unsigned int b = BinCount - 1; b > 0; b--)
+			{
+				accum.Grow(axisBins[b].TriangleBounds);
+				accumCount += axisBins[b].Count;
+				rightArea[b] = accum.Area();
+				rightCount[b] = accumCount;
+			}
+
+			accum = Bounds();
+			accumCount = 0;
+			for (unsigned int split = 1; split < BinCount; split++)
+			{
+				accum.Grow(axisBins[split - 1].TriangleBounds);
+				accumCount += axisBins[split - 1].Count;
+				if (accumCount == 0 || rightCount[split] == 0)
+					continue;
+
+				float cost = TraversalCost + IntersectionCost * invArea *
+					(accum.Area() * accumCount + rightArea[split] * rightCount[split]);
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+					found = true;
+				}
+			}
+		}
+
+		if (!found)
+			return false;
+
+		// The children's bounds come straight from the bins
+		left = BuildRange{ range.Start, range.Start, Bounds(), Bounds(), range.Depth + 1 };
+		right = BuildRange{ range.Start, range.End, Bounds(), Bounds(), range.Depth + 1 };
+		for (unsigned int b = 0; b < BinCount; b++)
+		{
+			const Bin& bin = bins.Axes[bestAxis][b];
+			BuildRange& side = b < bestSplit ? left : right;
+			side.TriangleBounds.Grow(bin.TriangleBounds);
+			side.CentroidBounds.Grow(bin.CentroidBounds);
+			if (b < bestSplit)
+				left.End += bin.Count;
+		}
+		right.Start = left.End;
+		return true;
+	}
+
+	// Recalculates the bounds of a range from its triangles
+	void CalculateRangeBounds(const BuildContext& ctx, BuildRange& range)
+	{
+		range.TriangleBounds = Bounds();
+		range.CentroidBounds = Bounds();
+		for (unsigned int i = range.Start; i < range.End; i++)
+		{
+			range.TriangleBounds.Grow(ctx.Refs[i].TriangleBounds);
+			range.CentroidBounds.Grow(ctx.Refs[i].Centroid);
+		}
+	}
+
+	// --------------------------------------------------------
+	// Decides how to handle a range: returns false if it should
+	// be a leaf, otherwise partitions its references in place
+	// and fills in the two child ranges
+	// --------------------------------------------------------
+	bool SplitRange(BuildContext& ctx, const BuildRange& range, BuildRange& left, BuildRange& right)
+	{
+		unsigned int count = range.End - range.Start;
+		if (count <= 1 || range.Depth + 1 >= MaxTreeDepth)
+			return false;
+
+		// Is any split cheaper than just testing every triangle?
+		unsigned int axis = 0;
+		unsigned int split = 0;
+		float leafCost = IntersectionCost * count;
+		float bestCost = FLT_MAX;
+		if (FindBestSplit(ctx, range, axis, split, bestCost, left, right))
+		{
+			if (bestCost >= leafCost && count <= MaxLeafSize)
+				return false;
+
+			float scale = BinCount / (Axis(range.CentroidBounds.Max, axis) - Axis(range.CentroidBounds.Min, axis));
+			float rangeMin = Axis(range.CentroidBounds.Min, axis);
+			std::partition(ctx.Refs.begin() + range.Start, ctx.Refs.begin() + range.End, [&](const BuildRef& ref)
+				{
+					return BinIndex(Axis(ref.Centroid, axis), rangeMin, scale) < split;
+				});
+			return true;
+		}
+
+		// All centroids are in the same spot, so only split if the leaf would be too big
+		if (count <= MaxLeafSize)
+			return false;
+
+		unsigned int mid = range.Start + count / 2;
+		left = BuildRange{ range.Start, mid, Bounds(), Bounds(), range.Depth + 1 };
+		right = BuildRange{ mid, range.End, Bounds(), Bounds(), range.Depth + 1 };
+		CalculateRangeBounds(ctx, left);
+		CalculateRangeBounds(ctx, right);
+		return true;
+	}
+
+	BVHNode MakeNode(const Bounds& bounds, unsigned int index, unsigned int count)
+	{
+		return BVHNode{ bounds.Min, index, bounds.Max, count };
+	}
+
+	// --------------------------------------------------------
+	// Builds a whole subtree depth-first into a node array,
+	// with child indices relative to the start of the array
+	// --------------------------------------------------------
+	void BuildSubtree(BuildContext& ctx, const BuildRange& range, std::vector<BVHNode>& nodes, unsigned int& maxDepth)
+	{
+		unsigned int index = (unsigned int)nodes.size();
+		nodes.push_back(MakeNode(range.TriangleBounds, range.Start, range.End - range.Start));
+		maxDepth = std::max(maxDepth, range.Depth);
+
+		BuildRange left, right;
+		if (!SplitRange(ctx, range, left, right))
+			return;
+
+		nodes[index].Count = 0;
+		BuildSubtree(ctx, left, nodes, maxDepth);
+		nodes[index].Index = (unsigned int)nodes.size();
+		BuildSubtree(ctx, right, nodes, maxDepth);
+	}
+
+	// --------------------------------------------------------
+	// Builds the top of the tree on this thread, stopping at
+	// ranges small enough to hand off as independent tasks.
+	// Those become placeholder nodes indexing into "tasks".
+	// --------------------------------------------------------
+	void BuildTop(BuildContext& ctx, const BuildRange& range, unsigned int taskSize, std::vector<BVHNode>& nodes, std::vector<BuildRange>& tasks, unsigned int& maxDepth)
+	{
+		if (range.End - range.Start <= taskSize)
+		{
+			nodes.push_back(MakeNode(range.TriangleBounds, (unsigned int)tasks.size(), SubtreePlaceholder));
+			tasks.push_back(range);
+			return;
+		}
+
+		unsigned int index = (unsigned int)nodes.size();
+		nodes.push_back(MakeNode(range.TriangleBounds, range.Start, range.End - range.Start));
+		maxDepth = std::max(maxDepth, range.Depth);
+
+		BuildRange left, right;
+		if (!SplitRange(ctx, range, left, right))
+			return;
+
+		nodes[index].Count = 0;
+		BuildTop(ctx, left, taskSize, nodes, tasks, maxDepth);
+		nodes[index].Index = (unsigned int)nodes.size();
+		BuildTop(ctx, right, taskSize, nodes, tasks, maxDepth);
+	}
+}
+
+
+BVH::BVH(const Vertex* verts, unsigned int numVerts, const unsigned int* indices, unsigned int numIndices)
+{
+	Build(verts, numVerts, indices, numIndices);
+}
+
+
+// --------------------------------------------------------
+// Builds the BVH for a set of indexed triangles, replacing
+// anything built previously.
+//
+// The top of the tree is split on the calling thread (with
+// parallel binning for large ranges) until there are enough
+// independent subtrees to keep every core busy.  Those are
+// then built in parallel, largest first, and stitched into
+// a single depth-first array.
+//
+// verts      - The vertices of the triangles
+// numVerts   - How many vertices are in the array
+// indices    - The indices making up the triangles
+// numIndices - How many indices are in the array
+// --------------------------------------------------------
+BVHBuildStats BVH::Build(const Vertex* verts, unsigned int numVerts, const unsigned int* indices, unsigned int numIndices)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	unsigned int numTris = numIndices / 3;
+	nodes.clear();
+	trianglePositions.clear();
+	triangleIDs.clear();
+	buildStats = {};
+	if (numTris == 0 || numVerts == 0)
+		return buildStats;
+
+	// Per-triangle bounds and centroids, which are all the build needs
+	BuildContext ctx;
+	ctx.Refs.resize(numTris);
+	unsigned int prepThreads = Parallel::ThreadCountFor(numTris, MinSubtreeTriangles * 16);
+	Parallel::ForRanges(numTris, prepThreads, [&](unsigned int, size_t first, size_t end)
+		{
+			for (size_t tri = first; tri < end; tri++)
+			{
+				Bounds bounds;
+				for (unsigned int c = 0; c < 3; c++)
+					bounds.Grow(verts[indices[tri * 3 + c]].Position);
+
+				BuildRef& ref = ctx.Refs[tri];
+				ref.TriangleBounds = bounds;
+				ref.Centroid = XMFLOAT3(
+					(bounds.Min.x + bounds.Max.x) * 0.5f,
+					(bounds.Min.y + bounds.Max.y) * 0.5f,
+					(bounds.Min.z + bounds.Max.z) * 0.5f);
+				ref.Triangle = (unsigned int)tri;
+			}
+		});
+
+	BuildRange root{ 0, numTris, Bounds(), Bounds(), 0 };
+	CalculateRangeBounds(ctx, root);
+
+	// Split off enough subtrees for each thread to get several
+	unsigned int threads = Parallel::ThreadCountFor(numTris, MinSubtreeTriangles);
+	unsigned int taskSize = std::max(MinSubtreeTriangles, numTris / (threads * 8));
+	if (threads == 1)
+		taskSize = numTris;
+
+	std::vector<BVHNode> top;
+	std::vector<BuildRange> tasks;
+	unsigned int maxDepth = 0;
+	BuildTop(ctx, root, taskSize, top, tasks, maxDepth);
+
+	// Build the subtrees, with each thread grabbing the largest remaining one
+	std::vector<unsigned int> taskOrder(tasks.size());
+	for (unsigned int i = 0; i < taskOrder.size(); i++)
+		taskOrder[i] = i;
+	std::sort(taskOrder.begin(), taskOrder.end(), [&](unsigned int a, unsigned int b)
+		{
+			return tasks[a].End - tasks[a].Start > tasks[b].End - tasks[b].Start;
+		});
+
+	std::vector<std::vector<BVHNode>> subtrees(tasks.size());
+	std::vector<unsigned int> subtreeDepths(tasks.size(), 0);
+	std::atomic<unsigned int> nextTask = 0;
+	threads = std::max(1u, std::min(threads, (unsigned int)tasks.size()));
+	Parallel::Run(threads, [&](size_t)
+		{
+			for (unsigned int t = nextTask++; t < tasks.size(); t = nextTask++)
+			{
+				unsigned int task = taskOrder[t];
+				BuildSubtree(ctx, tasks[task], subtrees[task], subtreeDepths[task]);
+			}
+		});
+
+	// Stitch everything into one depth-first array, remapping the top
+	// nodes' right children and offsetting the subtrees' right children
+	std::vector<unsigned int> remap(top.size());
+	for (unsigned int i = 0; i < top.size(); i++)
+	{
+		remap[i] = (unsigned int)nodes.size();
+		if (top[i].Count != SubtreePlaceholder)
+		{
+			nodes.push_back(top[i]);
+			continue;
+		}
+
+		unsigned int offset = (unsigned int)nodes.size();
+		unsigned int task = top[i].Index;
+		for (BVHNode node : subtrees[task])
+		{
+			if (node.Count == 0)
+				node.Index += offset;
+			nodes.push_back(node);
+		}
+		maxDepth = std::max(maxDepth, subtreeDepths[task]);
+	}
+	for (unsigned int i = 0; i < top.size(); i++)
+	{
+		if (top[i].Count == 0)
+			nodes[remap[i]].Index = remap[top[i].Index];
+	}
+
+	// Copy the triangles in leaf order so traversal reads them sequentially
+	trianglePositions.resize((size_t)numTris * 3);
+	triangleIDs.resize(numTris);
+	Parallel::ForRanges(numTris, prepThreads, [&](unsigned int, size_t first, size_t end)
+		{
+			for (size_t i = first; i < end; i++)
+			{
+				unsigned int tri = ctx.Refs[i].Triangle;
+				triangleIDs[i] = tri;
+				for (unsigned int c = 0; c < 3; c++)
+					trianglePositions[i * 3 + c] = verts[indices[tri * 3 + c]].Position;
+			}
+		});
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	buildStats.Triangles = numTris;
+	buildStats.Nodes = (unsigned int)nodes.size();
+	for (const BVHNode& node : nodes)
+		buildStats.Leaves += node.Count > 0 ? 1 : 0;
+	buildStats.MaxDepth = maxDepth;
+	buildStats.Subtrees = (unsigned int)tasks.size();
+	buildStats.Threads = threads;
+	buildStats.SAHCost = CalculateSAHCost();
+	buildStats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	return buildStats;
+}
+
+
+// --------------------------------------------------------
+// Refits the BVH to new vertex positions in O(n): the
+// triangles are gathered again in leaf order, then every
+// node's bounds are recalculated from the bottom up.
+//
+// Nodes are depth-first, so both children of a node come
+// after it, and walking the array backwards reaches every
+// child before its parent.
+//
+// verts      - The moved vertices of the triangles
+// numVerts   - How many vertices are in the array
+// indices    - The same indices the BVH was built with
+// numIndices - How many indices are in the array
+// --------------------------------------------------------
+BVHBuildStats BVH::Refit(const Vertex* verts, unsigned int numVerts, const unsigned int* indices, unsigned int numIndices)
+{
+	unsigned int numTris = numIndices / 3;
+	if (nodes.empty() || numVerts == 0 || numTris != triangleIDs.size())
+		return Build(verts, numVerts, indices, numIndices);
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	unsigned int threads = Parallel::ThreadCountFor(numTris, MinSubtreeTriangles * 16);
+	Parallel::ForRanges(numTris, threads, [&](unsigned int, size_t first, size_t end)
+		{
+			for (size_t i = first; i < end; i++)
+			{
+				unsigned int tri = triangleIDs[i];
+				for (unsigned int c = 0; c < 3; c++)
+					trianglePositions[i * 3 + c] = verts[indices[tri * 3 + c]].Position;
+			}
+		});
+
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		BVHNode& node = nodes[i];
+		Bounds bounds;
+		if (node.Count > 0)
+		{
+			size_t first = (size_t)node.Index * 3;
+			size_t end = first + (size_t)node.Count * 3;
+			for (size_t p = first; p < end; p++)
+				bounds.Grow(trianglePositions[p]);
+		}
+		else
+		{
+			const BVHNode& left = nodes[i + 1];
+			const BVHNode& right = nodes[node.Index];
+			bounds.Grow(left.BoundsMin);
+			bounds.Grow(left.BoundsMax);
+			bounds.Grow(right.BoundsMin);
+			bounds.Grow(right.BoundsMax);
+		}
+		node.BoundsMin = bounds.Min;
+		node.BoundsMax = bounds.Max;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	BVHBuildStats stats = buildStats;
+	stats.Subtrees = 0;
+	stats.Threads = threads;
+	stats.SAHCost = CalculateSAHCost();
+	stats.Refit = true;
+	stats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	return stats;
+}
+
+
+// --------------------------------------------------------
+// Finds the closest triangle hit along a ray, visiting the
+// nearer child of each node first so that hits found early
+// can cull the farther child
+// --------------------------------------------------------
+bool BVH::TraceClosest(XMFLOAT3 origin, XMFLOAT3 direction, float tMin, float tMax, BVHHit& hit) const
+{
+	if (nodes.empty())
+		return false;
+
+	XMFLOAT3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	XMVECTOR rayOrigin = XMLoadFloat3(&origin);
+	XMVECTOR rayDir = XMLoadFloat3(&direction);
+
+	float entry;
+	if (!RayIntersection::RayBox(origin, invDir, nodes[0].BoundsMin, nodes[0].BoundsMax, tMin, tMax, entry))
+		return false;
+
+	bool found = false;
+	float closest = tMax;
+	unsigned int stack[MaxTreeDepth];
+	unsigned int stackSize = 0;
+	unsigned int current = 0;
+	while (true)
+	{
+		const BVHNode& node = nodes[current];
+		if (node.Count > 0)
+		{
+			// Leaf, so test its triangles
+			for (unsigned int i = node.Index; i < node.Index + node.Count; i++)
+			{
+				const XMFLOAT3* p = &trianglePositions[(size_t)i * 3];
+				float t;
+				XMFLOAT2 barycentrics;
+				if (RayIntersection::RayTriangle(rayOrigin, rayDir, XMLoadFloat3(&p[0]), XMLoadFloat3(&p[1]), XMLoadFloat3(&p[2]), t, barycentrics) &&
+					t >= tMin && t < closest)
+				{
+					closest = t;
+					hit.T = t;
+					hit.Triangle = triangleIDs[i];
+					hit.Barycentrics = barycentrics;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			// Inner node, so visit whichever children the ray hits, nearest first
+			unsigned int left = current + 1;
+			unsigned int right = node.Index;
+			float leftEntry, rightEntry;
+			bool hitLeft = RayIntersection::RayBox(origin, invDir, nodes[left].BoundsMin, nodes[left].BoundsMax, tMin, closest, leftEntry);
+			bool hitRight = RayIntersection::RayBox(origin, invDir, nodes[right].BoundsMin, nodes[right].BoundsMax, tMin, closest, rightEntry);
+			if (hitLeft && hitRight)
+			{
+				if (rightEntry < leftEntry)
+					std::swap(left, right);
+				stack[stackSize++] = right;
+				current = left;
+				continue;
+			}
+			if (hitLeft) { current = left; continue; }
+			if (hitRight) { current = right; continue; }
+		}
+
+		if (stackSize == 0)
+			break;
+		current = stack[--stackSize];
+	}
+	return found;
+}
+
+
+// --------------------------------------------------------
+// Checks for any triangle hit along a ray, returning as
+// soon as one is found.  Which hit that is doesn't matter,
+// so children are visited without sorting them.
+// --------------------------------------------------------
+bool BVH::TraceAny(XMFLOAT3 origin, XMFLOAT3 direction, float tMin, float tMax) const
+{
+	if (nodes.empty())
+		return false;
+
+	XMFLOAT3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	XMVECTOR rayOrigin = XMLoadFloat3(&origin);
+	XMVECTOR rayDir = XMLoadFloat3(&direction);
+
+	float entry;
+	if (!RayIntersection::RayBox(origin, invDir, nodes[0].BoundsMin, nodes[0].BoundsMax, tMin, tMax, entry))
+		return false;
+
+	unsigned int stack[MaxTreeDepth];
+	unsigned int stackSize = 0;
+	unsigned int current = 0;
+	while (true)
+	{
+		const BVHNode& node = nodes[current];
+		if (node.Count > 0)
+		{
+			for (unsigned int i = node.Index; i < node.Index + node.Count; i++)
+			{
+				const XMFLOAT3* p = &trianglePositions[(size_t)i * 3];
+				float t;
+				XMFLOAT2 barycentrics;
+				if (RayIntersection::RayTriangle(rayOrigin, rayDir, XMLoadFloat3(&p[0]), XMLoadFloat3(&p[1]), XMLoadFloat3(&p[2]), t, barycentrics) &&
+					t >= tMin && t < tMax)
+					return true;
+			}
+		}
+		else
+		{
+			unsigned int left = current + 1;
+			unsigned int right = node.Index;
+			float leftEntry, rightEntry;
+			bool hitLeft = RayIntersection::RayBox(origin, invDir, nodes[left].BoundsMin, nodes[left].BoundsMax, tMin, tMax, leftEntry);
+			bool hitRight = RayIntersection::RayBox(origin, invDir, nodes[right].BoundsMin, nodes[right].BoundsMax, tMin, tMax, rightEntry);
+			if (hitLeft && hitRight)
+			{
+				stack[stackSize++] = right;
+				current = left;
+				continue;
+			}
+			if (hitLeft) { current = left; continue; }
+			if (hitRight) { current = right; continue; }
+		}
+
+		if (stackSize == 0)
+			break;
+		current = stack[--stackSize];
+	}
+	return false;
+}
+
+
+// --------------------------------------------------------
+// Checks that a packet's rays all head the same way on each
+// axis, so they enter every box through the same planes,
+// which is what makes culling the whole packet possible
+// --------------------------------------------------------
+bool BVH::IsCoherent(const BVHRayPacket& packet)
+{
+	if (packet.Count == 0 || packet.Count > BVHPacketSize)
+		return false;
+
+	const XMFLOAT3& first = packet.Directions[0];
+	for (unsigned int i = 1; i < packet.Count; i++)
+	{
+		const XMFLOAT3& dir = packet.Directions[i];
+		if (std::signbit(dir.x) != std::signbit(first.x) ||
+			std::signbit(dir.y) != std::signbit(first.y) ||
+			std::signbit(dir.z) != std::signbit(first.z))
+			return false;
+	}
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Traces a packet of rays through the tree together, so
+// each node is fetched once for the whole packet.
+//
+// Each node is tested against the first ray still active
+// for it.  When that ray misses, interval bounds over the
+// whole packet's directions check whether every ray misses
+// before finding the next ray that does hit.  The last ray
+// that hits is found the same way, and only rays between
+// the two are considered below that node.
+// --------------------------------------------------------
+unsigned long long BVH::TraceClosestPacket(BVHRayPacket& packet, BVHHit* hits) const
+{
+	packet.LeavesVisited = 0;
+	packet.LeafRays = 0;
+	if (nodes.empty() || packet.Count == 0)
+		return 0;
+
+	// Divergent packets can't be culled as a whole, so trace each ray alone
+	unsigned long long hitMask = 0;
+	if (!IsCoherent(packet))
+	{
+		for (unsigned int i = 0; i < packet.Count; i++)
+		{
+			if (TraceClosest(packet.Origin, packet.Directions[i], packet.TMin, packet.TMax[i], hits[i]))
+			{
+				packet.TMax[i] = hits[i].T;
+				hitMask |= 1ull << i;
+			}
+		}
+		return hitMask;
+	}
+
+	// Per ray reciprocals, and their range on each axis
+	XMFLOAT3 invDirs[BVHPacketSize];
+	XMFLOAT3 invMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 invMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	float packetTMax = 0.0f;
+	for (unsigned int i = 0; i < packet.Count; i++)
+	{
+		const XMFLOAT3& dir = packet.Directions[i];
+		invDirs[i] = XMFLOAT3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+		invMin = XMFLOAT3(std::min(invMin.x, invDirs[i].x), std::min(invMin.y, invDirs[i].y), std::min(invMin.z, invDirs[i].z));
+		invMax = XMFLOAT3(std::max(invMax.x, invDirs[i].x), std::max(invMax.y, invDirs[i].y), std::max(invMax.z, invDirs[i].z));
+		packetTMax = std::max(packetTMax, packet.TMax[i]);
+	}
+
+	// Could any ray in the packet hit the node?  Bounds where each slab is
+	// entered & exited across all directions, and if even the earliest exit
+	// comes before the latest entry, none can.  A NaN (from a ray in a
+	// slab's plane) fails the comparisons, leaving that slab out.
+	auto packetMisses = [&](const BVHNode& node)
+		{
+			float entry = packet.TMin;
+			float exit = packetTMax;
+			for (unsigned int axis = 0; axis < 3; axis++)
+			{
+				bool positive = !std::signbit(Axis(packet.Directions[0], axis));
+				float nearPlane = positive ? Axis(node.BoundsMin, axis) : Axis(node.BoundsMax, axis);
+				float farPlane = positive ? Axis(node.BoundsMax, axis) : Axis(node.BoundsMin, axis);
+				float origin = Axis(packet.Origin, axis);
+
+				float near0 = (nearPlane - origin) * Axis(invMin, axis);
+				float near1 = (nearPlane - origin) * Axis(invMax, axis);
+				float far0 = (farPlane - origin) * Axis(invMin, axis);
+				float far1 = (farPlane - origin) * Axis(invMax, axis);
+				if (near0 > entry && near1 > entry) entry = std::min(near0, near1);
+				if (far0 < exit && far1 < exit) exit = std::max(far0, far1);
+			}
+			return entry > exit;
+		};
+
+	auto rayHits = [&](unsigned int ray, const BVHNode& node)
+		{
+			float entry;
+			return RayIntersection::RayBox(packet.Origin, invDirs[ray], node.BoundsMin, node.BoundsMax, packet.TMin, packet.TMax[ray], entry);
+		};
+
+	XMVECTOR rayOrigin = XMLoadFloat3(&packet.Origin);
+	struct StackEntry
+	{
+		unsigned int Node;
+		unsigned int First;
+		unsigned int End;
+	};
+	StackEntry stack[MaxTreeDepth];
+	unsigned int stackSize = 0;
+	unsigned int current = 0;
+	unsigned int first = 0;
+	unsigned int end = packet.Count;
+	while (true)
+	{
+		const BVHNode& node = nodes[current];
+
+		// Find the first ray that hits this node, if any
+		bool visit = true;
+		if (!rayHits(first, node))
+		{
+			if (packetMisses(node))
+				visit = false;
+			else
+			{
+				do { first++; } while (first < end && !rayHits(first, node));
+				visit = first < end;
+			}
+		}
+
+		// Then the last (which is at least the first)
+		if (visit)
+		{
+			while (!rayHits(end - 1, node))
+				end--;
+		}
+
+		if (visit && node.Count > 0)
+		{
+			// Leaf, so test its triangles against every remaining ray that hits it
+			unsigned long long active = 0;
+			unsigned int activeCount = 0;
+			for (unsigned int i = first; i < end; i++)
+			{
+				if (rayHits(i, node))
+				{
+					active |= 1ull << i;
+					activeCount++;
+				}
+			}
+			packet.LeavesVisited++;
+			packet.LeafRays += activeCount;
+
+			for (unsigned int tri = node.Index; tri < node.Index + node.Count; tri++)
+			{
+				const XMFLOAT3* p = &trianglePositions[(size_t)tri * 3];
+				XMVECTOR p0 = XMLoadFloat3(&p[0]);
+				XMVECTOR p1 = XMLoadFloat3(&p[1]);
+				XMVECTOR p2 = XMLoadFloat3(&p[2]);
+				for (unsigned int i = first; i < end; i++)
+				{
+					if ((active & (1ull << i)) == 0)
+						continue;
+
+					float t;
+					XMFLOAT2 barycentrics;
+					if (RayIntersection::RayTriangle(rayOrigin, XMLoadFloat3(&packet.Directions[i]), p0, p1, p2, t, barycentrics) &&
+						t >= packet.TMin && t < packet.TMax[i])
+					{
+						packet.TMax[i] = t;
+						hits[i].T = t;
+						hits[i].Triangle = triangleIDs[tri];
+						hits[i].Barycentrics = barycentrics;
+						hitMask |= 1ull << i;
+					}
+				}
+			}
+
+			packetTMax = 0.0f;
+			for (unsigned int i = 0; i < packet.Count; i++)
+				packetTMax = std::max(packetTMax, packet.TMax[i]);
+		}
+		else if (visit)
+		{
+			// Inner node, so visit the child nearer to the first active ray first
+			unsigned int left = current + 1;
+			unsigned int right = node.Index;
+			XMVECTOR dir = XMLoadFloat3(&packet.Directions[first]);
+			auto distance = [&](const BVHNode& child)
+				{
+					XMVECTOR center = XMVectorScale(XMVectorAdd(XMLoadFloat3(&child.BoundsMin), XMLoadFloat3(&child.BoundsMax)), 0.5f);
+					return XMVectorGetX(XMVector3Dot(XMVectorSubtract(center, rayOrigin), dir));
+				};
+			if (distance(nodes[right]) < distance(nodes[left]))
+				std::swap(left, right);
+
+			stack[stackSize++] = { right, first, end };
+			current = left;
+			continue;
+		}
+
+		if (stackSize == 0)
+			break;
+		stackSize--;
+		current = stack[stackSize].Node;
+		first = stack[stackSize].First;
+		end = stack[stackSize].End;
+	}
+	return hitMask;
+}
+
+
+// --------------------------------------------------------
+// Expected cost of tracing a random ray through the tree,
+// using each node's surface area relative to the root as
+// the probability of visiting it
+// --------------------------------------------------------
+float BVH::CalculateSAHCost() const
+{
+	if (nodes.empty())
+		return 0.0f;
+
+	auto area = [](const BVHNode& node)
+		{
+			Bounds b;
+			b.Min = node.BoundsMin;
+			b.Max = node.BoundsMax;
+			return b.Area();
+		};
+
+	float rootArea = std::max(area(nodes[0]), FLT_MIN);
+	double cost = 0.0;
+	for (const BVHNode& node : nodes)
+	{
+		float relativeArea = area(node) / rootArea;
+		cost += node.Count > 0 ?
+			IntersectionCost * node.Count * relativeArea :
+			TraversalCost * relativeArea;
+	}
+	return (float)cost;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+#include "Vertex.h"
+
+// --------------------------------------------------------
+// A single BVH node, laid out depth-first: an inner node's
+// left child is always the very next node, so only the
+// right child's index is stored.  32 bytes.
+// --------------------------------------------------------
+struct BVHNode
+{
+	DirectX::XMFLOAT3 BoundsMin;
+	unsigned int Index;				// Leaf: first triangle, inner: right child
+	DirectX::XMFLOAT3 BoundsMax;
+	unsigned int Count;				// Leaf: triangle count, inner: 0
+};
+
+// Closest hit found by BVH::TraceClosest()
+struct BVHHit
+{
+	float T;
+	unsigned int Triangle;				// Index of the triangle in the original index data
+	DirectX::XMFLOAT2 Barycentrics;		// Weights of the 2nd & 3rd vertices
+};
+
+// Largest packet for BVH::TraceClosestPacket (an 8x8 block of pixels)
+const unsigned int BVHPacketSize = 64;
+
+// --------------------------------------------------------
+// Rays that share an origin, like the camera rays of a
+// block of pixels.  Each ray's TMax is shortened as hits
+// are found, so one packet can be traced through several
+// BVHs in a row.
+// --------------------------------------------------------
+struct BVHRayPacket
+{
+	DirectX::XMFLOAT3 Origin;
+	float TMin;
+	unsigned int Count;
+	DirectX::XMFLOAT3 Directions[BVHPacketSize];
+	float TMax[BVHPacketSize];
+
+	// Filled in by tracing, showing how well the rays stayed
+	// together: leaves visited, and rays tested at those leaves
+	unsigned int LeavesVisited;
+	unsigned int LeafRays;
+};
+
+// Details of the most recent build
+struct BVHBuildStats
+{
+	unsigned int Triangles;
+	unsigned int Nodes;
+	unsigned int Leaves;
+	unsigned int MaxDepth;
+	unsigned int Subtrees;		// Subtrees built in parallel
+	unsigned int Threads;
+	float SAHCost;				// Expected cost of a ray, in triangle tests
+	bool Refit;					// Refit rather than built (see BVH::Refit)
+	double Milliseconds;
+};
+
+// --------------------------------------------------------
+// A bounding volume hierarchy over a set of triangles,
+// built with a binned surface area heuristic (SAH)
+//
+// The BVH keeps its own copy of each triangle's positions
+// in leaf order, so it doesn't depend on the source data
+// after building.
+// --------------------------------------------------------
+class BVH
+{
+public:
+	BVH() = default;
+	BVH(const Vertex* verts, unsigned int numVerts, const unsigned int* indices, unsigned int numIndices);
+
+	BVHBuildStats Build(const Vertex* verts, unsigned int numVerts, const unsigned int* indices, unsigned int numIndices);
+
+	// Updates the bounds of every node for moved vertices of the same
+	// triangles as the last build (or builds, if they don't match).  The
+	// tree's structure is kept, so it gets slower to trace as triangles
+	// move away from where they were built: compare the SAH cost this
+	// returns with GetBuildStats().SAHCost to decide when to rebuild.
+	BVHBuildStats Refit(const Vertex* verts, unsigned int numVerts, const unsigned int* indices, unsigned int numIndices);
+
+	// Closest hit in [tMin, tMax], if any
+	bool TraceClosest(
+		DirectX::XMFLOAT3 origin,
+		DirectX::XMFLOAT3 direction,
+		float tMin,
+		float tMax,
+		BVHHit& hit) const;
+
+	// --------------------------------------------------------
+	// Is anything hit in [tMin, tMax]?  Stops at the first hit
+	// found (like RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH),
+	// which is all visibility tests like shadow rays need.
+	// --------------------------------------------------------
+	bool TraceAny(
+		DirectX::XMFLOAT3 origin,
+		DirectX::XMFLOAT3 direction,
+		float tMin,
+		float tMax) const;
+
+	// --------------------------------------------------------
+	// Closest hits for a whole packet, returning a mask with a
+	// bit set for each ray that hit (and has its hit filled
+	// in).  Packets whose directions don't all have the same
+	// signs trace each ray on its own instead.
+	// --------------------------------------------------------
+	unsigned long long TraceClosestPacket(BVHRayPacket& packet, BVHHit* hits) const;
+
+	// Can a packet's rays be traced together (see TraceClosestPacket)?
+	static bool IsCoherent(const BVHRayPacket& packet);
+
+	// Expected cost of tracing a ray through the tree (relative to one triangle test)
+	float CalculateSAHCost() const;
+
+	const std::vector<BVHNode>& GetNodes() const { return nodes; }
+	unsigned int GetTriangleCount() const { return (unsigned int)triangleIDs.size(); }
+	BVHBuildStats GetBuildStats() const { return buildStats; }	// Of the last full build
+
+	// Triangle data in leaf order, 3 positions per triangle
+	const DirectX::XMFLOAT3* GetTrianglePositions() const { return trianglePositions.data(); }
+	const unsigned int* GetTriangleIDs() const { return triangleIDs.data(); }
+
+private:
+	std::vector<BVHNode> nodes;
+	std::vector<DirectX::XMFLOAT3> trianglePositions;
+	std::vector<unsigned int> triangleIDs;
+	BVHBuildStats buildStats{};
+};
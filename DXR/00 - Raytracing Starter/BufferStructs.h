@@ -27,5 +27,20 @@ struct RaytracingSceneData
 {
 	DirectX::XMFLOAT4X4 inverseViewProjection;
 	DirectX::XMFLOAT3 cameraPosition;
+	unsigned int sampleIndex;		// Samples accumulated before this one (0 starts over)
+	DirectX::XMFLOAT2 pixelJitter;	// Offset of this sample's rays from each pixel's center
+	int lightCount;					// Hits are shaded by their normals alone without lights
 	float pad;
-};
\ No newline at end of file
+	Light lights[MAX_LIGHTS];		// Each tested for visibility with a shadow ray
+};
+// Per-mesh data for raytracing, stored as root constants in the
+// mesh's hit group shader record (see VertexFormat in Vertex.h)
+struct RaytracingMeshData
+{
+	unsigned int vertexFormat;
+	unsigned int positionStride;
+	unsigned int attributeStride;
+	unsigned int attributeOffset;
+	unsigned int indexStride;
+	float pad; // Keeps the descriptor table after these constants 8-byte aligned
+};
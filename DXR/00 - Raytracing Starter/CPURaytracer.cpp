@@ -0,0 +1,771 @@
+#include "CPURaytracer.h"
+#include "MeshProcessing.h"
+#include "RayIntersection.h"
+#include "TileScheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <string>
+
+using namespace DirectX;
+
+namespace CPURaytracer
+{
+	// Annonymous namespace to hold helpers
+	// only accessible in this file
+	namespace
+	{
+		// --------------------------------------------------------
+		// Finds the closest hit on a single geometry that's nearer
+		// than "closest", shortening it if there is one.  Uses the
+		// 4-wide BVH, the binary BVH or every triangle, in that
+		// order of preference.
+		// --------------------------------------------------------
+		bool TraceGeometry(const Geometry& geometry, const Ray& ray, float& closest, BVHHit& hit)
+		{
+			if (geometry.WideAccel || geometry.Accel)
+			{
+				bool found = geometry.WideAccel ?
+					geometry.WideAccel->TraceClosest(ray.Origin, ray.Direction, ray.TMin, closest, hit) :
+					geometry.Accel->TraceClosest(ray.Origin, ray.Direction, ray.TMin, closest, hit);
+				if (found)
+					closest = hit.T;
+				return found;
+			}
+
+			XMFLOAT3 invDir(1.0f / ray.Direction.x, 1.0f / ray.Direction.y, 1.0f / ray.Direction.z);
+			float entry;
+			if (!RayIntersection::RayBox(ray.Origin, invDir, geometry.BoundsMin, geometry.BoundsMax, ray.TMin, closest, entry))
+				return false;
+
+			XMVECTOR origin = XMLoadFloat3(&ray.Origin);
+			XMVECTOR dir = XMLoadFloat3(&ray.Direction);
+			bool found = false;
+			for (unsigned int tri = 0; tri < geometry.IndexCount / 3; tri++)
+			{
+				const unsigned int* indices = &geometry.Indices[tri * 3];
+				XMVECTOR p0 = XMLoadFloat3(&geometry.Vertices[indices[0]].Position);
+				XMVECTOR p1 = XMLoadFloat3(&geometry.Vertices[indices[1]].Position);
+				XMVECTOR p2 = XMLoadFloat3(&geometry.Vertices[indices[2]].Position);
+
+				float t;
+				XMFLOAT2 barycentrics;
+				if (RayIntersection::RayTriangle(origin, dir, p0, p1, p2, t, barycentrics) &&
+					t >= ray.TMin && t < closest)
+				{
+					closest = t;
+					hit.T = t;
+					hit.Triangle = tri;
+					hit.Barycentrics = barycentrics;
+					found = true;
+				}
+			}
+			return found;
+		}
+
+		// --------------------------------------------------------
+		// Diffuse light reaching a point from every light that
+		// isn't blocked, where isOccluded(shadowRay) says whether
+		// something is in the way (see CalcLighting)
+		// --------------------------------------------------------
+		template<typename OccludedFunc>
+		XMFLOAT3 LightPoint(const RaytracingSceneData& sceneData, XMFLOAT3 position, XMFLOAT3 normal, OccludedFunc isOccluded)
+		{
+			XMVECTOR total = XMVectorSet(0.1f, 0.1f, 0.1f, 0.0f); // Ambient
+			XMVECTOR pos = XMLoadFloat3(&position);
+			XMVECTOR n = XMLoadFloat3(&normal);
+			for (int i = 0; i < sceneData.lightCount; i++)
+			{
+				const Light& light = sceneData.lights[i];
+
+				// Direction & distance to the light, and how much of it is left by then
+				XMVECTOR toLight = XMVectorNegate(XMVector3Normalize(XMLoadFloat3(&light.Direction)));
+				float lightDistance = 1000.0f;
+				float attenuation = 1.0f;
+				if (light.Type != LIGHT_TYPE_DIRECTIONAL)
+				{
+					toLight = XMVectorSubtract(XMLoadFloat3(&light.Position), pos);
+					lightDistance = XMVectorGetX(XMVector3Length(toLight));
+					toLight = XMVectorScale(toLight, 1.0f / lightDistance);
+
+					attenuation = 1.0f - lightDistance * lightDistance / (light.Range * light.Range);
+					attenuation = attenuation < 0.0f ? 0.0f : (attenuation > 1.0f ? 1.0f : attenuation);
+					attenuation *= attenuation;
+					if (light.Type == LIGHT_TYPE_SPOT)
+					{
+						float spot = XMVectorGetX(XMVector3Dot(XMVectorNegate(toLight), XMVector3Normalize(XMLoadFloat3(&light.Direction))));
+						attenuation *= powf(spot < 0.0f ? 0.0f : (spot > 1.0f ? 1.0f : spot), light.SpotFalloff);
+					}
+				}
+
+				// Only trace a shadow ray if there's light to block
+				float nDotL = XMVectorGetX(XMVector3Dot(n, toLight));
+				nDotL = nDotL > 1.0f ? 1.0f : nDotL;
+				if (nDotL <= 0.0f || attenuation <= 0.0f)
+					continue;
+
+				Ray shadowRay;
+				shadowRay.Origin = position;
+				XMStoreFloat3(&shadowRay.Direction, toLight);
+				shadowRay.TMin = 0.01f;
+				shadowRay.TMax = lightDistance;
+				if (isOccluded(shadowRay))
+					continue;
+
+				XMVECTOR color = XMVectorScale(XMLoadFloat3(&light.Color), light.Intensity * nDotL * attenuation);
+				total = XMVectorAdd(total, color);
+			}
+
+			XMFLOAT3 result;
+			XMStoreFloat3(&result, total);
+			return result;
+		}
+
+		// Where along the ray the hit is, which is in world space
+		XMFLOAT3 HitPosition(const Ray& ray, float t)
+		{
+			XMFLOAT3 position;
+			XMStoreFloat3(&position, XMVectorMultiplyAdd(XMLoadFloat3(&ray.Direction), XMVectorReplicate(t), XMLoadFloat3(&ray.Origin)));
+			return position;
+		}
+
+		// --------------------------------------------------------
+		// The full closest hit shader: colored by the normal, and
+		// lit by the scene's lights if it has any
+		// --------------------------------------------------------
+		XMFLOAT3 Shade(const RaytracingSceneData& sceneData, const std::vector<Geometry>& scene, const Ray& ray, const Hit& hit)
+		{
+			XMFLOAT3 color = ClosestHit(scene[hit.Geometry], hit);
+			if (sceneData.lightCount <= 0)
+				return color;
+
+			// Geometry is already in world space, as if every instance had an identity transform
+			XMFLOAT3 normal;
+			XMStoreFloat3(&normal, XMVector3Normalize(XMLoadFloat3(&color)));
+
+			XMFLOAT3 light = CalcLighting(sceneData, scene, HitPosition(ray, hit.T), normal);
+			return XMFLOAT3(color.x * light.x, color.y * light.y, color.z * light.z);
+		}
+
+		// --------------------------------------------------------
+		// The same shader for a hit on an instance, whose normal
+		// is brought into world space by the instance's object to
+		// world matrix, as the shader does with ObjectToWorld3x4()
+		// --------------------------------------------------------
+		XMFLOAT3 Shade(const RaytracingSceneData& sceneData, const TopLevelBVH& scene, const std::vector<Geometry>& hitGroups, const Ray& ray, const TopLevelHit& instanceHit)
+		{
+			Hit hit = { instanceHit.T, instanceHit.HitGroupIndex, instanceHit.PrimitiveIndex, instanceHit.Barycentrics };
+			XMFLOAT3 color = ClosestHit(hitGroups[hit.Geometry], hit);
+			if (sceneData.lightCount <= 0)
+				return color;
+
+			// mul((float3x3)ObjectToWorld3x4(), normal)
+			const float (*m)[4] = instanceHit.ObjectToWorld;
+			XMFLOAT3 worldNormal(
+				m[0][0] * color.x + m[0][1] * color.y + m[0][2] * color.z,
+				m[1][0] * color.x + m[1][1] * color.y + m[1][2] * color.z,
+				m[2][0] * color.x + m[2][1] * color.y + m[2][2] * color.z);
+			XMFLOAT3 normal;
+			XMStoreFloat3(&normal, XMVector3Normalize(XMLoadFloat3(&worldNormal)));
+
+			XMFLOAT3 light = CalcLighting(sceneData, scene, HitPosition(ray, hit.T), normal);
+			return XMFLOAT3(color.x * light.x, color.y * light.y, color.z * light.z);
+		}
+
+		// Packets whose rays split up more than this (see TraceClosestPacket)
+		// are slower than single rays, as most of each leaf's rays miss it
+		const float MinPacketCoherence = 0.125f;
+
+		// --------------------------------------------------------
+		// Renders a rectangle of pixels as 8x8 packets of camera
+		// rays, returning how many rays were actually traced as
+		// packets.  Once a packet diverges too much, the rest of
+		// the rectangle falls back to tracing one ray at a time.
+		// --------------------------------------------------------
+		unsigned int RenderPackets(
+			const RaytracingSceneData& sceneData,
+			const std::vector<Geometry>& scene,
+			unsigned int startX,
+			unsigned int startY,
+			unsigned int endX,
+			unsigned int endY,
+			Image& output)
+		{
+			const unsigned int packetWidth = 8;
+			unsigned int packetRays = 0;
+			bool usePackets = true;
+			for (unsigned int packetY = startY; packetY < endY; packetY += packetWidth)
+			{
+				for (unsigned int packetX = startX; packetX < endX; packetX += packetWidth)
+				{
+					unsigned int packetEndX = packetX + packetWidth < endX ? packetX + packetWidth : endX;
+					unsigned int packetEndY = packetY + packetWidth < endY ? packetY + packetWidth : endY;
+
+					Ray rays[BVHPacketSize];
+					unsigned int count = 0;
+					for (unsigned int y = packetY; y < packetEndY; y++)
+						for (unsigned int x = packetX; x < packetEndX; x++)
+							rays[count++] = CalcRayFromCamera(sceneData, x, y, output.Width, output.Height);
+
+					Hit hits[BVHPacketSize];
+					unsigned long long hitMask = 0;
+					if (usePackets)
+					{
+						float coherence = 0.0f;
+						hitMask = TraceClosestPacket(scene, rays, count, hits, &coherence);
+						packetRays += coherence > 0.0f ? count : 0;
+						usePackets = coherence >= MinPacketCoherence;
+					}
+					else
+					{
+						for (unsigned int i = 0; i < count; i++)
+							hitMask |= TraceClosest(scene, rays[i], hits[i]) ? 1ull << i : 0;
+					}
+
+					unsigned int i = 0;
+					for (unsigned int y = packetY; y < packetEndY; y++)
+					{
+						for (unsigned int x = packetX; x < packetEndX; x++, i++)
+						{
+							XMFLOAT3 color = (hitMask & (1ull << i)) ?
+								Shade(sceneData, scene, rays[i], hits[i]) :
+								Miss();
+							output.Pixels[(size_t)y * output.Width + x] = XMFLOAT4(color.x, color.y, color.z, 1);
+						}
+					}
+				}
+			}
+			return packetRays;
+		}
+
+		// --------------------------------------------------------
+		// Runs renderTile() on every tile of the image across the
+		// cores with the work stealing scheduler, and fills in the
+		// stats' scheduling details.  Each finished tile of the
+		// output is handed to the writer, if there is one.
+		// --------------------------------------------------------
+		template<typename TileFunc>
+		void RenderTiles(unsigned int width, unsigned int height, unsigned int tileSize, unsigned int threads, const Image& output, TileImageWriter* writer, RenderStats& stats, TileFunc renderTile)
+		{
+			TileSchedulerStats schedule = TileScheduler::Run(width, height, tileSize, threads,
+				[&](unsigned int, const TileRect& tile)
+				{
+					renderTile(tile.StartX, tile.StartY, tile.EndX, tile.EndY);
+					if (writer)
+						writer->WriteTile(tile, &output.Pixels[(size_t)tile.StartY * width + tile.StartX], width);
+				});
+
+			stats.Threads = schedule.Threads;
+			stats.Tiles = schedule.Tiles;
+			stats.Steals = schedule.Steals;
+			stats.ThreadBusyMilliseconds = std::move(schedule.BusyMilliseconds);
+			stats.ThreadIdleMilliseconds = std::move(schedule.IdleMilliseconds);
+		}
+
+		// Converts to 8 bits per channel the same way a UNORM render target does
+		unsigned char ToUnorm8(float value)
+		{
+			if (!(value > 0.0f)) return 0; // Also catches NaN
+			if (value >= 1.0f) return 255;
+			return (unsigned char)(value * 255.0f + 0.5f);
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Points a geometry at a mesh's final data & BVHs
+// --------------------------------------------------------
+CPURaytracer::Geometry CPURaytracer::MakeGeometry(const MeshData& data)
+{
+	Geometry geometry;
+	geometry.Vertices = data.Vertices;
+	geometry.VertexCount = data.VertexCount;
+	geometry.Indices = data.Indices;
+	geometry.IndexCount = data.IndexCount;
+	geometry.BoundsMin = data.BoundsMin;
+	geometry.BoundsMax = data.BoundsMax;
+	geometry.Accel = data.Accel.get();
+	geometry.WideAccel = data.WideAccel.get();
+	return geometry;
+}
+
+
+// --------------------------------------------------------
+// Points a geometry at plain vertex & index arrays, and any
+// BVHs built over them
+// --------------------------------------------------------
+CPURaytracer::Geometry CPURaytracer::MakeGeometry(const std::vector<Vertex>& verts, const std::vector<unsigned int>& indices, const BVH* accel, const WideBVH* wideAccel)
+{
+	Geometry geometry;
+	geometry.Vertices = verts.data();
+	geometry.VertexCount = (unsigned int)verts.size();
+	geometry.Indices = indices.data();
+	geometry.IndexCount = (unsigned int)indices.size();
+	MeshProcessing::CalculateBounds(verts.data(), geometry.VertexCount, geometry.BoundsMin, geometry.BoundsMax);
+	geometry.Accel = accel;
+	geometry.WideAccel = wideAccel;
+	return geometry;
+}
+
+
+// --------------------------------------------------------
+// Fills the scene constants exactly like RayTracing::Raytrace
+// does for the GPU
+// --------------------------------------------------------
+RaytracingSceneData CPURaytracer::CalcSceneData(XMFLOAT4X4 view, XMFLOAT4X4 projection, XMFLOAT3 cameraPosition, const std::vector<Light>& lights)
+{
+	RaytracingSceneData sceneData = {};
+	sceneData.cameraPosition = cameraPosition;
+
+	sceneData.lightCount = lights.size() < MAX_LIGHTS ? (int)lights.size() : MAX_LIGHTS;
+	for (int i = 0; i < sceneData.lightCount; i++)
+		sceneData.lights[i] = lights[i];
+
+	XMMATRIX v = XMLoadFloat4x4(&view);
+	XMMATRIX p = XMLoadFloat4x4(&projection);
+	XMMATRIX vp = XMMatrixMultiply(v, p);
+	XMStoreFloat4x4(&sceneData.inverseViewProjection, XMMatrixInverse(0, vp));
+	return sceneData;
+}
+
+
+// --------------------------------------------------------
+// Calculates an origin and direction from the camera for a
+// specific pixel (mirrors CalcRayFromCamera() in the shader)
+// --------------------------------------------------------
+CPURaytracer::Ray CPURaytracer::CalcRayFromCamera(const RaytracingSceneData& scene, unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+	// Offset to the middle of the pixel, then jittered
+	float screenX = (x + 0.5f + scene.pixelJitter.x) / width * 2.0f - 1.0f;
+	float screenY = -((y + 0.5f + scene.pixelJitter.y) / height * 2.0f - 1.0f);
+
+	// Unproject the coords (the shader's mul(matrix, vector) on an
+	// untransposed C++ matrix is a row vector times the matrix)
+	XMMATRIX invVP = XMLoadFloat4x4(&scene.inverseViewProjection);
+	XMVECTOR worldPos = XMVector4Transform(XMVectorSet(screenX, screenY, 0, 1), invVP);
+	worldPos = XMVectorDivide(worldPos, XMVectorSplatW(worldPos));
+
+	// Set up the ray
+	Ray ray;
+	ray.Origin = scene.cameraPosition;
+	XMStoreFloat3(&ray.Direction, XMVector3Normalize(XMVectorSubtract(worldPos, XMLoadFloat3(&ray.Origin))));
+	ray.TMin = 0.01f;
+	ray.TMax = 1000.0f;
+	return ray;
+}
+
+
+// --------------------------------------------------------
+// Finds the closest triangle hit along a ray (if any).  Each
+// geometry with a BVH is traced through it, and any others
+// have every triangle tested if the ray hits their bounds.
+// --------------------------------------------------------
+bool CPURaytracer::TraceClosest(const std::vector<Geometry>& scene, const Ray& ray, Hit& hit)
+{
+	bool found = false;
+	float closest = ray.TMax;
+	for (unsigned int g = 0; g < scene.size(); g++)
+	{
+		BVHHit geometryHit;
+		if (TraceGeometry(scene[g], ray, closest, geometryHit))
+		{
+			hit.T = geometryHit.T;
+			hit.Geometry = g;
+			hit.Triangle = geometryHit.Triangle;
+			hit.Barycentrics = geometryHit.Barycentrics;
+			found = true;
+		}
+	}
+	return found;
+}
+
+
+// --------------------------------------------------------
+// Finds the closest triangle hit along a ray through a two
+// level scene, skipping instances whose masks don't share a
+// bit with instanceInclusionMask (as TraceRay() does).  The
+// hit's Geometry is the instance's hit group index.
+// --------------------------------------------------------
+bool CPURaytracer::TraceClosest(const TopLevelBVH& scene, const Ray& ray, unsigned int instanceInclusionMask, Hit& hit)
+{
+	TopLevelHit instanceHit;
+	if (!scene.TraceClosest(ray.Origin, ray.Direction, ray.TMin, ray.TMax, instanceInclusionMask, instanceHit))
+		return false;
+
+	hit.T = instanceHit.T;
+	hit.Geometry = instanceHit.HitGroupIndex;
+	hit.Triangle = instanceHit.PrimitiveIndex;
+	hit.Barycentrics = instanceHit.Barycentrics;
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Checks whether a ray hits anything, stopping at the first
+// geometry that reports a hit
+// --------------------------------------------------------
+bool CPURaytracer::TraceAny(const std::vector<Geometry>& scene, const Ray& ray)
+{
+	for (const Geometry& geometry : scene)
+	{
+		if (geometry.WideAccel)
+		{
+			if (geometry.WideAccel->TraceAny(ray.Origin, ray.Direction, ray.TMin, ray.TMax))
+				return true;
+			continue;
+		}
+		if (geometry.Accel)
+		{
+			if (geometry.Accel->TraceAny(ray.Origin, ray.Direction, ray.TMin, ray.TMax))
+				return true;
+			continue;
+		}
+
+		XMFLOAT3 invDir(1.0f / ray.Direction.x, 1.0f / ray.Direction.y, 1.0f / ray.Direction.z);
+		float entry;
+		if (!RayIntersection::RayBox(ray.Origin, invDir, geometry.BoundsMin, geometry.BoundsMax, ray.TMin, ray.TMax, entry))
+			continue;
+
+		XMVECTOR origin = XMLoadFloat3(&ray.Origin);
+		XMVECTOR dir = XMLoadFloat3(&ray.Direction);
+		for (unsigned int tri = 0; tri < geometry.IndexCount / 3; tri++)
+		{
+			const unsigned int* indices = &geometry.Indices[tri * 3];
+			float t;
+			XMFLOAT2 barycentrics;
+			if (RayIntersection::RayTriangle(origin, dir,
+					XMLoadFloat3(&geometry.Vertices[indices[0]].Position),
+					XMLoadFloat3(&geometry.Vertices[indices[1]].Position),
+					XMLoadFloat3(&geometry.Vertices[indices[2]].Position),
+					t, barycentrics) &&
+				t >= ray.TMin && t < ray.TMax)
+				return true;
+		}
+	}
+	return false;
+}
+
+
+// --------------------------------------------------------
+// Checks whether a ray hits any instance of a two level
+// scene that its mask includes
+// --------------------------------------------------------
+bool CPURaytracer::TraceAny(const TopLevelBVH& scene, const Ray& ray, unsigned int instanceInclusionMask)
+{
+	return scene.TraceAny(ray.Origin, ray.Direction, ray.TMin, ray.TMax, instanceInclusionMask);
+}
+
+
+// --------------------------------------------------------
+// Finds the closest hits for a set of rays (up to a whole
+// BVHPacketSize), returning a mask of the rays that hit.
+// Rays with a shared origin heading the same way on each
+// axis, like a block of camera rays, are traced through
+// binary BVHs together as a packet.  Anything else falls
+// back to tracing each ray on its own.
+//
+// scene     - Every geometry to trace against
+// rays      - The rays to trace
+// count     - How many rays are in the array
+// hits      - Filled in for each ray that hits
+// coherence - Optionally set to the average fraction of the
+//             rays that reached each BVH leaf: 1 if they all
+//             stayed together, 0 if they weren't a packet
+// --------------------------------------------------------
+unsigned long long CPURaytracer::TraceClosestPacket(const std::vector<Geometry>& scene, const Ray* rays, unsigned int count, Hit* hits, float* coherence)
+{
+	BVHRayPacket packet;
+	packet.Origin = rays[0].Origin;
+	packet.TMin = rays[0].TMin;
+	packet.Count = count;
+	bool coherent = count <= BVHPacketSize;
+	for (unsigned int i = 0; coherent && i < count; i++)
+	{
+		coherent =
+			rays[i].Origin.x == packet.Origin.x &&
+			rays[i].Origin.y == packet.Origin.y &&
+			rays[i].Origin.z == packet.Origin.z &&
+			rays[i].TMin == packet.TMin;
+		packet.Directions[i] = rays[i].Direction;
+		packet.TMax[i] = rays[i].TMax;
+	}
+	coherent = coherent && BVH::IsCoherent(packet);
+	if (coherence)
+		*coherence = coherent ? 1.0f : 0.0f;
+
+	unsigned long long hitMask = 0;
+	if (!coherent)
+	{
+		for (unsigned int i = 0; i < count; i++)
+			hitMask |= TraceClosest(scene, rays[i], hits[i]) ? 1ull << i : 0;
+		return hitMask;
+	}
+	unsigned int leavesVisited = 0;
+	unsigned int leafRays = 0;
+
+	// Each geometry shortens the rays, so later ones only find closer hits
+	for (unsigned int g = 0; g < scene.size(); g++)
+	{
+		const Geometry& geometry = scene[g];
+		if (geometry.Accel)
+		{
+			BVHHit packetHits[BVHPacketSize];
+			unsigned long long geometryMask = geometry.Accel->TraceClosestPacket(packet, packetHits);
+			leavesVisited += packet.LeavesVisited;
+			leafRays += packet.LeafRays;
+			for (unsigned int i = 0; i < count; i++)
+			{
+				if (geometryMask & (1ull << i))
+					hits[i] = { packetHits[i].T, g, packetHits[i].Triangle, packetHits[i].Barycentrics };
+			}
+			hitMask |= geometryMask;
+			continue;
+		}
+
+		for (unsigned int i = 0; i < count; i++)
+		{
+			BVHHit geometryHit;
+			if (TraceGeometry(geometry, rays[i], packet.TMax[i], geometryHit))
+			{
+				hits[i] = { geometryHit.T, g, geometryHit.Triangle, geometryHit.Barycentrics };
+				hitMask |= 1ull << i;
+			}
+		}
+	}
+
+	if (coherence && leavesVisited > 0)
+		*coherence = (float)leafRays / (leavesVisited * count);
+	return hitMask;
+}
+
+
+// --------------------------------------------------------
+// Barycentric interpolation of data from the triangle's
+// vertices (mirrors InterpolateVertices() in the shader)
+// --------------------------------------------------------
+Vertex CPURaytracer::InterpolateVertices(const Geometry& geometry, unsigned int triangleIndex, XMFLOAT2 barycentrics)
+{
+	const float weights[3] = {
+		1.0f - barycentrics.x - barycentrics.y,
+		barycentrics.x,
+		barycentrics.y };
+
+	XMVECTOR position = XMVectorZero();
+	XMVECTOR uv = XMVectorZero();
+	XMVECTOR normal = XMVectorZero();
+	XMVECTOR tangent = XMVectorZero();
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		const Vertex& corner = geometry.Vertices[geometry.Indices[triangleIndex * 3 + i]];
+		XMVECTOR w = XMVectorReplicate(weights[i]);
+		position = XMVectorMultiplyAdd(XMLoadFloat3(&corner.Position), w, position);
+		uv = XMVectorMultiplyAdd(XMLoadFloat2(&corner.UV), w, uv);
+		normal = XMVectorMultiplyAdd(XMLoadFloat3(&corner.Normal), w, normal);
+		tangent = XMVectorMultiplyAdd(XMLoadFloat4(&corner.Tangent), w, tangent);
+	}
+
+	Vertex vert;
+	XMStoreFloat3(&vert.Position, position);
+	XMStoreFloat2(&vert.UV, uv);
+	XMStoreFloat3(&vert.Normal, normal);
+	XMStoreFloat4(&vert.Tangent, tangent);
+	return vert;
+}
+
+
+// --------------------------------------------------------
+// Mirrors the Miss() shader
+// --------------------------------------------------------
+XMFLOAT3 CPURaytracer::Miss()
+{
+	return XMFLOAT3(0.4f, 0.6f, 0.75f);
+}
+
+
+// --------------------------------------------------------
+// Mirrors the ClosestHit() shader
+// --------------------------------------------------------
+XMFLOAT3 CPURaytracer::ClosestHit(const Geometry& geometry, const Hit& hit)
+{
+	Vertex interpolatedVert = InterpolateVertices(geometry, hit.Triangle, hit.Barycentrics);
+	return interpolatedVert.Normal;
+}
+
+
+// --------------------------------------------------------
+// Diffuse light reaching a point from every light that
+// isn't blocked, checked with occlusion queries (mirrors
+// CalcLighting() in the shader)
+// --------------------------------------------------------
+XMFLOAT3 CPURaytracer::CalcLighting(const RaytracingSceneData& sceneData, const std::vector<Geometry>& scene, XMFLOAT3 position, XMFLOAT3 normal)
+{
+	return LightPoint(sceneData, position, normal, [&](const Ray& shadowRay) { return TraceAny(scene, shadowRay); });
+}
+
+
+// --------------------------------------------------------
+// The same, with shadow rays through a two-level scene,
+// using the same mask as the shader's occlusion rays
+// --------------------------------------------------------
+XMFLOAT3 CPURaytracer::CalcLighting(const RaytracingSceneData& sceneData, const TopLevelBVH& scene, XMFLOAT3 position, XMFLOAT3 normal)
+{
+	return LightPoint(sceneData, position, normal, [&](const Ray& shadowRay) { return TraceAny(scene, shadowRay, 0xFF); });
+}
+
+
+// --------------------------------------------------------
+// Runs the ray generation "shader" for every pixel of the
+// image.  The image is split into square tiles, which are
+// shared between the threads by TileScheduler.
+//
+// sceneData - Camera & light data (see CalcSceneData)
+// scene     - Every geometry to trace against
+// width     - Output width (like DispatchRaysDimensions().x)
+// height    - Output height (like DispatchRaysDimensions().y)
+// output    - Image to resize and fill
+// tileSize  - Width & height of each tile in pixels
+// packets   - Trace each tile's rays in 8x8 packets where possible?
+// threads   - Threads to render with (0 for one per core)
+// writer    - Where to stream finished tiles (optional, and
+//             must already be open at the output's size)
+// --------------------------------------------------------
+CPURaytracer::RenderStats CPURaytracer::Render(
+	const RaytracingSceneData& sceneData,
+	const std::vector<Geometry>& scene,
+	unsigned int width,
+	unsigned int height,
+	Image& output,
+	unsigned int tileSize,
+	bool packets,
+	unsigned int threads,
+	TileImageWriter* writer)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	output.Width = width;
+	output.Height = height;
+	output.Pixels.assign((size_t)width * height, XMFLOAT4(0, 0, 0, 1));
+
+	std::atomic<unsigned long long> packetRays = 0;
+	RenderStats stats = {};
+	RenderTiles(width, height, tileSize, threads, output, writer, stats, [&](unsigned int startX, unsigned int startY, unsigned int endX, unsigned int endY)
+		{
+			if (packets)
+			{
+				packetRays += RenderPackets(sceneData, scene, startX, startY, endX, endY, output);
+				return;
+			}
+
+			for (unsigned int y = startY; y < endY; y++)
+			{
+				for (unsigned int x = startX; x < endX; x++)
+				{
+					Ray ray = CalcRayFromCamera(sceneData, x, y, width, height);
+
+					Hit hit;
+					XMFLOAT3 color = TraceClosest(scene, ray, hit) ?
+						Shade(sceneData, scene, ray, hit) :
+						Miss();
+
+					output.Pixels[(size_t)y * width + x] = XMFLOAT4(color.x, color.y, color.z, 1);
+				}
+			}
+		});
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	stats.Rays = (unsigned long long)width * height;
+	stats.PacketRays = packetRays;
+	stats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	return stats;
+}
+
+
+// --------------------------------------------------------
+// Runs the ray generation "shader" for every pixel of the
+// image, tracing a two-level scene one ray at a time.
+//
+// sceneData - Camera & light data (see CalcSceneData)
+// scene     - Instances to trace against
+// hitGroups - Geometry for each hit group index, used to
+//             shade the instances that select it
+// width     - Output width (like DispatchRaysDimensions().x)
+// height    - Output height (like DispatchRaysDimensions().y)
+// output    - Image to resize and fill
+// tileSize  - Width & height of each tile in pixels
+// threads   - Threads to render with (0 for one per core)
+// writer    - Where to stream finished tiles (optional)
+// --------------------------------------------------------
+CPURaytracer::RenderStats CPURaytracer::Render(
+	const RaytracingSceneData& sceneData,
+	const TopLevelBVH& scene,
+	const std::vector<Geometry>& hitGroups,
+	unsigned int width,
+	unsigned int height,
+	Image& output,
+	unsigned int tileSize,
+	unsigned int threads,
+	TileImageWriter* writer)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	output.Width = width;
+	output.Height = height;
+	output.Pixels.assign((size_t)width * height, XMFLOAT4(0, 0, 0, 1));
+
+	RenderStats stats = {};
+	RenderTiles(width, height, tileSize, threads, output, writer, stats, [&](unsigned int startX, unsigned int startY, unsigned int endX, unsigned int endY)
+		{
+			for (unsigned int y = startY; y < endY; y++)
+			{
+				for (unsigned int x = startX; x < endX; x++)
+				{
+					Ray ray = CalcRayFromCamera(sceneData, x, y, width, height);
+
+					// Same mask as the TraceRay() call in the shader
+					TopLevelHit hit;
+					XMFLOAT3 color = scene.TraceClosest(ray.Origin, ray.Direction, ray.TMin, ray.TMax, 0xFF, hit) && hit.HitGroupIndex < hitGroups.size() ?
+						Shade(sceneData, scene, hitGroups, ray, hit) :
+						Miss();
+
+					output.Pixels[(size_t)y * width + x] = XMFLOAT4(color.x, color.y, color.z, 1);
+				}
+			}
+		});
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	stats.Rays = (unsigned long long)width * height;
+	stats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	return stats;
+}
+
+
+// --------------------------------------------------------
+// Saves an image as a binary (P6) PPM file, clamping each
+// channel to [0,1] like the GPU's UNORM output does
+// --------------------------------------------------------
+bool CPURaytracer::WritePPM(const Image& image, const char* file)
+{
+	std::ofstream ppm(file, std::ios::binary | std::ios::trunc);
+	if (!ppm.is_open())
+		return false;
+
+	std::string header = "P6\n" + std::to_string(image.Width) + " " + std::to_string(image.Height) + "\n255\n";
+	ppm.write(header.data(), (std::streamsize)header.size());
+
+	std::vector<unsigned char> row((size_t)image.Width * 3);
+	for (unsigned int y = 0; y < image.Height; y++)
+	{
+		const XMFLOAT4* pixels = &image.Pixels[(size_t)y * image.Width];
+		for (unsigned int x = 0; x < image.Width; x++)
+		{
+			row[x * 3 + 0] = ToUnorm8(pixels[x].x);
+			row[x * 3 + 1] = ToUnorm8(pixels[x].y);
+			row[x * 3 + 2] = ToUnorm8(pixels[x].z);
+		}
+		ppm.write((const char*)row.data(), (std::streamsize)row.size());
+	}
+	return ppm.good();
+}
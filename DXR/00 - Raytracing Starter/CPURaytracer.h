@@ -0,0 +1,144 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+#include "Vertex.h"
+#include "BufferStructs.h"
+#include "MeshData.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "TopLevelBVH.h"
+#include "ImageWriter.h"
+
+// --------------------------------------------------------
+// A CPU reference implementation of the pipeline in
+// Raytracing.hlsl: the same camera rays, miss color and
+// closest hit shading, traced against the same triangles.
+//
+// Nothing here touches D3D12 or the window, so it can
+// render headless, and its output can be compared against
+// (or stand in for) the GPU's output.
+// --------------------------------------------------------
+namespace CPURaytracer
+{
+	// One mesh's triangles, as kept on the CPU by Mesh
+	// (see MeshOptions::KeepCPUData), in its local space.
+	// The 4-wide BVH is used if there is one, then the binary
+	// BVH, and without either every triangle is tested.
+	// Packets of camera rays use the binary BVH.
+	struct Geometry
+	{
+		const Vertex* Vertices = 0;
+		unsigned int VertexCount = 0;
+		const unsigned int* Indices = 0;
+		unsigned int IndexCount = 0;
+		DirectX::XMFLOAT3 BoundsMin = DirectX::XMFLOAT3(0, 0, 0);
+		DirectX::XMFLOAT3 BoundsMax = DirectX::XMFLOAT3(0, 0, 0);
+		const BVH* Accel = 0;
+		const WideBVH* WideAccel = 0;
+	};
+
+	// Geometry for a mesh's processed data, or for plain arrays (with
+	// bounds calculated from the vertices).  Only points at the data,
+	// which has to outlive it.  Mesh::GetCPUGeometry() does the same.
+	Geometry MakeGeometry(const MeshData& data);
+	Geometry MakeGeometry(const std::vector<Vertex>& verts, const std::vector<unsigned int>& indices, const BVH* accel = 0, const WideBVH* wideAccel = 0);
+
+	// Matches RayDesc in HLSL
+	struct Ray
+	{
+		DirectX::XMFLOAT3 Origin;
+		float TMin;
+		DirectX::XMFLOAT3 Direction;
+		float TMax;
+	};
+
+	// What a ray hit, with barycentrics matching
+	// BuiltInTriangleIntersectionAttributes
+	struct Hit
+	{
+		float T;
+		unsigned int Geometry;
+		unsigned int Triangle;
+		DirectX::XMFLOAT2 Barycentrics;
+	};
+
+	// Final pixels in the same layout as OutputColor in Raytracing.hlsl
+	struct Image
+	{
+		unsigned int Width = 0;
+		unsigned int Height = 0;
+		std::vector<DirectX::XMFLOAT4> Pixels;
+	};
+
+	struct RenderStats
+	{
+		unsigned int Threads;
+		unsigned int Tiles;
+		unsigned long long Rays;
+		unsigned long long PacketRays;		// Rays traced together as packets
+		unsigned int Steals;				// See TileSchedulerStats
+		double Milliseconds;
+		std::vector<double> ThreadBusyMilliseconds;
+		std::vector<double> ThreadIdleMilliseconds;
+	};
+
+	// Scene constants, exactly as RayTracing::Raytrace() fills them
+	RaytracingSceneData CalcSceneData(
+		DirectX::XMFLOAT4X4 view,
+		DirectX::XMFLOAT4X4 projection,
+		DirectX::XMFLOAT3 cameraPosition,
+		const std::vector<Light>& lights = std::vector<Light>());
+
+	// The individual pieces of the shader pipeline
+	Ray CalcRayFromCamera(const RaytracingSceneData& scene, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+	bool TraceClosest(const std::vector<Geometry>& scene, const Ray& ray, Hit& hit);
+	bool TraceClosest(const TopLevelBVH& scene, const Ray& ray, unsigned int instanceInclusionMask, Hit& hit);
+	unsigned long long TraceClosestPacket(const std::vector<Geometry>& scene, const Ray* rays, unsigned int count, Hit* hits, float* coherence = 0);
+
+	// Occlusion queries: is anything hit at all?  These stop at the first
+	// hit found and never interpolate attributes, like the shader's shadow
+	// rays (RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH | RAY_FLAG_SKIP_CLOSEST_HIT_SHADER)
+	bool TraceAny(const std::vector<Geometry>& scene, const Ray& ray);
+	bool TraceAny(const TopLevelBVH& scene, const Ray& ray, unsigned int instanceInclusionMask);
+
+	Vertex InterpolateVertices(const Geometry& geometry, unsigned int triangleIndex, DirectX::XMFLOAT2 barycentrics);
+	DirectX::XMFLOAT3 Miss();
+	DirectX::XMFLOAT3 ClosestHit(const Geometry& geometry, const Hit& hit);
+	DirectX::XMFLOAT3 CalcLighting(const RaytracingSceneData& sceneData, const std::vector<Geometry>& scene, DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 normal);
+	DirectX::XMFLOAT3 CalcLighting(const RaytracingSceneData& sceneData, const TopLevelBVH& scene, DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 normal);
+
+	// Renders the whole image (resized to width x height) in tiles across
+	// all cores (or "threads" of them), tracing the camera rays as packets
+	// unless told not to.  Tiles are also streamed to a file as they
+	// finish if given a writer.
+	RenderStats Render(
+		const RaytracingSceneData& sceneData,
+		const std::vector<Geometry>& scene,
+		unsigned int width,
+		unsigned int height,
+		Image& output,
+		unsigned int tileSize = 16,
+		bool packets = true,
+		unsigned int threads = 0,
+		TileImageWriter* writer = 0);
+
+	// Renders through a two-level scene instead, like DispatchRays() on a TLAS.
+	// Each hit is shaded with hitGroups[InstanceContributionToHitGroupIndex],
+	// standing in for the shader table's hit group records, and lit with
+	// its normal in world space and shadow rays through the same scene.
+	RenderStats Render(
+		const RaytracingSceneData& sceneData,
+		const TopLevelBVH& scene,
+		const std::vector<Geometry>& hitGroups,
+		unsigned int width,
+		unsigned int height,
+		Image& output,
+		unsigned int tileSize = 16,
+		unsigned int threads = 0,
+		TileImageWriter* writer = 0);
+
+	// Writes an image as a binary PPM, converted like the R8G8B8A8_UNORM output
+	bool WritePPM(const Image& image, const char* file);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+
+// --------------------------------------------------------
+// A switch for the detailed stats printed for every mesh
+// loaded & processed, every buffer uploaded and every
+// batch of acceleration structures built.
+//
+// They're on by default in debug builds and off in release
+// builds, and can be toggled at runtime (the V key).  Stats
+// that take extra work to gather should check IsVerbose()
+// before gathering them, not just before printing them.
+// --------------------------------------------------------
+namespace Diagnostics
+{
+	inline std::atomic<bool>& VerboseFlag()
+	{
+#if defined(DEBUG) || defined(_DEBUG)
+		static std::atomic<bool> verbose(true);
+#else
+		static std::atomic<bool> verbose(false);
+#endif
+		return verbose;
+	}
+
+	inline bool IsVerbose() { return VerboseFlag().load(std::memory_order_relaxed); }
+	inline void SetVerbose(bool verbose) { VerboseFlag().store(verbose, std::memory_order_relaxed); }
+
+	// printf, but only when verbose stats are on
+	inline void Print(const char* format, ...)
+	{
+		if (!IsVerbose())
+			return;
+
+		va_list args;
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+	}
+}
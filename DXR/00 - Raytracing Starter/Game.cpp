@@ -8,8 +8,16 @@
 #include "BufferStructs.h"
 #include "Material.h"
 #include "RayTracing.h"
+#include "JobSystem.h"
+#include "CPURaytracer.h"
+#include "Diagnostics.h"
+#include "ProceduralMeshes.h"
 
 #include <DirectXMath.h>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
 
 // Needed for a helper function to load pre-compiled shader files
 #pragma comment(lib, "d3dcompiler.lib")
@@ -36,14 +44,82 @@ void Game::Initialize()
 		XM_PIDIV4,						// Field of view
 		Window::AspectRatio());			// Aspect ratio
 
-	sphereMesh = std::make_shared<Mesh>(FixPath(L"../../../../Assets/Meshes/sphere.obj").c_str());
+	// Asset loading, parsing & processing happens on worker threads,
+	// while GPU resource creation stays here on the main thread
+	JobSystem::Initialize();
+	auto loadStart = std::chrono::high_resolution_clock::now();
+
+	// Meshes only need their compressed vertex format for raytracing,
+	// BLAS builds only need positions, so keep those on their own, and
+	// cache-friendly ordering helps hit shader attribute fetches
+	MeshOptions meshOptions;
+	meshOptions.Format = VertexFormat::Packed;
+	meshOptions.SeparatePositions = true;
+	meshOptions.OptimizeVertexOrder = true;
+	meshOptions.LODCount = 3; // 50%, 25% & 12.5% of the triangles
+	meshOptions.KeepCPUData = true; // For the CPU reference raytracer
+	meshOptions.BuildBVH = true;
+	std::wstring spherePath = FixPath(L"../../../../Assets/Meshes/sphere.obj");
+	std::future<std::shared_ptr<MeshData>> sphereData = JobSystem::Submit(
+		[spherePath, meshOptions]() { return Mesh::LoadData(spherePath.c_str(), meshOptions); });
+
+	// Create GPU resources as each asset finishes, sending
+	// all of their data to the GPU together at the end
+	Graphics::BeginUploadBatch();
+	sphereMesh = meshLibrary.Get(*sphereData.get());
+
+	// A floor that ripples every frame, so its BLAS is refit on the
+	// GPU (and its BVHs on the CPU) as the sample runs.  Deformed from
+	// a copy of its vertices as processed, which is the order
+	// UpdateVertices() needs.
+	std::vector<Vertex> gridVerts;
+	std::vector<unsigned int> gridIndices;
+	ProceduralMeshes::MakeBumpyGrid(64, gridVerts, gridIndices);
+	MeshOptions waveOptions;
+	waveOptions.BuildBVH = true;
+	waveOptions.Deformable = true;
+	waveMesh = meshLibrary.Create(gridVerts.data(), (int)gridVerts.size(), gridIndices.data(), (int)gridIndices.size(), waveOptions);
+	waveBaseVertices = waveMesh->GetCPUVertices();
+	Graphics::EndUploadBatch();
+
+	// The sphere at the origin, with the floor spread out below it
+	entities.push_back(std::make_shared<GameEntity>(sphereMesh, std::shared_ptr<Material>()));
+	entities.push_back(std::make_shared<GameEntity>(waveMesh, std::shared_ptr<Material>()));
+	entities.back()->GetTransform()->SetPosition(0.0f, -1.5f, 0.0f);
+	entities.back()->GetTransform()->SetScale(6.0f);
+
+	auto loadEnd = std::chrono::high_resolution_clock::now();
+	printf("Loaded assets on %u worker thread(s) in %.2fms\n",
+		JobSystem::GetThreadCount(),
+		std::chrono::duration<double, std::milli>(loadEnd - loadStart).count());
+
+	// A key light from above and a warm point light to one side,
+	// both of which cast shadows through occlusion rays
+	Light sun = {};
+	sun.Type = LIGHT_TYPE_DIRECTIONAL;
+	sun.Direction = XMFLOAT3(0.5f, -1.0f, 0.5f);
+	sun.Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
+	sun.Intensity = 1.0f;
+	lights.push_back(sun);
+
+	Light point = {};
+	point.Type = LIGHT_TYPE_POINT;
+	point.Position = XMFLOAT3(-2.0f, 1.0f, -1.0f);
+	point.Range = 10.0f;
+	point.Color = XMFLOAT3(1.0f, 0.8f, 0.6f);
+	point.Intensity = 1.0f;
+	lights.push_back(point);
 
 	// Last step in raytracing setup is to create the accel structures,
-	// which require mesh data.  Currently just a single mesh is handled!
-	RayTracing::CreateBLAS(sphereMesh);
+	// which require mesh data.  BLASes are compacted, as they rarely
+	// need their worst case size (other than the floor's, which is
+	// refit instead).
+	RayTracing::BLASCompactionEnabled = true;
+	RayTracing::CreateBLAS({ sphereMesh, waveMesh });
 
 	// Once we have all of the BLAS ready, we can make a TLAS
-	RayTracing::CreateTLAS();
+	// with an instance of it for each entity
+	RayTracing::CreateTLAS(entities, camera);
 
 	// Finalize any initialization and wait for the GPU
 	// before proceeding to the game loop
@@ -64,6 +140,7 @@ void Game::ShutDown()
 {
 	// Wait for the GPU before we shut down
 	Graphics::WaitForGPU();
+	JobSystem::ShutDown();
 }
 
 
@@ -91,9 +168,250 @@ void Game::Update(float deltaTime, float totalTime)
 		Window::Quit();
 
 	camera->Update(deltaTime);
+
+	// Ripple the floor, with normals to match the slope of the waves.
+	// The new vertices are uploaded & the BLAS refit by UpdateTLAS().
+	std::vector<Vertex> waveVerts = waveBaseVertices;
+	for (Vertex& v : waveVerts)
+	{
+		float phase = v.Position.x * 20.0f + v.Position.z * 12.0f - totalTime * 2.0f;
+		v.Position.y += 0.02f * sinf(phase);
+		XMStoreFloat3(&v.Normal, XMVector3Normalize(XMVectorSet(-0.4f * cosf(phase), 1.0f, -0.24f * cosf(phase), 0.0f)));
+	}
+	waveMesh->UpdateVertices(waveVerts.data(), (int)waveVerts.size());
+
+	// Keep gameplay ray queries in sync with the entities
+	rayQueries.Update(entities);
+
+	// Pick whatever is under the cursor
+	if (Input::MouseRightPress())
+	{
+		RaytracingSceneData sceneData = CPURaytracer::CalcSceneData(
+			camera->GetView(),
+			camera->GetProjection(),
+			camera->GetTransform()->GetPosition());
+		CPURaytracer::Ray ray = CPURaytracer::CalcRayFromCamera(sceneData, Input::GetMouseX(), Input::GetMouseY(), Window::Width(), Window::Height());
+
+		RayQueryDesc pick;
+		pick.Origin = ray.Origin;
+		pick.Direction = ray.Direction;
+		pick.TMin = ray.TMin;
+		pick.TMax = ray.TMax;
+		RayQueryHit hit;
+		if (rayQueries.CastRay(pick, hit))
+			printf("Picked entity %u, triangle %u, %.3f units away\n", hit.Entity, hit.PrimitiveIndex, hit.T);
+		else
+			printf("Picked nothing\n");
+	}
+
+	// Toggle progressive accumulation of samples while the view is still
+	if (Input::KeyPress('G'))
+	{
+		RayTracing::AccumulationEnabled = !RayTracing::AccumulationEnabled;
+		printf("Accumulation %s (up to %u samples per pixel)\n",
+			RayTracing::AccumulationEnabled ? "enabled" : "disabled",
+			RayTracing::MaxAccumulatedSamples);
+	}
+
+	// Note when the view has converged, as that's when rays stop being traced
+	bool converged = RayTracing::GetAccumulatedSamples() >= RayTracing::MaxAccumulatedSamples;
+	if (converged && !accumulationConverged)
+		printf("Accumulation converged at %u samples per pixel\n", RayTracing::GetAccumulatedSamples());
+	accumulationConverged = converged;
+
+	// Render the current view on the CPU for comparison with the GPU
+	if (Input::KeyPress('P'))
+		RenderCPUReference();
+
+	// Time CPU top level builds & refits over many sphere instances
+	if (Input::KeyPress('L'))
+		BenchmarkTopLevel();
+
+	// Show how much memory the GPU's accel structures take
+	if (Input::KeyPress('M'))
+		PrintAccelStructMemory();
+
+	// Toggle the detailed stats printed for each mesh load, upload & build
+	if (Input::KeyPress('V'))
+	{
+		Diagnostics::SetVerbose(!Diagnostics::IsVerbose());
+		printf("Verbose stats %s\n", Diagnostics::IsVerbose() ? "enabled" : "disabled");
+	}
+}
+
+
+// --------------------------------------------------------
+// Renders the current view with the CPU reference raytracer
+// and saves it next to the executable, both as an 8-bit PPM
+// and (streamed out while rendering) as an unclamped PFM
+// --------------------------------------------------------
+void Game::RenderCPUReference()
+{
+	RaytracingSceneData sceneData = CPURaytracer::CalcSceneData(
+		camera->GetView(),
+		camera->GetProjection(),
+		camera->GetTransform()->GetPosition(),
+		lights);
+
+	// Every entity with a CPU BVH, through the same top level as the ray queries
+	std::vector<CPURaytracer::Geometry> hitGroups;
+	for (const std::shared_ptr<Mesh>& mesh : rayQueries.GetMeshes())
+		hitGroups.push_back(mesh->GetCPUGeometry());
+
+	std::string floatFile = FixPath(std::string("cpu_raytrace.pfm"));
+	TileImageWriter writer;
+	bool streaming = writer.Open(floatFile.c_str(), Window::Width(), Window::Height(), ImageFileFormat::PFM);
+
+	CPURaytracer::Image image;
+	CPURaytracer::RenderStats stats = CPURaytracer::Render(sceneData, rayQueries.GetTLAS(), hitGroups,
+		Window::Width(), Window::Height(), image, 16, 0, streaming ? &writer : 0);
+	ImageWriterStats written = writer.Close();
+
+	std::string file = FixPath(std::string("cpu_raytrace.ppm"));
+	bool saved = CPURaytracer::WritePPM(image, file.c_str());
+	printf("CPU raytrace: %ux%u, %u tiles on %u thread(s) in %.2fms (%.2f Mrays/s), %s %s\n",
+		image.Width,
+		image.Height,
+		stats.Tiles,
+		stats.Threads,
+		stats.Milliseconds,
+		stats.Rays / (stats.Milliseconds * 1000.0),
+		saved ? "saved to" : "FAILED to save",
+		file.c_str());
+	printf("CPU raytrace: %u tiles %s %s in the background (%.2fms writing, renderers stalled %.2fms, at most %u tiles queued)\n",
+		written.Tiles,
+		streaming && written.Succeeded ? "streamed to" : "FAILED to stream to",
+		floatFile.c_str(),
+		written.WriterMilliseconds,
+		written.StallMilliseconds,
+		written.MaxQueuedTiles);
 }
 
 
+// --------------------------------------------------------
+// Scatters 250 thousand instances of the sphere's BLAS over
+// a large field of transforms and times a full top level
+// build, a refit after every instance moves and a rebuild,
+// then renders the field from above at 1280x720.  Every
+// other instance has an empty mask, so (just like with
+// TraceRay()) no ray can hit it.
+// --------------------------------------------------------
+void Game::BenchmarkTopLevel()
+{
+	const unsigned int width = 1280;
+	const unsigned int height = 720;
+	const unsigned int fieldSize = 500;
+	const unsigned int instanceCount = fieldSize * fieldSize;
+
+	// One transform per instance, as a GameEntity would have
+	std::vector<Transform> transforms(instanceCount);
+	std::vector<BVHInstance> instances(instanceCount);
+	for (unsigned int i = 0; i < instanceCount; i++)
+	{
+		float x = (float)(i % fieldSize);
+		float z = (float)(i / fieldSize);
+		transforms[i].SetPosition(x * 2.0f - fieldSize, sinf(x * 0.1f) * cosf(z * 0.1f) * 4.0f, z * 2.0f - fieldSize);
+		transforms[i].SetRotation(0, x * 0.3f + z, 0);
+		transforms[i].SetScale(0.5f + 0.4f * sinf(x * 0.7f + z * 1.3f), 1.0f, 0.8f);
+
+		instances[i].SetWorldMatrix(transforms[i].GetWorldMatrix());
+		instances[i].InstanceID = i;
+		instances[i].InstanceMask = (i & 1) ? 0xFF : 0x00;
+		instances[i].BLAS = sphereMesh->GetBVH().get();
+		instances[i].WideBLAS = sphereMesh->GetWideBVH().get();
+	}
+
+	TopLevelBVH tlas;
+	TopLevelBuildStats build = tlas.Build(instances.data(), instanceCount);
+
+	// Shift & spin everything a little, then refit the same tree
+	for (unsigned int i = 0; i < instanceCount; i++)
+	{
+		transforms[i].MoveAbsolute(0, 0.5f, 0);
+		transforms[i].Rotate(0, 0.2f, 0);
+		instances[i].SetWorldMatrix(transforms[i].GetWorldMatrix());
+	}
+	TopLevelBuildStats refit = tlas.Refit(instances.data(), instanceCount);
+	TopLevelBuildStats rebuild = tlas.Build(instances.data(), instanceCount);
+
+	printf("Top level benchmark: %u instances, %u nodes, depth %u, build %.2fms, refit %.2fms (%.2fx faster), rebuild after moving %.2fms, on %u thread(s)\n",
+		build.Instances,
+		build.Nodes,
+		build.MaxDepth,
+		build.Milliseconds,
+		refit.Milliseconds,
+		build.Milliseconds / refit.Milliseconds,
+		rebuild.Milliseconds,
+		build.Threads);
+
+	std::vector<CPURaytracer::Geometry> hitGroups = { sphereMesh->GetCPUGeometry() };
+
+	// Looking across the field from above one corner
+	XMFLOAT3 fieldCameraPos(-(float)fieldSize, 40.0f, -(float)fieldSize);
+	XMFLOAT4X4 fieldView, fieldProjection;
+	XMStoreFloat4x4(&fieldView, XMMatrixLookToLH(XMLoadFloat3(&fieldCameraPos), XMVectorSet(1.0f, -0.3f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)));
+	XMStoreFloat4x4(&fieldProjection, XMMatrixPerspectiveFovLH(XM_PIDIV4, (float)width / height, 0.01f, 1000.0f));
+	RaytracingSceneData sceneData = CPURaytracer::CalcSceneData(fieldView, fieldProjection, fieldCameraPos);
+
+	CPURaytracer::Image image;
+	CPURaytracer::RenderStats stats = CPURaytracer::Render(sceneData, tlas, hitGroups, width, height, image);
+
+	std::string file = FixPath(std::string("cpu_raytrace_instances.ppm"));
+	bool saved = CPURaytracer::WritePPM(image, file.c_str());
+	printf("Top level benchmark: %ux%u through %u instances in %.2fms (%.2f Mrays/s) on %u thread(s), %s %s\n",
+		width,
+		height,
+		instanceCount,
+		stats.Milliseconds,
+		stats.Rays / (stats.Milliseconds * 1000.0),
+		stats.Threads,
+		saved ? "saved to" : "FAILED to save",
+		file.c_str());
+}
+
+
+// --------------------------------------------------------
+// Prints the size of every BLAS as built and as it is now
+// (after any compaction), then the totals for every accel
+// structure and the scratch memory kept for building them
+// --------------------------------------------------------
+void Game::PrintAccelStructMemory()
+{
+	const double KB = 1024.0;
+	RayTracing::AccelStructMemoryStats stats = RayTracing::GetMemoryStats();
+
+	for (size_t i = 0; i < stats.BLASes.size(); i++)
+	{
+		const RayTracing::BLASMemoryStats& blas = stats.BLASes[i];
+		printf("BLAS %u (mesh %016llx LOD %u, %u triangles): %.1f KB as built, %.1f KB %s\n",
+			(unsigned int)i,
+			blas.MeshHash,
+			blas.LOD,
+			blas.TriangleCount,
+			blas.BuiltBytes / KB,
+			blas.CurrentBytes / KB,
+			blas.Released ? "before being released" : blas.Compacted ? "compacted" : "now (not compacted)");
+	}
+
+	printf("Accel structures: BLASes %.1f KB (%.1f KB as built), TLAS %.1f KB, scratch %.1f KB\n",
+		stats.BLASCurrentBytes / KB,
+		stats.BLASBuiltBytes / KB,
+		stats.TLASBytes / KB,
+		stats.ScratchBytes / KB);
+
+	// Identical meshes share a Mesh, and meshes with identical contents a BLAS
+	MeshLibraryStats library = meshLibrary.GetStats();
+	printf("Mesh library: %u mesh(es) in use, %u hit(s) (%u by source), %u miss(es); BLAS cache: %u hit(s), %u miss(es)\n",
+		library.Meshes,
+		library.Hits,
+		library.SourceHits,
+		library.Misses,
+		stats.BLASCacheHits,
+		stats.BLASCacheMisses);
+}
+
+
+
 // --------------------------------------------------------
 // Clear the screen, redraw everything, present to the user
 // --------------------------------------------------------
@@ -105,8 +423,9 @@ void Game::Draw(float deltaTime, float totalTime)
 	// Grab the current back buffer for this frame
 	Microsoft::WRL::ComPtr<ID3D12Resource> currentBackBuffer = Graphics::BackBuffers[Graphics::SwapChainIndex()];
 
-	// Ray tracing
-	RayTracing::Raytrace(camera, currentBackBuffer);
+	// Ray tracing, after bringing the TLAS up to date with the entities
+	RayTracing::UpdateTLAS(entities, camera);
+	RayTracing::Raytrace(camera, lights, currentBackBuffer);
 	Graphics::CloseAndExecuteCommandList();
 
 	// Present
@@ -5,6 +5,8 @@
 #include "Transform.h"
 #include "Camera.h"
 #include "Lights.h"
+#include "RayQuery.h"
+#include "MeshLibrary.h"
 
 #include <d3d12.h>
 #include <wrl/client.h>
@@ -29,6 +31,9 @@ public:
 	void ShutDown();
 
 private:
+	void RenderCPUReference();
+	void BenchmarkTopLevel();
+	void PrintAccelStructMemory();
 
 	// Note the usage of ComPtr below
 	//  - This is a smart pointer for objects that abide by the
@@ -41,6 +46,13 @@ private:
 
 	// Scene
 	std::shared_ptr<Camera> camera;
+	MeshLibrary meshLibrary;
 	std::shared_ptr<Mesh> sphereMesh;
+	std::shared_ptr<Mesh> waveMesh;
+	std::vector<Vertex> waveBaseVertices;
+	std::vector<std::shared_ptr<GameEntity>> entities;
+	RayQueryScene rayQueries;
+	std::vector<Light> lights;
+	bool accumulationConverged = false;
 };
 
@@ -16,3 +16,6 @@ void GameEntity::SetMesh(std::shared_ptr<Mesh> mesh) { this->mesh = mesh; }
 void GameEntity::SetMaterial(std::shared_ptr<Material> material) { this->material = material; }
 
 Transform* GameEntity::GetTransform() { return &transform; }
+
+unsigned int GameEntity::GetInstanceMask() { return instanceMask; }
+void GameEntity::SetInstanceMask(unsigned int mask) { instanceMask = mask & 0xFF; }
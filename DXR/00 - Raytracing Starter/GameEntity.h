@@ -22,10 +22,15 @@ public:
 
 	Transform* GetTransform();
 
+	// Which ray queries can hit this entity, like a DXR instance mask
+	unsigned int GetInstanceMask();
+	void SetInstanceMask(unsigned int mask);
+
 private:
 
 	std::shared_ptr<Mesh> mesh;
 	std::shared_ptr<Material> material;
 	Transform transform;
+	unsigned int instanceMask = 0xFF;
 };
 
@@ -1,8 +1,10 @@
 #include "Graphics.h"
 #include <dxgi1_6.h>
+#include <chrono>
 
 #include "WICTextureLoader.h"
 #include "ResourceUploadBatch.h"
+#include "Diagnostics.h"
 
 using namespace DirectX;
 
@@ -37,6 +39,16 @@ namespace Graphics
 		UINT64 cbUploadHeapSizeInBytes = 0;
 		UINT64 cbUploadHeapOffsetInBytes = 0;
 		void* cbUploadHeapStartAddress = 0;
+
+		// Batched static resource uploads (see BeginUploadBatch)
+		bool uploadBatchOpen = false;
+		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> uploadBatchAllocator;
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> uploadBatchList;
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> uploadBatchHeaps;
+		std::unique_ptr<DirectX::ResourceUploadBatch> uploadBatchTextures;
+		UINT64 uploadBatchBytes = 0;
+		unsigned int uploadBatchTextureCount = 0;
+		std::chrono::high_resolution_clock::time_point uploadBatchStart;
 	}
 }
 
@@ -577,28 +589,34 @@ Microsoft::WRL::ComPtr<ID3D12Resource> Graphics::CreateBuffer(
 // dataCount - How many pieces of data (like how many vertices)
 // data - Pointer to the data itself
 // --------------------------------------------------------
-Microsoft::WRL::ComPtr<ID3D12Resource> Graphics::CreateStaticBuffer(size_t dataStride, size_t dataCount, void* data)
+Microsoft::WRL::ComPtr<ID3D12Resource> Graphics::CreateStaticBuffer(size_t dataStride, size_t dataCount, const void* data)
 {
 	// Creates a temporary command allocator and list so we don't
 	// screw up any other ongoing work (since resetting a command allocator
 	// cannot happen while its list is being executed).  These ComPtrs will
 	// be cleaned up automatically when they go out of scope.
-	// Note: This certainly isn't efficient, but hopefully this only
-	//       happens during start-up.  Otherwise, refactor this to use
-	//       the existing list and allocator(s).
+	// Note: If an upload batch is open, its list is used instead and
+	//       nothing is executed until the batch ends.
 	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> localAllocator;
 	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> localList;
 
-	Device->CreateCommandAllocator(
-		D3D12_COMMAND_LIST_TYPE_DIRECT,
-		IID_PPV_ARGS(localAllocator.GetAddressOf()));
+	if (uploadBatchOpen)
+	{
+		localList = uploadBatchList;
+	}
+	else
+	{
+		Device->CreateCommandAllocator(
+			D3D12_COMMAND_LIST_TYPE_DIRECT,
+			IID_PPV_ARGS(localAllocator.GetAddressOf()));
 
-	Device->CreateCommandList(
-		0,								// Which physical GPU will handle these tasks?  0 for single GPU setup
-		D3D12_COMMAND_LIST_TYPE_DIRECT,	// Type of command list - direct is for standard API calls
-		localAllocator.Get(),			// The allocator for this list (to start)
-		0,								// Initial pipeline state - none for now
-		IID_PPV_ARGS(localList.GetAddressOf()));
+		Device->CreateCommandList(
+			0,								// Which physical GPU will handle these tasks?  0 for single GPU setup
+			D3D12_COMMAND_LIST_TYPE_DIRECT,	// Type of command list - direct is for standard API calls
+			localAllocator.Get(),			// The allocator for this list (to start)
+			0,								// Initial pipeline state - none for now
+			IID_PPV_ARGS(localList.GetAddressOf()));
+	}
 
 	// The overall buffer we'll be creating
 	Microsoft::WRL::ComPtr<ID3D12Resource> buffer;
@@ -668,6 +686,14 @@ Microsoft::WRL::ComPtr<ID3D12Resource> Graphics::CreateStaticBuffer(size_t dataS
 	rb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
 	localList->ResourceBarrier(1, &rb);
 
+	// When batching, the upload heap must survive until the batch is done
+	if (uploadBatchOpen)
+	{
+		uploadBatchHeaps.push_back(uploadHeap);
+		uploadBatchBytes += desc.Width;
+		return buffer;
+	}
+
 	// Execute the local command list and wait for it to complete
 	// before returning the final buffer
 	localList->Close();
@@ -766,25 +792,83 @@ D3D12_GPU_DESCRIPTOR_HANDLE Graphics::FillNextConstantBufferAndGetGPUDescriptorH
 // generateMips - Should mip maps be generated? (defaults to true)
 // --------------------------------------------------------
 D3D12_CPU_DESCRIPTOR_HANDLE Graphics::LoadTexture(const wchar_t* file, bool generateMips)
+{
+	DecodedTexture texture = DecodeTexture(file, generateMips);
+	return UploadTexture(texture);
+}
+
+
+// --------------------------------------------------------
+// Reads and decodes an image file and creates its (still
+// empty) texture resource.  This touches the device but no
+// command lists, so it's safe to call from worker threads,
+// as long as COM has been initialized on them.
+// 
+// file - The image file to attempt to load
+// generateMips - Should mip maps be generated? (defaults to true)
+// --------------------------------------------------------
+Graphics::DecodedTexture Graphics::DecodeTexture(const wchar_t* file, bool generateMips)
+{
+	DecodedTexture texture;
+	texture.GenerateMips = generateMips;
+	LoadWICTextureFromFileEx(
+		Device.Get(),
+		file,
+		0,
+		D3D12_RESOURCE_FLAG_NONE,
+		generateMips ? WIC_LOADER_MIP_AUTOGEN : WIC_LOADER_DEFAULT,
+		texture.Resource.GetAddressOf(),
+		texture.Data,
+		texture.Subresource);
+	return texture;
+}
+
+
+// --------------------------------------------------------
+// Uploads a decoded texture's pixels (generating mips if
+// requested) and creates a non-shader-visible SRV for it,
+// just like LoadTexture().  If an upload batch is open the
+// upload joins it, otherwise this waits for the upload.
+// 
+// texture - A texture from DecodeTexture(), whose pixel data
+//           can be freed as soon as this returns
+// --------------------------------------------------------
+D3D12_CPU_DESCRIPTOR_HANDLE Graphics::UploadTexture(DecodedTexture& texture)
 {
 	// Helper function from DXTK for uploading a resource
 	// (like a texture) to the appropriate GPU memory
-	ResourceUploadBatch upload(Device.Get());
-	upload.Begin();
+	std::unique_ptr<ResourceUploadBatch> localUpload;
+	ResourceUploadBatch* upload = uploadBatchTextures.get();
+	if (!uploadBatchOpen)
+	{
+		localUpload = std::make_unique<ResourceUploadBatch>(Device.Get());
+		localUpload->Begin();
+		upload = localUpload.get();
+	}
 
-	// Attempt to create the texture
-	Microsoft::WRL::ComPtr<ID3D12Resource> texture;
-	CreateWICTextureFromFile(Device.Get(), upload, file, texture.GetAddressOf(), generateMips);
+	// Copy the pixels into the texture (the batch makes its own copy)
+	if (texture.Resource)
+	{
+		upload->Upload(texture.Resource.Get(), 0, &texture.Subresource, 1);
+		upload->Transition(texture.Resource.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+		if (texture.GenerateMips)
+			upload->GenerateMips(texture.Resource.Get());
+		if (uploadBatchOpen)
+			uploadBatchTextureCount++;
+	}
 
 	// Perform the upload and wait for it to finish before returning the texture
-	auto finish = upload.End(CommandQueue.Get());
-	finish.wait();
+	if (localUpload)
+	{
+		auto finish = localUpload->End(CommandQueue.Get());
+		finish.wait();
+	}
 
 	// Now that we have the texture, add to our list and make a CPU-side descriptor heap
 	// just for this texture's SRV.  Note that it would probably be better to put all 
 	// texture SRVs into the same descriptor heap, but we don't know how many we'll need
 	// until they're all loaded and this is a quick and dirty implementation!
-	Textures.push_back(texture);
+	Textures.push_back(texture.Resource);
 
 	// Create the CPU-SIDE descriptor heap for our descriptor
 	D3D12_DESCRIPTOR_HEAP_DESC dhDesc = {};
@@ -800,7 +884,10 @@ D3D12_CPU_DESCRIPTOR_HANDLE Graphics::LoadTexture(const wchar_t* file, bool gene
 	// Create the SRV on this descriptor heap
 	// Note: Using a null description results in the "default" SRV (same format, all mips, all array slices, etc.)
 	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle = descHeap->GetCPUDescriptorHandleForHeapStart();
-	Device->CreateShaderResourceView(texture.Get(), 0, cpuHandle);
+	Device->CreateShaderResourceView(texture.Resource.Get(), 0, cpuHandle);
+
+	// The pixels live on the GPU (or in the batch's upload heap) now
+	texture.Data.reset();
 
 	// Return the CPU descriptor handle, which can be used to
 	// copy the descriptor to a shader-visible heap later
@@ -808,6 +895,73 @@ D3D12_CPU_DESCRIPTOR_HANDLE Graphics::LoadTexture(const wchar_t* file, bool gene
 }
 
 
+// --------------------------------------------------------
+// Starts batching static buffer and texture uploads, so
+// that everything created until EndUploadBatch() is sent
+// to the GPU together with a single wait, rather than one
+// submission and wait per resource.  Resources created in
+// the batch must not be used by the GPU until it ends.
+// --------------------------------------------------------
+void Graphics::BeginUploadBatch()
+{
+	if (uploadBatchOpen)
+		return;
+
+	Device->CreateCommandAllocator(
+		D3D12_COMMAND_LIST_TYPE_DIRECT,
+		IID_PPV_ARGS(uploadBatchAllocator.ReleaseAndGetAddressOf()));
+
+	Device->CreateCommandList(
+		0,
+		D3D12_COMMAND_LIST_TYPE_DIRECT,
+		uploadBatchAllocator.Get(),
+		0,
+		IID_PPV_ARGS(uploadBatchList.ReleaseAndGetAddressOf()));
+
+	uploadBatchTextures = std::make_unique<ResourceUploadBatch>(Device.Get());
+	uploadBatchTextures->Begin();
+
+	uploadBatchBytes = 0;
+	uploadBatchTextureCount = 0;
+	uploadBatchStart = std::chrono::high_resolution_clock::now();
+	uploadBatchOpen = true;
+}
+
+
+// --------------------------------------------------------
+// Submits every upload recorded since BeginUploadBatch()
+// and waits (once) for the GPU to finish them all
+// --------------------------------------------------------
+void Graphics::EndUploadBatch()
+{
+	if (!uploadBatchOpen)
+		return;
+	uploadBatchOpen = false;
+
+	// Buffers first, then textures, on the same queue
+	uploadBatchList->Close();
+	ID3D12CommandList* list[] = { uploadBatchList.Get() };
+	CommandQueue->ExecuteCommandLists(1, list);
+	auto finish = uploadBatchTextures->End(CommandQueue.Get());
+
+	WaitForGPU();
+	finish.wait();
+
+	auto end = std::chrono::high_resolution_clock::now();
+	Diagnostics::Print("Upload batch: %zu buffer(s) totalling %llu bytes and %u texture(s), one submission & wait, %.2fms\n",
+		uploadBatchHeaps.size(),
+		uploadBatchBytes,
+		uploadBatchTextureCount,
+		std::chrono::duration<double, std::milli>(end - uploadBatchStart).count());
+
+	// Everything has been copied, so the temporary resources can go
+	uploadBatchHeaps.clear();
+	uploadBatchTextures.reset();
+	uploadBatchList.Reset();
+	uploadBatchAllocator.Reset();
+}
+
+
 // --------------------------------------------------------
 // Copies one or more SRVs starting at the given CPU handle
 // to the final CBV/SRV descriptor heap, and returns
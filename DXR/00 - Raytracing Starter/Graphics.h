@@ -3,6 +3,7 @@
 #include <Windows.h>
 #include <d3d12.h>
 #include <dxgi1_6.h>
+#include <memory>
 #include <string>
 #include <wrl/client.h>
 #include <vector>
@@ -29,6 +30,16 @@ namespace Graphics
 	//       constant ensures we (hopefully) never run out of room.
 	const unsigned int MaxTextureDescriptors = 1000;
 
+	// A texture decoded from a file and created on the device, but
+	// whose pixels haven't been uploaded to it yet (see DecodeTexture)
+	struct DecodedTexture
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> Resource;
+		std::unique_ptr<uint8_t[]> Data;
+		D3D12_SUBRESOURCE_DATA Subresource{};
+		bool GenerateMips = false;
+	};
+
 	// --- GLOBAL VARS ---
 
 	// Primary D3D11 API objects
@@ -88,11 +99,15 @@ namespace Graphics
 		D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_COMMON,
 		D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE,
 		UINT64 alignment = 0);
-	Microsoft::WRL::ComPtr<ID3D12Resource> CreateStaticBuffer(size_t dataStride, size_t dataCount, void* data);
+	Microsoft::WRL::ComPtr<ID3D12Resource> CreateStaticBuffer(size_t dataStride, size_t dataCount, const void* data);
 	D3D12_GPU_DESCRIPTOR_HANDLE FillNextConstantBufferAndGetGPUDescriptorHandle(
 		void* data,
 		unsigned int dataSizeInBytes);
 	D3D12_CPU_DESCRIPTOR_HANDLE LoadTexture(const wchar_t* file, bool generateMips = true);
+	DecodedTexture DecodeTexture(const wchar_t* file, bool generateMips = true);
+	D3D12_CPU_DESCRIPTOR_HANDLE UploadTexture(DecodedTexture& texture);
+	void BeginUploadBatch();
+	void EndUploadBatch();
 	D3D12_GPU_DESCRIPTOR_HANDLE CopySRVsToDescriptorHeapAndGetGPUDescriptorHandle(
 		D3D12_CPU_DESCRIPTOR_HANDLE firstDescriptorToCopy,
 		unsigned int numDescriptorsToCopy);
@@ -0,0 +1,147 @@
+#include "CPURaytracer.h"
+#include "Diagnostics.h"
+#include "ImageWriter.h"
+#include "JobSystem.h"
+#include "MeshData.h"
+#include "ProceduralMeshes.h"
+
+#include <DirectXMath.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// A console entry point for the CPU reference raytracer,
+// with no window, D3D12 or other Windows dependencies, so
+// renders can run (and be compared) on any build machine.
+//
+// Usage: HeadlessRender [-v] [output] [width] [height] [mesh.obj]
+//
+// The output is a PPM unless its name ends in .pfm, in
+// which case it's an unclamped float map streamed out tile
+// by tile.  Without an OBJ, a generated sphere is rendered.
+// -v prints the detailed stats of loading & processing.
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	bool EndsWith(const std::string& text, const char* suffix)
+	{
+		size_t length = strlen(suffix);
+		return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	// -v can go anywhere, the rest are positional
+	std::vector<std::string> args;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-v") == 0)
+			Diagnostics::SetVerbose(true);
+		else
+			args.push_back(argv[i]);
+	}
+
+	std::string output = args.size() > 0 ? args[0] : "headless_raytrace.ppm";
+	unsigned int width = args.size() > 1 ? (unsigned int)atoi(args[1].c_str()) : 1280;
+	unsigned int height = args.size() > 2 ? (unsigned int)atoi(args[2].c_str()) : 720;
+	if (width == 0 || height == 0)
+	{
+		printf("Usage: HeadlessRender [-v] [output.ppm|output.pfm] [width] [height] [mesh.obj]\n");
+		return 1;
+	}
+
+	// Loading & processing use the same worker threads as the sample
+	JobSystem::Initialize();
+
+	// Same processing the sample asks for, minus the GPU-only choices
+	MeshOptions options;
+	options.OptimizeVertexOrder = true;
+	options.BuildBVH = true;
+
+	std::shared_ptr<MeshData> mesh;
+	if (args.size() > 3)
+	{
+		const std::string& objFile = args[3];
+		mesh = MeshData::Load(std::wstring(objFile.begin(), objFile.end()).c_str(), options);
+	}
+	else
+	{
+		std::vector<Vertex> verts;
+		std::vector<unsigned int> indices;
+		ProceduralMeshes::MakeSphere(64, 32, verts, indices);
+		mesh = MeshData::Process(verts.data(), (int)verts.size(), indices.data(), (int)indices.size(), options);
+	}
+
+	if (mesh->IndexCount == 0)
+	{
+		printf("HeadlessRender: no triangles to render\n");
+		JobSystem::ShutDown();
+		return 1;
+	}
+
+	std::vector<CPURaytracer::Geometry> scene = { CPURaytracer::MakeGeometry(*mesh) };
+
+	// Frame the whole mesh, looking down +Z like the sample's camera
+	XMVECTOR boundsMin = XMLoadFloat3(&mesh->BoundsMin);
+	XMVECTOR boundsMax = XMLoadFloat3(&mesh->BoundsMax);
+	XMVECTOR center = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+	float radius = XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, boundsMin))) * 0.5f;
+	float fov = XM_PIDIV4;
+	float distance = radius / sinf(fov * 0.5f);
+	XMVECTOR eye = XMVectorSubtract(center, XMVectorSet(0, 0, distance, 0));
+
+	XMFLOAT4X4 view;
+	XMFLOAT4X4 projection;
+	XMFLOAT3 cameraPosition;
+	XMStoreFloat4x4(&view, XMMatrixLookToLH(eye, XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 1, 0, 0)));
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(fov, (float)width / height, distance * 0.01f, distance + radius * 2.0f));
+	XMStoreFloat3(&cameraPosition, eye);
+
+	// The sample's key light from above
+	Light sun = {};
+	sun.Type = LIGHT_TYPE_DIRECTIONAL;
+	sun.Direction = XMFLOAT3(0.5f, -1.0f, 0.5f);
+	sun.Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
+	sun.Intensity = 1.0f;
+	RaytracingSceneData sceneData = CPURaytracer::CalcSceneData(view, projection, cameraPosition, { sun });
+
+	// Float maps are streamed out as tiles finish, anything else is written at the end
+	bool floatOutput = EndsWith(output, ".pfm");
+	TileImageWriter writer;
+	if (floatOutput && !writer.Open(output.c_str(), width, height, ImageFileFormat::PFM))
+	{
+		printf("HeadlessRender: FAILED to open %s\n", output.c_str());
+		JobSystem::ShutDown();
+		return 1;
+	}
+
+	CPURaytracer::Image image;
+	CPURaytracer::RenderStats stats = CPURaytracer::Render(sceneData, scene, width, height, image,
+		16, true, 0, floatOutput ? &writer : 0);
+	bool saved = floatOutput ? writer.Close().Succeeded : CPURaytracer::WritePPM(image, output.c_str());
+
+	printf("HeadlessRender: %u triangles at %ux%u, %u tiles on %u thread(s) in %.2fms (%.2f Mrays/s), %s %s\n",
+		mesh->IndexCount / 3,
+		width,
+		height,
+		stats.Tiles,
+		stats.Threads,
+		stats.Milliseconds,
+		stats.Rays / (stats.Milliseconds * 1000.0),
+		saved ? "saved to" : "FAILED to save",
+		output.c_str());
+
+	JobSystem::ShutDown();
+	return saved ? 0 : 1;
+}
@@ -0,0 +1,259 @@
+#include "ImageWriter.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+using namespace DirectX;
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	unsigned int BytesPerPixel(ImageFileFormat format)
+	{
+		return format == ImageFileFormat::PFM ? 3 * sizeof(float) : 3;
+	}
+
+	// Same conversion as a UNORM render target
+	unsigned char ToUnorm8(float value)
+	{
+		if (!(value > 0.0f)) return 0; // Also catches NaN
+		if (value >= 1.0f) return 255;
+		return (unsigned char)(value * 255.0f + 0.5f);
+	}
+
+	// Same conversion as a UNORM_SRGB render target
+	unsigned char ToSRGB8(float value)
+	{
+		if (!(value > 0.0f)) return 0;
+		if (value >= 1.0f) return 255;
+		float encoded = value <= 0.0031308f ?
+			value * 12.92f :
+			1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+		return (unsigned char)(encoded * 255.0f + 0.5f);
+	}
+}
+
+
+// --------------------------------------------------------
+// Sets up the writer's tile slots.  No thread is started
+// until a file is opened.
+//
+// maxQueuedTiles - Tiles that can wait to be written before
+//                  WriteTile() blocks
+// --------------------------------------------------------
+TileImageWriter::TileImageWriter(unsigned int maxQueuedTiles)
+{
+	slots.resize(maxQueuedTiles > 0 ? maxQueuedTiles : 1);
+}
+
+
+TileImageWriter::~TileImageWriter()
+{
+	Close();
+}
+
+
+// --------------------------------------------------------
+// Creates the file, writes its header and reserves space
+// for every pixel, then starts the writer thread
+//
+// file   - Path of the file to create (replacing any)
+// width  - Image width in pixels
+// height - Image height in pixels
+// format - How pixels are stored in the file
+// --------------------------------------------------------
+bool TileImageWriter::Open(const char* file, unsigned int width, unsigned int height, ImageFileFormat format)
+{
+	Close();
+
+	this->file.open(file, std::ios::binary | std::ios::trunc);
+	if (!this->file.is_open())
+		return false;
+
+	this->width = width;
+	this->height = height;
+	this->format = format;
+
+	// PFM stores rows bottom to top, and a negative scale means little endian
+	std::string header = format == ImageFileFormat::PFM ?
+		"PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n" :
+		"P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+	this->file.write(header.data(), (std::streamsize)header.size());
+	pixelDataOffset = (std::streamoff)header.size();
+
+	// Size the file up front, so tiles can land anywhere in it
+	unsigned long long pixelBytes = (unsigned long long)width * height * BytesPerPixel(format);
+	if (pixelBytes > 0)
+	{
+		this->file.seekp(pixelDataOffset + (std::streamoff)pixelBytes - 1);
+		this->file.put(0);
+	}
+	if (!this->file.good())
+	{
+		this->file.close();
+		return false;
+	}
+
+	stats = {};
+	stats.Succeeded = true;
+	closing = false;
+	freeSlots.clear();
+	queuedSlots.clear();
+	for (unsigned int i = 0; i < slots.size(); i++)
+		freeSlots.push_back(i);
+
+	writerThread = std::thread(&TileImageWriter::WriterLoop, this);
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Copies a tile into a free slot (waiting for one if need
+// be) and hands it to the writer thread
+// --------------------------------------------------------
+void TileImageWriter::WriteTile(const TileRect& tile, const XMFLOAT4* pixels, unsigned int rowPitch)
+{
+	if (!IsOpen())
+		return;
+
+	unsigned int slot;
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+		if (freeSlots.empty())
+		{
+			auto waitStart = std::chrono::high_resolution_clock::now();
+			slotFreed.wait(lock, [this] { return !freeSlots.empty(); });
+			auto waitEnd = std::chrono::high_resolution_clock::now();
+			stats.StallMilliseconds += std::chrono::duration<double, std::milli>(waitEnd - waitStart).count();
+		}
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+
+	// Slots keep their memory, so this only allocates the first few times
+	QueuedTile& queued = slots[slot];
+	queued.Rect = tile;
+	unsigned int tileWidth = tile.EndX - tile.StartX;
+	unsigned int tileHeight = tile.EndY - tile.StartY;
+	queued.Pixels.resize((size_t)tileWidth * tileHeight);
+	for (unsigned int y = 0; y < tileHeight; y++)
+		memcpy(&queued.Pixels[(size_t)y * tileWidth], &pixels[(size_t)y * rowPitch], tileWidth * sizeof(XMFLOAT4));
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queuedSlots.push_back(slot);
+		if (queuedSlots.size() > stats.MaxQueuedTiles)
+			stats.MaxQueuedTiles = (unsigned int)queuedSlots.size();
+	}
+	slotQueued.notify_one();
+}
+
+
+// --------------------------------------------------------
+// Lets the writer thread finish every queued tile, then
+// closes the file.  Does nothing if no file is open.
+// --------------------------------------------------------
+ImageWriterStats TileImageWriter::Close()
+{
+	if (!IsOpen())
+		return stats;
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		closing = true;
+	}
+	slotQueued.notify_one();
+	writerThread.join();
+
+	file.flush();
+	if (!file.good())
+		stats.Succeeded = false;
+	file.close();
+	return stats;
+}
+
+
+// --------------------------------------------------------
+// Writes queued tiles until the file is closed and there
+// are none left
+// --------------------------------------------------------
+void TileImageWriter::WriterLoop()
+{
+	std::vector<unsigned char> row;
+	while (true)
+	{
+		unsigned int slot;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			slotQueued.wait(lock, [this] { return closing || !queuedSlots.empty(); });
+			if (queuedSlots.empty())
+				break;
+
+			slot = queuedSlots.front();
+			queuedSlots.pop_front();
+		}
+
+		auto writeStart = std::chrono::high_resolution_clock::now();
+		WriteQueuedTile(slots[slot], row);
+		auto writeEnd = std::chrono::high_resolution_clock::now();
+
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stats.WriterMilliseconds += std::chrono::duration<double, std::milli>(writeEnd - writeStart).count();
+			freeSlots.push_back(slot);
+		}
+		slotFreed.notify_one();
+	}
+}
+
+
+// --------------------------------------------------------
+// Converts each row of a tile to the file's format and
+// writes it at that row's place in the file
+// --------------------------------------------------------
+void TileImageWriter::WriteQueuedTile(const QueuedTile& tile, std::vector<unsigned char>& row)
+{
+	unsigned int bytesPerPixel = BytesPerPixel(format);
+	unsigned int tileWidth = tile.Rect.EndX - tile.Rect.StartX;
+	row.resize((size_t)tileWidth * bytesPerPixel);
+
+	for (unsigned int y = tile.Rect.StartY; y < tile.Rect.EndY; y++)
+	{
+		const XMFLOAT4* pixels = &tile.Pixels[(size_t)(y - tile.Rect.StartY) * tileWidth];
+		for (unsigned int x = 0; x < tileWidth; x++)
+		{
+			unsigned char* out = &row[(size_t)x * bytesPerPixel];
+			switch (format)
+			{
+			case ImageFileFormat::PPM:
+				out[0] = ToUnorm8(pixels[x].x);
+				out[1] = ToUnorm8(pixels[x].y);
+				out[2] = ToUnorm8(pixels[x].z);
+				break;
+
+			case ImageFileFormat::PPMsRGB:
+				out[0] = ToSRGB8(pixels[x].x);
+				out[1] = ToSRGB8(pixels[x].y);
+				out[2] = ToSRGB8(pixels[x].z);
+				break;
+
+			case ImageFileFormat::PFM:
+				memcpy(out, &pixels[x], 3 * sizeof(float));
+				break;
+			}
+		}
+
+		unsigned int fileRow = format == ImageFileFormat::PFM ? height - 1 - y : y;
+		std::streamoff offset = pixelDataOffset + ((std::streamoff)fileRow * width + tile.Rect.StartX) * bytesPerPixel;
+		file.seekp(offset);
+		file.write((const char*)row.data(), (std::streamsize)row.size());
+	}
+
+	if (!file.good())
+		stats.Succeeded = false;
+	stats.Tiles++;
+	stats.Bytes += (unsigned long long)row.size() * (tile.Rect.EndY - tile.Rect.StartY);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TileScheduler.h"
+
+// File formats TileImageWriter can produce
+enum class ImageFileFormat
+{
+	PPM,		// Binary PPM, 8 bits per channel, clamped like the R8G8B8A8_UNORM output
+	PPMsRGB,	// Binary PPM, 8 bits per channel, sRGB encoded from linear values
+	PFM			// Portable float map, 32 bits per channel, unclamped
+};
+
+// Details of the most recent file
+struct ImageWriterStats
+{
+	unsigned int Tiles;
+	unsigned long long Bytes;			// Pixel data only, not the header
+	unsigned int MaxQueuedTiles;		// Most tiles ever waiting to be written at once
+	double StallMilliseconds;			// Total time WriteTile() waited for a free tile
+	double WriterMilliseconds;			// Time the writer thread spent converting & writing
+	bool Succeeded;
+};
+
+// --------------------------------------------------------
+// Streams finished tiles of an image (in the same float4
+// layout as OutputColor in Raytracing.hlsl) to a file on a
+// background thread, so renderers only pay for a copy.
+//
+// Every pixel of these formats is the same size, so each
+// tile row is written straight to its final offset in the
+// file.  The file is therefore byte for byte the same no
+// matter what order the tiles finish in, and nothing has to
+// be held back waiting for earlier tiles.
+//
+// Tiles are copied into a fixed number of reusable slots,
+// which bounds the memory used: when every slot is waiting
+// to be written, WriteTile() blocks until one is free.
+// --------------------------------------------------------
+class TileImageWriter
+{
+public:
+	TileImageWriter(unsigned int maxQueuedTiles = 64);
+	~TileImageWriter();
+
+	bool Open(const char* file, unsigned int width, unsigned int height, ImageFileFormat format);
+
+	// Queues a tile to be written, and can be called from any thread.
+	// pixels is the tile's top left pixel, and rowPitch the number of
+	// pixels from the start of one of its rows to the next.
+	void WriteTile(const TileRect& tile, const DirectX::XMFLOAT4* pixels, unsigned int rowPitch);
+
+	// Waits for every queued tile to be written, then closes the file
+	ImageWriterStats Close();
+
+	bool IsOpen() const { return writerThread.joinable(); }
+
+private:
+	struct QueuedTile
+	{
+		TileRect Rect;
+		std::vector<DirectX::XMFLOAT4> Pixels;
+	};
+
+	// File details
+	std::ofstream file;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	ImageFileFormat format = ImageFileFormat::PPM;
+	std::streamoff pixelDataOffset = 0;
+
+	// Tile slots, and which are free or waiting to be written
+	std::vector<QueuedTile> slots;
+	std::vector<unsigned int> freeSlots;
+	std::deque<unsigned int> queuedSlots;
+	std::mutex queueMutex;
+	std::condition_variable slotFreed;
+	std::condition_variable slotQueued;
+	bool closing = false;
+
+	std::thread writerThread;
+	ImageWriterStats stats{};
+
+	void WriterLoop();
+	void WriteQueuedTile(const QueuedTile& tile, std::vector<unsigned char>& row);
+};
@@ -0,0 +1,33 @@
+#include "InstanceTransforms.h"
+#include "Parallel.h"
+
+using namespace DirectX;
+
+
+// --------------------------------------------------------
+// Writes the 3x4 transform of every world matrix
+//
+// worlds     - The world matrices, one per instance
+// count      - How many matrices there are
+// dest       - Where the first transform goes
+// destStride - Bytes from one transform to the next
+// threads    - Threads to split the work across (0 to pick)
+// --------------------------------------------------------
+void InstanceTransforms::Write(const XMFLOAT4X4* worlds, unsigned int count, void* dest, size_t destStride, unsigned int threads)
+{
+	if (threads == 0)
+		threads = Parallel::ThreadCountFor(count, MinInstancesPerThread);
+
+	unsigned char* destBytes = (unsigned char*)dest;
+	Parallel::ForRanges(count, threads, [&](unsigned int, size_t start, size_t end)
+		{
+			for (size_t i = start; i < end; i++)
+			{
+				XMMATRIX transposed = XMMatrixTranspose(XMLoadFloat4x4(&worlds[i]));
+				XMFLOAT4* rows = (XMFLOAT4*)(destBytes + i * destStride);
+				XMStoreFloat4(&rows[0], transposed.r[0]);
+				XMStoreFloat4(&rows[1], transposed.r[1]);
+				XMStoreFloat4(&rows[2], transposed.r[2]);
+			}
+		});
+}
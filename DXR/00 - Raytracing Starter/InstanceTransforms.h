@@ -0,0 +1,30 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <cstddef>
+
+// --------------------------------------------------------
+// Converts world matrices (as from Transform::GetWorldMatrix)
+// into the 3x4 object to world transforms at the start of
+// D3D12_RAYTRACING_INSTANCE_DESC and BVHInstance.
+//
+// DirectXMath matrices are row vector, so the 3x4 layout is
+// the top three rows of the transpose: one SIMD transpose
+// and three 16 byte stores per instance.  Large arrays are
+// split across threads.
+// --------------------------------------------------------
+namespace InstanceTransforms
+{
+	// Fewer instances than this per thread isn't worth the threads
+	const unsigned int MinInstancesPerThread = 4096;
+
+	// Writes the transform of each matrix to dest, with consecutive
+	// transforms destStride bytes apart, so they can go straight into
+	// an array of instance descs.  threads of 0 picks a count.
+	void Write(
+		const DirectX::XMFLOAT4X4* worlds,
+		unsigned int count,
+		void* dest,
+		size_t destStride,
+		unsigned int threads = 0);
+}
@@ -0,0 +1,121 @@
+#include "JobSystem.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <objbase.h>
+#endif
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace JobSystem
+{
+	// Annonymous namespace to hold variables
+	// only accessible in this file
+	namespace
+	{
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()>> jobs;
+		std::mutex jobMutex;
+		std::condition_variable jobAvailable;
+		bool stopping = false;
+
+		// --------------------------------------------------------
+		// Each worker pulls jobs until the system shuts down,
+		// finishing any jobs still queued before it exits
+		// --------------------------------------------------------
+		void WorkerLoop()
+		{
+#ifdef _WIN32
+			// WIC (and any other COM objects) need this on every thread
+			HRESULT comResult = CoInitializeEx(0, COINIT_MULTITHREADED);
+#endif
+
+			while (true)
+			{
+				std::function<void()> job;
+				{
+					std::unique_lock<std::mutex> lock(jobMutex);
+					jobAvailable.wait(lock, [] { return stopping || !jobs.empty(); });
+					if (jobs.empty())
+						break;
+
+					job = std::move(jobs.front());
+					jobs.pop_front();
+				}
+				job();
+			}
+
+#ifdef _WIN32
+			if (SUCCEEDED(comResult))
+				CoUninitialize();
+#endif
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Starts the worker threads
+//
+// threadCount - How many workers to create (0 for one per
+//               core, leaving a core for the main thread)
+// --------------------------------------------------------
+void JobSystem::Initialize(unsigned int threadCount)
+{
+	if (!workers.empty())
+		return;
+
+	if (threadCount == 0)
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		threadCount = cores > 1 ? cores - 1 : 1;
+	}
+
+	stopping = false;
+	for (unsigned int i = 0; i < threadCount; i++)
+		workers.emplace_back(WorkerLoop);
+}
+
+
+// --------------------------------------------------------
+// Finishes all queued jobs and then joins the workers
+// --------------------------------------------------------
+void JobSystem::ShutDown()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+}
+
+
+unsigned int JobSystem::GetThreadCount() { return (unsigned int)workers.size(); }
+
+
+// --------------------------------------------------------
+// Adds a job to the queue and wakes a worker to run it
+// --------------------------------------------------------
+void JobSystem::Enqueue(std::function<void()> job)
+{
+	// No workers?  Nothing would ever run it, so do it now
+	if (workers.empty())
+	{
+		job();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		jobs.push_back(std::move(job));
+	}
+	jobAvailable.notify_one();
+}
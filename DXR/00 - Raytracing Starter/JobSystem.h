@@ -0,0 +1,41 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+
+// --------------------------------------------------------
+// A small pool of long-lived worker threads for running
+// independent jobs (like loading & decoding assets) in the
+// background.  Jobs run in the order they're submitted, on
+// whichever worker is free first.
+//
+// Workers have COM initialized (on Windows), so jobs are
+// free to use WIC and other COM-based APIs.  Jobs must NOT
+// record or submit GPU commands, which stays on the main
+// thread.
+// --------------------------------------------------------
+namespace JobSystem
+{
+	void Initialize(unsigned int threadCount = 0);
+	void ShutDown();
+	unsigned int GetThreadCount();
+
+	// Queues a job with no result.  Runs it immediately on the
+	// calling thread if the job system isn't initialized.
+	void Enqueue(std::function<void()> job);
+
+	// --------------------------------------------------------
+	// Queues a job and returns a future for its result, which
+	// also rethrows any exception the job threw
+	// --------------------------------------------------------
+	template<typename Func>
+	auto Submit(Func func) -> std::future<decltype(func())>
+	{
+		// std::function must be copyable, which packaged_task isn't
+		auto task = std::make_shared<std::packaged_task<decltype(func())()>>(std::move(func));
+		std::future<decltype(func())> result = task->get_future();
+		Enqueue([task]() { (*task)(); });
+		return result;
+	}
+}
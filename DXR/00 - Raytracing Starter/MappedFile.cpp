@@ -0,0 +1,120 @@
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const wchar_t* file)
+{
+	Open(file);
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+
+// --------------------------------------------------------
+// Opens and maps the entire file for reading.  Returns
+// false (leaving this object closed) if the file can't be
+// opened, is empty or can't be mapped.
+// --------------------------------------------------------
+bool MappedFile::Open(const wchar_t* file)
+{
+	// Only one file per object at a time
+	Close();
+
+#ifdef _WIN32
+	fileHandle = CreateFileW(
+		file,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		0,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+		0);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Empty files cannot be mapped, so treat them as a failure
+	LARGE_INTEGER fileSize{};
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	// Map the whole file as a read-only view
+	mappingHandle = CreateFileMappingW(fileHandle, 0, PAGE_READONLY, 0, 0, 0);
+	if (!mappingHandle)
+	{
+		Close();
+		return false;
+	}
+
+	data = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		Close();
+		return false;
+	}
+
+	size = (size_t)fileSize.QuadPart;
+	return true;
+#else
+	// Paths are wide everywhere else in the project, so convert
+	// to the narrow encoding the OS expects
+	fileDescriptor = open(std::filesystem::path(file).c_str(), O_RDONLY);
+	if (fileDescriptor == -1)
+		return false;
+
+	// Empty files cannot be mapped, so treat them as a failure
+	struct stat fileInfo {};
+	if (fstat(fileDescriptor, &fileInfo) != 0 || fileInfo.st_size == 0)
+	{
+		Close();
+		return false;
+	}
+
+	// Map the whole file as a read-only view
+	void* view = mmap(0, (size_t)fileInfo.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+	if (view == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	data = (const char*)view;
+	size = (size_t)fileInfo.st_size;
+	return true;
+#endif
+}
+
+
+// --------------------------------------------------------
+// Unmaps the view and releases the OS handles
+// --------------------------------------------------------
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (data) UnmapViewOfFile(data);
+	if (mappingHandle) CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+
+	mappingHandle = 0;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (data) munmap((void*)data, size);
+	if (fileDescriptor != -1) close(fileDescriptor);
+
+	fileDescriptor = -1;
+#endif
+
+	data = 0;
+	size = 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#include <cstddef>
+
+// --------------------------------------------------------
+// A read-only, memory-mapped view of an entire file
+//
+// The file's bytes are paged in by the OS on demand, so
+// large files can be parsed (or handed straight to the GPU
+// upload path) without first copying them into our own
+// buffers.  The view stays valid until this object is
+// destroyed or Close() is called.
+// --------------------------------------------------------
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const wchar_t* file);
+	~MappedFile();
+
+	// Mapped views own OS handles, so no copying allowed
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const wchar_t* file);
+	void Close();
+
+	bool IsOpen() { return data != 0; }
+	const char* GetData() { return data; }
+	size_t GetSize() { return size; }
+
+private:
+#ifdef _WIN32
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mappingHandle = 0;
+#else
+	int fileDescriptor = -1;
+#endif
+	const char* data = 0;
+	size_t size = 0;
+};
+
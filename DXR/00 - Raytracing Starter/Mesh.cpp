@@ -1,281 +1,354 @@
 #include "Mesh.h"
 #include "Graphics.h"
 
+#include "MeshProcessing.h"
+#include "VertexPacking.h"
+#include "Diagnostics.h"
+
 #include <DirectXMath.h>
 #include <vector>
-#include <fstream>
+#include <cstring>
 
 
 using namespace DirectX;
 
-Mesh::Mesh(Vertex* vertArray, int numVerts, unsigned int* indexArray, int numIndices)
+namespace
 {
-	CreateBuffers(vertArray, numVerts, indexArray, numIndices);
+	// --------------------------------------------------------
+	// Splits interleaved vertices (either format, which both
+	// start with a float3 position) into a position array and
+	// an array of everything after the position
+	// --------------------------------------------------------
+	void SplitPositions(const void* interleaved, size_t stride, unsigned int numVerts, XMFLOAT3* positions, void* attributes)
+	{
+		size_t attributeStride = stride - sizeof(XMFLOAT3);
+		const unsigned char* source = (const unsigned char*)interleaved;
+		unsigned char* attributeDest = (unsigned char*)attributes;
+		for (unsigned int i = 0; i < numVerts; i++, source += stride, attributeDest += attributeStride)
+		{
+			memcpy(&positions[i], source, sizeof(XMFLOAT3));
+			memcpy(attributeDest, source + sizeof(XMFLOAT3), attributeStride);
+		}
+	}
+
+	// Meshes with this many vertices or fewer get 16-bit indices
+	const int MaxVertsFor16BitIndices = 65536;
+
+	// --------------------------------------------------------
+	// Creates an index buffer and its view, using 16-bit
+	// indices whenever every vertex can be reached with them
+	// --------------------------------------------------------
+	Microsoft::WRL::ComPtr<ID3D12Resource> CreateIndexBuffer(const unsigned int* indices, int numIndices, int numVerts, D3D12_INDEX_BUFFER_VIEW& view)
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> buffer;
+		if (numVerts <= MaxVertsFor16BitIndices)
+		{
+			// Pad to an even count plus one extra pair, so the buffer is a whole number
+			// of dwords and the shader can always load two dwords around any triangle
+			std::vector<unsigned short> shortIndices(((size_t)numIndices + 2) & ~(size_t)1, 0);
+			for (int i = 0; i < numIndices; i++)
+				shortIndices[i] = (unsigned short)indices[i];
+
+			buffer = Graphics::CreateStaticBuffer(sizeof(unsigned short), shortIndices.size(), shortIndices.data());
+			view.Format = DXGI_FORMAT_R16_UINT;
+			view.SizeInBytes = sizeof(unsigned short) * numIndices;
+		}
+		else
+		{
+			buffer = Graphics::CreateStaticBuffer(sizeof(unsigned int), numIndices, indices);
+			view.Format = DXGI_FORMAT_R32_UINT;
+			view.SizeInBytes = sizeof(unsigned int) * numIndices;
+		}
+		view.BufferLocation = buffer->GetGPUVirtualAddress();
+
+		Diagnostics::Print("Index buffer: %d indices as %s, %zu -> %u bytes\n",
+			numIndices,
+			view.Format == DXGI_FORMAT_R16_UINT ? "R16" : "R32",
+			sizeof(unsigned int) * numIndices,
+			view.SizeInBytes);
+		return buffer;
+	}
+
+	// Compares the memory & bandwidth of interleaved and split vertex layouts
+	void PrintLayoutStats(unsigned int numVerts, unsigned int numIndices, size_t stride, bool split)
+	{
+		size_t attributeStride = stride - sizeof(XMFLOAT3);
+		Diagnostics::Print("Vertex layout (%s): %zu bytes interleaved vs %zu + %zu bytes split; "
+			"BLAS build reads %zu vs %zu bytes of vertex data (%u triangles)\n",
+			split ? "split" : "interleaved",
+			stride * numVerts,
+			sizeof(XMFLOAT3) * numVerts,
+			attributeStride * numVerts,
+			stride * numVerts,
+			sizeof(XMFLOAT3) * numVerts,
+			numIndices / 3);
+	}
 }
 
-Mesh::Mesh(const wchar_t* objFile)
+Mesh::Mesh(Vertex* vertArray, int numVerts, unsigned int* indexArray, int numIndices, MeshOptions options)
+	: Mesh(*ProcessData(vertArray, numVerts, indexArray, numIndices, options))
 {
-	// Initialize in the event the load fails
+}
+
+Mesh::Mesh(const wchar_t* objFile, MeshOptions options)
+	: Mesh(*LoadData(objFile, options))
+{
+}
+
+// --------------------------------------------------------
+// Creates the GPU resources for already loaded & processed
+// mesh data, along with any LODs it has.  Must be called
+// from the thread that owns the graphics command queue.
+// --------------------------------------------------------
+Mesh::Mesh(const MeshData& data)
+	: vertexFormat(data.Options.Format),
+	separatePositions(data.Options.SeparatePositions),
+	deformable(data.Options.Deformable),
+	maxRefitDegradation(data.Options.MaxRefitDegradation)
+{
+	// Initialize in the event the load failed
 	numIndices = 0;
 	numVertices = 0;
+	boundsMin = data.BoundsMin;
+	boundsMax = data.BoundsMax;
+	contentHash = data.ContentHash;
 	ibView = {};
 	vbView = {};
+	attributeView = {};
+	attributeOffset = 0;
 
+	// Nothing to upload?
+	if (data.IndexCount == 0)
+		return;
 
-	// File input object
-	std::ifstream obj(objFile);
-
-	// Check for successful open
-	if (!obj.is_open())	return;
+	CreateBuffers(data.Vertices, data.VertexCount, data.Indices, data.IndexCount);
 
-	// Variables used while reading the file
-	std::vector<XMFLOAT3> positions;     // Positions from the file
-	std::vector<XMFLOAT3> normals;       // Normals from the file
-	std::vector<XMFLOAT2> uvs;           // UVs from the file
-	std::vector<Vertex> verts;           // Verts we're assembling
-	std::vector<UINT> indices;           // Indices of these verts
-	unsigned int vertCounter = 0;        // Count of vertices/indices
-	char chars[100];                     // String for line reading
-
-	// Still have data left?
-	while (obj.good())
+	// Each LOD is just another index buffer into the same vertices
+	for (size_t i = 0; i < data.LODIndices.size(); i++)
 	{
-		// Get the line (100 characters should be more than enough)
-		obj.getline(chars, 100);
+		LOD lod = {};
+		lod.IndexCount = (int)data.LODIndices[i].size();
+		lod.IndexBuffer = CreateIndexBuffer(data.LODIndices[i].data(), lod.IndexCount, data.VertexCount, lod.IBView);
+		lod.Error = data.LODErrors[i];
+		lods.push_back(lod);
+	}
 
-		// Check the type of line
-		if (chars[0] == 'v' && chars[1] == 'n')
-		{
-			// Read the 3 numbers directly into an XMFLOAT3
-			XMFLOAT3 norm{};
-			sscanf_s(
-				chars,
-				"vn %f %f %f",
-				&norm.x, &norm.y, &norm.z);
-
-			// Add to the list of normals
-			normals.push_back(norm);
-		}
-		else if (chars[0] == 'v' && chars[1] == 't')
-		{
-			// Read the 2 numbers directly into an XMFLOAT2
-			XMFLOAT2 uv{};
-			sscanf_s(
-				chars,
-				"vt %f %f",
-				&uv.x, &uv.y);
-
-			// Add to the list of uv's
-			uvs.push_back(uv);
-		}
-		else if (chars[0] == 'v')
-		{
-			// Read the 3 numbers directly into an XMFLOAT3
-			XMFLOAT3 pos{};
-			sscanf_s(
-				chars,
-				"v %f %f %f",
-				&pos.x, &pos.y, &pos.z);
-
-			// Add to the positions
-			positions.push_back(pos);
-		}
-		else if (chars[0] == 'f')
+	// Keep a copy for CPU-side work, round tripping packed vertices
+	// so anything using them sees exactly what the shaders see.
+	// Deformable meshes always keep one, as it's the only way to
+	// know the vertex order UpdateVertices() needs.
+	if (data.Options.KeepCPUData || deformable)
+	{
+		cpuVertices.assign(data.Vertices, data.Vertices + data.VertexCount);
+		cpuIndices.assign(data.Indices, data.Indices + data.IndexCount);
+		if (vertexFormat == VertexFormat::Packed)
 		{
-			// Read the face indices into an array
-			unsigned int i[12]{};
-			int facesRead = sscanf_s(
-				chars,
-				"f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d",
-				&i[0], &i[1], &i[2],
-				&i[3], &i[4], &i[5],
-				&i[6], &i[7], &i[8],
-				&i[9], &i[10], &i[11]);
-			
-			// - Create the verts by looking up
-			//    corresponding data from vectors
-			// - OBJ File indices are 1-based, so
-			//    they need to be adusted
-			Vertex v1{};
-			v1.Position = positions[i[0] - 1];
-			v1.UV = uvs[i[1] - 1];
-			v1.Normal = normals[i[2] - 1];
-
-			Vertex v2{};
-			v2.Position = positions[i[3] - 1];
-			v2.UV = uvs[i[4] - 1];
-			v2.Normal = normals[i[5] - 1];
-
-			Vertex v3{};
-			v3.Position = positions[i[6] - 1];
-			v3.UV = uvs[i[7] - 1];
-			v3.Normal = normals[i[8] - 1];
-
-			// The model is most likely in a right-handed space,
-			// especially if it came from Maya.  We want to convert
-			// to a left-handed space for DirectX.  This means we 
-			// need to:
-			//  - Invert the Z position
-			//  - Invert the normal's Z
-			//  - Flip the winding order
-			// We also need to flip the UV coordinate since DirectX
-			// defines (0,0) as the top left of the texture, and many
-			// 3D modeling packages use the bottom left as (0,0)
-
-			// Flip the UV's since they're probably "upside down"
-			v1.UV.y = 1.0f - v1.UV.y;
-			v2.UV.y = 1.0f - v2.UV.y;
-			v3.UV.y = 1.0f - v3.UV.y;
-
-			// Flip Z (LH vs. RH)
-			v1.Position.z *= -1.0f;
-			v2.Position.z *= -1.0f;
-			v3.Position.z *= -1.0f;
-
-			// Flip normal Z
-			v1.Normal.z *= -1.0f;
-			v2.Normal.z *= -1.0f;
-			v3.Normal.z *= -1.0f;
-
-			// Add the verts to the vector (flipping the winding order)
-			verts.push_back(v1);
-			verts.push_back(v3);
-			verts.push_back(v2);
-
-			// Add three more indices
-			indices.push_back(vertCounter); vertCounter += 1;
-			indices.push_back(vertCounter); vertCounter += 1;
-			indices.push_back(vertCounter); vertCounter += 1;
-
-			// Was there a 4th face?
-			if (facesRead == 12)
-			{
-				// Make the last vertex
-				Vertex v4{};
-				v4.Position = positions[i[9] - 1];
-				v4.UV = uvs[i[10] - 1];
-				v4.Normal = normals[i[11] - 1];
-
-				// Flip the UV, Z pos and normal
-				v4.UV.y = 1.0f - v4.UV.y;
-				v4.Position.z *= -1.0f;
-				v4.Normal.z *= -1.0f;
-
-				// Add a whole triangle (flipping the winding order)
-				verts.push_back(v1);
-				verts.push_back(v4);
-				verts.push_back(v3);
-
-				// Add three more indices
-				indices.push_back(vertCounter); vertCounter += 1;
-				indices.push_back(vertCounter); vertCounter += 1;
-				indices.push_back(vertCounter); vertCounter += 1;
-			}
+			for (Vertex& v : cpuVertices)
+				v = VertexPacking::Unpack(VertexPacking::Pack(v));
 		}
 	}
 
-	// Close the file and create the actual buffers
-	obj.close();
-	CreateBuffers(&verts[0], vertCounter, &indices[0], vertCounter);
+	bvh = data.Accel;
+	wideBVH = data.WideAccel;
+
+	// Deforming changes the BVHs, so this mesh needs its own
+	if (deformable && bvh)
+	{
+		bvh = std::make_shared<BVH>(*data.Accel);
+		if (wideBVH) wideBVH = std::make_shared<WideBVH>(*data.WideAccel);
+	}
 }
 
 
-void Mesh::CreateBuffers(Vertex* vertArray, int numVerts, unsigned int* indexArray, int numIndices)
+// --------------------------------------------------------
+// Points a CPU raytracer geometry at the kept CPU data
+// --------------------------------------------------------
+CPURaytracer::Geometry Mesh::GetCPUGeometry()
 {
-	// Save the counts
-	this->numIndices = numIndices;
-	this->numVertices = numVerts;
-
-	// Calculate the tangents before copying to buffer
-	CalculateTangents(vertArray, numVerts, indexArray, numIndices);
+	CPURaytracer::Geometry geometry = CPURaytracer::MakeGeometry(cpuVertices, cpuIndices, bvh.get(), wideBVH.get());
+	geometry.BoundsMin = boundsMin;
+	geometry.BoundsMax = boundsMax;
+	return geometry;
+}
 
-	// Create the two buffers
-	vertexBuffer = Graphics::CreateStaticBuffer(sizeof(Vertex), numVerts, vertArray);
-	indexBuffer  = Graphics::CreateStaticBuffer(sizeof(unsigned int), numIndices, indexArray);
 
-	// Set up the views
-	vbView.StrideInBytes = sizeof(Vertex);
-	vbView.SizeInBytes = sizeof(Vertex) * numVerts;
-	vbView.BufferLocation = vertexBuffer->GetGPUVirtualAddress();
+// --------------------------------------------------------
+// Replaces every vertex of a deformable mesh, which must
+// have the same count (and triangles) as before, in the
+// order of GetCPUVertices().  The new data is packed &
+// split like the original, and staged in this frame's
+// upload buffer for RecordVertexUpload().
+//
+// vertArray - The new vertices
+// numVerts  - How many vertices are in the array
+// --------------------------------------------------------
+void Mesh::UpdateVertices(const Vertex* vertArray, int numVerts)
+{
+	if (!deformable || numVerts != numVertices || numVerts == 0)
+		return;
+
+	// Same layout as CreateBuffers()
+	const void* vertexData = vertArray;
+	size_t vertexStride = sizeof(Vertex);
+	std::vector<PackedVertex> packedVerts;
+	if (vertexFormat == VertexFormat::Packed)
+	{
+		packedVerts.resize(numVerts);
+		VertexPacking::PackVertices(vertArray, numVerts, packedVerts.data());
+		vertexData = packedVerts.data();
+		vertexStride = sizeof(PackedVertex);
+	}
+	size_t vertexBytes = vertexStride * numVerts;
+
+	// The GPU is done with this frame's upload buffer by now
+	if (uploadBuffers.empty())
+		uploadBuffers.resize(Graphics::NumBackBuffers);
+	Microsoft::WRL::ComPtr<ID3D12Resource>& upload = uploadBuffers[Graphics::SwapChainIndex()];
+	if (!upload)
+		upload = Graphics::CreateBuffer(vertexBytes, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_STATE_GENERIC_READ);
+
+	// Positions first, then any separate attributes
+	unsigned char* mapped = 0;
+	upload->Map(0, 0, (void**)&mapped);
+	if (separatePositions)
+		SplitPositions(vertexData, vertexStride, numVerts, (XMFLOAT3*)mapped, mapped + sizeof(XMFLOAT3) * numVerts);
+	else
+		memcpy(mapped, vertexData, vertexBytes);
+	upload->Unmap(0, 0);
+	pendingUpload = upload;
+
+	// CPU-side copy, round tripped like the original
+	MeshProcessing::CalculateBounds(vertArray, numVerts, boundsMin, boundsMax);
+	cpuVertices.assign(vertArray, vertArray + numVerts);
+	if (vertexFormat == VertexFormat::Packed)
+	{
+		for (Vertex& v : cpuVertices)
+			v = VertexPacking::Unpack(VertexPacking::Pack(v));
+	}
 
-	ibView.Format = DXGI_FORMAT_R32_UINT;
-	ibView.SizeInBytes = sizeof(unsigned int) * numIndices;
-	ibView.BufferLocation = indexBuffer->GetGPUVirtualAddress();
+	// Refit the BVHs, unless that's made them too slow to trace.  The
+	// wide BVH keeps its own structure, so only needs collapsing again
+	// when the binary one is rebuilt.
+	if (bvh)
+	{
+		BVHBuildStats refit = bvh->Refit(vertArray, numVerts, cpuIndices.data(), (unsigned int)cpuIndices.size());
+		float builtCost = bvh->GetBuildStats().SAHCost;
+		refitDegradation = builtCost > 0.0f ? refit.SAHCost / builtCost : 1.0f;
+		bool rebuilt = refitDegradation > maxRefitDegradation;
+		if (rebuilt)
+		{
+			bvh->Build(vertArray, numVerts, cpuIndices.data(), (unsigned int)cpuIndices.size());
+			refitDegradation = 1.0f;
+			rebuildVersion++;
+		}
 
+		if (wideBVH && rebuilt)
+			wideBVH->Build(*bvh);
+		else if (wideBVH)
+			wideBVH->Refit(*bvh);
+	}
 
+	vertexVersion++;
 }
 
 
-// Calculates the tangents of the vertices in a mesh
-// Code adapted from: http://www.terathon.com/code/tangent.html
-void Mesh::CalculateTangents(Vertex* verts, int numVerts, unsigned int* indices, int numIndices)
+// --------------------------------------------------------
+// Records copies of the latest staged vertices into the
+// vertex buffer(s), if there are any that haven't been
+// recorded yet.  Returns whether anything was recorded.
+//
+// commandList - This frame's command list
+// --------------------------------------------------------
+bool Mesh::RecordVertexUpload(ID3D12GraphicsCommandList* commandList)
 {
-	// Reset tangents
-	for (int i = 0; i < numVerts; i++)
+	if (!pendingUpload)
+		return false;
+
+	// Static buffers are kept in generic read, so flip them for the copy
+	ID3D12Resource* buffers[] = { vertexBuffer.Get(), attributeBuffer.Get() };
+	unsigned int bufferCount = separatePositions ? 2 : 1;
+	D3D12_RESOURCE_BARRIER barriers[2] = {};
+	for (unsigned int i = 0; i < bufferCount; i++)
 	{
-		verts[i].Tangent = XMFLOAT3(0, 0, 0);
+		barriers[i].Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+		barriers[i].Transition.pResource = buffers[i];
+		barriers[i].Transition.StateBefore = D3D12_RESOURCE_STATE_GENERIC_READ;
+		barriers[i].Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_DEST;
+		barriers[i].Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
 	}
+	commandList->ResourceBarrier(bufferCount, barriers);
+
+	commandList->CopyBufferRegion(vertexBuffer.Get(), 0, pendingUpload.Get(), 0, vbView.SizeInBytes);
+	if (separatePositions)
+		commandList->CopyBufferRegion(attributeBuffer.Get(), 0, pendingUpload.Get(), vbView.SizeInBytes, attributeView.SizeInBytes);
 
-	// Calculate tangents one whole triangle at a time
-	for (int i = 0; i < numVerts;)
+	for (unsigned int i = 0; i < bufferCount; i++)
 	{
-		// Grab indices and vertices of first triangle
-		unsigned int i1 = indices[i++];
-		unsigned int i2 = indices[i++];
-		unsigned int i3 = indices[i++];
-		Vertex* v1 = &verts[i1];
-		Vertex* v2 = &verts[i2];
-		Vertex* v3 = &verts[i3];
-
-		// Calculate vectors relative to triangle positions
-		float x1 = v2->Position.x - v1->Position.x;
-		float y1 = v2->Position.y - v1->Position.y;
-		float z1 = v2->Position.z - v1->Position.z;
-
-		float x2 = v3->Position.x - v1->Position.x;
-		float y2 = v3->Position.y - v1->Position.y;
-		float z2 = v3->Position.z - v1->Position.z;
-
-		// Do the same for vectors relative to triangle uv's
-		float s1 = v2->UV.x - v1->UV.x;
-		float t1 = v2->UV.y - v1->UV.y;
-
-		float s2 = v3->UV.x - v1->UV.x;
-		float t2 = v3->UV.y - v1->UV.y;
-
-		// Create vectors for tangent calculation
-		float r = 1.0f / (s1 * t2 - s2 * t1);
-
-		float tx = (t2 * x1 - t1 * x2) * r;
-		float ty = (t2 * y1 - t1 * y2) * r;
-		float tz = (t2 * z1 - t1 * z2) * r;
-
-		// Adjust tangents of each vert of the triangle
-		v1->Tangent.x += tx;
-		v1->Tangent.y += ty;
-		v1->Tangent.z += tz;
-
-		v2->Tangent.x += tx;
-		v2->Tangent.y += ty;
-		v2->Tangent.z += tz;
-
-		v3->Tangent.x += tx;
-		v3->Tangent.y += ty;
-		v3->Tangent.z += tz;
+		barriers[i].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
+		barriers[i].Transition.StateAfter = D3D12_RESOURCE_STATE_GENERIC_READ;
 	}
+	commandList->ResourceBarrier(bufferCount, barriers);
 
-	// Ensure all of the tangents are orthogonal to the normals
-	for (int i = 0; i < numVerts; i++)
+	pendingUpload.Reset();
+	return true;
+}
+
+
+void Mesh::CreateBuffers(const Vertex* vertArray, int numVerts, const unsigned int* indexArray, int numIndices)
+{
+	// Save the counts
+	this->numIndices = numIndices;
+	this->numVertices = numVerts;
+
+	// Compress the vertices first if requested
+	const void* vertexData = vertArray;
+	size_t vertexStride = sizeof(Vertex);
+	std::vector<PackedVertex> packedVerts;
+	if (vertexFormat == VertexFormat::Packed)
 	{
-		// Grab the two vectors
-		XMVECTOR normal = XMLoadFloat3(&verts[i].Normal);
-		XMVECTOR tangent = XMLoadFloat3(&verts[i].Tangent);
+		packedVerts.resize(numVerts);
+		VertexPacking::PackVertices(vertArray, numVerts, packedVerts.data());
+		vertexData = packedVerts.data();
+		vertexStride = sizeof(PackedVertex);
+	}
+	PrintLayoutStats(numVerts, numIndices, vertexStride, separatePositions);
+
+	// Create the vertex buffer(s), either as one interleaved buffer or
+	// positions alone (all that acceleration structure builds need)
+	// plus a second buffer for everything else
+	size_t attributeStride = vertexStride - sizeof(XMFLOAT3);
+	if (separatePositions)
+	{
+		std::vector<XMFLOAT3> positions(numVerts);
+		std::vector<unsigned char> attributes(attributeStride * numVerts);
+		SplitPositions(vertexData, vertexStride, numVerts, positions.data(), attributes.data());
+
+		vertexBuffer = Graphics::CreateStaticBuffer(sizeof(XMFLOAT3), numVerts, positions.data());
+		attributeBuffer = Graphics::CreateStaticBuffer(attributeStride, numVerts, attributes.data());
+		attributeOffset = 0;
 
-		// Use Gram-Schmidt orthogonalize
-		tangent = XMVector3Normalize(
-			tangent - normal * XMVector3Dot(normal, tangent));
+		vbView.StrideInBytes = sizeof(XMFLOAT3);
+		vbView.SizeInBytes = (UINT)(sizeof(XMFLOAT3) * numVerts);
+		vbView.BufferLocation = vertexBuffer->GetGPUVirtualAddress();
 
-		// Store the tangent
-		XMStoreFloat3(&verts[i].Tangent, tangent);
+		attributeView.StrideInBytes = (UINT)attributeStride;
+		attributeView.SizeInBytes = (UINT)(attributeStride * numVerts);
+		attributeView.BufferLocation = attributeBuffer->GetGPUVirtualAddress();
 	}
-}
\ No newline at end of file
+	else
+	{
+		vertexBuffer = Graphics::CreateStaticBuffer(vertexStride, numVerts, vertexData);
+		attributeBuffer = vertexBuffer;
+		attributeOffset = sizeof(XMFLOAT3);
+
+		vbView.StrideInBytes = (UINT)vertexStride;
+		vbView.SizeInBytes = (UINT)(vertexStride * numVerts);
+		vbView.BufferLocation = vertexBuffer->GetGPUVirtualAddress();
+		attributeView = vbView;
+	}
+
+	// Create the index buffer
+	indexBuffer = CreateIndexBuffer(indexArray, numIndices, numVerts, ibView);
+	lods.clear();
+	lods.push_back({ indexBuffer, ibView, numIndices, 0.0f });
+}
@@ -2,15 +2,33 @@
 
 #include <d3d12.h>
 #include <wrl/client.h>
+#include <DirectXMath.h>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "Vertex.h"
-
+#include "MeshData.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "CPURaytracer.h"
 
 class Mesh
 {
 public:
-	Mesh(Vertex* vertArray, int numVerts, unsigned int* indexArray, int numIndices);
-	Mesh(const wchar_t* objFile);
+	Mesh(Vertex* vertArray, int numVerts, unsigned int* indexArray, int numIndices, MeshOptions options = MeshOptions());
+	Mesh(const wchar_t* objFile, MeshOptions options = MeshOptions());
+	Mesh(const MeshData& data);
+
+	// CPU-only halves of the constructors above, which can run on any thread
+	static std::shared_ptr<MeshData> ProcessData(const Vertex* vertArray, int numVerts, const unsigned int* indexArray, int numIndices, MeshOptions options = MeshOptions())
+	{
+		return MeshData::Process(vertArray, numVerts, indexArray, numIndices, options);
+	}
+	static std::shared_ptr<MeshData> LoadData(const wchar_t* objFile, MeshOptions options = MeshOptions())
+	{
+		return MeshData::Load(objFile, options);
+	}
 
 	D3D12_VERTEX_BUFFER_VIEW GetVBView() { return vbView; }
 	D3D12_INDEX_BUFFER_VIEW GetIBView() { return ibView; }
@@ -18,18 +36,107 @@ public:
 	Microsoft::WRL::ComPtr<ID3D12Resource> GetIBResource() { return indexBuffer; }
 	int GetIndexCount() { return numIndices; }
 	int GetVertexCount() { return numVertices; }
+	DXGI_FORMAT GetIndexFormat() { return ibView.Format; }
+	DirectX::XMFLOAT3 GetBoundsMin() { return boundsMin; }
+	DirectX::XMFLOAT3 GetBoundsMax() { return boundsMax; }
+	unsigned long long GetContentHash() { return contentHash; }
+	VertexFormat GetVertexFormat() { return vertexFormat; }
+
+	// Non-position attributes, which are either in their own buffer or
+	// interleaved with the positions in the vertex buffer (in which case
+	// these refer to the vertex buffer and the offset skips the position)
+	D3D12_VERTEX_BUFFER_VIEW GetAttributeView() { return attributeView; }
+	Microsoft::WRL::ComPtr<ID3D12Resource> GetAttributeResource() { return attributeBuffer; }
+	unsigned int GetAttributeOffset() { return attributeOffset; }
+	bool HasSeparatePositions() { return separatePositions; }
+
+	// Levels of detail, each with its own index buffer into the shared vertex
+	// buffer(s).  LOD 0 is the full mesh (the same as GetIBView(), etc.)
+	int GetLODCount() { return (int)lods.size(); }
+	D3D12_INDEX_BUFFER_VIEW GetLODIBView(int lod) { return lods[lod].IBView; }
+	Microsoft::WRL::ComPtr<ID3D12Resource> GetLODIBResource(int lod) { return lods[lod].IndexBuffer; }
+	int GetLODIndexCount(int lod) { return lods[lod].IndexCount; }
+	float GetLODError(int lod) { return lods[lod].Error; }
+
+	// Final vertices & indices (full LOD), if the mesh was created with
+	// KeepCPUData or is deformable.  Packed vertices are decoded, so they
+	// match what the GPU sees.  This is the order after welding and any
+	// OptimizeVertexOrder, not the order the vertices were given in.
+	const std::vector<Vertex>& GetCPUVertices() { return cpuVertices; }
+	const std::vector<unsigned int>& GetCPUIndices() { return cpuIndices; }
+
+	// CPU-side BVHs over the full LOD, if the mesh was created with BuildBVH
+	std::shared_ptr<BVH> GetBVH() { return bvh; }
+	std::shared_ptr<WideBVH> GetWideBVH() { return wideBVH; }
+
+	// The CPU data & BVHs above for the CPU raytracer, valid while the mesh
+	// is alive and until its next UpdateVertices()
+	CPURaytracer::Geometry GetCPUGeometry();
+
+	// --------------------------------------------------------
+	// Deformable meshes (see MeshOptions::Deformable) can have
+	// every vertex replaced, keeping the same triangles.  New
+	// vertices must be in the order of GetCPUVertices(), which
+	// processing may have welded & reordered, so deformations
+	// are best worked out from a copy of it taken up front.  CPU
+	// data & BVHs are updated right away, with the BVH refit
+	// until that degrades it too far, and then rebuilt.  The
+	// GPU copy is staged and only recorded by
+	// RecordVertexUpload(), which RayTracing::UpdateTLAS()
+	// calls before refitting (or rebuilding) the mesh's BLAS.
+	// --------------------------------------------------------
+	void UpdateVertices(const Vertex* vertArray, int numVerts);
+	bool RecordVertexUpload(ID3D12GraphicsCommandList* commandList);
+	bool IsDeformable() { return deformable; }
+	unsigned int GetVertexVersion() { return vertexVersion; }		// Bumped by every update
+	unsigned int GetRebuildVersion() { return rebuildVersion; }		// Bumped when the BVH has to be rebuilt
+	float GetRefitDegradation() { return refitDegradation; }		// BVH SAH cost relative to its last build
 
 private:
 	int numIndices;
 	int numVertices;
+	VertexFormat vertexFormat;
+	bool separatePositions;
+
+	// Local space bounds and a hash identifying the final vertex & index data
+	DirectX::XMFLOAT3 boundsMin;
+	DirectX::XMFLOAT3 boundsMax;
+	unsigned long long contentHash;
 	
 	D3D12_VERTEX_BUFFER_VIEW vbView;
 	Microsoft::WRL::ComPtr<ID3D12Resource> vertexBuffer;
 
+	D3D12_VERTEX_BUFFER_VIEW attributeView;
+	Microsoft::WRL::ComPtr<ID3D12Resource> attributeBuffer;
+	unsigned int attributeOffset;
+
 	D3D12_INDEX_BUFFER_VIEW ibView;
 	Microsoft::WRL::ComPtr<ID3D12Resource> indexBuffer;
 
-	void CalculateTangents(Vertex* verts, int numVerts, unsigned int* indices, int numIndices);
-	void CreateBuffers(Vertex* vertArray, int numVerts, unsigned int* indexArray, int numIndices);
+	// Error is the simplification error relative to the mesh's size
+	struct LOD
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> IndexBuffer;
+		D3D12_INDEX_BUFFER_VIEW IBView;
+		int IndexCount;
+		float Error;
+	};
+	std::vector<LOD> lods;
+
+	std::vector<Vertex> cpuVertices;
+	std::vector<unsigned int> cpuIndices;
+	std::shared_ptr<BVH> bvh;
+	std::shared_ptr<WideBVH> wideBVH;
+
+	// Deformation state, and an upload buffer per frame in flight
+	bool deformable = false;
+	float maxRefitDegradation = 1.5f;
+	float refitDegradation = 1.0f;
+	unsigned int vertexVersion = 0;
+	unsigned int rebuildVersion = 0;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> uploadBuffers;
+	Microsoft::WRL::ComPtr<ID3D12Resource> pendingUpload;
+
+	void CreateBuffers(const Vertex* vertArray, int numVerts, const unsigned int* indexArray, int numIndices);
 };
 
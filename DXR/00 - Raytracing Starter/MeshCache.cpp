@@ -0,0 +1,238 @@
+#include "MeshCache.h"
+#include "MeshProcessing.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace MeshCache
+{
+	// Annonymous namespace to hold helpers
+	// only accessible in this file
+	namespace
+	{
+		const char Magic[4] = { 'M', 'E', 'S', 'H' };
+
+		// Cache files live right next to their OBJ
+		std::wstring GetCachePath(const wchar_t* objFile)
+		{
+			return std::wstring(objFile) + L".meshcache";
+		}
+
+		// Caches are written here first, so a crash (or another thread
+		// loading the same OBJ) never leaves a half-written cache behind
+		std::wstring GetTempPath(const wchar_t* objFile)
+		{
+			return GetCachePath(objFile) + L"." + std::to_wstring(std::hash<std::thread::id>()(std::this_thread::get_id())) + L".tmp";
+		}
+
+		// Grabs the size and last write time of the source OBJ so
+		// we can tell if a cache was made from an older version.
+		// On Windows the time is in the same units as a FILETIME.
+		bool GetSourceInfo(const wchar_t* objFile, unsigned long long& size, unsigned long long& writeTime)
+		{
+			std::error_code error;
+			std::filesystem::path path(objFile);
+			size = (unsigned long long)std::filesystem::file_size(path, error);
+			if (error)
+				return false;
+
+			writeTime = (unsigned long long)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+			return !error;
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Memory maps the cache file for the given OBJ and verifies
+// that it matches both this version of the code and the
+// current contents of the OBJ, and that its data hasn't
+// been corrupted (by re-hashing it and comparing with the
+// header's ContentHash & LODHash).  Returns a pointer to the header
+// (inside the mapped file) or null if there is no usable
+// cache.
+//
+// objFile         - The OBJ file the cache was made from
+// processingFlags - The optional processing the data must have had
+// file            - Mapped file object which keeps the data alive
+// --------------------------------------------------------
+const MeshCacheHeader* MeshCache::Open(const wchar_t* objFile, unsigned int processingFlags, MappedFile& file)
+{
+	// The OBJ is still the source of truth
+	unsigned long long sourceSize = 0;
+	unsigned long long sourceWriteTime = 0;
+	if (!GetSourceInfo(objFile, sourceSize, sourceWriteTime))
+		return 0;
+
+	if (!file.Open(GetCachePath(objFile).c_str()) || file.GetSize() < sizeof(MeshCacheHeader))
+		return 0;
+
+	// Validate everything about the header before trusting it
+	const MeshCacheHeader* header = (const MeshCacheHeader*)file.GetData();
+	unsigned long long lodTableSize = (unsigned long long)header->LODCount * sizeof(MeshCacheLOD);
+	unsigned long long expectedSize =
+		sizeof(MeshCacheHeader) +
+		(unsigned long long)header->VertexCount * header->VertexStride +
+		(unsigned long long)header->IndexCount * header->IndexStride +
+		lodTableSize;
+
+	if (memcmp(header->Magic, Magic, sizeof(Magic)) != 0 ||
+		header->Version != Version ||
+		header->VertexStride != sizeof(Vertex) ||
+		header->IndexStride != sizeof(unsigned int) ||
+		header->ProcessingFlags != processingFlags ||
+		header->SourceSize != sourceSize ||
+		header->SourceWriteTime != sourceWriteTime ||
+		file.GetSize() < expectedSize)
+	{
+		file.Close();
+		return 0;
+	}
+
+	// The LOD table is in the file, so the size of their indices can be checked too
+	const MeshCacheLOD* lods = GetLODs(header);
+	unsigned long long lodIndexCount = 0;
+	for (unsigned int lod = 0; lod < header->LODCount; lod++)
+		lodIndexCount += lods[lod].IndexCount;
+	if (file.GetSize() != expectedSize + lodIndexCount * sizeof(unsigned int))
+	{
+		file.Close();
+		return 0;
+	}
+
+	// Hashed exactly like MeshData, which is where the header's hash came from
+	unsigned long long hash = MeshProcessing::HashData(GetVertices(header), (size_t)header->VertexCount * header->VertexStride);
+	hash = MeshProcessing::HashData(GetIndices(header), (size_t)header->IndexCount * header->IndexStride, hash);
+
+	// The LODs are hashed like Write() does: the table, then each index list
+	unsigned long long lodHash = MeshProcessing::HashData(lods, (size_t)lodTableSize);
+	const unsigned int* lodIndices = GetLODIndices(header);
+	for (unsigned int lod = 0; lod < header->LODCount; lod++)
+	{
+		lodHash = MeshProcessing::HashData(lodIndices, (size_t)lods[lod].IndexCount * sizeof(unsigned int), lodHash);
+		lodIndices += lods[lod].IndexCount;
+	}
+	if (hash != header->ContentHash || lodHash != header->LODHash)
+	{
+		file.Close();
+		return 0;
+	}
+
+	return header;
+}
+
+
+// --------------------------------------------------------
+// Gets the vertex data within a mapped cache file
+// --------------------------------------------------------
+const Vertex* MeshCache::GetVertices(const MeshCacheHeader* header)
+{
+	return (const Vertex*)(header + 1);
+}
+
+
+// --------------------------------------------------------
+// Gets the index data within a mapped cache file
+// --------------------------------------------------------
+const void* MeshCache::GetIndices(const MeshCacheHeader* header)
+{
+	return GetVertices(header) + header->VertexCount;
+}
+
+
+// --------------------------------------------------------
+// Gets the LOD table within a mapped cache file
+// --------------------------------------------------------
+const MeshCacheLOD* MeshCache::GetLODs(const MeshCacheHeader* header)
+{
+	return (const MeshCacheLOD*)((const char*)GetIndices(header) + (size_t)header->IndexCount * header->IndexStride);
+}
+
+
+// --------------------------------------------------------
+// Gets the indices of every LOD, one after another, within
+// a mapped cache file
+// --------------------------------------------------------
+const unsigned int* MeshCache::GetLODIndices(const MeshCacheHeader* header)
+{
+	return (const unsigned int*)(GetLODs(header) + header->LODCount);
+}
+
+
+// --------------------------------------------------------
+// Writes the final mesh data to a cache file next to the
+// OBJ it came from.  The data goes to a temporary file that
+// then replaces the cache in one step, so readers only ever
+// see the old cache or the whole new one.  Returns false if
+// the file could not be written, which simply means the OBJ
+// will be parsed again next time.
+//
+// objFile    - The OBJ file the data came from
+// details    - Counts, index stride, flags, bounds, hash of the data
+//              and the LOD options used (identifying fields and the
+//              LOD count & hash are filled in automatically)
+// verts      - The final vertex data
+// indices    - The final index data
+// lodIndices - Index lists of LODs 1+ (optional)
+// lodErrors  - Accumulated error of each LOD
+// --------------------------------------------------------
+bool MeshCache::Write(
+	const wchar_t* objFile,
+	const MeshCacheHeader& details,
+	const Vertex* verts,
+	const void* indices,
+	const std::vector<std::vector<unsigned int>>& lodIndices,
+	const std::vector<float>& lodErrors)
+{
+	MeshCacheHeader header = details;
+	memcpy(header.Magic, Magic, sizeof(Magic));
+	header.Version = Version;
+	header.VertexStride = sizeof(Vertex);
+	if (!GetSourceInfo(objFile, header.SourceSize, header.SourceWriteTime))
+		return false;
+
+	// The LOD table and indices are hashed as they'll sit in the file
+	std::vector<MeshCacheLOD> lods(lodIndices.size());
+	for (size_t lod = 0; lod < lods.size(); lod++)
+		lods[lod] = { (unsigned int)lodIndices[lod].size(), lod < lodErrors.size() ? lodErrors[lod] : 0.0f };
+	header.LODCount = (unsigned int)lods.size();
+	header.LODHash = MeshProcessing::HashData(lods.data(), lods.size() * sizeof(MeshCacheLOD));
+	for (const std::vector<unsigned int>& lod : lodIndices)
+		header.LODHash = MeshProcessing::HashData(lod.data(), lod.size() * sizeof(unsigned int), header.LODHash);
+
+	std::filesystem::path tempPath(GetTempPath(objFile));
+	{
+		std::ofstream cache(tempPath, std::ios::binary | std::ios::trunc);
+		if (!cache.is_open())
+			return false;
+
+		cache.write((const char*)&header, sizeof(MeshCacheHeader));
+		cache.write((const char*)verts, (std::streamsize)header.VertexCount * header.VertexStride);
+		cache.write((const char*)indices, (std::streamsize)header.IndexCount * header.IndexStride);
+		cache.write((const char*)lods.data(), (std::streamsize)(lods.size() * sizeof(MeshCacheLOD)));
+		for (const std::vector<unsigned int>& lod : lodIndices)
+			cache.write((const char*)lod.data(), (std::streamsize)(lod.size() * sizeof(unsigned int)));
+		cache.close();
+		if (!cache.good())
+		{
+			std::error_code error;
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+	}
+
+	// Fails if the old cache can't be replaced (say, it's mapped
+	// by another load on Windows), which leaves it as it was
+	std::error_code error;
+	std::filesystem::rename(tempPath, std::filesystem::path(GetCachePath(objFile)), error);
+	if (error)
+	{
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
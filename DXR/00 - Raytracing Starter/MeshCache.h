@@ -0,0 +1,77 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+#include "Vertex.h"
+#include "MappedFile.h"
+
+// --------------------------------------------------------
+// Header at the start of a binary mesh cache file.  The
+// final vertex data immediately follows the header, and
+// the index data immediately follows the vertices, so the
+// file can be memory mapped and uploaded as-is.  Any LODs
+// come last: a MeshCacheLOD for each, then their indices
+// one after another.
+// --------------------------------------------------------
+struct MeshCacheHeader
+{
+	char Magic[4];							// Always "MESH"
+	unsigned int Version;					// Must match MeshCache::Version
+	unsigned int VertexStride;				// Must match sizeof(Vertex)
+	unsigned int IndexStride;				// Bytes per index
+
+	unsigned int VertexCount;
+	unsigned int IndexCount;
+	unsigned int ProcessingFlags;			// Optional processing applied (MeshCache::Flag*)
+	unsigned int Padding;
+	unsigned long long ContentHash;			// Hash of the vertex & index data
+
+	DirectX::XMFLOAT3 BoundsMin;
+	DirectX::XMFLOAT3 BoundsMax;
+
+	unsigned long long SourceSize;			// Size of the OBJ this came from
+	unsigned long long SourceWriteTime;		// Last write time of the OBJ this came from
+
+	unsigned int LODCount;					// LODs stored, which can be fewer than were asked for
+	unsigned int LODsRequested;				// MeshOptions::LODCount they were generated with
+	float LODReduction;						// MeshOptions::LODReduction they were generated with
+	unsigned int LODPadding;
+	unsigned long long LODHash;				// Hash of the LOD table & indices
+};
+
+// One simplified LOD in a mesh cache file
+struct MeshCacheLOD
+{
+	unsigned int IndexCount;
+	float Error;							// Accumulated simplification error
+};
+
+namespace MeshCache
+{
+	// Bump this whenever the layout of the cache (or the
+	// processing that produces its data) changes
+	const unsigned int Version = 4;
+
+	// Optional processing baked into a cache's data, which
+	// must match the processing requested by the loader
+	const unsigned int FlagOptimizedVertexOrder = 1 << 0;
+
+	// Maps an up-to-date, intact cache for the given OBJ, if one exists
+	const MeshCacheHeader* Open(const wchar_t* objFile, unsigned int processingFlags, MappedFile& file);
+
+	// Pointers into a mapped cache file
+	const Vertex* GetVertices(const MeshCacheHeader* header);
+	const void* GetIndices(const MeshCacheHeader* header);
+	const MeshCacheLOD* GetLODs(const MeshCacheHeader* header);
+	const unsigned int* GetLODIndices(const MeshCacheHeader* header);
+
+	// Writes a cache file next to the given OBJ, replacing any old one in a single step
+	bool Write(
+		const wchar_t* objFile,
+		const MeshCacheHeader& details,
+		const Vertex* verts,
+		const void* indices,
+		const std::vector<std::vector<unsigned int>>& lodIndices = std::vector<std::vector<unsigned int>>(),
+		const std::vector<float>& lodErrors = std::vector<float>());
+}
@@ -0,0 +1,442 @@
+#include "MeshData.h"
+
+#include "ObjLoader.h"
+#include "MeshProcessing.h"
+#include "MeshCache.h"
+#include "Diagnostics.h"
+
+#include <chrono>
+#include <cstdio>
+#include <unordered_map>
+
+using namespace DirectX;
+
+namespace
+{
+	// --------------------------------------------------------
+	// Builds a vertex from one corner of an OBJ triangle
+	//
+	// The model is most likely in a right-handed space,
+	// especially if it came from Maya.  We want to convert
+	// to a left-handed space for DirectX.  This means we 
+	// need to:
+	//  - Invert the Z position
+	//  - Invert the normal's Z
+	//  - Flip the winding order (handled by the caller)
+	// We also need to flip the UV coordinate since DirectX
+	// defines (0,0) as the top left of the texture, and many
+	// 3D modeling packages use the bottom left as (0,0)
+	// --------------------------------------------------------
+	Vertex ConvertObjCorner(const ObjData& obj, const ObjCorner& corner)
+	{
+		Vertex v{};
+		v.Position = obj.Positions[corner.Position];
+		if (corner.UV != -1) v.UV = obj.UVs[corner.UV];
+		if (corner.Normal != -1) v.Normal = obj.Normals[corner.Normal];
+
+		// Flip the UV's since they're probably "upside down"
+		v.UV.y = 1.0f - v.UV.y;
+
+		// Flip Z (LH vs. RH)
+		v.Position.z *= -1.0f;
+		v.Normal.z *= -1.0f;
+		return v;
+	}
+
+	// Hashes an OBJ corner's (position, uv, normal) index triple for welding
+	struct ObjCornerHash
+	{
+		size_t operator()(const ObjCorner& c) const
+		{
+			unsigned long long hash = (unsigned int)c.Position;
+			hash = hash * 0x9E3779B97F4A7C15ull + (unsigned int)c.UV;
+			hash = hash * 0x9E3779B97F4A7C15ull + (unsigned int)c.Normal;
+			return (size_t)(hash ^ (hash >> 32));
+		}
+	};
+
+	struct ObjCornerEqual
+	{
+		bool operator()(const ObjCorner& a, const ObjCorner& b) const
+		{
+			return a.Position == b.Position && a.UV == b.UV && a.Normal == b.Normal;
+		}
+	};
+
+	// Reports how much welding shrunk a mesh's buffers
+	void PrintWeldStats(const wchar_t* name, unsigned int vertsBefore, unsigned int vertsAfter, unsigned int numIndices)
+	{
+		size_t bytesBefore = sizeof(Vertex) * vertsBefore + sizeof(unsigned int) * numIndices;
+		size_t bytesAfter = sizeof(Vertex) * vertsAfter + sizeof(unsigned int) * numIndices;
+		Diagnostics::Print("Welded %ls: %u -> %u vertices, %zu -> %zu bytes\n",
+			name,
+			vertsBefore,
+			vertsAfter,
+			bytesBefore,
+			bytesAfter);
+	}
+
+	// --------------------------------------------------------
+	// The stride of each vertex stream Mesh::CreateBuffers
+	// will upload for these options: one interleaved stream,
+	// or positions followed by everything else
+	// --------------------------------------------------------
+	void GetUploadStrides(const MeshOptions& options, size_t& firstStride, size_t& secondStride)
+	{
+		size_t vertexStride = options.Format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+		firstStride = options.SeparatePositions ? sizeof(XMFLOAT3) : vertexStride;
+		secondStride = options.SeparatePositions ? vertexStride - sizeof(XMFLOAT3) : 0;
+	}
+
+	// --------------------------------------------------------
+	// Reorders triangles for post-transform cache reuse and
+	// then vertices for fetch locality, reporting the
+	// simulated cache behaviour before and after.  Overfetch
+	// is measured with the layout the vertices will actually
+	// be uploaded in, per stream when positions are split.
+	// Returns the number of vertices remaining.
+	// --------------------------------------------------------
+	unsigned int OptimizeVertexOrder(const wchar_t* name, const MeshOptions& options, Vertex* verts, unsigned int numVerts, unsigned int* indices, unsigned int numIndices)
+	{
+		size_t firstStride, secondStride;
+		GetUploadStrides(options, firstStride, secondStride);
+
+		// Simulating the caches is only needed for the stats, so
+		// it's skipped (rather than just not printed) when they're off
+		bool verbose = Diagnostics::IsVerbose();
+		auto Analyze = [&](size_t stride)
+			{
+				return verbose && stride ? MeshProcessing::AnalyzeVertexCache(indices, numIndices, numVerts, stride) : VertexCacheStats{};
+			};
+
+		VertexCacheStats before = Analyze(firstStride);
+		VertexCacheStats secondBefore = Analyze(secondStride);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		MeshProcessing::OptimizeVertexCache(indices, numIndices, numVerts);
+		numVerts = MeshProcessing::OptimizeVertexFetch(verts, numVerts, indices, numIndices);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		VertexCacheStats after = Analyze(firstStride);
+		VertexCacheStats secondAfter = Analyze(secondStride);
+
+		// One print per mesh, as meshes can be processed on several threads at once
+		char secondStats[96] = "";
+		if (secondStride)
+			snprintf(secondStats, sizeof(secondStats), ", attribute overfetch %.3f -> %.3f (%zu byte stride)", secondBefore.Overfetch, secondAfter.Overfetch, secondStride);
+
+		Diagnostics::Print("Optimized %ls in %.2fms: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overfetch %.3f -> %.3f (%zu byte stride)%s\n",
+			name,
+			std::chrono::duration<double, std::milli>(end - start).count(),
+			before.ACMR, after.ACMR,
+			before.ATVR, after.ATVR,
+			before.Overfetch, after.Overfetch,
+			firstStride,
+			secondStats);
+		return numVerts;
+	}
+
+	// --------------------------------------------------------
+	// Calculates the tangents (and their handedness) of the
+	// vertices in a mesh.  The heavy lifting is vectorized and
+	// spread across threads by MeshProcessing.
+	// --------------------------------------------------------
+	void CalculateTangents(Vertex* verts, unsigned int numVerts, const unsigned int* indices, unsigned int numIndices)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		unsigned int threads = MeshProcessing::CalculateTangents(verts, numVerts, indices, numIndices);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		Diagnostics::Print("Tangents: %u vertices, %u triangles in %.2fms on %u thread(s)\n",
+			numVerts,
+			numIndices / 3,
+			std::chrono::duration<double, std::milli>(end - start).count(),
+			threads);
+	}
+
+	// --------------------------------------------------------
+	// Generates the requested chain of simplified index lists,
+	// each built from the previous LOD and sharing the mesh's
+	// vertices.  Stops early if a mesh can't be reduced any
+	// further (for instance, if it's all seams & borders).
+	// --------------------------------------------------------
+	void GenerateLODs(MeshData& data)
+	{
+		if (data.Options.LODCount == 0 || data.IndexCount == 0)
+			return;
+
+		auto chainStart = std::chrono::high_resolution_clock::now();
+		std::vector<unsigned int> previous(data.Indices, data.Indices + data.IndexCount);
+		std::vector<unsigned int> simplified(data.IndexCount);
+		float target = (float)data.IndexCount;
+		float error = 0.0f;
+
+		for (unsigned int lod = 1; lod <= data.Options.LODCount; lod++)
+		{
+			target *= data.Options.LODReduction;
+			unsigned int targetCount = (unsigned int)target / 3 * 3;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			float lodError = 0.0f;
+			unsigned int count = MeshProcessing::Simplify(
+				simplified.data(),
+				data.Vertices,
+				data.VertexCount,
+				previous.data(),
+				(unsigned int)previous.size(),
+				targetCount,
+				&lodError);
+			if (count == 0 || count >= previous.size())
+				break;
+
+			if (data.Options.OptimizeVertexOrder)
+				MeshProcessing::OptimizeVertexCache(simplified.data(), count, data.VertexCount);
+			auto end = std::chrono::high_resolution_clock::now();
+
+			// Each LOD is simplified from the last, so their errors add up
+			error += lodError;
+			data.LODIndices.emplace_back(simplified.begin(), simplified.begin() + count);
+			data.LODErrors.push_back(error);
+
+			Diagnostics::Print("LOD %u of %ls: %u -> %u triangles (%.1f%% of full, target %u), error %.5f, %.2fms\n",
+				lod,
+				data.Name.c_str(),
+				(unsigned int)previous.size() / 3,
+				count / 3,
+				100.0f * count / data.IndexCount,
+				targetCount / 3,
+				error,
+				std::chrono::duration<double, std::milli>(end - start).count());
+
+			previous.assign(simplified.begin(), simplified.begin() + count);
+		}
+
+		auto chainEnd = std::chrono::high_resolution_clock::now();
+		Diagnostics::Print("Generated %zu LOD(s) of %ls in %.2fms\n",
+			data.LODIndices.size(),
+			data.Name.c_str(),
+			std::chrono::duration<double, std::milli>(chainEnd - chainStart).count());
+	}
+
+	// --------------------------------------------------------
+	// Builds the CPU-side BVHs over the final (full LOD)
+	// triangles, if the options ask for them.  The 4-wide one
+	// is collapsed from the binary one.
+	// --------------------------------------------------------
+	void BuildAccelerationStructure(MeshData& data)
+	{
+		if (!data.Options.BuildBVH || data.IndexCount == 0)
+			return;
+
+		data.Accel = std::make_shared<BVH>();
+		BVHBuildStats stats = data.Accel->Build(data.Vertices, data.VertexCount, data.Indices, data.IndexCount);
+		Diagnostics::Print("BVH for %ls: %u triangles, %u nodes (%u leaves, depth %u), SAH cost %.2f, %.2fms (%.1fms per million triangles) on %u thread(s)\n",
+			data.Name.c_str(),
+			stats.Triangles,
+			stats.Nodes,
+			stats.Leaves,
+			stats.MaxDepth,
+			stats.SAHCost,
+			stats.Milliseconds,
+			stats.Milliseconds * 1000000.0 / stats.Triangles,
+			stats.Threads);
+
+		data.WideAccel = std::make_shared<WideBVH>();
+		WideBVHBuildStats wideStats = data.WideAccel->Build(*data.Accel);
+		Diagnostics::Print("4-wide BVH for %ls: %u nodes (%.2f children each), %u triangle blocks (%.2f triangles each), %.2fms\n",
+			data.Name.c_str(),
+			wideStats.Nodes,
+			wideStats.ChildFill,
+			wideStats.TriangleBlocks,
+			wideStats.TriangleFill,
+			wideStats.Milliseconds);
+	}
+
+	// --------------------------------------------------------
+	// Runs every processing step that follows welding on the
+	// data's own vertex & index storage, and points the final
+	// data at that storage
+	// --------------------------------------------------------
+	void FinalizeData(MeshData& data)
+	{
+		unsigned int vertCount = (unsigned int)data.VertexStorage.size();
+		unsigned int indexCount = (unsigned int)data.IndexStorage.size();
+
+		if (data.Options.OptimizeVertexOrder)
+		{
+			vertCount = OptimizeVertexOrder(data.Name.c_str(), data.Options, data.VertexStorage.data(), vertCount, data.IndexStorage.data(), indexCount);
+			data.VertexStorage.resize(vertCount);
+		}
+
+		CalculateTangents(data.VertexStorage.data(), vertCount, data.IndexStorage.data(), indexCount);
+
+		data.Vertices = data.VertexStorage.data();
+		data.VertexCount = vertCount;
+		data.Indices = data.IndexStorage.data();
+		data.IndexCount = indexCount;
+
+		// Bounds and a hash of the vertex and index data together, which
+		// can be used to identify meshes with identical contents
+		MeshProcessing::CalculateBounds(data.Vertices, vertCount, data.BoundsMin, data.BoundsMax);
+		data.ContentHash = MeshProcessing::HashData(data.Vertices, sizeof(Vertex) * vertCount);
+		data.ContentHash = MeshProcessing::HashData(data.Indices, sizeof(unsigned int) * indexCount, data.ContentHash);
+
+		GenerateLODs(data);
+		BuildAccelerationStructure(data);
+	}
+}
+
+
+// --------------------------------------------------------
+// Welds and processes an array of vertices & indices.  The
+// caller's arrays are copied, so they're left alone.  Safe
+// to call from any thread, as nothing touches the GPU.
+// --------------------------------------------------------
+std::shared_ptr<MeshData> MeshData::Process(const Vertex* vertArray, int numVerts, const unsigned int* indexArray, int numIndices, MeshOptions options)
+{
+	std::shared_ptr<MeshData> data = std::make_shared<MeshData>();
+	data->Name = L"vertex array";
+	data->Options = options;
+	data->VertexStorage.assign(vertArray, vertArray + numVerts);
+	data->IndexStorage.assign(indexArray, indexArray + numIndices);
+
+	unsigned int uniqueVerts = MeshProcessing::WeldVertices(data->VertexStorage.data(), numVerts, data->IndexStorage.data(), numIndices);
+	PrintWeldStats(data->Name.c_str(), numVerts, uniqueVerts, numIndices);
+	data->VertexStorage.resize(uniqueVerts);
+
+	FinalizeData(*data);
+	return data;
+}
+
+
+// --------------------------------------------------------
+// Loads and processes an OBJ file (or its up-to-date cache).
+// Safe to call from any thread, as nothing touches the GPU.
+// The result has no triangles if the load failed.
+// --------------------------------------------------------
+std::shared_ptr<MeshData> MeshData::Load(const wchar_t* objFile, MeshOptions options)
+{
+	std::shared_ptr<MeshData> data = std::make_shared<MeshData>();
+	data->Name = objFile;
+	data->Options = options;
+
+	// Is there an up-to-date binary cache of this OBJ?  If so, the
+	// mapped file's bytes are used directly with no parsing,
+	// processing or intermediate copies
+	auto loadStart = std::chrono::high_resolution_clock::now();
+	unsigned int cacheFlags = options.OptimizeVertexOrder ? MeshCache::FlagOptimizedVertexOrder : 0;
+	{
+		data->CacheFile = std::make_shared<MappedFile>();
+		const MeshCacheHeader* cache = MeshCache::Open(objFile, cacheFlags, *data->CacheFile);
+		if (cache)
+		{
+			data->Vertices = MeshCache::GetVertices(cache);
+			data->VertexCount = cache->VertexCount;
+			data->Indices = (const unsigned int*)MeshCache::GetIndices(cache);
+			data->IndexCount = cache->IndexCount;
+			data->BoundsMin = cache->BoundsMin;
+			data->BoundsMax = cache->BoundsMax;
+			data->ContentHash = cache->ContentHash;
+
+			// The cached LODs are only used if they were made the same way
+			if (cache->LODsRequested == options.LODCount && cache->LODReduction == options.LODReduction)
+			{
+				const MeshCacheLOD* lods = MeshCache::GetLODs(cache);
+				const unsigned int* lodIndices = MeshCache::GetLODIndices(cache);
+				for (unsigned int lod = 0; lod < cache->LODCount; lod++)
+				{
+					data->LODIndices.emplace_back(lodIndices, lodIndices + lods[lod].IndexCount);
+					data->LODErrors.push_back(lods[lod].Error);
+					lodIndices += lods[lod].IndexCount;
+				}
+			}
+			else
+				GenerateLODs(*data);
+			BuildAccelerationStructure(*data);
+
+			auto loadEnd = std::chrono::high_resolution_clock::now();
+			Diagnostics::Print("Loaded %ls: %u triangles from cache (warm) in %.2fms\n",
+				objFile,
+				cache->IndexCount / 3,
+				std::chrono::duration<double, std::milli>(loadEnd - loadStart).count());
+			return data;
+		}
+		data->CacheFile.reset();
+	}
+
+	// Memory map and parse the whole file (in parallel)
+	auto parseStart = std::chrono::high_resolution_clock::now();
+	ObjData obj;
+	if (!ObjLoader::Load(objFile, obj))
+		return data;
+	auto parseEnd = std::chrono::high_resolution_clock::now();
+
+	// Variables used while assembling the mesh
+	std::vector<Vertex>& verts = data->VertexStorage;            // Unique verts we're assembling
+	std::vector<unsigned int>& indices = data->IndexStorage;     // Indices of these verts
+	verts.reserve(obj.Corners.size() / 2);
+	indices.reserve(obj.Corners.size());
+
+	// Each unique (position, uv, normal) triple becomes exactly one vertex
+	std::unordered_map<ObjCorner, unsigned int, ObjCornerHash, ObjCornerEqual> cornerToIndex(obj.Corners.size() / 2);
+	auto WeldCorner = [&](const ObjCorner& corner)
+		{
+			auto result = cornerToIndex.try_emplace(corner, (unsigned int)verts.size());
+			if (result.second)
+				verts.push_back(ConvertObjCorner(obj, corner));
+			return result.first->second;
+		};
+
+	// Every 3 corners make up a triangle
+	for (size_t c = 0; c + 2 < obj.Corners.size(); c += 3)
+	{
+		const ObjCorner* tri = &obj.Corners[c];
+
+		// Skip triangles that reference positions that don't exist
+		if (tri[0].Position == -1 || tri[1].Position == -1 || tri[2].Position == -1)
+			continue;
+
+		// Add the indices of this triangle (flipping the winding order)
+		indices.push_back(WeldCorner(tri[0]));
+		indices.push_back(WeldCorner(tri[2]));
+		indices.push_back(WeldCorner(tri[1]));
+	}
+
+	unsigned int vertCount = (unsigned int)verts.size();
+	unsigned int indexCount = (unsigned int)indices.size();
+	Diagnostics::Print("Parsed %ls: %u triangles in %.2fms on %u thread(s)\n",
+		objFile,
+		indexCount / 3,
+		std::chrono::duration<double, std::milli>(parseEnd - parseStart).count(),
+		obj.ThreadCount);
+
+	// Nothing usable in the file?
+	if (indexCount == 0)
+		return data;
+
+	// Without welding, every index would have had its own vertex
+	PrintWeldStats(objFile, indexCount, vertCount, indexCount);
+
+	// Finalize the data
+	FinalizeData(*data);
+
+	// Save the final data so the next load can skip all of the above
+	MeshCacheHeader cacheDetails{};
+	cacheDetails.VertexCount = data->VertexCount;
+	cacheDetails.IndexCount = data->IndexCount;
+	cacheDetails.IndexStride = sizeof(unsigned int);
+	cacheDetails.ProcessingFlags = cacheFlags;
+	cacheDetails.ContentHash = data->ContentHash;
+	cacheDetails.BoundsMin = data->BoundsMin;
+	cacheDetails.BoundsMax = data->BoundsMax;
+	cacheDetails.LODsRequested = options.LODCount;
+	cacheDetails.LODReduction = options.LODReduction;
+	MeshCache::Write(objFile, cacheDetails, data->Vertices, data->Indices, data->LODIndices, data->LODErrors);
+
+	auto loadEnd = std::chrono::high_resolution_clock::now();
+	Diagnostics::Print("Loaded %ls: %u triangles from OBJ (cold) in %.2fms\n",
+		objFile,
+		data->IndexCount / 3,
+		std::chrono::duration<double, std::milli>(loadEnd - loadStart).count());
+	return data;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Vertex.h"
+#include "MappedFile.h"
+#include "BVH.h"
+#include "WideBVH.h"
+
+// --------------------------------------------------------
+// Choices about how a mesh's data is stored on the GPU,
+// made when the mesh is created
+// --------------------------------------------------------
+struct MeshOptions
+{
+	VertexFormat Format = VertexFormat::Full;
+	bool SeparatePositions = false;		// Positions in their own tightly packed buffer?
+	bool OptimizeVertexOrder = false;	// Reorder triangles & vertices for cache efficiency?
+	unsigned int LODCount = 0;			// Simplified versions to generate beyond the full mesh (cached with the OBJ's data)
+	float LODReduction = 0.5f;			// Fraction of the previous LOD's triangles each LOD keeps
+	bool KeepCPUData = false;			// Keep the final vertices & indices around (for CPU raytracing)?
+	bool BuildBVH = false;				// Build CPU-side BVHs (binary & 4-wide) over the full LOD's triangles? (Not cached, so built on every load)
+	bool Deformable = false;			// Can vertices be replaced later with UpdateVertices()? (Always keeps CPU data)
+	float MaxRefitDegradation = 1.5f;	// Growth in SAH cost refits can cause before a deformable mesh's BVH is rebuilt
+};
+
+// --------------------------------------------------------
+// A mesh's final CPU-side data, after loading & processing
+// but before anything is created on the GPU.  Producing it
+// is safe on any thread; turning it into a Mesh is not.
+//
+// Nothing here depends on D3D12 or the window, so tools
+// (like the headless renderer) can use it directly.
+//
+// The vertex & index pointers refer to either the storage
+// vectors or a mapped cache file, which this keeps alive.
+// --------------------------------------------------------
+struct MeshData
+{
+	std::wstring Name;
+	MeshOptions Options;
+
+	const Vertex* Vertices = 0;
+	unsigned int VertexCount = 0;
+	const unsigned int* Indices = 0;
+	unsigned int IndexCount = 0;
+
+	// Simplified index lists (and their accumulated error) for LODs 1+
+	std::vector<std::vector<unsigned int>> LODIndices;
+	std::vector<float> LODErrors;
+
+	DirectX::XMFLOAT3 BoundsMin = DirectX::XMFLOAT3(0, 0, 0);
+	DirectX::XMFLOAT3 BoundsMax = DirectX::XMFLOAT3(0, 0, 0);
+	unsigned long long ContentHash = 0;
+
+	// Built along with the rest of the data if requested
+	std::shared_ptr<BVH> Accel;
+	std::shared_ptr<WideBVH> WideAccel;
+
+	std::vector<Vertex> VertexStorage;
+	std::vector<unsigned int> IndexStorage;
+	std::shared_ptr<MappedFile> CacheFile;
+
+	// Welds and processes an array of vertices & indices (which are copied)
+	static std::shared_ptr<MeshData> Process(const Vertex* vertArray, int numVerts, const unsigned int* indexArray, int numIndices, MeshOptions options = MeshOptions());
+
+	// Loads and processes an OBJ file (or its up-to-date cache)
+	static std::shared_ptr<MeshData> Load(const wchar_t* objFile, MeshOptions options = MeshOptions());
+};
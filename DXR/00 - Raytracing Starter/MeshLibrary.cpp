@@ -0,0 +1,231 @@
+#include "MeshLibrary.h"
+#include "MeshProcessing.h"
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Would meshes made from the same data with these options match?
+	// (OptimizeVertexOrder is left out, as it's part of the data itself)
+	bool SameOptions(const MeshOptions& a, const MeshOptions& b)
+	{
+		return
+			a.Format == b.Format &&
+			a.SeparatePositions == b.SeparatePositions &&
+			a.LODCount == b.LODCount &&
+			(a.LODCount == 0 || a.LODReduction == b.LODReduction) &&
+			a.KeepCPUData == b.KeepCPUData &&
+			a.BuildBVH == b.BuildBVH;
+	}
+
+	// Would loading or processing the same source with these options
+	// give the same data?  (Unlike above, the vertex order matters)
+	bool SameSourceOptions(const MeshOptions& a, const MeshOptions& b)
+	{
+		return SameOptions(a, b) && a.OptimizeVertexOrder == b.OptimizeVertexOrder;
+	}
+}
+
+
+// --------------------------------------------------------
+// Finds a mesh with the same contents & options as the data,
+// or creates one from it (which needs the GPU, like Mesh's
+// constructors) if there isn't one still in use
+// --------------------------------------------------------
+std::shared_ptr<Mesh> MeshLibrary::Get(const MeshData& data)
+{
+	// Deformable meshes change after creation, so are never shared
+	if (data.Options.Deformable)
+	{
+		misses++;
+		return std::make_shared<Mesh>(data);
+	}
+
+	ForgetReleased();
+	std::vector<Entry>& matches = entries[data.ContentHash];
+	for (const Entry& entry : matches)
+	{
+		std::shared_ptr<Mesh> mesh = entry.Handle.lock();
+		if (mesh &&
+			entry.VertexCount == data.VertexCount &&
+			entry.IndexCount == data.IndexCount &&
+			SameOptions(entry.Options, data.Options) &&
+			SameData(entry, *mesh, data))
+		{
+			hits++;
+			return mesh;
+		}
+	}
+
+	std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>(data);
+	Entry entry = { data.Options, data.VertexCount, data.IndexCount, mesh };
+	if (mesh->GetCPUVertices().empty())
+	{
+		entry.Vertices.assign(data.Vertices, data.Vertices + data.VertexCount);
+		entry.Indices.assign(data.Indices, data.Indices + data.IndexCount);
+	}
+	matches.push_back(std::move(entry));
+	misses++;
+	return mesh;
+}
+
+
+// --------------------------------------------------------
+// Checks that a mesh with a matching hash, counts & options
+// really was made from exactly this data.  The mesh's own
+// CPU data has packed vertices round tripped (see Mesh), so
+// the new data is too before comparing.
+// --------------------------------------------------------
+bool MeshLibrary::SameData(const Entry& entry, Mesh& mesh, const MeshData& data)
+{
+	const std::vector<Vertex>& meshVertices = mesh.GetCPUVertices();
+	const std::vector<unsigned int>& meshIndices = mesh.GetCPUIndices();
+	if (meshVertices.empty())
+	{
+		return
+			entry.Vertices.size() == data.VertexCount &&
+			entry.Indices.size() == data.IndexCount &&
+			memcmp(entry.Vertices.data(), data.Vertices, sizeof(Vertex) * data.VertexCount) == 0 &&
+			memcmp(entry.Indices.data(), data.Indices, sizeof(unsigned int) * data.IndexCount) == 0;
+	}
+
+	if (meshVertices.size() != data.VertexCount ||
+		meshIndices.size() != data.IndexCount ||
+		memcmp(meshIndices.data(), data.Indices, sizeof(unsigned int) * data.IndexCount) != 0)
+		return false;
+
+	if (mesh.GetVertexFormat() != VertexFormat::Packed)
+		return memcmp(meshVertices.data(), data.Vertices, sizeof(Vertex) * data.VertexCount) == 0;
+
+	for (unsigned int i = 0; i < data.VertexCount; i++)
+	{
+		Vertex packed = VertexPacking::Unpack(VertexPacking::Pack(data.Vertices[i]));
+		if (memcmp(&packed, &meshVertices[i], sizeof(Vertex)) != 0)
+			return false;
+	}
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Drops the entries of meshes released since the last
+// request, along with any copies of their data
+// --------------------------------------------------------
+void MeshLibrary::ForgetReleased()
+{
+	for (auto it = entries.begin(); it != entries.end();)
+	{
+		std::vector<Entry>& hashEntries = it->second;
+		hashEntries.erase(
+			std::remove_if(hashEntries.begin(), hashEntries.end(), [](const Entry& entry) { return entry.Handle.expired(); }),
+			hashEntries.end());
+		it = hashEntries.empty() ? entries.erase(it) : std::next(it);
+	}
+}
+
+
+// --------------------------------------------------------
+// Returns the mesh already made from an OBJ file with these
+// options, or loads the file and returns a mesh for its data
+// --------------------------------------------------------
+std::shared_ptr<Mesh> MeshLibrary::Load(const wchar_t* objFile, MeshOptions options)
+{
+	SourceEntry source = { objFile, 0, 0, options };
+	unsigned long long key = MeshProcessing::HashData(source.File.data(), source.File.size() * sizeof(wchar_t));
+	if (std::shared_ptr<Mesh> mesh = FindSource(key, source))
+		return mesh;
+
+	return AddSource(key, source, Get(*Mesh::LoadData(objFile, options)));
+}
+
+
+// --------------------------------------------------------
+// Returns the mesh already made from the same arrays with
+// these options, or processes them and returns a mesh for
+// the result
+// --------------------------------------------------------
+std::shared_ptr<Mesh> MeshLibrary::Create(const Vertex* vertArray, int numVerts, const unsigned int* indexArray, int numIndices, MeshOptions options)
+{
+	SourceEntry source = { std::wstring(), (unsigned int)numVerts, (unsigned int)numIndices, options };
+	unsigned long long key = MeshProcessing::HashData(vertArray, sizeof(Vertex) * numVerts);
+	key = MeshProcessing::HashData(indexArray, sizeof(unsigned int) * numIndices, key);
+	if (std::shared_ptr<Mesh> mesh = FindSource(key, source))
+		return mesh;
+
+	return AddSource(key, source, Get(*Mesh::ProcessData(vertArray, numVerts, indexArray, numIndices, options)));
+}
+
+
+// --------------------------------------------------------
+// The mesh still in use that was made from the same source
+// with the same options, if any (never for deformable ones)
+// --------------------------------------------------------
+std::shared_ptr<Mesh> MeshLibrary::FindSource(unsigned long long key, const SourceEntry& source)
+{
+	if (source.Options.Deformable)
+		return 0;
+
+	auto found = sources.find(key);
+	if (found == sources.end())
+		return 0;
+
+	std::vector<SourceEntry>& matches = found->second;
+	for (size_t i = 0; i < matches.size(); i++)
+	{
+		std::shared_ptr<Mesh> mesh = matches[i].Handle.lock();
+		if (!mesh)
+		{
+			// Released since, so forget it
+			matches.erase(matches.begin() + i);
+			i--;
+			continue;
+		}
+
+		if (matches[i].File == source.File &&
+			matches[i].VertexCount == source.VertexCount &&
+			matches[i].IndexCount == source.IndexCount &&
+			SameSourceOptions(matches[i].Options, source.Options))
+		{
+			hits++;
+			sourceHits++;
+			return mesh;
+		}
+	}
+	return 0;
+}
+
+
+// --------------------------------------------------------
+// Remembers the source a mesh was made from, so the next
+// request for it can skip straight to the mesh
+// --------------------------------------------------------
+std::shared_ptr<Mesh> MeshLibrary::AddSource(unsigned long long key, SourceEntry source, std::shared_ptr<Mesh> mesh)
+{
+	if (!source.Options.Deformable)
+	{
+		source.Handle = mesh;
+		sources[key].push_back(source);
+	}
+	return mesh;
+}
+
+
+// --------------------------------------------------------
+// Hit & miss counts so far, and how many meshes are alive
+// --------------------------------------------------------
+MeshLibraryStats MeshLibrary::GetStats()
+{
+	MeshLibraryStats stats = {};
+	stats.Hits = hits;
+	stats.SourceHits = sourceHits;
+	stats.Misses = misses;
+	for (auto& hashEntries : entries)
+		for (Entry& entry : hashEntries.second)
+			if (!entry.Handle.expired())
+				stats.Meshes++;
+	return stats;
+}
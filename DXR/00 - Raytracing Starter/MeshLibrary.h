@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Mesh.h"
+
+// How often meshes asked for already existed
+struct MeshLibraryStats
+{
+	unsigned int Hits;						// Requests given an existing mesh
+	unsigned int SourceHits;				// Of those, found by source without loading or processing
+	unsigned int Misses;					// Requests that created a mesh
+	unsigned int Meshes;					// Meshes still in use
+};
+
+// --------------------------------------------------------
+// Hands out meshes so that identical ones are only created
+// once: loading the same OBJ twice, or generating the same
+// data procedurally, gives back the same Mesh (and so the
+// same GPU buffers, and the same BLAS in RayTracing).
+//
+// Meshes are found by MeshData::ContentHash, a hash of the
+// final vertex & index data, along with their counts and
+// every option that changes what's created from that data,
+// and then the data itself is compared byte for byte, so
+// a hash collision can't hand out the wrong mesh.  That's
+// against the mesh's kept CPU data if it has any (see
+// MeshOptions::KeepCPUData), or else a copy the library
+// keeps until the mesh is released.
+// Load() and Create() first look for a mesh made from the
+// same source (the same file, or a hash of the same input
+// arrays) with the same options, so asking again skips
+// loading & processing entirely.  A file isn't read again
+// while a mesh loaded from it is still in use.
+// The library only holds weak references, so a mesh is
+// released as usual once nothing else is using it.
+// Deformable meshes are always created fresh.
+//
+// Like creating a Mesh, this is only safe on one thread.
+// --------------------------------------------------------
+class MeshLibrary
+{
+public:
+	// The existing mesh with this data, or a new one made from it
+	std::shared_ptr<Mesh> Get(const MeshData& data);
+
+	// Loads or processes data (see Mesh) and returns a mesh for it
+	std::shared_ptr<Mesh> Load(const wchar_t* objFile, MeshOptions options = MeshOptions());
+	std::shared_ptr<Mesh> Create(const Vertex* vertArray, int numVerts, const unsigned int* indexArray, int numIndices, MeshOptions options = MeshOptions());
+
+	MeshLibraryStats GetStats();
+
+private:
+	struct Entry
+	{
+		MeshOptions Options;
+		unsigned int VertexCount;
+		unsigned int IndexCount;
+		std::weak_ptr<Mesh> Handle;		// Empty once the mesh is released
+
+		// The data, for meshes that don't keep their own CPU copy
+		std::vector<Vertex> Vertices;
+		std::vector<unsigned int> Indices;
+	};
+
+	// What a mesh was loaded or processed from (File is empty for arrays)
+	struct SourceEntry
+	{
+		std::wstring File;
+		unsigned int VertexCount;
+		unsigned int IndexCount;
+		MeshOptions Options;
+		std::weak_ptr<Mesh> Handle;
+	};
+
+	static bool SameData(const Entry& entry, Mesh& mesh, const MeshData& data);
+	void ForgetReleased();
+	std::shared_ptr<Mesh> FindSource(unsigned long long key, const SourceEntry& source);
+	std::shared_ptr<Mesh> AddSource(unsigned long long key, SourceEntry source, std::shared_ptr<Mesh> mesh);
+
+	// Entries by content hash (more than one if the options differ)
+	std::unordered_map<unsigned long long, std::vector<Entry>> entries;
+
+	// Sources by a hash of the file name or input arrays
+	std::unordered_map<unsigned long long, std::vector<SourceEntry>> sources;
+
+	unsigned int hits = 0;
+	unsigned int sourceHits = 0;
+	unsigned int misses = 0;
+};
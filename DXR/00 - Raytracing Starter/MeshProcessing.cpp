@@ -0,0 +1,1189 @@
+#include "MeshProcessing.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using namespace DirectX;
+
+namespace MeshProcessing
+{
+	// Annonymous namespace to hold helpers
+	// only accessible in this file
+	namespace
+	{
+		// Welding compares everything up to the tangent, since
+		// tangents are always recalculated after welding
+		const size_t WeldKeySize = offsetof(Vertex, Tangent);
+
+		// Hashes the welded portion of a vertex (referenced by index)
+		struct VertexKeyHash
+		{
+			const Vertex* verts;
+			size_t operator()(unsigned int index) const
+			{
+				unsigned int words[WeldKeySize / sizeof(unsigned int)];
+				memcpy(words, &verts[index], WeldKeySize);
+
+				// FNV-1a style mix, one 32-bit word at a time
+				unsigned long long hash = 14695981039346656037ull;
+				for (unsigned int w : words)
+					hash = (hash ^ w) * 1099511628211ull;
+				return (size_t)hash;
+			}
+		};
+
+		// Thresholds for splitting tangent generation across threads, including
+		// a cap on the memory used by the per-thread accumulators
+		const size_t MinTrianglesPerThread = 16 * 1024;
+		const size_t MinVertsPerThread = 16 * 1024;
+		const size_t MaxTangentAccumulatorBytes = 256 * 1024 * 1024;
+
+		// One vertex's running sums of per-triangle tangents and bitangents
+		struct TangentSum
+		{
+			float TX, TY, TZ;
+			float BX, BY, BZ;
+		};
+
+		// One thread's running sums, padded to a multiple of 4 vertices.
+		// Each vertex's sums are kept together (AoS), as a triangle's
+		// three scattered writes then touch 3 cache lines, not 18.
+		struct TangentAccumulator
+		{
+			std::vector<TangentSum> Sums;
+		};
+
+		// Loads one float from each of 4 vertices into a single vector
+		XMVECTOR Gather(const Vertex* const v[4], size_t byteOffset)
+		{
+			auto f = [&](int lane) { return *(const float*)((const char*)v[lane] + byteOffset); };
+			return XMVectorSet(f(0), f(1), f(2), f(3));
+		}
+
+		// --------------------------------------------------------
+		// Calculates the tangent & bitangent of triangles in the
+		// range [firstTri, endTri) and adds them to the accumulator.
+		// This is scalar: gathering 4 triangles into SIMD lanes and
+		// scattering them back out cost more than the math saved.
+		// Code adapted from: http://www.terathon.com/code/tangent.html
+		// --------------------------------------------------------
+		void AccumulateTriangleTangents(
+			const Vertex* verts,
+			const unsigned int* indices,
+			size_t firstTri,
+			size_t endTri,
+			TangentAccumulator& acc)
+		{
+			TangentSum* sums = acc.Sums.data();
+			for (size_t t = firstTri; t < endTri; t++)
+			{
+				const unsigned int* tri = &indices[t * 3];
+				const Vertex& v1 = verts[tri[0]];
+				const Vertex& v2 = verts[tri[1]];
+				const Vertex& v3 = verts[tri[2]];
+
+				// Calculate vectors relative to triangle positions
+				float x1 = v2.Position.x - v1.Position.x;
+				float y1 = v2.Position.y - v1.Position.y;
+				float z1 = v2.Position.z - v1.Position.z;
+
+				float x2 = v3.Position.x - v1.Position.x;
+				float y2 = v3.Position.y - v1.Position.y;
+				float z2 = v3.Position.z - v1.Position.z;
+
+				// Do the same for vectors relative to triangle uv's
+				float s1 = v2.UV.x - v1.UV.x;
+				float t1 = v2.UV.y - v1.UV.y;
+
+				float s2 = v3.UV.x - v1.UV.x;
+				float t2 = v3.UV.y - v1.UV.y;
+
+				// Triangles with degenerate UVs contribute nothing
+				float det = s1 * t2 - s2 * t1;
+				float r = fabsf(det) > 1e-20f ? 1.0f / det : 0.0f;
+
+				float tx = (t2 * x1 - t1 * x2) * r;
+				float ty = (t2 * y1 - t1 * y2) * r;
+				float tz = (t2 * z1 - t1 * z2) * r;
+				float bx = (s1 * x2 - s2 * x1) * r;
+				float by = (s1 * y2 - s2 * y1) * r;
+				float bz = (s1 * z2 - s2 * z1) * r;
+
+				// Adjust tangents of each vert of the triangle
+				for (int corner = 0; corner < 3; corner++)
+				{
+					TangentSum& sum = sums[tri[corner]];
+					sum.TX += tx; sum.TY += ty; sum.TZ += tz;
+					sum.BX += bx; sum.BY += by; sum.BZ += bz;
+				}
+			}
+		}
+
+		// --------------------------------------------------------
+		// Sums all thread accumulators for vertices in the range
+		// [firstVert, endVert), 4 vertices at a time, and writes
+		// the final orthonormalized tangents and handedness
+		// --------------------------------------------------------
+		void FinalizeTangents(
+			Vertex* verts,
+			size_t firstVert,
+			size_t endVert,
+			const std::vector<TangentAccumulator>& accumulators)
+		{
+			const size_t normX = offsetof(Vertex, Normal);
+			const size_t normY = normX + sizeof(float);
+			const size_t normZ = normY + sizeof(float);
+
+			for (size_t v = firstVert; v < endVert; v += 4)
+			{
+				size_t lanes = endVert - v < 4 ? endVert - v : 4;
+
+				// Total up every thread's contributions (arrays are padded, so 4 is always safe)
+				XMVECTOR tx = XMVectorZero(), ty = XMVectorZero(), tz = XMVectorZero();
+				XMVECTOR bx = XMVectorZero(), by = XMVectorZero(), bz = XMVectorZero();
+				for (const TangentAccumulator& acc : accumulators)
+				{
+					const TangentSum* sum = &acc.Sums[v];
+					tx += XMVectorSet(sum[0].TX, sum[1].TX, sum[2].TX, sum[3].TX);
+					ty += XMVectorSet(sum[0].TY, sum[1].TY, sum[2].TY, sum[3].TY);
+					tz += XMVectorSet(sum[0].TZ, sum[1].TZ, sum[2].TZ, sum[3].TZ);
+					bx += XMVectorSet(sum[0].BX, sum[1].BX, sum[2].BX, sum[3].BX);
+					by += XMVectorSet(sum[0].BY, sum[1].BY, sum[2].BY, sum[3].BY);
+					bz += XMVectorSet(sum[0].BZ, sum[1].BZ, sum[2].BZ, sum[3].BZ);
+				}
+
+				const Vertex* lanesV[4];
+				for (size_t l = 0; l < 4; l++)
+					lanesV[l] = &verts[v + (l < lanes ? l : 0)];
+
+				XMVECTOR nx = Gather(lanesV, normX);
+				XMVECTOR ny = Gather(lanesV, normY);
+				XMVECTOR nz = Gather(lanesV, normZ);
+
+				// Use Gram-Schmidt to ensure the tangents are orthogonal to the normals
+				XMVECTOR dot = nx * tx + ny * ty + nz * tz;
+				tx -= nx * dot;
+				ty -= ny * dot;
+				tz -= nz * dot;
+
+				// Vertices with no usable tangent get an arbitrary one perpendicular to
+				// the normal: N x (1,0,0) unless the normal is close to the X axis,
+				// in which case N x (0,1,0)
+				XMVECTOR useX = XMVectorLess(XMVectorAbs(nx), XMVectorReplicate(0.9f));
+				XMVECTOR fx = XMVectorSelect(-nz, XMVectorZero(), useX);
+				XMVECTOR fy = XMVectorSelect(XMVectorZero(), nz, useX);
+				XMVECTOR fz = XMVectorSelect(nx, -ny, useX);
+
+				XMVECTOR lengthSq = tx * tx + ty * ty + tz * tz;
+				XMVECTOR usable = XMVectorGreater(lengthSq, XMVectorReplicate(1e-20f));
+				tx = XMVectorSelect(fx, tx, usable);
+				ty = XMVectorSelect(fy, ty, usable);
+				tz = XMVectorSelect(fz, tz, usable);
+
+				XMVECTOR invLength = XMVectorReciprocalSqrt(tx * tx + ty * ty + tz * tz);
+				tx *= invLength;
+				ty *= invLength;
+				tz *= invLength;
+
+				// Handedness: does the bitangent agree with N x T?
+				XMVECTOR cx = ny * tz - nz * ty;
+				XMVECTOR cy = nz * tx - nx * tz;
+				XMVECTOR cz = nx * ty - ny * tx;
+				XMVECTOR flipped = XMVectorLess(cx * bx + cy * by + cz * bz, XMVectorZero());
+				XMVECTOR w = XMVectorSelect(XMVectorReplicate(1.0f), XMVectorReplicate(-1.0f), flipped);
+
+				// Store the tangents
+				XMFLOAT4 outX, outY, outZ, outW;
+				XMStoreFloat4(&outX, tx);
+				XMStoreFloat4(&outY, ty);
+				XMStoreFloat4(&outZ, tz);
+				XMStoreFloat4(&outW, w);
+				for (size_t l = 0; l < lanes; l++)
+					verts[v + l].Tangent = XMFLOAT4((&outX.x)[l], (&outY.x)[l], (&outZ.x)[l], (&outW.x)[l]);
+			}
+		}
+
+		// Cache line size and line count of the simulated vertex fetch cache
+		const size_t FetchCacheLineSize = 64;
+		const unsigned int FetchCacheLines = 32;
+
+		// --------------------------------------------------------
+		// Builds a list of adjacent triangles for each vertex,
+		// stored as one array with a start offset per vertex
+		// (the triangles of vertex v are at [offsets[v], offsets[v+1]))
+		// --------------------------------------------------------
+		void BuildVertexTriangles(
+			const unsigned int* indices,
+			unsigned int numIndices,
+			unsigned int numVerts,
+			std::vector<unsigned int>& offsets,
+			std::vector<unsigned int>& triangles)
+		{
+			offsets.assign(numVerts + 1, 0);
+			for (unsigned int i = 0; i < numIndices; i++)
+				offsets[indices[i] + 1]++;
+			for (unsigned int v = 0; v < numVerts; v++)
+				offsets[v + 1] += offsets[v];
+
+			std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+			triangles.resize(numIndices);
+			for (unsigned int i = 0; i < numIndices; i++)
+				triangles[fill[indices[i]]++] = i / 3;
+		}
+
+		// --------------------------------------------------------
+		// Tipsify's choice of the next vertex to fan around: the
+		// candidate still in the cache (after emitting its
+		// remaining triangles) that entered the cache earliest,
+		// falling back to recently used vertices and then to any
+		// vertex with triangles left.  Returns -1 when finished.
+		// --------------------------------------------------------
+		int NextFanningVertex(
+			const std::vector<unsigned int>& candidates,
+			const std::vector<unsigned int>& liveTriangles,
+			const std::vector<unsigned int>& cacheTime,
+			unsigned int time,
+			unsigned int cacheSize,
+			std::vector<unsigned int>& deadEnds,
+			unsigned int& cursor)
+		{
+			int best = -1;
+			int bestPriority = -1;
+			for (unsigned int v : candidates)
+			{
+				if (liveTriangles[v] == 0)
+					continue;
+
+				int priority = 0;
+				if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+					priority = time - cacheTime[v];
+
+				if (priority > bestPriority)
+				{
+					best = v;
+					bestPriority = priority;
+				}
+			}
+			if (best != -1)
+				return best;
+
+			// Dead end - try recently used vertices, then anything
+			while (!deadEnds.empty())
+			{
+				unsigned int v = deadEnds.back();
+				deadEnds.pop_back();
+				if (liveTriangles[v] > 0)
+					return v;
+			}
+
+			for (; cursor < liveTriangles.size(); cursor++)
+			{
+				if (liveTriangles[cursor] > 0)
+					return cursor;
+			}
+			return -1;
+		}
+
+		// --------------------------------------------------------
+		// Symmetric 4x4 error quadric (Garland & Heckbert) for the
+		// squared distance of a point from a set of planes, with a
+		// total weight so the error can be normalized to a distance
+		// --------------------------------------------------------
+		struct Quadric
+		{
+			double A2, AB, AC, AD;
+			double B2, BC, BD;
+			double C2, CD;
+			double D2;
+			double Weight;
+
+			void Add(const Quadric& q)
+			{
+				A2 += q.A2; AB += q.AB; AC += q.AC; AD += q.AD;
+				B2 += q.B2; BC += q.BC; BD += q.BD;
+				C2 += q.C2; CD += q.CD;
+				D2 += q.D2;
+				Weight += q.Weight;
+			}
+
+			// Weighted average squared distance of p from the planes
+			double Evaluate(const XMFLOAT3& p) const
+			{
+				double x = p.x, y = p.y, z = p.z;
+				double error =
+					A2 * x * x + 2 * AB * x * y + 2 * AC * x * z + 2 * AD * x +
+					B2 * y * y + 2 * BC * y * z + 2 * BD * y +
+					C2 * z * z + 2 * CD * z +
+					D2;
+				return Weight > 0 ? std::fabs(error) / Weight : 0;
+			}
+		};
+
+		// Quadric for the plane of a triangle, weighted by its area
+		Quadric TriangleQuadric(const XMFLOAT3& p0, const XMFLOAT3& p1, const XMFLOAT3& p2)
+		{
+			XMVECTOR v0 = XMLoadFloat3(&p0);
+			XMVECTOR normal = XMVector3Cross(XMLoadFloat3(&p1) - v0, XMLoadFloat3(&p2) - v0);
+			double area = 0.5 * XMVectorGetX(XMVector3Length(normal));
+
+			XMFLOAT3 n;
+			XMStoreFloat3(&n, XMVector3Normalize(normal));
+			double d = -(n.x * p0.x + n.y * p0.y + n.z * p0.z);
+
+			Quadric q;
+			q.A2 = area * n.x * n.x; q.AB = area * n.x * n.y; q.AC = area * n.x * n.z; q.AD = area * n.x * d;
+			q.B2 = area * n.y * n.y; q.BC = area * n.y * n.z; q.BD = area * n.y * d;
+			q.C2 = area * n.z * n.z; q.CD = area * n.z * d;
+			q.D2 = area * d * d;
+			q.Weight = area;
+			return q;
+		}
+
+		// How strongly borders & seams resist changing shape, relative to surfaces
+		const double BorderPlaneWeight = 10.0;
+
+		// --------------------------------------------------------
+		// Quadric for the plane through an open edge, perpendicular
+		// to its triangle, so sliding along a straight border is
+		// free but cutting across a corner is costly.  It adds no
+		// weight, leaving the error normalized by surface area.
+		// --------------------------------------------------------
+		Quadric BorderQuadric(const XMFLOAT3& p0, const XMFLOAT3& p1, const XMFLOAT3& p2)
+		{
+			XMVECTOR v0 = XMLoadFloat3(&p0);
+			XMVECTOR edge = XMLoadFloat3(&p1) - v0;
+			XMVECTOR faceNormal = XMVector3Cross(edge, XMLoadFloat3(&p2) - v0);
+			double weight = BorderPlaneWeight * XMVectorGetX(XMVector3Dot(edge, edge));
+
+			XMFLOAT3 n;
+			XMStoreFloat3(&n, XMVector3Normalize(XMVector3Cross(edge, faceNormal)));
+			double d = -(n.x * p0.x + n.y * p0.y + n.z * p0.z);
+
+			Quadric q;
+			q.A2 = weight * n.x * n.x; q.AB = weight * n.x * n.y; q.AC = weight * n.x * n.z; q.AD = weight * n.x * d;
+			q.B2 = weight * n.y * n.y; q.BC = weight * n.y * n.z; q.BD = weight * n.y * d;
+			q.C2 = weight * n.z * n.z; q.CD = weight * n.z * d;
+			q.D2 = weight * d * d;
+			q.Weight = 0;
+			return q;
+		}
+
+		// A potential collapse of one vertex into another, and its error
+		struct Collapse
+		{
+			unsigned int From;
+			unsigned int To;
+			double Error;
+		};
+
+		// How a vertex may move during simplification
+		enum class VertexKind
+		{
+			Manifold,	// Surrounded by triangles: can collapse along any edge
+			Border,		// On one open edge chain: can only slide along it
+			Seam,		// On a UV/normal seam: slides along it along with its twin
+			Locked		// Corners, non-manifold spots, etc.: never moves
+		};
+
+		// Open edge links for vertices with none or more than one
+		const unsigned int NoEdge = ~0u;
+		const unsigned int ManyEdges = ~1u;
+
+		// The class of each vertex, plus the vertices its open
+		// edges lead to (OpenOut) and come from (OpenIn)
+		struct VertexTopology
+		{
+			std::vector<VertexKind> Kinds;
+			std::vector<unsigned int> OpenOut;
+			std::vector<unsigned int> OpenIn;
+		};
+
+		bool SamePosition(const Vertex* verts, unsigned int a, unsigned int b)
+		{
+			return memcmp(&verts[a].Position, &verts[b].Position, sizeof(XMFLOAT3)) == 0;
+		}
+
+		// --------------------------------------------------------
+		// Links every vertex to the next vertex with exactly the
+		// same position, in a ring (unique positions link to
+		// themselves), so seams can be followed to their twins
+		// --------------------------------------------------------
+		std::vector<unsigned int> BuildPositionRings(const Vertex* verts, unsigned int numVerts)
+		{
+			struct PositionHash
+			{
+				size_t operator()(const XMFLOAT3& p) const
+				{
+					unsigned int words[3];
+					memcpy(words, &p, sizeof(words));
+					return (size_t)(((unsigned long long)words[0] * 73856093ull) ^ ((unsigned long long)words[1] * 19349663ull) ^ ((unsigned long long)words[2] * 83492791ull));
+				}
+			};
+			struct PositionEqual
+			{
+				bool operator()(const XMFLOAT3& a, const XMFLOAT3& b) const { return memcmp(&a, &b, sizeof(XMFLOAT3)) == 0; }
+			};
+
+			std::vector<unsigned int> next(numVerts);
+			std::unordered_map<XMFLOAT3, unsigned int, PositionHash, PositionEqual> firstAtPosition(numVerts);
+			for (unsigned int v = 0; v < numVerts; v++)
+			{
+				auto result = firstAtPosition.try_emplace(verts[v].Position, v);
+				if (result.second)
+				{
+					next[v] = v;
+					continue;
+				}
+
+				// Splice into the ring just after the first vertex
+				unsigned int first = result.first->second;
+				next[v] = next[first];
+				next[first] = v;
+			}
+			return next;
+		}
+
+		// Does any triangle around vertex a contain the directed edge a -> b?
+		bool HasEdge(
+			const unsigned int* indices,
+			const std::vector<unsigned int>& offsets,
+			const std::vector<unsigned int>& vertexTriangles,
+			unsigned int a,
+			unsigned int b)
+		{
+			for (unsigned int t = offsets[a]; t < offsets[a + 1]; t++)
+			{
+				const unsigned int* tri = &indices[vertexTriangles[t] * 3];
+				for (int c = 0; c < 3; c++)
+					if (tri[c] == a && tri[(c + 1) % 3] == b)
+						return true;
+			}
+			return false;
+		}
+
+		// --------------------------------------------------------
+		// Classifies each vertex by the open edges (edges with no
+		// opposite edge) it's on.  Only these edges constrain the
+		// simplifier: a vertex that merely shares its position
+		// with others, but isn't on an open edge, moves freely.
+		//
+		// A vertex on exactly one chain of open edges is on a
+		// border, unless another vertex shares its position and
+		// runs along the same edges the other way, making the pair
+		// a seam (an attribute discontinuity on a closed surface).
+		// --------------------------------------------------------
+		void ClassifyVertices(
+			const Vertex* verts,
+			const unsigned int* indices,
+			unsigned int numIndices,
+			unsigned int numVerts,
+			const std::vector<unsigned int>& offsets,
+			const std::vector<unsigned int>& vertexTriangles,
+			const std::vector<unsigned int>& nextAtPosition,
+			VertexTopology& topology)
+		{
+			topology.OpenOut.assign(numVerts, NoEdge);
+			topology.OpenIn.assign(numVerts, NoEdge);
+			topology.Kinds.assign(numVerts, VertexKind::Manifold);
+
+			for (unsigned int i = 0; i < numIndices; i += 3)
+			{
+				for (unsigned int e = 0; e < 3; e++)
+				{
+					unsigned int a = indices[i + e];
+					unsigned int b = indices[i + (e + 1) % 3];
+					if (HasEdge(indices, offsets, vertexTriangles, b, a))
+						continue;
+
+					topology.OpenOut[a] = topology.OpenOut[a] == NoEdge ? b : ManyEdges;
+					topology.OpenIn[b] = topology.OpenIn[b] == NoEdge ? a : ManyEdges;
+				}
+			}
+
+			auto OnOneChain = [&](unsigned int v)
+				{
+					return topology.OpenOut[v] < ManyEdges && topology.OpenIn[v] < ManyEdges;
+				};
+
+			for (unsigned int v = 0; v < numVerts; v++)
+			{
+				if (topology.OpenOut[v] == NoEdge && topology.OpenIn[v] == NoEdge)
+					continue;
+
+				VertexKind kind = VertexKind::Locked;
+				unsigned int twin = nextAtPosition[v];
+				if (OnOneChain(v))
+				{
+					if (twin == v)
+					{
+						kind = VertexKind::Border;
+					}
+					else if (nextAtPosition[twin] == v &&
+						OnOneChain(twin) &&
+						SamePosition(verts, topology.OpenOut[v], topology.OpenIn[twin]) &&
+						SamePosition(verts, topology.OpenIn[v], topology.OpenOut[twin]))
+					{
+						kind = VertexKind::Seam;
+					}
+				}
+				topology.Kinds[v] = kind;
+			}
+		}
+
+		// Can vertex "from" collapse onto its neighbour "to" without
+		// changing the mesh's borders or seams?
+		bool CanCollapse(const VertexTopology& topology, unsigned int from, unsigned int to)
+		{
+			switch (topology.Kinds[from])
+			{
+			case VertexKind::Manifold:
+				return true;
+			case VertexKind::Border:
+			case VertexKind::Seam:
+				return to == topology.OpenOut[from] || to == topology.OpenIn[from];
+			default:
+				return false;
+			}
+		}
+
+		// --------------------------------------------------------
+		// The collapse a seam vertex's twin has to make when the
+		// seam vertex collapses onto "to": along the same seam
+		// edge, which runs the other way on the twin's side
+		// --------------------------------------------------------
+		unsigned int SeamTwinTarget(const VertexTopology& topology, unsigned int twin, unsigned int from, unsigned int to)
+		{
+			return to == topology.OpenOut[from] ? topology.OpenIn[twin] : topology.OpenOut[twin];
+		}
+
+		// --------------------------------------------------------
+		// Would moving vertex "from" onto vertex "to" flip (or
+		// collapse to nothing) any triangle that survives?
+		// Corners are looked up through the current remap.
+		// --------------------------------------------------------
+		bool CollapseFlipsTriangle(
+			const Vertex* verts,
+			const unsigned int* indices,
+			const std::vector<unsigned int>& remap,
+			const unsigned int* triangles,
+			unsigned int triangleCount,
+			unsigned int from,
+			unsigned int to)
+		{
+			for (unsigned int t = 0; t < triangleCount; t++)
+			{
+				const unsigned int* tri = &indices[triangles[t] * 3];
+				unsigned int corners[3] = { remap[tri[0]], remap[tri[1]], remap[tri[2]] };
+
+				// Triangles using the edge itself simply disappear
+				if (corners[0] == to || corners[1] == to || corners[2] == to)
+					continue;
+
+				XMVECTOR p[3];
+				XMVECTOR moved[3];
+				for (int c = 0; c < 3; c++)
+				{
+					p[c] = XMLoadFloat3(&verts[corners[c]].Position);
+					moved[c] = corners[c] == from ? XMLoadFloat3(&verts[to].Position) : p[c];
+				}
+
+				XMVECTOR before = XMVector3Cross(p[1] - p[0], p[2] - p[0]);
+				XMVECTOR after = XMVector3Cross(moved[1] - moved[0], moved[2] - moved[0]);
+				if (XMVectorGetX(XMVector3Dot(before, after)) <= 0.0f)
+					return true;
+			}
+			return false;
+		}
+
+		// Bitwise equality of the welded portion of two vertices
+		struct VertexKeyEqual
+		{
+			const Vertex* verts;
+			bool operator()(unsigned int a, unsigned int b) const
+			{
+				return memcmp(&verts[a], &verts[b], WeldKeySize) == 0;
+			}
+		};
+	}
+}
+
+
+// --------------------------------------------------------
+// Welds vertices whose position, UV and normal are bitwise
+// identical.  The vertex array is compacted in place (keeping
+// the first occurrence of each unique vertex, in order) and
+// the index array is remapped to match.
+//
+// verts      - The vertices to weld (compacted in place)
+// numVerts   - How many vertices are in the array
+// indices    - The indices to remap (in place)
+// numIndices - How many indices are in the array
+//
+// Returns the number of unique vertices left in the array
+// --------------------------------------------------------
+unsigned int MeshProcessing::WeldVertices(Vertex* verts, unsigned int numVerts, unsigned int* indices, unsigned int numIndices)
+{
+	// Maps an original vertex index to the first identical vertex
+	std::unordered_map<unsigned int, unsigned int, VertexKeyHash, VertexKeyEqual> unique(
+		numVerts,
+		VertexKeyHash{ verts },
+		VertexKeyEqual{ verts });
+
+	// Find the final index of each original vertex
+	std::vector<unsigned int> remap(numVerts);
+	unsigned int uniqueCount = 0;
+	for (unsigned int i = 0; i < numVerts; i++)
+	{
+		auto result = unique.try_emplace(i, uniqueCount);
+		if (result.second) uniqueCount++;
+		remap[i] = result.first->second;
+	}
+
+	// Compact the vertices - a unique vertex only ever moves toward
+	// the front of the array, so this is safe to do in place.  Only
+	// the first occurrence of each vertex lands on a "new" slot.
+	unsigned int nextUnique = 0;
+	for (unsigned int i = 0; i < numVerts; i++)
+	{
+		if (remap[i] != nextUnique)
+			continue;
+
+		verts[nextUnique] = verts[i];
+		nextUnique++;
+	}
+
+	// Point the indices at the welded vertices
+	for (unsigned int i = 0; i < numIndices; i++)
+		indices[i] = remap[indices[i]];
+
+	return uniqueCount;
+}
+
+
+// --------------------------------------------------------
+// Reorders triangles so that consecutive triangles share as
+// many vertices as possible, using the Tipsify algorithm:
+// "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw" - Sander, Nehab & Barczak, 2007
+//
+// indices    - The triangles to reorder (in place)
+// numIndices - How many indices are in the array
+// numVerts   - How many vertices the indices refer to
+// cacheSize  - Post-transform cache size to optimize for
+// --------------------------------------------------------
+void MeshProcessing::OptimizeVertexCache(unsigned int* indices, unsigned int numIndices, unsigned int numVerts, unsigned int cacheSize)
+{
+	unsigned int numTris = numIndices / 3;
+	if (numTris == 0)
+		return;
+
+	// Which triangles use each vertex, and how many are left to emit
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> vertexTriangles;
+	BuildVertexTriangles(indices, numTris * 3, numVerts, offsets, vertexTriangles);
+
+	std::vector<unsigned int> liveTriangles(numVerts);
+	for (unsigned int v = 0; v < numVerts; v++)
+		liveTriangles[v] = offsets[v + 1] - offsets[v];
+
+	std::vector<unsigned int> cacheTime(numVerts, 0);
+	std::vector<bool> emitted(numTris, false);
+	std::vector<unsigned int> deadEnds;
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> output;
+	output.reserve(numTris * 3);
+
+	unsigned int time = cacheSize + 1;
+	unsigned int cursor = 0;
+	int fanning = NextFanningVertex(candidates, liveTriangles, cacheTime, time, cacheSize, deadEnds, cursor);
+	while (fanning >= 0)
+	{
+		// Emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (unsigned int t = offsets[fanning]; t < offsets[fanning + 1]; t++)
+		{
+			unsigned int tri = vertexTriangles[t];
+			if (emitted[tri])
+				continue;
+
+			for (unsigned int corner = 0; corner < 3; corner++)
+			{
+				unsigned int v = indices[tri * 3 + corner];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+
+				// Only a cache miss if it has been pushed out since it was last used
+				if (time - cacheTime[v] > cacheSize)
+				{
+					cacheTime[v] = time;
+					time++;
+				}
+			}
+			emitted[tri] = true;
+		}
+
+		fanning = NextFanningVertex(candidates, liveTriangles, cacheTime, time, cacheSize, deadEnds, cursor);
+	}
+
+	memcpy(indices, output.data(), sizeof(unsigned int) * output.size());
+}
+
+
+// --------------------------------------------------------
+// Reorders vertices into the order they're first used by
+// the index buffer, so nearby triangles fetch nearby memory.
+// Vertices not used by any triangle are removed.
+//
+// verts      - The vertices to reorder (in place)
+// numVerts   - How many vertices are in the array
+// indices    - The indices to remap (in place)
+// numIndices - How many indices are in the array
+//
+// Returns the number of vertices remaining
+// --------------------------------------------------------
+unsigned int MeshProcessing::OptimizeVertexFetch(Vertex* verts, unsigned int numVerts, unsigned int* indices, unsigned int numIndices)
+{
+	const unsigned int Unused = ~0u;
+	std::vector<unsigned int> remap(numVerts, Unused);
+	std::vector<Vertex> reordered;
+	reordered.reserve(numVerts);
+
+	for (unsigned int i = 0; i < numIndices; i++)
+	{
+		unsigned int& newIndex = remap[indices[i]];
+		if (newIndex == Unused)
+		{
+			newIndex = (unsigned int)reordered.size();
+			reordered.push_back(verts[indices[i]]);
+		}
+		indices[i] = newIndex;
+	}
+
+	memcpy(verts, reordered.data(), sizeof(Vertex) * reordered.size());
+	return (unsigned int)reordered.size();
+}
+
+
+// --------------------------------------------------------
+// Runs an index buffer through a simulated FIFO post-
+// transform cache and a small FIFO cache of vertex buffer
+// lines, to measure how well it reuses vertex work & data
+//
+// indices    - The index buffer to analyze
+// numIndices - How many indices are in the array
+// numVerts   - How many vertices the indices refer to
+// vertexSize - Bytes per vertex in the vertex buffer
+// cacheSize  - Post-transform cache size to simulate
+// --------------------------------------------------------
+VertexCacheStats MeshProcessing::AnalyzeVertexCache(const unsigned int* indices, unsigned int numIndices, unsigned int numVerts, size_t vertexSize, unsigned int cacheSize)
+{
+	VertexCacheStats stats{};
+	if (numIndices < 3 || numVerts == 0)
+		return stats;
+
+	// Post-transform cache, tracked by the "time" each vertex entered
+	std::vector<unsigned int> cacheTime(numVerts, 0);
+	unsigned int time = cacheSize + 1;
+	unsigned int transformed = 0;
+
+	// Vertex fetch cache, as a ring of line addresses
+	size_t fetchCache[FetchCacheLines];
+	for (size_t& line : fetchCache) line = ~(size_t)0;
+	unsigned int fetchNext = 0;
+	size_t linesFetched = 0;
+
+	std::vector<bool> used(numVerts, false);
+	unsigned int uniqueVerts = 0;
+
+	for (unsigned int i = 0; i < numIndices; i++)
+	{
+		unsigned int v = indices[i];
+		if (!used[v])
+		{
+			used[v] = true;
+			uniqueVerts++;
+		}
+
+		// Already transformed and still in the cache?
+		if (time - cacheTime[v] <= cacheSize)
+			continue;
+		cacheTime[v] = time++;
+		transformed++;
+
+		// Transforming requires fetching every line the vertex touches
+		size_t firstLine = v * vertexSize / FetchCacheLineSize;
+		size_t lastLine = ((v + 1) * vertexSize - 1) / FetchCacheLineSize;
+		for (size_t line = firstLine; line <= lastLine; line++)
+		{
+			bool hit = false;
+			for (size_t cached : fetchCache)
+				hit |= cached == line;
+			if (hit)
+				continue;
+
+			fetchCache[fetchNext] = line;
+			fetchNext = (fetchNext + 1) % FetchCacheLines;
+			linesFetched++;
+		}
+	}
+
+	stats.ACMR = (float)transformed / (numIndices / 3);
+	stats.ATVR = (float)transformed / uniqueVerts;
+	stats.Overfetch = (float)(linesFetched * FetchCacheLineSize) / (uniqueVerts * vertexSize);
+	return stats;
+}
+
+
+// --------------------------------------------------------
+// Simplifies a mesh with quadric error metrics, collapsing
+// vertices into their neighbours (never creating new ones),
+// so the result can share the original vertex buffer.
+// Vertices on open borders only slide along the border, and
+// vertices on UV/normal seams only slide along the seam (with
+// their twin on the other side), which keeps seams and the
+// silhouettes of open meshes intact.  Corners and other
+// tangled spots never move.
+//
+// Collapses happen in passes: each pass sorts every possible
+// collapse by error and applies the cheapest ones that don't
+// touch each other or flip triangles, until enough triangles
+// have been removed or nothing more can be collapsed.
+//
+// destIndices      - Array of at least numIndices for the results
+// verts            - The mesh's vertices
+// numVerts         - How many vertices are in the array
+// indices          - The mesh's original indices
+// numIndices       - How many indices are in the array
+// targetIndexCount - The index count to aim for
+// resultError      - Optional: the largest collapse error, as a
+//                    distance relative to the mesh's size
+//
+// Returns the number of indices written
+// --------------------------------------------------------
+unsigned int MeshProcessing::Simplify(
+	unsigned int* destIndices,
+	const Vertex* verts,
+	unsigned int numVerts,
+	const unsigned int* indices,
+	unsigned int numIndices,
+	unsigned int targetIndexCount,
+	float* resultError)
+{
+	std::vector<unsigned int> current(indices, indices + numIndices - numIndices % 3);
+	std::vector<unsigned int> nextAtPosition = BuildPositionRings(verts, numVerts);
+
+	// Each vertex starts with the planes of all triangles around it
+	std::vector<Quadric> quadrics(numVerts, Quadric{});
+	for (size_t i = 0; i < current.size(); i += 3)
+	{
+		Quadric q = TriangleQuadric(verts[current[i]].Position, verts[current[i + 1]].Position, verts[current[i + 2]].Position);
+		for (int c = 0; c < 3; c++)
+			quadrics[current[i + c]].Add(q);
+	}
+
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> vertexTriangles;
+	VertexTopology topology;
+	unsigned int currentCount = (unsigned int)current.size();
+	BuildVertexTriangles(current.data(), currentCount, numVerts, offsets, vertexTriangles);
+
+	// Borders & seams also get the planes along their open edges
+	for (unsigned int i = 0; i < currentCount; i += 3)
+	{
+		for (unsigned int e = 0; e < 3; e++)
+		{
+			unsigned int a = current[i + e];
+			unsigned int b = current[i + (e + 1) % 3];
+			if (HasEdge(current.data(), offsets, vertexTriangles, b, a))
+				continue;
+
+			Quadric q = BorderQuadric(verts[a].Position, verts[b].Position, verts[current[i + (e + 2) % 3]].Position);
+			quadrics[a].Add(q);
+			quadrics[b].Add(q);
+		}
+	}
+
+	double maxError = 0;
+	std::vector<Collapse> collapses;
+	std::vector<unsigned int> remap(numVerts);
+	std::vector<bool> touched(numVerts);
+
+	// Error of moving one vertex onto another, with both vertices' planes
+	auto CollapseError = [&](unsigned int from, unsigned int to)
+		{
+			Quadric combined = quadrics[from];
+			combined.Add(quadrics[to]);
+			return combined.Evaluate(verts[to].Position);
+		};
+
+	while (current.size() > targetIndexCount)
+	{
+		currentCount = (unsigned int)current.size();
+		BuildVertexTriangles(current.data(), currentCount, numVerts, offsets, vertexTriangles);
+		ClassifyVertices(verts, current.data(), currentCount, numVerts, offsets, vertexTriangles, nextAtPosition, topology);
+
+		// Every edge can collapse either way, if its moving vertex allows it.
+		// Seam vertices bring their twin along, so pay for both collapses.
+		collapses.clear();
+		for (unsigned int i = 0; i < currentCount; i += 3)
+		{
+			for (unsigned int e = 0; e < 3; e++)
+			{
+				unsigned int a = current[i + e];
+				unsigned int b = current[i + (e + 1) % 3];
+				for (int direction = 0; direction < 2; direction++)
+				{
+					unsigned int from = direction ? b : a;
+					unsigned int to = direction ? a : b;
+					if (!CanCollapse(topology, from, to))
+						continue;
+
+					double error = CollapseError(from, to);
+					if (topology.Kinds[from] == VertexKind::Seam)
+					{
+						unsigned int twin = nextAtPosition[from];
+						error += CollapseError(twin, SeamTwinTarget(topology, twin, from, to));
+					}
+					collapses.push_back({ from, to, error });
+				}
+			}
+		}
+		if (collapses.empty())
+			break;
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.Error < y.Error; });
+
+		// Apply the cheapest independent collapses
+		for (unsigned int v = 0; v < numVerts; v++)
+			remap[v] = v;
+		std::fill(touched.begin(), touched.end(), false);
+
+		unsigned int trianglesToRemove = (currentCount - targetIndexCount + 2) / 3;
+		unsigned int trianglesRemoved = 0;
+		for (const Collapse& collapse : collapses)
+		{
+			if (trianglesRemoved >= trianglesToRemove)
+				break;
+
+			// The vertex moves, as does its twin if it's on a seam
+			unsigned int moves[2][2] = { { collapse.From, collapse.To } };
+			unsigned int moveCount = 1;
+			if (topology.Kinds[collapse.From] == VertexKind::Seam)
+			{
+				unsigned int twin = nextAtPosition[collapse.From];
+				moves[1][0] = twin;
+				moves[1][1] = SeamTwinTarget(topology, twin, collapse.From, collapse.To);
+				moveCount = 2;
+			}
+
+			bool blocked = false;
+			for (unsigned int m = 0; m < moveCount && !blocked; m++)
+			{
+				unsigned int from = moves[m][0];
+				unsigned int to = moves[m][1];
+				blocked = touched[from] || touched[to] || CollapseFlipsTriangle(verts, current.data(), remap,
+					&vertexTriangles[offsets[from]], offsets[from + 1] - offsets[from], from, to);
+			}
+			if (blocked)
+				continue;
+
+			for (unsigned int m = 0; m < moveCount; m++)
+			{
+				unsigned int from = moves[m][0];
+				unsigned int to = moves[m][1];
+				const unsigned int* fromTriangles = &vertexTriangles[offsets[from]];
+				unsigned int fromTriangleCount = offsets[from + 1] - offsets[from];
+
+				// Count the triangles that will disappear along with the edge
+				for (unsigned int t = 0; t < fromTriangleCount; t++)
+				{
+					const unsigned int* tri = &current[fromTriangles[t] * 3];
+					if (tri[0] == to || tri[1] == to || tri[2] == to)
+						trianglesRemoved++;
+				}
+
+				remap[from] = to;
+				quadrics[to].Add(quadrics[from]);
+				touched[from] = true;
+				touched[to] = true;
+
+				// Neighbours of the moved vertex can't safely collapse this pass either
+				for (unsigned int t = 0; t < fromTriangleCount; t++)
+				{
+					const unsigned int* tri = &current[fromTriangles[t] * 3];
+					touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+				}
+			}
+
+			if (collapse.Error > maxError)
+				maxError = collapse.Error;
+		}
+		if (trianglesRemoved == 0)
+			break;
+
+		// Rebuild the triangle list without the collapsed triangles
+		unsigned int kept = 0;
+		for (unsigned int i = 0; i < currentCount; i += 3)
+		{
+			unsigned int a = remap[current[i]];
+			unsigned int b = remap[current[i + 1]];
+			unsigned int c = remap[current[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+
+			current[kept++] = a;
+			current[kept++] = b;
+			current[kept++] = c;
+		}
+		current.resize(kept);
+	}
+
+	// Report error relative to the size of the mesh so it's comparable across meshes
+	if (resultError)
+	{
+		XMFLOAT3 boundsMin, boundsMax;
+		CalculateBounds(verts, numVerts, boundsMin, boundsMax);
+		float extent = std::fmax(boundsMax.x - boundsMin.x, std::fmax(boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z));
+		*resultError = extent > 0 ? (float)std::sqrt(maxError) / extent : 0.0f;
+	}
+
+	memcpy(destIndices, current.data(), sizeof(unsigned int) * current.size());
+	return (unsigned int)current.size();
+}
+
+
+// --------------------------------------------------------
+// Calculates tangents for every vertex of a set of indexed
+// triangles, including handedness in the tangent's W (the
+// bitangent is cross(normal, tangent.xyz) * tangent.w).
+//
+// Triangles are split into ranges across threads, each of
+// which accumulates into its own arrays so no locking is
+// needed.  The accumulators are then summed, orthonormalized
+// and stored in parallel across ranges of vertices, 4 at a
+// time with one vertex per SIMD lane.
+//
+// verts      - The vertices whose tangents will be replaced
+// numVerts   - How many vertices are in the array
+// indices    - The indices making up the triangles
+// numIndices - How many indices are in the array
+//
+// Returns how many threads were used
+// --------------------------------------------------------
+unsigned int MeshProcessing::CalculateTangents(Vertex* verts, unsigned int numVerts, const unsigned int* indices, unsigned int numIndices)
+{
+	size_t numTris = numIndices / 3;
+	size_t paddedVerts = ((size_t)numVerts + 3) & ~(size_t)3;
+
+	// Each thread needs its own set of accumulators, so limit
+	// thread count by memory as well as by the amount of work
+	size_t accumulatorBytes = paddedVerts * sizeof(TangentSum);
+	size_t maxThreadsForMemory = accumulatorBytes > 0 ? MaxTangentAccumulatorBytes / accumulatorBytes : 1;
+	unsigned int threads = Parallel::ThreadCountFor(numTris, MinTrianglesPerThread, (unsigned int)(maxThreadsForMemory > 0 ? maxThreadsForMemory : 1));
+
+	// Accumulate per-triangle tangents
+	std::vector<TangentAccumulator> accumulators(threads);
+	Parallel::ForRanges(numTris, threads, [&](unsigned int t, size_t start, size_t end)
+		{
+			TangentAccumulator& acc = accumulators[t];
+			acc.Sums.assign(paddedVerts, TangentSum{});
+
+			AccumulateTriangleTangents(verts, indices, start, end, acc);
+		});
+
+	// Combine and finalize each vertex, keeping ranges a multiple of 4
+	size_t vertGroups = paddedVerts / 4;
+	unsigned int finalizeThreads = Parallel::ThreadCountFor(numVerts, MinVertsPerThread);
+	Parallel::ForRanges(vertGroups, finalizeThreads, [&](unsigned int, size_t start, size_t end)
+		{
+			size_t firstVert = start * 4;
+			size_t endVert = end * 4 < numVerts ? end * 4 : numVerts;
+			FinalizeTangents(verts, firstVert, endVert, accumulators);
+		});
+
+	return threads;
+}
+
+
+// --------------------------------------------------------
+// Calculates the axis-aligned bounding box of a set of
+// vertex positions.  Empty sets result in zero bounds.
+// --------------------------------------------------------
+void MeshProcessing::CalculateBounds(const Vertex* verts, unsigned int numVerts, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax)
+{
+	if (numVerts == 0)
+	{
+		boundsMin = XMFLOAT3(0, 0, 0);
+		boundsMax = XMFLOAT3(0, 0, 0);
+		return;
+	}
+
+	XMVECTOR minV = XMLoadFloat3(&verts[0].Position);
+	XMVECTOR maxV = minV;
+	for (unsigned int i = 1; i < numVerts; i++)
+	{
+		XMVECTOR pos = XMLoadFloat3(&verts[i].Position);
+		minV = XMVectorMin(minV, pos);
+		maxV = XMVectorMax(maxV, pos);
+	}
+
+	XMStoreFloat3(&boundsMin, minV);
+	XMStoreFloat3(&boundsMax, maxV);
+}
+
+
+// --------------------------------------------------------
+// Hashes a block of memory 8 bytes at a time (in the style
+// of xxHash64's single lane).  This is used to identify mesh
+// contents, so it needs to be quick rather than secure.
+//
+// data - The data to hash
+// size - Size of the data in bytes
+// seed - Starting value, allowing several blocks to be chained
+// --------------------------------------------------------
+unsigned long long MeshProcessing::HashData(const void* data, size_t size, unsigned long long seed)
+{
+	const unsigned long long Prime1 = 0x9E3779B185EBCA87ull;
+	const unsigned long long Prime2 = 0xC2B2AE3D27D4EB4Full;
+	const unsigned long long Prime3 = 0x165667B19E3779F9ull;
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	unsigned long long hash = seed + Prime3 + size * Prime1;
+
+	// Bulk of the data, one 64-bit word at a time
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, bytes + i, 8);
+
+		word *= Prime2;
+		word = (word << 31) | (word >> 33);
+		word *= Prime1;
+
+		hash ^= word;
+		hash = ((hash << 27) | (hash >> 37)) * Prime1 + Prime3;
+	}
+
+	// Any leftover bytes
+	for (; i < size; i++)
+	{
+		hash ^= bytes[i] * Prime3;
+		hash = ((hash << 11) | (hash >> 53)) * Prime1;
+	}
+
+	// Final mix so every input bit affects every output bit
+	hash ^= hash >> 33;
+	hash *= Prime2;
+	hash ^= hash >> 29;
+	hash *= Prime3;
+	hash ^= hash >> 32;
+	return hash;
+}
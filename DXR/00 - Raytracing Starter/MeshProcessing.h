@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Vertex.h"
+
+// --------------------------------------------------------
+// Simulated GPU cache behaviour of an index buffer
+//
+// ACMR      - Average cache miss ratio: vertices transformed per
+//             triangle (0.5 is ideal for large regular meshes, 3 is worst)
+// ATVR      - Average transformed vertex ratio: vertices transformed per
+//             unique vertex (1.0 is ideal)
+// Overfetch - Vertex buffer bytes pulled into cache per byte of
+//             vertex data (1.0 is ideal)
+// --------------------------------------------------------
+struct VertexCacheStats
+{
+	float ACMR;
+	float ATVR;
+	float Overfetch;
+};
+
+// --------------------------------------------------------
+// CPU-side processing helpers for raw vertex & index data,
+// used while building meshes before anything reaches the GPU
+// --------------------------------------------------------
+namespace MeshProcessing
+{
+	// Merges vertices with identical attributes and remaps indices
+	unsigned int WeldVertices(
+		Vertex* verts,
+		unsigned int numVerts,
+		unsigned int* indices,
+		unsigned int numIndices);
+
+	// Handedness-aware tangents for indexed triangles (returns threads used)
+	unsigned int CalculateTangents(
+		Vertex* verts,
+		unsigned int numVerts,
+		const unsigned int* indices,
+		unsigned int numIndices);
+
+	// Reorders triangles to reuse recently transformed vertices (Tipsify)
+	void OptimizeVertexCache(
+		unsigned int* indices,
+		unsigned int numIndices,
+		unsigned int numVerts,
+		unsigned int cacheSize = 16);
+
+	// Reorders vertices into first-use order (returns how many are still used)
+	unsigned int OptimizeVertexFetch(
+		Vertex* verts,
+		unsigned int numVerts,
+		unsigned int* indices,
+		unsigned int numIndices);
+
+	// Simulates post-transform & vertex fetch caches for an index buffer
+	VertexCacheStats AnalyzeVertexCache(
+		const unsigned int* indices,
+		unsigned int numIndices,
+		unsigned int numVerts,
+		size_t vertexSize,
+		unsigned int cacheSize = 16);
+
+	// Collapses edges (keeping seams & borders) until the index count is at
+	// or below the target, writing new indices into the same vertices
+	unsigned int Simplify(
+		unsigned int* destIndices,
+		const Vertex* verts,
+		unsigned int numVerts,
+		const unsigned int* indices,
+		unsigned int numIndices,
+		unsigned int targetIndexCount,
+		float* resultError = 0);
+
+	// Axis-aligned bounds of a set of vertices
+	void CalculateBounds(
+		const Vertex* verts,
+		unsigned int numVerts,
+		DirectX::XMFLOAT3& boundsMin,
+		DirectX::XMFLOAT3& boundsMax);
+
+	// Fast, non-cryptographic 64-bit hash of arbitrary data
+	unsigned long long HashData(const void* data, size_t size, unsigned long long seed = 0);
+}
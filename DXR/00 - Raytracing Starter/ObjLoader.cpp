@@ -0,0 +1,295 @@
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+using namespace DirectX;
+
+namespace ObjLoader
+{
+	// Annonymous namespace to hold helpers
+	// only accessible in this file
+	namespace
+	{
+		// Files smaller than this per thread aren't worth splitting up
+		const size_t MinBytesPerChunk = 256 * 1024;
+
+		// Bits in ObjChunk::CornerFlags marking relative (negative) indices
+		const unsigned char RelativePosition = 1 << 0;
+		const unsigned char RelativeUV = 1 << 1;
+		const unsigned char RelativeNormal = 1 << 2;
+
+		// Everything parsed from one newline-aligned slice of the file
+		struct ObjChunk
+		{
+			const char* Start;
+			const char* End;
+
+			std::vector<XMFLOAT3> Positions;
+			std::vector<XMFLOAT2> UVs;
+			std::vector<XMFLOAT3> Normals;
+			std::vector<ObjCorner> Corners;
+			std::vector<unsigned char> CornerFlags;
+		};
+
+		bool IsSpace(char c) { return c == ' ' || c == '\t'; }
+
+		const char* SkipSpaces(const char* p, const char* end)
+		{
+			while (p < end && IsSpace(*p)) p++;
+			return p;
+		}
+
+		// Reads a single float, leaving "value" at zero if there isn't one
+		const char* ReadFloat(const char* p, const char* end, float& value)
+		{
+			p = SkipSpaces(p, end);
+			if (p < end && *p == '+') p++; // from_chars doesn't accept a leading plus
+
+			std::from_chars_result result = std::from_chars(p, end, value);
+			if (result.ec != std::errc()) return p;
+			return result.ptr;
+		}
+
+		// Reads a single (possibly negative) integer, leaving "value" at zero if there isn't one
+		const char* ReadInt(const char* p, const char* end, int& value)
+		{
+			if (p < end && *p == '+') p++;
+
+			std::from_chars_result result = std::from_chars(p, end, value);
+			if (result.ec != std::errc()) return p;
+			return result.ptr;
+		}
+
+		// Converts a one-based OBJ index to zero-based.  Negative indices
+		// are relative to the count of elements read so far, which in
+		// a chunk is only the local count, so those are flagged and
+		// finished off once the chunks are merged.
+		int ResolveIndex(int objIndex, size_t localCount, unsigned char relativeBit, unsigned char& flags)
+		{
+			if (objIndex > 0) return objIndex - 1;
+			if (objIndex == 0) return -1;
+
+			flags |= relativeBit;
+			return (int)localCount + objIndex;
+		}
+
+		// Reads one "v/vt/vn" group from a face line
+		const char* ReadCorner(const char* p, const char* end, ObjChunk& chunk, ObjCorner& corner, unsigned char& flags)
+		{
+			int v = 0, vt = 0, vn = 0;
+
+			p = ReadInt(p, end, v);
+			if (p < end && *p == '/')
+			{
+				p++;
+				if (p < end && *p != '/')
+					p = ReadInt(p, end, vt);
+
+				if (p < end && *p == '/')
+				{
+					p++;
+					p = ReadInt(p, end, vn);
+				}
+			}
+
+			flags = 0;
+			corner.Position = ResolveIndex(v, chunk.Positions.size(), RelativePosition, flags);
+			corner.UV = vt == 0 ? -1 : ResolveIndex(vt, chunk.UVs.size(), RelativeUV, flags);
+			corner.Normal = vn == 0 ? -1 : ResolveIndex(vn, chunk.Normals.size(), RelativeNormal, flags);
+
+			// Skip anything odd that's left of this group
+			while (p < end && !IsSpace(*p)) p++;
+			return p;
+		}
+
+		// Reads an entire face line, triangulating it as a fan
+		void ReadFace(const char* p, const char* end, ObjChunk& chunk)
+		{
+			ObjCorner first{}, previous{};
+			unsigned char firstFlags = 0, previousFlags = 0;
+			int cornerCount = 0;
+
+			while ((p = SkipSpaces(p, end)) < end)
+			{
+				ObjCorner corner{};
+				unsigned char flags = 0;
+				p = ReadCorner(p, end, chunk, corner, flags);
+
+				if (cornerCount == 0) { first = corner; firstFlags = flags; }
+				else if (cornerCount >= 2)
+				{
+					chunk.Corners.push_back(first);
+					chunk.Corners.push_back(previous);
+					chunk.Corners.push_back(corner);
+					chunk.CornerFlags.push_back(firstFlags);
+					chunk.CornerFlags.push_back(previousFlags);
+					chunk.CornerFlags.push_back(flags);
+				}
+
+				previous = corner;
+				previousFlags = flags;
+				cornerCount++;
+			}
+		}
+
+		// Parses every line of a single chunk
+		void ParseChunk(ObjChunk& chunk)
+		{
+			const char* p = chunk.Start;
+			const char* end = chunk.End;
+
+			while (p < end)
+			{
+				// Find the extent of this line (no length limit)
+				const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+				if (!lineEnd) lineEnd = end;
+
+				const char* next = lineEnd + (lineEnd < end ? 1 : 0);
+				if (lineEnd > p && lineEnd[-1] == '\r') lineEnd--;
+
+				p = SkipSpaces(p, lineEnd);
+				if (lineEnd - p >= 2)
+				{
+					if (p[0] == 'v' && IsSpace(p[1]))
+					{
+						XMFLOAT3 pos{};
+						const char* c = ReadFloat(p + 2, lineEnd, pos.x);
+						c = ReadFloat(c, lineEnd, pos.y);
+						ReadFloat(c, lineEnd, pos.z);
+						chunk.Positions.push_back(pos);
+					}
+					else if (p[0] == 'v' && p[1] == 't')
+					{
+						XMFLOAT2 uv{};
+						const char* c = ReadFloat(p + 2, lineEnd, uv.x);
+						ReadFloat(c, lineEnd, uv.y);
+						chunk.UVs.push_back(uv);
+					}
+					else if (p[0] == 'v' && p[1] == 'n')
+					{
+						XMFLOAT3 norm{};
+						const char* c = ReadFloat(p + 2, lineEnd, norm.x);
+						c = ReadFloat(c, lineEnd, norm.y);
+						ReadFloat(c, lineEnd, norm.z);
+						chunk.Normals.push_back(norm);
+					}
+					else if (p[0] == 'f' && IsSpace(p[1]))
+					{
+						ReadFace(p + 2, lineEnd, chunk);
+					}
+				}
+
+				p = next;
+			}
+		}
+
+		// Turns a chunk-relative index into a file-wide one, invalidating anything out of range
+		int FinalizeIndex(int index, bool relative, size_t chunkOffset, size_t totalCount)
+		{
+			if (relative) index += (int)chunkOffset;
+			return (index >= 0 && (size_t)index < totalCount) ? index : -1;
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Memory maps an OBJ file and parses it.  Returns false
+// if the file can't be opened.
+//
+// file       - The OBJ file to load
+// data       - The parsed data (replaced entirely)
+// maxThreads - Upper limit on worker threads (0 = one per core)
+// --------------------------------------------------------
+bool ObjLoader::Load(const wchar_t* file, ObjData& data, unsigned int maxThreads)
+{
+	MappedFile mapped;
+	if (!mapped.Open(file))
+		return false;
+
+	Parse(mapped.GetData(), mapped.GetSize(), data, maxThreads);
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Parses OBJ text in parallel.  The text is split into
+// roughly equal, newline-aligned chunks which are parsed
+// on separate threads and then merged back together in
+// file order, so the results are identical regardless of
+// how many threads did the work.
+//
+// text       - The OBJ file's contents (need not be null terminated)
+// size       - Size of the text in bytes
+// data       - The parsed data (replaced entirely)
+// maxThreads - Upper limit on worker threads (0 = one per core)
+// --------------------------------------------------------
+void ObjLoader::Parse(const char* text, size_t size, ObjData& data, unsigned int maxThreads)
+{
+	data = {};
+
+	// How many chunks are worth making?
+	size_t chunkCount = Parallel::ThreadCountFor(size, MinBytesPerChunk, maxThreads);
+
+	// Split into chunks, pushing each split point forward to the next line
+	std::vector<ObjChunk> chunks(chunkCount);
+	const char* end = text + size;
+	const char* chunkStart = text;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		const char* chunkEnd = (i == chunkCount - 1) ? end : text + size * (i + 1) / chunkCount;
+		if (chunkEnd < chunkStart) chunkEnd = chunkStart;
+
+		const char* newline = (const char*)memchr(chunkEnd, '\n', end - chunkEnd);
+		chunkEnd = newline ? newline + 1 : end;
+
+		chunks[i].Start = chunkStart;
+		chunks[i].End = chunkEnd;
+		chunkStart = chunkEnd;
+	}
+
+	// Parse all of the chunks at once
+	Parallel::Run(chunkCount, [&](size_t i) { ParseChunk(chunks[i]); });
+
+	// Determine where each chunk's data lands in the final arrays
+	std::vector<size_t> positionOffsets(chunkCount), uvOffsets(chunkCount), normalOffsets(chunkCount), cornerOffsets(chunkCount);
+	size_t positionCount = 0, uvCount = 0, normalCount = 0, cornerCount = 0;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		positionOffsets[i] = positionCount; positionCount += chunks[i].Positions.size();
+		uvOffsets[i] = uvCount; uvCount += chunks[i].UVs.size();
+		normalOffsets[i] = normalCount; normalCount += chunks[i].Normals.size();
+		cornerOffsets[i] = cornerCount; cornerCount += chunks[i].Corners.size();
+	}
+
+	data.Positions.resize(positionCount);
+	data.UVs.resize(uvCount);
+	data.Normals.resize(normalCount);
+	data.Corners.resize(cornerCount);
+	data.ThreadCount = (unsigned int)chunkCount;
+
+	// Merge in file order, each chunk writing its own disjoint range
+	Parallel::Run(chunkCount, [&](size_t i)
+		{
+			ObjChunk& chunk = chunks[i];
+			std::copy(chunk.Positions.begin(), chunk.Positions.end(), data.Positions.begin() + positionOffsets[i]);
+			std::copy(chunk.UVs.begin(), chunk.UVs.end(), data.UVs.begin() + uvOffsets[i]);
+			std::copy(chunk.Normals.begin(), chunk.Normals.end(), data.Normals.begin() + normalOffsets[i]);
+
+			for (size_t c = 0; c < chunk.Corners.size(); c++)
+			{
+				ObjCorner corner = chunk.Corners[c];
+				unsigned char flags = chunk.CornerFlags[c];
+
+				corner.Position = FinalizeIndex(corner.Position, flags & RelativePosition, positionOffsets[i], positionCount);
+				corner.UV = FinalizeIndex(corner.UV, flags & RelativeUV, uvOffsets[i], uvCount);
+				corner.Normal = FinalizeIndex(corner.Normal, flags & RelativeNormal, normalOffsets[i], normalCount);
+
+				data.Corners[cornerOffsets[i] + c] = corner;
+			}
+		});
+}
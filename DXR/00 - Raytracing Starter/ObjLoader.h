@@ -0,0 +1,43 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+// --------------------------------------------------------
+// One corner of a triangle from an OBJ file.  Each member
+// is a zero-based index into the corresponding ObjData
+// array, or -1 if the file didn't supply that attribute
+// (or supplied an index that was out of range).
+// --------------------------------------------------------
+struct ObjCorner
+{
+	int Position;
+	int UV;
+	int Normal;
+};
+
+// --------------------------------------------------------
+// Raw data parsed from an OBJ file, exactly as it appears
+// in the file (no handedness or UV conversion).  Faces are
+// already triangulated as fans, so every 3 corners form
+// one triangle in the file's original winding order.
+// --------------------------------------------------------
+struct ObjData
+{
+	std::vector<DirectX::XMFLOAT3> Positions;
+	std::vector<DirectX::XMFLOAT2> UVs;
+	std::vector<DirectX::XMFLOAT3> Normals;
+	std::vector<ObjCorner> Corners;
+
+	// How many threads were used for the parse
+	unsigned int ThreadCount = 0;
+};
+
+namespace ObjLoader
+{
+	// Memory maps and parses an entire OBJ file
+	bool Load(const wchar_t* file, ObjData& data, unsigned int maxThreads = 0);
+
+	// Parses OBJ text already in memory
+	void Parse(const char* text, size_t size, ObjData& data, unsigned int maxThreads = 0);
+}
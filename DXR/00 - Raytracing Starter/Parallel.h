@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "JobSystem.h"
+
+// --------------------------------------------------------
+// Small helpers for splitting CPU work across cores
+//
+// Work runs on the JobSystem's workers (plus the calling
+// thread), rather than on threads of its own, so nested
+// use (like a parallel BVH build inside a parallel load)
+// never has more threads than cores.  Without workers,
+// everything runs on the calling thread.
+// --------------------------------------------------------
+namespace Parallel
+{
+	// --------------------------------------------------------
+	// How many threads to use for "count" items of work, where
+	// each thread should get at least "minItemsPerThread" items
+	// --------------------------------------------------------
+	inline unsigned int ThreadCountFor(size_t count, size_t minItemsPerThread, unsigned int maxThreads = 0)
+	{
+		size_t threads = (size_t)JobSystem::GetThreadCount() + 1;
+		if (maxThreads > 0 && threads > maxThreads) threads = maxThreads;
+		if (minItemsPerThread > 0 && threads > count / minItemsPerThread) threads = count / minItemsPerThread;
+		return threads > 0 ? (unsigned int)threads : 1;
+	}
+
+	// --------------------------------------------------------
+	// Runs func(i) once for every i in [0, count), returning
+	// when they've all finished.  The calling thread runs
+	// indices itself until none are left to start, with the
+	// JobSystem's workers helping as they become free, so it
+	// only ever waits on indices that are already running.
+	// That keeps nested calls from a worker deadlock-free.
+	//
+	// Each index runs on a single thread, but several can run
+	// one after another on the same thread.
+	// --------------------------------------------------------
+	template<typename Func>
+	void Run(size_t count, Func func)
+	{
+		if (count == 0)
+			return;
+
+		// Nobody to help?  Skip the bookkeeping
+		size_t helpers = JobSystem::GetThreadCount();
+		if (helpers > count - 1) helpers = count - 1;
+		if (helpers == 0)
+		{
+			for (size_t i = 0; i < count; i++)
+				func(i);
+			return;
+		}
+
+		// Shared with the helpers, which might not start until after
+		// this returns (and then find nothing left to do)
+		struct RunState
+		{
+			std::atomic<size_t> Next = 0;
+			std::atomic<size_t> Finished = 0;
+		};
+		std::shared_ptr<RunState> state = std::make_shared<RunState>();
+
+		// Only touches func after claiming an index, which Run() waits for
+		auto work = [state, count, &func]()
+			{
+				for (size_t i = state->Next++; i < count; i = state->Next++)
+				{
+					func(i);
+					if (++state->Finished == count)
+						state->Finished.notify_all();
+				}
+			};
+
+		for (size_t h = 0; h < helpers; h++)
+			JobSystem::Enqueue(work);
+		work();
+
+		// Whatever's left is already running elsewhere
+		for (size_t finished = state->Finished; finished < count; finished = state->Finished)
+			state->Finished.wait(finished);
+	}
+
+	// --------------------------------------------------------
+	// Splits [0, count) into "threads" contiguous ranges and
+	// runs func(threadIndex, start, end) for each in parallel
+	// --------------------------------------------------------
+	template<typename Func>
+	void ForRanges(size_t count, unsigned int threads, Func func)
+	{
+		Run(threads, [&](size_t t)
+			{
+				size_t start = count * t / threads;
+				size_t end = count * (t + 1) / threads;
+				func((unsigned int)t, start, end);
+			});
+	}
+}
@@ -0,0 +1,79 @@
+#include "ProceduralMeshes.h"
+
+#include <DirectXMath.h>
+#include <cmath>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Heights are 0.05 * sin(40u) * cos(30v), with normals from
+// the slope of that along each axis
+// --------------------------------------------------------
+void ProceduralMeshes::MakeBumpyGrid(unsigned int size, std::vector<Vertex>& verts, std::vector<unsigned int>& indices)
+{
+	verts.resize((size + 1) * (size + 1));
+	for (unsigned int y = 0; y <= size; y++)
+	{
+		for (unsigned int x = 0; x <= size; x++)
+		{
+			float u = (float)x / size;
+			float v = (float)y / size;
+			float slopeX = 2.0f * cosf(u * 40.0f) * cosf(v * 30.0f);
+			float slopeZ = -1.5f * sinf(u * 40.0f) * sinf(v * 30.0f);
+
+			Vertex& vert = verts[y * (size + 1) + x];
+			vert = {};
+			vert.Position = XMFLOAT3(u - 0.5f, 0.05f * sinf(u * 40.0f) * cosf(v * 30.0f), v - 0.5f);
+			XMStoreFloat3(&vert.Normal, XMVector3Normalize(XMVectorSet(-slopeX, 1.0f, -slopeZ, 0.0f)));
+			vert.UV = XMFLOAT2(u, v);
+		}
+	}
+
+	indices.clear();
+	indices.reserve((size_t)size * size * 6);
+	for (unsigned int y = 0; y < size; y++)
+	{
+		for (unsigned int x = 0; x < size; x++)
+		{
+			unsigned int i = y * (size + 1) + x;
+			indices.insert(indices.end(), { i, i + size + 1, i + 1, i + 1, i + size + 1, i + size + 2 });
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Rings of vertices from the top pole down, with a seam
+// (duplicated vertices) where U wraps around
+// --------------------------------------------------------
+void ProceduralMeshes::MakeSphere(unsigned int slices, unsigned int stacks, std::vector<Vertex>& verts, std::vector<unsigned int>& indices)
+{
+	const float pi = 3.14159265f;
+	verts.clear();
+	for (unsigned int y = 0; y <= stacks; y++)
+	{
+		float v = (float)y / stacks;
+		float phi = v * pi;
+		for (unsigned int x = 0; x <= slices; x++)
+		{
+			float u = (float)x / slices;
+			float theta = u * 2.0f * pi;
+
+			Vertex vert = {};
+			vert.Normal = XMFLOAT3(sinf(phi) * cosf(theta), cosf(phi), sinf(phi) * sinf(theta));
+			vert.Position = XMFLOAT3(vert.Normal.x * 0.5f, vert.Normal.y * 0.5f, vert.Normal.z * 0.5f);
+			vert.UV = XMFLOAT2(u, v);
+			verts.push_back(vert);
+		}
+	}
+
+	indices.clear();
+	for (unsigned int y = 0; y < stacks; y++)
+	{
+		for (unsigned int x = 0; x < slices; x++)
+		{
+			unsigned int i = y * (slices + 1) + x;
+			indices.insert(indices.end(), { i, i + 1, i + slices + 1, i + 1, i + slices + 2, i + slices + 1 });
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+
+#include "Vertex.h"
+
+// --------------------------------------------------------
+// Generated meshes for benchmarks, tests and the headless
+// renderer, so they don't depend on asset files
+// --------------------------------------------------------
+namespace ProceduralMeshes
+{
+	// --------------------------------------------------------
+	// A size x size grid of quads on the XZ plane, 1 unit
+	// across and centered on the origin, with enough bumps
+	// that the triangles aren't all perfectly axis aligned.
+	// Normals follow the bumps, and UVs run 0-1 across it.
+	// --------------------------------------------------------
+	void MakeBumpyGrid(unsigned int size, std::vector<Vertex>& verts, std::vector<unsigned int>& indices);
+
+	// A UV sphere of radius 0.5 at the origin, standing in for sphere.obj,
+	// and clockwise when viewed from outside like the OBJ loader's output
+	void MakeSphere(unsigned int slices, unsigned int stacks, std::vector<Vertex>& verts, std::vector<unsigned int>& indices);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// --------------------------------------------------------
+// Basic ray intersection tests shared by the CPU raytracer
+// and acceleration structures.  Like DXR, triangles are
+// two-sided and barycentrics are the weights of the 2nd
+// and 3rd vertices.
+// --------------------------------------------------------
+namespace RayIntersection
+{
+	// --------------------------------------------------------
+	// Slab test of a ray against an axis-aligned box, limited
+	// to [tMin, tMax].  Takes the reciprocal of the ray's
+	// direction, since that's shared by every box a ray tests.
+	// tEntry is where the ray enters the box (clamped to tMin).
+	// --------------------------------------------------------
+	inline bool RayBox(
+		const DirectX::XMFLOAT3& origin,
+		const DirectX::XMFLOAT3& invDir,
+		const DirectX::XMFLOAT3& boundsMin,
+		const DirectX::XMFLOAT3& boundsMax,
+		float tMin,
+		float tMax,
+		float& tEntry)
+	{
+		// Division by zero gives infinities, which the comparisons handle
+		float tx0 = (boundsMin.x - origin.x) * invDir.x;
+		float tx1 = (boundsMax.x - origin.x) * invDir.x;
+		float ty0 = (boundsMin.y - origin.y) * invDir.y;
+		float ty1 = (boundsMax.y - origin.y) * invDir.y;
+		float tz0 = (boundsMin.z - origin.z) * invDir.z;
+		float tz1 = (boundsMax.z - origin.z) * invDir.z;
+
+		float tNear = tMin;
+		float tFar = tMax;
+		if (tx0 > tx1) { float swap = tx0; tx0 = tx1; tx1 = swap; }
+		if (ty0 > ty1) { float swap = ty0; ty0 = ty1; ty1 = swap; }
+		if (tz0 > tz1) { float swap = tz0; tz0 = tz1; tz1 = swap; }
+		if (tx0 > tNear) tNear = tx0;
+		if (ty0 > tNear) tNear = ty0;
+		if (tz0 > tNear) tNear = tz0;
+		if (tx1 < tFar) tFar = tx1;
+		if (ty1 < tFar) tFar = ty1;
+		if (tz1 < tFar) tFar = tz1;
+
+		tEntry = tNear;
+		return tNear <= tFar;
+	}
+
+	// --------------------------------------------------------
+	// Moller-Trumbore ray/triangle test with no culling.  Gives
+	// the distance along the ray, which the caller compares
+	// against its own [tMin, tMax].
+	// --------------------------------------------------------
+	inline bool RayTriangle(
+		DirectX::FXMVECTOR origin,
+		DirectX::FXMVECTOR dir,
+		DirectX::FXMVECTOR p0,
+		DirectX::GXMVECTOR p1,
+		DirectX::HXMVECTOR p2,
+		float& t,
+		DirectX::XMFLOAT2& barycentrics)
+	{
+		using namespace DirectX;
+
+		XMVECTOR edge1 = XMVectorSubtract(p1, p0);
+		XMVECTOR edge2 = XMVectorSubtract(p2, p0);
+		XMVECTOR p = XMVector3Cross(dir, edge2);
+		float det = XMVectorGetX(XMVector3Dot(edge1, p));
+		if (det == 0.0f)
+			return false;
+
+		float invDet = 1.0f / det;
+		XMVECTOR toOrigin = XMVectorSubtract(origin, p0);
+		float u = XMVectorGetX(XMVector3Dot(toOrigin, p)) * invDet;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+
+		XMVECTOR q = XMVector3Cross(toOrigin, edge1);
+		float v = XMVectorGetX(XMVector3Dot(dir, q)) * invDet;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+
+		t = XMVectorGetX(XMVector3Dot(edge2, q)) * invDet;
+		barycentrics = XMFLOAT2(u, v);
+		return true;
+	}
+}
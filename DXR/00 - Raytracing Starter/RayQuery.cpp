@@ -0,0 +1,202 @@
+#include "RayQuery.h"
+#include "JobSystem.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace DirectX;
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Rays handed out at a time.  Small enough that a batch of a
+	// few thousand still spreads over every worker, large enough
+	// that threads aren't fighting over the counter.
+	const unsigned int RaysPerChunk = 64;
+
+	// --------------------------------------------------------
+	// Progress of one batch, shared with the workers helping
+	// with it.  A worker that only starts once every chunk has
+	// been claimed finds nothing to do and never touches the
+	// batch's rays, so the caller doesn't wait for those.
+	// --------------------------------------------------------
+	struct BatchProgress
+	{
+		std::atomic<unsigned int> NextChunk = 0;
+		std::atomic<unsigned int> ChunksDone = 0;
+		std::atomic<unsigned int> Hits = 0;
+		std::atomic<unsigned int> Threads = 0;
+	};
+}
+
+
+// --------------------------------------------------------
+// Builds (or refits) the scene's top level over a set of
+// instances, refitting while they use the same BLASes in
+// the same order (see the entity version of Update())
+// --------------------------------------------------------
+TopLevelBuildStats RayQueryScene::Update(const std::vector<BVHInstance>& instances)
+{
+	bool sameBLASes = meshes.empty() && instances.size() == instanceDescs.size();
+	for (size_t i = 0; sameBLASes && i < instances.size(); i++)
+		sameBLASes = instances[i].BLAS == instanceDescs[i].BLAS && instances[i].WideBLAS == instanceDescs[i].WideBLAS;
+
+	meshes.clear();
+	instanceDescs = instances;
+	return BuildOrRefit(sameBLASes);
+}
+
+
+// --------------------------------------------------------
+// Refits the top level over the current instances if their
+// BLASes haven't changed, and builds it otherwise.
+//
+// A refit that leaves the tree's SAH cost more than
+// maxRefitDegradation times what it was when built is
+// thrown away for a full build, so entities that wander
+// far from where they started don't slow every ray down.
+// --------------------------------------------------------
+TopLevelBuildStats RayQueryScene::BuildOrRefit(bool sameBLASes)
+{
+	unsigned int instanceCount = (unsigned int)instanceDescs.size();
+	if (!sameBLASes)
+		return tlas.Build(instanceDescs.data(), instanceCount);
+
+	TopLevelBuildStats refit = tlas.Refit(instanceDescs.data(), instanceCount);
+	float builtCost = tlas.GetBuildStats().SAHCost;
+	if (refit.Refit && builtCost > 0.0f && refit.SAHCost > builtCost * maxRefitDegradation)
+	{
+		TopLevelBuildStats rebuild = tlas.Build(instanceDescs.data(), instanceCount);
+		rebuild.Milliseconds += refit.Milliseconds;
+		return rebuild;
+	}
+	return refit;
+}
+
+
+// --------------------------------------------------------
+// Runs traceRay(i) for every ray of a batch, in chunks that
+// threads claim as they go.  Workers are only asked to help
+// when there's more than one chunk, so small batches stay on
+// the calling thread.
+// --------------------------------------------------------
+template<typename Func>
+RayQueryStats RayQueryScene::RunBatch(unsigned int count, Func traceRay) const
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	unsigned int chunkCount = (count + RaysPerChunk - 1) / RaysPerChunk;
+	std::shared_ptr<BatchProgress> progress = std::make_shared<BatchProgress>();
+
+	// Claims & traces chunks until there are none left
+	auto work = [progress, chunkCount, count, traceRay]()
+		{
+			bool counted = false;
+			unsigned int chunk;
+			while ((chunk = progress->NextChunk.fetch_add(1)) < chunkCount)
+			{
+				if (!counted)
+				{
+					progress->Threads++;
+					counted = true;
+				}
+
+				unsigned int hits = 0;
+				unsigned int end = (chunk + 1) * RaysPerChunk < count ? (chunk + 1) * RaysPerChunk : count;
+				for (unsigned int i = chunk * RaysPerChunk; i < end; i++)
+					if (traceRay(i))
+						hits++;
+
+				// Counted before the chunk is, so the totals are final once every chunk is done
+				progress->Hits += hits;
+				progress->ChunksDone++;
+			}
+		};
+
+	unsigned int helpers = JobSystem::GetThreadCount();
+	if (helpers + 1 > chunkCount)
+		helpers = chunkCount > 0 ? chunkCount - 1 : 0;
+	for (unsigned int i = 0; i < helpers; i++)
+		JobSystem::Enqueue(work);
+
+	// Help out, then wait for any chunks still being traced elsewhere
+	work();
+	while (progress->ChunksDone < chunkCount)
+		std::this_thread::yield();
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	RayQueryStats stats;
+	stats.Rays = count;
+	stats.Hits = progress->Hits;
+	stats.Threads = progress->Threads;
+	stats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	return stats;
+}
+
+
+// --------------------------------------------------------
+// Finds the closest hit of every ray in a batch, using the
+// job system's workers alongside the calling thread, and
+// returns once they're all done
+//
+// rays  - The rays to cast
+// count - How many rays are in the array
+// hits  - Where the results go, one per ray
+// --------------------------------------------------------
+RayQueryStats RayQueryScene::CastRays(const RayQueryDesc* rays, unsigned int count, RayQueryHit* hits) const
+{
+	return RunBatch(count, [this, rays, hits](unsigned int i) { return CastRay(rays[i], hits[i]); });
+}
+
+
+// --------------------------------------------------------
+// Checks whether each ray in a batch hits anything, like
+// CastRays() but stopping at the first hit found
+//
+// rays     - The rays to cast
+// count    - How many rays are in the array
+// occluded - Where the results go, one per ray
+// --------------------------------------------------------
+RayQueryStats RayQueryScene::CheckOcclusion(const RayQueryDesc* rays, unsigned int count, unsigned char* occluded) const
+{
+	return RunBatch(count, [this, rays, occluded](unsigned int i)
+		{
+			occluded[i] = IsOccluded(rays[i]) ? 1 : 0;
+			return occluded[i] != 0;
+		});
+}
+
+
+// --------------------------------------------------------
+// Finds the closest hit along a single ray, if any
+// --------------------------------------------------------
+bool RayQueryScene::CastRay(const RayQueryDesc& ray, RayQueryHit& hit) const
+{
+	TopLevelHit tlHit;
+	if (!tlas.TraceClosest(ray.Origin, ray.Direction, ray.TMin, ray.TMax, ray.InstanceInclusionMask, tlHit))
+	{
+		hit.T = ray.TMax;
+		hit.Entity = RayQueryMiss;
+		hit.PrimitiveIndex = 0;
+		hit.Barycentrics = XMFLOAT2(0, 0);
+		return false;
+	}
+
+	hit.T = tlHit.T;
+	hit.Entity = tlHit.InstanceID;
+	hit.PrimitiveIndex = tlHit.PrimitiveIndex;
+	hit.Barycentrics = tlHit.Barycentrics;
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Checks whether a single ray hits anything
+// --------------------------------------------------------
+bool RayQueryScene::IsOccluded(const RayQueryDesc& ray) const
+{
+	return tlas.TraceAny(ray.Origin, ray.Direction, ray.TMin, ray.TMax, ray.InstanceInclusionMask);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <memory>
+#include <vector>
+
+#include "TopLevelBVH.h"
+
+class GameEntity;
+class Mesh;
+
+// Entity index reported by rays that hit nothing
+const unsigned int RayQueryMiss = 0xFFFFFFFF;
+
+// One ray to cast, laid out like RayDesc in HLSL plus
+// the instance mask TraceRay() would take
+struct RayQueryDesc
+{
+	DirectX::XMFLOAT3 Origin;
+	float TMin = 0.0f;
+	DirectX::XMFLOAT3 Direction;
+	float TMax = 1000.0f;
+	unsigned int InstanceInclusionMask = 0xFF;	// See GameEntity::SetInstanceMask()
+};
+
+// The closest hit of a ray, if any
+struct RayQueryHit
+{
+	float T;								// Distance along the ray (TMax on a miss)
+	unsigned int Entity;					// Index into the scene's entities, or RayQueryMiss
+	unsigned int PrimitiveIndex;			// Triangle within the entity's mesh
+	DirectX::XMFLOAT2 Barycentrics;			// As in BuiltInTriangleIntersectionAttributes
+
+	bool Hit() const { return Entity != RayQueryMiss; }
+};
+
+// Details of the most recent batch
+struct RayQueryStats
+{
+	unsigned int Rays;
+	unsigned int Hits;						// Rays that hit (or were blocked by) anything
+	unsigned int Threads;					// Threads that traced at least one ray
+	double Milliseconds;
+};
+
+// --------------------------------------------------------
+// Ray casts against the scene's entities for gameplay code
+// (picking, line of sight, ground snapping, etc.), traced
+// on the CPU so results are available the same frame.
+//
+// Update() builds a TopLevelBVH over every entity whose
+// mesh has a CPU BVH (see MeshOptions::BuildBVH), and just
+// refits it while the same entities are passed in, until
+// the refits have made it too slow to trace (see
+// SetMaxRefitDegradation()) and it's rebuilt.  Scenes
+// without entities can pass their instances in directly.  Rays are
+// cast in batches, which are split into small chunks
+// shared out between the calling thread and JobSystem's
+// workers.  Results are written straight into the caller's
+// array, so nothing is allocated per ray, but each batch
+// allocates its shared progress and a job for every
+// worker that helps with it.
+// --------------------------------------------------------
+class RayQueryScene
+{
+public:
+	TopLevelBuildStats Update(const std::vector<std::shared_ptr<GameEntity>>& entities);
+
+	// Each instance's InstanceID is the Entity reported by its hits, and
+	// the caller keeps its BVHs alive until the next Update()
+	TopLevelBuildStats Update(const std::vector<BVHInstance>& instances);
+
+	// Closest hit of each ray, written to the matching element of hits
+	RayQueryStats CastRays(const RayQueryDesc* rays, unsigned int count, RayQueryHit* hits) const;
+
+	// Whether each ray hits anything at all (1) or not (0), which
+	// stops at the first hit and suits line of sight checks
+	RayQueryStats CheckOcclusion(const RayQueryDesc* rays, unsigned int count, unsigned char* occluded) const;
+
+	// Single rays, traced on the calling thread
+	bool CastRay(const RayQueryDesc& ray, RayQueryHit& hit) const;
+	bool IsOccluded(const RayQueryDesc& ray) const;
+
+	unsigned int GetInstanceCount() const { return tlas.GetInstanceCount(); }
+
+	// The top level & the mesh of each of its instances, in hit group
+	// order, for rendering the entities with CPURaytracer::Render()
+	// (no meshes when updated with instances rather than entities)
+	const TopLevelBVH& GetTLAS() const { return tlas; }
+	const std::vector<std::shared_ptr<Mesh>>& GetMeshes() const { return meshes; }
+
+	// Growth in SAH cost refits can cause before Update() rebuilds
+	// instead, like MeshOptions::MaxRefitDegradation for a mesh
+	void SetMaxRefitDegradation(float degradation) { maxRefitDegradation = degradation; }
+	float GetMaxRefitDegradation() const { return maxRefitDegradation; }
+
+private:
+	TopLevelBVH tlas;
+	float maxRefitDegradation = 1.5f;
+	std::vector<BVHInstance> instanceDescs;
+	std::vector<std::shared_ptr<Mesh>> meshes;	// Keeps every instance's BVHs alive
+
+	TopLevelBuildStats BuildOrRefit(bool sameBLASes);
+
+	template<typename Func>
+	RayQueryStats RunBatch(unsigned int count, Func traceRay) const;
+};
@@ -0,0 +1,54 @@
+#include "RayQuery.h"
+#include "GameEntity.h"
+
+// --------------------------------------------------------
+// Builds (or refits) the scene's top level over a set of
+// entities.  Each entity's index in the list is the Entity
+// reported by its hits, and each instance's hit group index
+// is where its mesh is in GetMeshes().  Entities whose
+// meshes have no CPU BVH can't be hit.
+//
+// Kept apart from the rest of RayQueryScene, which doesn't
+// need D3D12, so the queries can be tested without it.
+// --------------------------------------------------------
+TopLevelBuildStats RayQueryScene::Update(const std::vector<std::shared_ptr<GameEntity>>& entities)
+{
+	// Same meshes in the same order?  Then only transforms &
+	// masks can have changed, which a refit handles
+	bool sameMeshes = true;
+	unsigned int instanceCount = 0;
+	for (unsigned int i = 0; i < entities.size(); i++)
+	{
+		std::shared_ptr<Mesh> mesh = entities[i]->GetMesh();
+		if (!mesh || !mesh->GetBVH())
+			continue;
+
+		if (instanceCount >= meshes.size() || meshes[instanceCount] != mesh)
+			sameMeshes = false;
+		instanceCount++;
+	}
+	if (instanceCount != meshes.size() || instanceDescs.size() != meshes.size())
+		sameMeshes = false;
+
+	meshes.resize(instanceCount);
+	instanceDescs.resize(instanceCount);
+	unsigned int instance = 0;
+	for (unsigned int i = 0; i < entities.size(); i++)
+	{
+		std::shared_ptr<Mesh> mesh = entities[i]->GetMesh();
+		if (!mesh || !mesh->GetBVH())
+			continue;
+
+		BVHInstance& desc = instanceDescs[instance];
+		desc.SetWorldMatrix(entities[i]->GetTransform()->GetWorldMatrix());
+		desc.InstanceID = i;
+		desc.InstanceMask = entities[i]->GetInstanceMask();
+		desc.InstanceContributionToHitGroupIndex = instance;
+		desc.BLAS = mesh->GetBVH().get();
+		desc.WideBLAS = mesh->GetWideBVH().get();
+		meshes[instance] = mesh;
+		instance++;
+	}
+
+	return BuildOrRefit(sameMeshes);
+}
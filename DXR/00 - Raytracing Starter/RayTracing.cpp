@@ -2,9 +2,18 @@
 #include "Graphics.h"
 #include "BufferStructs.h"
 #include "Window.h"
+#include "AccelBuildPlanner.h"
+#include "InstanceTransforms.h"
+#include "Diagnostics.h"
 
 #include <d3dcompiler.h>
 #include <DirectXMath.h>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+// Makes use of integer division to ensure we are aligned to the proper multiple of "alignment"
+#define ALIGN(value, alignment) (((value + alignment - 1) / alignment) * alignment)
 
 namespace RayTracing
 {
@@ -19,12 +28,385 @@ namespace RayTracing
 		const char* errorRaytracingNotSupported = "\nERROR: Raytracing not supported by the current graphics device.\n(On laptops, this may be due to battery saver mode.)\n";
 		const char* errorDXRDeviceQueryFailed = "\nERROR: DXR Device query failed - DirectX Raytracing unavailable.\n";
 		const char* errorDXRCommandListQueryFailed = "\nERROR: DXR Command List query failed - DirectX Raytracing unavailable.\n";
+
+		// Accumulation state, and the camera & lights it applies to
+		unsigned int accumulatedSamples = 0;
+		DirectX::XMFLOAT4X4 accumulatedView = {};
+		DirectX::XMFLOAT4X4 accumulatedProjection = {};
+		std::vector<Light> accumulatedLights;
+
+		// Buffers replaced while commands using them may still be
+		// pending, released once the GPU has caught up
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> retiredBuffers;
+
+		// Sizes of every BLAS built so far
+		std::vector<BLASMemoryStats> blasMemoryStats;
+
+		// A hit group record in the shader table (counting from the first
+		// after the raygen & miss records), and SRVs for the index, vertex
+		// & attribute buffers it reads, one after another in the heap as
+		// the local root signature expects.  The buffers are held so they
+		// outlive any frame still tracing against them.
+		struct HitGroupRecord
+		{
+			unsigned int Index;
+			D3D12_CPU_DESCRIPTOR_HANDLE SRVsCPU[3];
+			D3D12_GPU_DESCRIPTOR_HANDLE SRVs;
+			Microsoft::WRL::ComPtr<ID3D12Resource> Buffers[3];
+		};
+
+		// Records (and their SRVs) are reused once released, as neither
+		// the shader table nor the descriptor heap can free them.  Like
+		// buffers, released ones are retired until the GPU is done with
+		// them, either until the next full wait or until their frame
+		// index comes around again.
+		unsigned int hitGroupRecordCount = 0;
+		std::vector<HitGroupRecord> freeHitGroupRecords;
+		std::vector<HitGroupRecord> retiredHitGroupRecords;
+		std::vector<HitGroupRecord> retiredFrameHitGroupRecords[Graphics::NumBackBuffers];
+
+		// A BLAS for one of a mesh's LODs, and the hit group record
+		// that instances of it use to read that LOD's indices
+		struct LODBLAS
+		{
+			BLASHandle BLAS;
+			HitGroupRecord Record;
+		};
+		typedef std::vector<LODBLAS> MeshLODs;
+
+		// BLASes made by CreateBLAS(), one per LOD (only the full mesh
+		// for deformable meshes), found by mesh for TLAS instances.
+		// Meshes with the same contents share them, and they're
+		// released once the last of those is (noticed by UpdateTLAS()).
+		struct MeshBLAS
+		{
+			std::weak_ptr<Mesh> Owner;			// Expired if the address was freed
+			std::shared_ptr<MeshLODs> LODs;
+
+			// Deformable meshes only: the mesh versions the BLAS matches
+			unsigned int VertexVersion;
+			unsigned int RebuildVersion;
+			unsigned int UpdatesSinceBuild;
+		};
+		std::unordered_map<const Mesh*, MeshBLAS> meshBLASes;
+
+		// Every mesh's BLASes still in use, by its content hash
+		struct CachedBLAS
+		{
+			int VertexCount;
+			int IndexCount;
+			std::weak_ptr<MeshLODs> LODs;
+		};
+		std::unordered_map<unsigned long long, std::vector<CachedBLAS>> blasCache;
+		unsigned int blasCacheHits = 0;
+		unsigned int blasCacheMisses = 0;
+
+		// Instance descs are rewritten every frame the scene changes, so
+		// each frame in flight gets its own upload buffer, along with a
+		// list of buffers it replaced (freed when that frame comes around
+		// again, as the GPU is done with it by then)
+		Microsoft::WRL::ComPtr<ID3D12Resource> instanceDescBuffers[Graphics::NumBackBuffers];
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> retiredFrameBuffers[Graphics::NumBackBuffers];
+
+		// This frame's instances, and those the TLAS currently holds
+		std::vector<DirectX::XMFLOAT4X4> instanceWorlds;
+		std::vector<D3D12_RAYTRACING_INSTANCE_DESC> instanceDescs;
+		std::vector<D3D12_RAYTRACING_INSTANCE_DESC> tlasInstanceDescs;
+		unsigned int tlasUpdatesSinceBuild = 0;
+
+		// --------------------------------------------------------
+		// Makes retired hit group records free to reuse, letting
+		// go of the buffers their SRVs viewed
+		// --------------------------------------------------------
+		void FreeHitGroupRecords(std::vector<HitGroupRecord>& retired)
+		{
+			for (HitGroupRecord& record : retired)
+			{
+				for (auto& buffer : record.Buffers)
+					buffer.Reset();
+				freeHitGroupRecords.push_back(record);
+			}
+			retired.clear();
+		}
+
+		// --------------------------------------------------------
+		// Executes everything recorded on the command list, waits
+		// for the GPU to finish it and resets the list
+		// --------------------------------------------------------
+		void ExecuteAndWait()
+		{
+			DXRCommandList->Close();
+
+			ID3D12CommandList* lists[] = { DXRCommandList.Get() };
+			Graphics::CommandQueue->ExecuteCommandLists(1, lists);
+
+			Graphics::WaitForGPU();
+			Graphics::ResetAllocatorAndCommandList(0);
+
+			// Nothing can be using replaced buffers or records now
+			retiredBuffers.clear();
+			for (auto& frameBuffers : retiredFrameBuffers)
+				frameBuffers.clear();
+			FreeHitGroupRecords(retiredHitGroupRecords);
+			for (auto& frameRecords : retiredFrameHitGroupRecords)
+				FreeHitGroupRecords(frameRecords);
+		}
+
+		// --------------------------------------------------------
+		// Drops a released mesh's hold on its BLASes & hit group
+		// records.  Once no other mesh shares them, they're kept
+		// in retired lists until the GPU is done with them.
+		// --------------------------------------------------------
+		void ReleaseMeshBLAS(
+			MeshBLAS& entry,
+			std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>>& retired,
+			std::vector<HitGroupRecord>& retiredRecords)
+		{
+			if (entry.LODs.use_count() == 1)
+			{
+				for (LODBLAS& lod : *entry.LODs)
+				{
+					retired.push_back(lod.BLAS.Buffer);
+					if (lod.BLAS.MemoryStatsIndex < blasMemoryStats.size())
+						blasMemoryStats[lod.BLAS.MemoryStatsIndex].Released = true;
+					retiredRecords.push_back(lod.Record);
+				}
+			}
+			entry.LODs.reset();
+		}
+
+		// --------------------------------------------------------
+		// Do two meshes have exactly the same final vertices &
+		// indices?  Only meshes that kept their CPU data (see
+		// MeshOptions::KeepCPUData) can show that they do.
+		// --------------------------------------------------------
+		bool SameCPUData(Mesh& a, Mesh& b)
+		{
+			const std::vector<Vertex>& vertsA = a.GetCPUVertices();
+			const std::vector<Vertex>& vertsB = b.GetCPUVertices();
+			const std::vector<unsigned int>& indicesA = a.GetCPUIndices();
+			const std::vector<unsigned int>& indicesB = b.GetCPUIndices();
+			return
+				!vertsA.empty() && !indicesA.empty() &&
+				a.GetVertexFormat() == b.GetVertexFormat() &&
+				vertsA.size() == vertsB.size() &&
+				indicesA.size() == indicesB.size() &&
+				memcmp(vertsA.data(), vertsB.data(), sizeof(Vertex) * vertsA.size()) == 0 &&
+				memcmp(indicesA.data(), indicesB.data(), sizeof(unsigned int) * indicesA.size()) == 0;
+		}
+
+		// A mesh still in use that has these BLASes, if any
+		std::shared_ptr<Mesh> FindLODsOwner(const std::shared_ptr<MeshLODs>& lods)
+		{
+			for (auto& meshBLAS : meshBLASes)
+			{
+				if (meshBLAS.second.LODs != lods)
+					continue;
+				if (std::shared_ptr<Mesh> owner = meshBLAS.second.Owner.lock())
+					return owner;
+			}
+			return 0;
+		}
+
+		// --------------------------------------------------------
+		// Describes the triangles of one of a mesh's LODs for a
+		// BLAS build (LODs share the full mesh's vertices)
+		// --------------------------------------------------------
+		D3D12_RAYTRACING_GEOMETRY_DESC DescribeGeometry(Mesh& mesh, int lod = 0)
+		{
+			D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = {};
+			geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+			geometryDesc.Triangles.VertexBuffer.StartAddress = mesh.GetVBResource()->GetGPUVirtualAddress();
+			geometryDesc.Triangles.VertexBuffer.StrideInBytes = mesh.GetVBView().StrideInBytes;
+			geometryDesc.Triangles.VertexCount = static_cast<UINT>(mesh.GetVertexCount());
+			geometryDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+			geometryDesc.Triangles.IndexBuffer = lod == 0 ? mesh.GetIBResource()->GetGPUVirtualAddress() : mesh.GetLODIBView(lod).BufferLocation;
+			geometryDesc.Triangles.IndexFormat = lod == 0 ? mesh.GetIBView().Format : mesh.GetLODIBView(lod).Format;
+			geometryDesc.Triangles.IndexCount = static_cast<UINT>(lod == 0 ? mesh.GetIndexCount() : mesh.GetLODIndexCount(lod));
+			geometryDesc.Triangles.Transform3x4 = 0;
+			geometryDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE; // Performance boost when dealing with opaque geometry
+			return geometryDesc;
+		}
+
+		// --------------------------------------------------------
+		// A hit group record to use, reusing a released one (and
+		// its SRVs) if there is one.  Otherwise three new SRVs are
+		// reserved, and the shader table grows if it's full.
+		// --------------------------------------------------------
+		HitGroupRecord AllocateHitGroupRecord()
+		{
+			if (!freeHitGroupRecords.empty())
+			{
+				HitGroupRecord record = freeHitGroupRecords.back();
+				freeHitGroupRecords.pop_back();
+				return record;
+			}
+
+			// These must come one after the other in the descriptor heap, and index must come first
+			// This is due to the way we've set up the root signature (expects a table of these)
+			HitGroupRecord record = {};
+			record.Index = hitGroupRecordCount++;
+			Graphics::ReserveSrvUavDescriptorHeapSlot(&record.SRVsCPU[0], &record.SRVs);
+			Graphics::ReserveSrvUavDescriptorHeapSlot(&record.SRVsCPU[1], 0);
+			Graphics::ReserveSrvUavDescriptorHeapSlot(&record.SRVsCPU[2], 0);
+
+			// Grow the table (doubling it) to fit the raygen & miss records and every hit group record.
+			// Frames in flight may still be reading the old one, so it's retired rather than released.
+			UINT64 tableBytes = ShaderTable->GetDesc().Width;
+			UINT64 neededBytes = ShaderTableRecordSize * (3 + hitGroupRecordCount);
+			if (tableBytes < neededBytes)
+			{
+				UINT64 grownBytes = ALIGN(max(tableBytes * 2, neededBytes), D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT);
+				Microsoft::WRL::ComPtr<ID3D12Resource> grownTable = Graphics::CreateBuffer(grownBytes, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_STATE_GENERIC_READ);
+
+				unsigned char* oldData = 0;
+				unsigned char* newData = 0;
+				ShaderTable->Map(0, 0, (void**)&oldData);
+				grownTable->Map(0, 0, (void**)&newData);
+				memcpy(newData, oldData, tableBytes);
+				grownTable->Unmap(0, 0);
+				ShaderTable->Unmap(0, 0);
+
+				retiredBuffers.push_back(ShaderTable);
+				ShaderTable = grownTable;
+			}
+
+			return record;
+		}
+
+		// --------------------------------------------------------
+		// Creates SRVs for the index buffer of one of a mesh's
+		// LODs and its vertex & attribute buffers, and fills in a
+		// hit group record to read them
+		// --------------------------------------------------------
+		void WriteHitGroupRecord(Mesh& mesh, int lod, HitGroupRecord& record)
+		{
+			Microsoft::WRL::ComPtr<ID3D12Resource> indexBuffer = lod == 0 ? mesh.GetIBResource() : mesh.GetLODIBResource(lod);
+			DXGI_FORMAT indexFormat = lod == 0 ? mesh.GetIndexFormat() : mesh.GetLODIBView(lod).Format;
+
+			// Note: For interleaved meshes the vertex and attribute SRVs both view the vertex buffer
+			record.Buffers[0] = indexBuffer;
+			record.Buffers[1] = mesh.GetVBResource();
+			record.Buffers[2] = mesh.GetAttributeResource();
+
+			// Index buffer SRV
+			D3D12_SHADER_RESOURCE_VIEW_DESC indexSRVDesc = {};
+			indexSRVDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+			indexSRVDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+			indexSRVDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_RAW;
+			indexSRVDesc.Buffer.StructureByteStride = 0;
+			indexSRVDesc.Buffer.FirstElement = 0;
+			indexSRVDesc.Buffer.NumElements = (UINT)(indexBuffer->GetDesc().Width / sizeof(unsigned int)); // Raw views count dwords, even for 16-bit indices
+			indexSRVDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+			DXRDevice->CreateShaderResourceView(indexBuffer.Get(), &indexSRVDesc, record.SRVsCPU[0]);
+
+			// Vertex buffer SRV
+			D3D12_SHADER_RESOURCE_VIEW_DESC vertexSRVDesc = {};
+			vertexSRVDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+			vertexSRVDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+			vertexSRVDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_RAW;
+			vertexSRVDesc.Buffer.StructureByteStride = 0;
+			vertexSRVDesc.Buffer.FirstElement = 0;
+			vertexSRVDesc.Buffer.NumElements = mesh.GetVBView().SizeInBytes / sizeof(float); // How many floats total?
+			vertexSRVDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+			DXRDevice->CreateShaderResourceView(mesh.GetVBResource().Get(), &vertexSRVDesc, record.SRVsCPU[1]);
+
+			// Attribute buffer SRV
+			D3D12_SHADER_RESOURCE_VIEW_DESC attributeSRVDesc = vertexSRVDesc;
+			attributeSRVDesc.Buffer.NumElements = mesh.GetAttributeView().SizeInBytes / sizeof(float);
+			DXRDevice->CreateShaderResourceView(mesh.GetAttributeResource().Get(), &attributeSRVDesc, record.SRVsCPU[2]);
+
+			// Put this mesh's record into the shader table
+			{
+				unsigned char* tablePointer = 0;
+				ShaderTable->Map(0, 0, (void**)&tablePointer);
+
+				// Get past the raygen and miss shaders, and any records before this one
+				tablePointer += ShaderTableRecordSize * (3 + record.Index);
+
+				// Every record starts with the hit group's identifier
+				memcpy(tablePointer, RaytracingPipelineProperties->GetShaderIdentifier(L"HitGroup"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
+				tablePointer += D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
+
+				// Copy this mesh's constants, which tell the shader how to read its vertices
+				RaytracingMeshData meshData = {};
+				meshData.vertexFormat = (unsigned int)mesh.GetVertexFormat();
+				meshData.positionStride = mesh.GetVBView().StrideInBytes;
+				meshData.attributeStride = mesh.GetAttributeView().StrideInBytes;
+				meshData.attributeOffset = mesh.GetAttributeOffset();
+				meshData.indexStride = indexFormat == DXGI_FORMAT_R16_UINT ? sizeof(unsigned short) : sizeof(unsigned int);
+				memcpy(tablePointer, &meshData, sizeof(RaytracingMeshData));
+				tablePointer += sizeof(RaytracingMeshData);
+
+				// Memcpy the index buffer's SRV to the table
+				// - The vertex & attribute buffer SRVs IMMEDIATELY follow it in the heap
+				memcpy(
+					tablePointer,
+					&record.SRVs,
+					sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
+
+				// All done
+				ShaderTable->Unmap(0, 0);
+			}
+		}
+
+		// --------------------------------------------------------
+		// The coarsest of a mesh's first "lodCount" LODs whose
+		// simplification error, seen from the camera at the near
+		// side of the instance's bounding sphere, covers less
+		// than MaxLODErrorPixels.  pixelScale is the screen height
+		// over 2 * tan(fov / 2), so pixels = size * scale / distance.
+		// --------------------------------------------------------
+		int SelectLOD(Mesh& mesh, int lodCount, const DirectX::XMFLOAT4X4& world, DirectX::XMFLOAT3 cameraPosition, float pixelScale)
+		{
+			using namespace DirectX;
+
+			// LOD errors are relative to the mesh's largest dimension
+			XMFLOAT3 boundsMin = mesh.GetBoundsMin();
+			XMFLOAT3 boundsMax = mesh.GetBoundsMax();
+			XMVECTOR localMin = XMLoadFloat3(&boundsMin);
+			XMVECTOR localMax = XMLoadFloat3(&boundsMax);
+			XMFLOAT3 extent;
+			XMStoreFloat3(&extent, XMVectorSubtract(localMax, localMin));
+			float meshSize = max(extent.x, max(extent.y, extent.z));
+
+			// The instance's largest scale, and the distance to its bounds
+			XMMATRIX worldMatrix = XMLoadFloat4x4(&world);
+			float scale = sqrtf(max(
+				XMVectorGetX(XMVector3LengthSq(worldMatrix.r[0])),
+				max(XMVectorGetX(XMVector3LengthSq(worldMatrix.r[1])), XMVectorGetX(XMVector3LengthSq(worldMatrix.r[2])))));
+			XMVECTOR center = XMVector3Transform(XMVectorScale(XMVectorAdd(localMin, localMax), 0.5f), worldMatrix);
+			float radius = XMVectorGetX(XMVector3Length(XMVectorSubtract(localMax, localMin))) * 0.5f * scale;
+			float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(center, XMLoadFloat3(&cameraPosition)))) - radius;
+			if (distance <= 0.0f)
+				return 0;
+
+			int lod = 0;
+			float pixelsPerUnit = meshSize * scale * pixelScale / distance;
+			while (lod + 1 < lodCount && mesh.GetLODError(lod + 1) * pixelsPerUnit < MaxLODErrorPixels)
+				lod++;
+			return lod;
+		}
+
+		// --------------------------------------------------------
+		// Element "index" of the Halton sequence with the given
+		// (prime) base, which spreads samples evenly over [0, 1)
+		// --------------------------------------------------------
+		float Halton(unsigned int index, unsigned int base)
+		{
+			float result = 0.0f;
+			float fraction = 1.0f;
+			while (index > 0)
+			{
+				fraction /= base;
+				result += fraction * (index % base);
+				index /= base;
+			}
+			return result;
+		}
 	}
 }
 
-// Makes use of integer division to ensure we are aligned to the proper multiple of "alignment"
-#define ALIGN(value, alignment) (((value + alignment - 1) / alignment) * alignment)
-
 
 // --------------------------------------------------------
 // Check for raytracing support and create all necessary
@@ -81,11 +463,11 @@ void RayTracing::CreateRaytracingRootSignatures()
 	// Create a global root signature shared across all raytracing shaders
 	{
 		// Two descriptor ranges
-		// 1: The output texture, which is an unordered access view (UAV)
+		// 1: The output & accumulation textures, which are unordered access views (UAVs)
 		// 2: Two separate SRVs, which are the index and vertex data of the geometry
 		D3D12_DESCRIPTOR_RANGE outputUAVRange = {};
 		outputUAVRange.BaseShaderRegister = 0;
-		outputUAVRange.NumDescriptors = 1;
+		outputUAVRange.NumDescriptors = 2;
 		outputUAVRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
 		outputUAVRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
 		outputUAVRange.RegisterSpace = 0;
@@ -101,7 +483,7 @@ void RayTracing::CreateRaytracingRootSignatures()
 		// These need to match the shader(s) we'll be using
 		D3D12_ROOT_PARAMETER rootParams[3] = {};
 		{
-			// First param is the UAV range for the output texture
+			// First param is the UAV range for the output & accumulation textures
 			rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
 			rootParams[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
 			rootParams[0].DescriptorTable.NumDescriptorRanges = 1;
@@ -136,32 +518,25 @@ void RayTracing::CreateRaytracingRootSignatures()
 
 	// Create a local root signature enabling shaders to have unique data from shader tables
 	{
-		// cbuffer for hit group data
-		D3D12_DESCRIPTOR_RANGE cbufferRange = {};
-		cbufferRange.BaseShaderRegister = 1;
-		cbufferRange.NumDescriptors = 1;
-		cbufferRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
-		cbufferRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_CBV;
-		cbufferRange.RegisterSpace = 0;
-
-		// Table of 2 starting at register(t1)
+		// Table of 3 starting at register(t1)
 		D3D12_DESCRIPTOR_RANGE geometrySRVRange = {};
 		geometrySRVRange.BaseShaderRegister = 1;
-		geometrySRVRange.NumDescriptors = 2;
+		geometrySRVRange.NumDescriptors = 3;
 		geometrySRVRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
 		geometrySRVRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
 		geometrySRVRange.RegisterSpace = 0;
 
-		// Two params: Tables for constant buffer and geometry
+		// Two params: Root constants for per-mesh data and a table for geometry
 		D3D12_ROOT_PARAMETER rootParams[2] = {};
 
-		// Constant buffer at register(b1)
-		rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+		// Per-mesh constants at register(b1), stored directly in the shader table
+		rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
 		rootParams[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
-		rootParams[0].DescriptorTable.NumDescriptorRanges = 1;
-		rootParams[0].DescriptorTable.pDescriptorRanges = &cbufferRange;
+		rootParams[0].Constants.ShaderRegister = 1;
+		rootParams[0].Constants.RegisterSpace = 0;
+		rootParams[0].Constants.Num32BitValues = sizeof(RaytracingMeshData) / sizeof(unsigned int);
 
-		// Range of SRVs for geometry (verts & indices)
+		// Range of SRVs for geometry (indices, positions & other vertex attributes)
 		rootParams[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
 		rootParams[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
 		rootParams[1].DescriptorTable.NumDescriptorRanges = 1;
@@ -199,7 +574,7 @@ void RayTracing::CreateRaytracingPipelineState(std::wstring raytracingShaderLibr
 
 	// There are ten subobjects that make up our raytracing pipeline object:
 	// - Ray generation shader
-	// - Miss shader
+	// - Miss shaders (regular & shadow rays)
 	// - Closest hit shader
 	// - Hit group (group of all "hit"-type shaders, which is just "closest hit" for us)
 	// - Payload configuration
@@ -227,16 +602,19 @@ void RayTracing::CreateRaytracingPipelineState(std::wstring raytracingShaderLibr
 
 	subobjects[0] = rayGenSubObj;
 
-	// === Miss shader ===
-	D3D12_EXPORT_DESC missExportDesc = {};
-	missExportDesc.Name = L"Miss";
-	missExportDesc.Flags = D3D12_EXPORT_FLAG_NONE;
+	// === Miss shaders ===
+	// Shadow rays have their own, as they only need to know that nothing was hit
+	D3D12_EXPORT_DESC missExportDescs[2] = {};
+	missExportDescs[0].Name = L"Miss";
+	missExportDescs[0].Flags = D3D12_EXPORT_FLAG_NONE;
+	missExportDescs[1].Name = L"ShadowMiss";
+	missExportDescs[1].Flags = D3D12_EXPORT_FLAG_NONE;
 
 	D3D12_DXIL_LIBRARY_DESC	missLibDesc = {};
 	missLibDesc.DXILLibrary.BytecodeLength = blob->GetBufferSize();
 	missLibDesc.DXILLibrary.pShaderBytecode = blob->GetBufferPointer();
-	missLibDesc.NumExports = 1;
-	missLibDesc.pExports = &missExportDesc;
+	missLibDesc.NumExports = ARRAYSIZE(missExportDescs);
+	missLibDesc.pExports = missExportDescs;
 
 	D3D12_STATE_SUBOBJECT missSubObj = {};
 	missSubObj.Type = D3D12_STATE_SUBOBJECT_TYPE_DXIL_LIBRARY;
@@ -275,7 +653,7 @@ void RayTracing::CreateRaytracingPipelineState(std::wstring raytracingShaderLibr
 
 	// === Shader config (payload) ===
 	D3D12_RAYTRACING_SHADER_CONFIG shaderConfigDesc = {};
-	shaderConfigDesc.MaxPayloadSizeInBytes = sizeof(DirectX::XMFLOAT3);	// Assuming a float3 color for now
+	shaderConfigDesc.MaxPayloadSizeInBytes = sizeof(DirectX::XMFLOAT3);	// Assuming a float3 color for now (shadow payloads are smaller)
 	shaderConfigDesc.MaxAttributeSizeInBytes = sizeof(DirectX::XMFLOAT2); // Assuming a float2 for barycentric coords for now
 
 	D3D12_STATE_SUBOBJECT shaderConfigSubObj = {};
@@ -286,7 +664,7 @@ void RayTracing::CreateRaytracingPipelineState(std::wstring raytracingShaderLibr
 
 	// === Association - Payload and shaders ===
 	// Names of shaders that use the payload
-	const wchar_t* payloadShaderNames[] = { L"RayGen", L"Miss", L"HitGroup" };
+	const wchar_t* payloadShaderNames[] = { L"RayGen", L"Miss", L"ShadowMiss", L"HitGroup" };
 
 	D3D12_SUBOBJECT_TO_EXPORTS_ASSOCIATION shaderPayloadAssociation = {};
 	shaderPayloadAssociation.NumExports = ARRAYSIZE(payloadShaderNames);
@@ -308,7 +686,7 @@ void RayTracing::CreateRaytracingPipelineState(std::wstring raytracingShaderLibr
 
 	// === Association - Shaders and local root sig ===
 	// Names of shaders that use the root sig
-	const wchar_t* rootSigShaderNames[] = { L"RayGen", L"Miss", L"HitGroup" };
+	const wchar_t* rootSigShaderNames[] = { L"RayGen", L"Miss", L"ShadowMiss", L"HitGroup" };
 
 	// Add a state subobject for the association between the RayGen shader and the local root signature
 	D3D12_SUBOBJECT_TO_EXPORTS_ASSOCIATION rootSigAssociation = {};
@@ -367,14 +745,15 @@ void RayTracing::CreateShaderTable()
 	// Create the table of shaders and their data to use for rays
 	// 0 - Ray generation shader
 	// 1 - Miss shader
-	// 2 - Closest hit shader
+	// 2 - Shadow miss shader
+	// 3+ - Closest hit shader, one record per mesh
 	// Note: All records must have the same size, so we need to calculate
 	//       the size of the largest possible entry for our program
 	//       - This will be the default (32) + one descriptor table pointer (8)
 	//       - This also must be aligned up to D3D12_RAYTRACING_SHADER_BINDING_TABLE_RECORD_BYTE_ALIGNMENT
 	UINT64 shaderTableRayGenRecordSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
 	UINT64 shaderTableMissRecordSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
-	UINT64 shaderTableHitGroupRecordSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES + sizeof(D3D12_GPU_DESCRIPTOR_HANDLE) * 2; // CBV & SRV
+	UINT64 shaderTableHitGroupRecordSize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES + sizeof(RaytracingMeshData) + sizeof(D3D12_GPU_DESCRIPTOR_HANDLE); // Constants & SRV table
 
 	// Align them
 	shaderTableRayGenRecordSize = ALIGN(shaderTableRayGenRecordSize, D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT);
@@ -384,8 +763,8 @@ void RayTracing::CreateShaderTable()
 	// Which is largest?
 	ShaderTableRecordSize = max(shaderTableRayGenRecordSize, max(shaderTableMissRecordSize, shaderTableHitGroupRecordSize));
 
-	// How big should the table be?  Need a record for each of 3 shaders (in our simple demo)
-	UINT64 shaderTableSize = ShaderTableRecordSize * 3;
+	// How big should the table be?  Start with a record for each of 4 shaders
+	UINT64 shaderTableSize = ShaderTableRecordSize * 4;
 	shaderTableSize = ALIGN(shaderTableSize, D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT);
 
 	// Create the shader table buffer and map it so we can write to it
@@ -393,16 +772,20 @@ void RayTracing::CreateShaderTable()
 	unsigned char* shaderTableData = 0;
 	ShaderTable->Map(0, 0, (void**)&shaderTableData);
 
-	// Mem copy each record in: ray gen, miss and the overall hit group (from CreateRaytracingPipelineState() above)
+	// Mem copy each record in: ray gen, both misses and the overall hit group (from CreateRaytracingPipelineState() above)
 	memcpy(shaderTableData, RaytracingPipelineProperties->GetShaderIdentifier(L"RayGen"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
 	shaderTableData += ShaderTableRecordSize;
 
 	memcpy(shaderTableData, RaytracingPipelineProperties->GetShaderIdentifier(L"Miss"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
 	shaderTableData += ShaderTableRecordSize;
 
+	memcpy(shaderTableData, RaytracingPipelineProperties->GetShaderIdentifier(L"ShadowMiss"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
+	shaderTableData += ShaderTableRecordSize;
+
 	memcpy(shaderTableData, RaytracingPipelineProperties->GetShaderIdentifier(L"HitGroup"), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
 
-	// We'll eventually need to memcpy per-object data to the shader table, but we don't have that yet
+	// Each mesh's hit group record (with its per-object data) is written by
+	// CreateBLAS(), from this one on, and the table grows to fit them all
 
 	// Unmap
 	ShaderTable->Unmap(0, 0);
@@ -446,16 +829,31 @@ void RayTracing::CreateRaytracingOutputUAV(unsigned int width, unsigned int heig
 		0,
 		IID_PPV_ARGS(RaytracingOutput.GetAddressOf()));
 
-	// Do we have a UAV alrady?
+	// The accumulation buffer matches, but in full precision
+	// and always ready for the shaders to read & write
+	desc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	DXRDevice->CreateCommittedResource(
+		&heapDesc,
+		D3D12_HEAP_FLAG_NONE,
+		&desc,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		0,
+		IID_PPV_ARGS(AccumulationBuffer.GetAddressOf()));
+
+	// Do we have UAVs alrady?
 	if (!RaytracingOutputUAV_GPU.ptr)
 	{
-		// Nope, so reserve a spot
+		// Nope, so reserve a spot for each (one after the
+		// other, as they share a descriptor table)
 		Graphics::ReserveSrvUavDescriptorHeapSlot(
 			&RaytracingOutputUAV_CPU,
 			&RaytracingOutputUAV_GPU);
+		Graphics::ReserveSrvUavDescriptorHeapSlot(
+			&AccumulationUAV_CPU,
+			&AccumulationUAV_GPU);
 	}
 
-	// Set up the UAV
+	// Set up the UAVs
 	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
 	uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
 
@@ -464,6 +862,15 @@ void RayTracing::CreateRaytracingOutputUAV(unsigned int width, unsigned int heig
 		0,
 		&uavDesc,
 		RaytracingOutputUAV_CPU);
+
+	DXRDevice->CreateUnorderedAccessView(
+		AccumulationBuffer.Get(),
+		0,
+		&uavDesc,
+		AccumulationUAV_CPU);
+
+	// Anything accumulated so far is gone
+	ResetAccumulation();
 }
 
 
@@ -480,243 +887,757 @@ void RayTracing::ResizeOutputUAV(
 	// Wait for the GPU to be done
 	Graphics::WaitForGPU();
 
-	// Reset and re-created the buffer
+	// Reset and re-created the buffers
 	RaytracingOutput.Reset();
+	AccumulationBuffer.Reset();
 	CreateRaytracingOutputUAV(outputWidth, outputHeight);
 }
 
 
 // --------------------------------------------------------
-// Creates a BLAS for a particular mesh.  
-// 
-// NOTE: This demo assumes exactly one BLAS, so running this 
-// method more than once is not advised!
+// Builds a BLAS for every mesh at once.  Prebuild info for
+// all of them is gathered first, so AccelBuildPlanner can
+// put every result in one buffer and pack the builds into
+// batches sharing one scratch buffer.  All the builds are
+// recorded on the DXR command list, which is NOT executed
+// here (CreateTLAS() does that).
+//
+// meshes - The meshes to build, in any order
 // --------------------------------------------------------
-void RayTracing::CreateBLAS(std::shared_ptr<Mesh> mesh)
+std::vector<RayTracing::BLASHandle> RayTracing::CreateBLASes(const std::vector<std::shared_ptr<Mesh>>& meshes, const std::vector<int>& lods)
 {
-	// Don't bother if DXR isn't available
-	if (!dxrAvailable)
-		return;
-
-	// Create the Bottom Level accel structure for this mesh
-	// Note: Currently, this is the one and only BLAS in our simple implementation!
-
-	// Describe the geometry data we intend to store in this BLAS
-	D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = {};
-	geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-	geometryDesc.Triangles.VertexBuffer.StartAddress = mesh->GetVBResource()->GetGPUVirtualAddress();
-	geometryDesc.Triangles.VertexBuffer.StrideInBytes = mesh->GetVBView().StrideInBytes;
-	geometryDesc.Triangles.VertexCount = static_cast<UINT>(mesh->GetVertexCount());
-	geometryDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-	geometryDesc.Triangles.IndexBuffer = mesh->GetIBResource()->GetGPUVirtualAddress();
-	geometryDesc.Triangles.IndexFormat = mesh->GetIBView().Format;
-	geometryDesc.Triangles.IndexCount = static_cast<UINT>(mesh->GetIndexCount());
-	geometryDesc.Triangles.Transform3x4 = 0;
-	geometryDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE; // Performance boost when dealing with opaque geometry
-
-	// Describe our overall input so we can get sizing info
-	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS accelStructInputs = {};
-	accelStructInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-	accelStructInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-	accelStructInputs.pGeometryDescs = &geometryDesc;
-	accelStructInputs.NumDescs = 1;
-	accelStructInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+	std::vector<BLASHandle> handles(meshes.size());
+	if (!dxrAvailable || meshes.empty())
+		return handles;
+
+	// Describe every build so we can get sizing info
+	std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geometryDescs(meshes.size());
+	std::vector<D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS> inputs(meshes.size());
+	std::vector<AccelBuildSizes> sizes(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		geometryDescs[i] = DescribeGeometry(*meshes[i], lods.empty() ? 0 : lods[i]);
+
+		inputs[i] = {};
+		inputs[i].Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+		inputs[i].DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+		inputs[i].pGeometryDescs = &geometryDescs[i];
+		inputs[i].NumDescs = 1;
+		inputs[i].Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+
+		// Deformable meshes are updated in place later, which needs
+		// the full size, so they're never compacted
+		if (meshes[i]->IsDeformable())
+			inputs[i].Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+		else if (BLASCompactionEnabled)
+			inputs[i].Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
+		DXRDevice->GetRaytracingAccelerationStructurePrebuildInfo(&inputs[i], &prebuildInfo);
+		sizes[i].ScratchBytes = prebuildInfo.ScratchDataSizeInBytes;
+		sizes[i].ResultBytes = prebuildInfo.ResultDataMaxSizeInBytes;
+
+		UINT64 scratchBytes = prebuildInfo.ScratchDataSizeInBytes > prebuildInfo.UpdateScratchDataSizeInBytes ?
+			prebuildInfo.ScratchDataSizeInBytes :
+			prebuildInfo.UpdateScratchDataSizeInBytes;
+		handles[i].ScratchBytes = ALIGN(scratchBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+	}
 
-	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO accelStructPrebuildInfo = {};
-	DXRDevice->GetRaytracingAccelerationStructurePrebuildInfo(&accelStructInputs, &accelStructPrebuildInfo);
+	AccelBuildPlan plan = AccelBuildPlanner::Plan(sizes, BLASScratchBudget);
 
-	// Handle alignment requirements ourselves
-	accelStructPrebuildInfo.ScratchDataSizeInBytes = ALIGN(accelStructPrebuildInfo.ScratchDataSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
-	accelStructPrebuildInfo.ResultDataMaxSizeInBytes = ALIGN(accelStructPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+	// Reuse the scratch buffer if it's big enough, otherwise replace
+	// it (keeping the old one until earlier builds are done with it)
+	if (!BLASScratchBuffer || BLASScratchBuffer->GetDesc().Width < plan.ScratchBytes)
+	{
+		if (BLASScratchBuffer)
+			retiredBuffers.push_back(BLASScratchBuffer);
+
+		BLASScratchBuffer = Graphics::CreateBuffer(
+			plan.ScratchBytes,
+			D3D12_HEAP_TYPE_DEFAULT,
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+			D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+			max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+	}
 
-	// Create a scratch buffer so the device has a place to temporarily store data
-	BLASScratchBuffer = Graphics::CreateBuffer(
-		accelStructPrebuildInfo.ScratchDataSizeInBytes,
+	// One buffer holds every BLAS
+	Microsoft::WRL::ComPtr<ID3D12Resource> resultBuffer = Graphics::CreateBuffer(
+		plan.ResultBytes,
 		D3D12_HEAP_TYPE_DEFAULT,
-		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
 		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
 		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
 
-	// Create the final buffer for the BLAS
-	BLAS = Graphics::CreateBuffer(
-		accelStructPrebuildInfo.ResultDataMaxSizeInBytes,
+	// Record each batch's builds together, then wait for them
+	// before the next batch reuses the same scratch memory
+	for (unsigned int batch = 0; batch < plan.BatchCount; batch++)
+	{
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			if (plan.Builds[i].Batch != batch)
+				continue;
+
+			D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
+			buildDesc.Inputs = inputs[i];
+			buildDesc.ScratchAccelerationStructureData = BLASScratchBuffer->GetGPUVirtualAddress() + plan.Builds[i].ScratchOffset;
+			buildDesc.DestAccelerationStructureData = resultBuffer->GetGPUVirtualAddress() + plan.Builds[i].ResultOffset;
+			DXRCommandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, 0);
+		}
+
+		D3D12_RESOURCE_BARRIER scratchBarrier = {};
+		scratchBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+		scratchBarrier.UAV.pResource = BLASScratchBuffer.Get();
+		scratchBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+		DXRCommandList->ResourceBarrier(1, &scratchBarrier);
+	}
+
+	// Set up a barrier to wait until the BLASes are actually built to proceed
+	D3D12_RESOURCE_BARRIER blasBarrier = {};
+	blasBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+	blasBarrier.UAV.pResource = resultBuffer.Get();
+	blasBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+	DXRCommandList->ResourceBarrier(1, &blasBarrier);
+
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		handles[i].Buffer = resultBuffer;
+		handles[i].Offset = plan.Builds[i].ResultOffset;
+		handles[i].Size = ALIGN(sizes[i].ResultBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+		handles[i].AllowCompaction = BLASCompactionEnabled && !meshes[i]->IsDeformable();
+		handles[i].AllowUpdate = meshes[i]->IsDeformable();
+		handles[i].MemoryStatsIndex = (unsigned int)blasMemoryStats.size();
+
+		BLASMemoryStats memory = {};
+		memory.MeshHash = meshes[i]->GetContentHash();
+		memory.LOD = lods.empty() ? 0 : lods[i];
+		memory.TriangleCount = geometryDescs[i].Triangles.IndexCount / 3;
+		memory.BuiltBytes = handles[i].Size;
+		memory.CurrentBytes = handles[i].Size;
+		blasMemoryStats.push_back(memory);
+	}
+
+	Diagnostics::Print("Recorded %u BLAS build(s) in %u batch(es): %.2f MB of scratch (%.2f MB with a buffer each), %.2f MB of results\n",
+		(unsigned int)meshes.size(),
+		plan.BatchCount,
+		plan.ScratchBytes / (1024.0 * 1024.0),
+		plan.SeparateScratchBytes / (1024.0 * 1024.0),
+		plan.ResultBytes / (1024.0 * 1024.0));
+	return handles;
+}
+
+
+// --------------------------------------------------------
+// Compacts BLASes, which first needs their compacted sizes
+// from the GPU: those are written to a buffer and read back
+// once every recorded build is done.  Each BLAS is then
+// copied to its own range of a new, tightly sized buffer,
+// and the originals are released once the copies are done
+// (unless other handles still hold them).  BLASes built
+// without ALLOW_COMPACTION are left alone.
+//
+// blases - Handles from CreateBLASes(), updated in place
+// --------------------------------------------------------
+void RayTracing::CompactBLASes(std::vector<BLASHandle>& blases)
+{
+	if (!dxrAvailable)
+		return;
+
+	std::vector<size_t> compactable;
+	std::vector<D3D12_GPU_VIRTUAL_ADDRESS> addresses;
+	for (size_t i = 0; i < blases.size(); i++)
+	{
+		if (!blases[i].AllowCompaction || !blases[i].Buffer)
+			continue;
+		compactable.push_back(i);
+		addresses.push_back(blases[i].GetAddress());
+	}
+	if (compactable.empty())
+		return;
+
+	// Ask for the compacted sizes, and copy them somewhere the CPU can read
+	UINT64 sizesBytes = addresses.size() * sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC);
+	Microsoft::WRL::ComPtr<ID3D12Resource> sizesBuffer = Graphics::CreateBuffer(
+		sizesBytes,
+		D3D12_HEAP_TYPE_DEFAULT,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+	Microsoft::WRL::ComPtr<ID3D12Resource> readbackBuffer = Graphics::CreateBuffer(
+		sizesBytes,
+		D3D12_HEAP_TYPE_READBACK,
+		D3D12_RESOURCE_STATE_COPY_DEST);
+
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildDesc = {};
+	postbuildDesc.DestBuffer = sizesBuffer->GetGPUVirtualAddress();
+	postbuildDesc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+	DXRCommandList->EmitRaytracingAccelerationStructurePostbuildInfo(&postbuildDesc, (UINT)addresses.size(), addresses.data());
+
+	D3D12_RESOURCE_BARRIER toCopySource = {};
+	toCopySource.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	toCopySource.Transition.pResource = sizesBuffer.Get();
+	toCopySource.Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+	toCopySource.Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE;
+	toCopySource.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	DXRCommandList->ResourceBarrier(1, &toCopySource);
+	DXRCommandList->CopyBufferRegion(readbackBuffer.Get(), 0, sizesBuffer.Get(), 0, sizesBytes);
+	ExecuteAndWait();
+
+	// Lay the compacted BLASes out one after another
+	std::vector<AccelBuildSizes> compactedSizes(compactable.size());
+	{
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC* mapped = 0;
+		D3D12_RANGE readRange = { 0, (SIZE_T)sizesBytes };
+		D3D12_RANGE writeRange = { 0, 0 };
+		readbackBuffer->Map(0, &readRange, (void**)&mapped);
+		for (size_t i = 0; i < compactable.size(); i++)
+			compactedSizes[i] = { 0, mapped[i].CompactedSizeInBytes };
+		readbackBuffer->Unmap(0, &writeRange);
+	}
+	AccelBuildPlan plan = AccelBuildPlanner::Plan(compactedSizes, 0);
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> compactedBuffer = Graphics::CreateBuffer(
+		plan.ResultBytes,
 		D3D12_HEAP_TYPE_DEFAULT,
 		D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
 		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
 		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
 
-	// Describe the final BLAS and set up the build
-	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
-	buildDesc.Inputs = accelStructInputs;
-	buildDesc.ScratchAccelerationStructureData = BLASScratchBuffer->GetGPUVirtualAddress();
-	buildDesc.DestAccelerationStructureData = BLAS->GetGPUVirtualAddress();
-	DXRCommandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, 0);
+	for (size_t i = 0; i < compactable.size(); i++)
+	{
+		DXRCommandList->CopyRaytracingAccelerationStructure(
+			compactedBuffer->GetGPUVirtualAddress() + plan.Builds[i].ResultOffset,
+			addresses[i],
+			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
+	}
 
-	// Set up a barrier to wait until the BLAS is actually built to proceed
 	D3D12_RESOURCE_BARRIER blasBarrier = {};
 	blasBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-	blasBarrier.UAV.pResource = BLAS.Get();
+	blasBarrier.UAV.pResource = compactedBuffer.Get();
 	blasBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
 	DXRCommandList->ResourceBarrier(1, &blasBarrier);
+	ExecuteAndWait();
 
-	// Create two SRVs for the index and vertex buffers
-	// Note: These must come one after the other in the descriptor heap, and index must come first
-	//       This is due to the way we've set up the root signature (expects a table of these)
-	D3D12_CPU_DESCRIPTOR_HANDLE ib_cpu, vb_cpu;
-	Graphics::ReserveSrvUavDescriptorHeapSlot(&ib_cpu, &indexBufferSRV);
-	Graphics::ReserveSrvUavDescriptorHeapSlot(&vb_cpu, &vertexBufferSRV);
-
-	// Index buffer SRV
-	D3D12_SHADER_RESOURCE_VIEW_DESC indexSRVDesc = {};
-	indexSRVDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
-	indexSRVDesc.Format = DXGI_FORMAT_R32_TYPELESS;
-	indexSRVDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_RAW;
-	indexSRVDesc.Buffer.StructureByteStride = 0;
-	indexSRVDesc.Buffer.FirstElement = 0;
-	indexSRVDesc.Buffer.NumElements = mesh->GetIndexCount();
-	indexSRVDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	DXRDevice->CreateShaderResourceView(mesh->GetIBResource().Get(), &indexSRVDesc, ib_cpu);
-
-	// Vertex buffer SRV
-	D3D12_SHADER_RESOURCE_VIEW_DESC vertexSRVDesc = {};
-	vertexSRVDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
-	vertexSRVDesc.Format = DXGI_FORMAT_R32_TYPELESS;
-	vertexSRVDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_RAW;
-	vertexSRVDesc.Buffer.StructureByteStride = 0;
-	vertexSRVDesc.Buffer.FirstElement = 0;
-	vertexSRVDesc.Buffer.NumElements = (mesh->GetVertexCount() * sizeof(Vertex)) / sizeof(float); // How many floats total?
-	vertexSRVDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	DXRDevice->CreateShaderResourceView(mesh->GetVBResource().Get(), &vertexSRVDesc, vb_cpu);
-
-
-	// We need to put this mesh's SRVs into the shader table
-	// - In a larger application, each unique mesh will need its own entry in the shader table!
+	// Swap in the compacted copies, which releases our hold on the originals
+	UINT64 before = 0;
+	UINT64 after = 0;
+	for (size_t i = 0; i < compactable.size(); i++)
 	{
-		unsigned char* tablePointer = 0;
-		ShaderTable->Map(0, 0, (void**)&tablePointer);
+		BLASHandle& blas = blases[compactable[i]];
+		before += blas.Size;
+		after += compactedSizes[i].ResultBytes;
+
+		blas.Buffer = compactedBuffer;
+		blas.Offset = plan.Builds[i].ResultOffset;
+		blas.Size = compactedSizes[i].ResultBytes;
+		blas.AllowCompaction = false;
 
-		// Get past the raygen and miss shaders in the shader table
-		tablePointer += ShaderTableRecordSize + ShaderTableRecordSize;
+		if (blas.MemoryStatsIndex < blasMemoryStats.size())
+		{
+			blasMemoryStats[blas.MemoryStatsIndex].CurrentBytes = blas.Size;
+			blasMemoryStats[blas.MemoryStatsIndex].Compacted = true;
+		}
+	}
 
-		// In the shader table, we need to get past the identifier and first CBV descriptor
-		tablePointer += D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES + sizeof(D3D12_GPU_DESCRIPTOR_HANDLE);
+	Diagnostics::Print("Compacted %u BLAS(es) from %.2f MB to %.2f MB (%.1f%%)\n",
+		(unsigned int)compactable.size(),
+		before / (1024.0 * 1024.0),
+		after / (1024.0 * 1024.0),
+		before > 0 ? 100.0 * after / before : 100.0);
+}
 
-		// Memcpy the index buffer's SRV to the table
-		// - This is assuming that the index buffer SRV is IMMEDIATELY followed by the vertex buffer SRV in the heap
-		memcpy(
-			tablePointer,
-			&indexBufferSRV,
-			sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
 
-		// All done
-		ShaderTable->Unmap(0, 0);
+// --------------------------------------------------------
+// Gathers the sizes of every accel structure built so far,
+// along with the scratch buffers kept around for builds
+// --------------------------------------------------------
+RayTracing::AccelStructMemoryStats RayTracing::GetMemoryStats()
+{
+	AccelStructMemoryStats stats = {};
+	stats.BLASes = blasMemoryStats;
+	for (const BLASMemoryStats& blas : blasMemoryStats)
+	{
+		if (blas.Released)
+			continue;
+		stats.BLASBuiltBytes += blas.BuiltBytes;
+		stats.BLASCurrentBytes += blas.CurrentBytes;
 	}
+	stats.BLASCacheHits = blasCacheHits;
+	stats.BLASCacheMisses = blasCacheMisses;
+
+	if (TLAS) stats.TLASBytes = TLAS->GetDesc().Width;
+	if (BLASScratchBuffer) stats.ScratchBytes += BLASScratchBuffer->GetDesc().Width;
+	if (TLASScratchBuffer) stats.ScratchBytes += TLASScratchBuffer->GetDesc().Width;
+	return stats;
 }
 
 
 // --------------------------------------------------------
-// Creates the top level accel structure, which can be made
-// up of one or more BLAS instances, each with their own
-// unique transform.  This demo uses exactly one BLAS instance.
+// Creates a BLAS for a particular mesh, and sets up the
+// shader table to read its vertices.  See the overload
+// below, which this is the single mesh version of.
 // --------------------------------------------------------
-void RayTracing::CreateTLAS()
+void RayTracing::CreateBLAS(std::shared_ptr<Mesh> mesh)
 {
-	// Don't bother if DXR isn't available or the AS is finalized already
+	CreateBLAS(std::vector<std::shared_ptr<Mesh>>{ mesh });
+}
+
+
+// --------------------------------------------------------
+// Creates BLASes for a set of meshes, and sets up the
+// shader table to read their vertices.
+//
+// Each of a mesh's LODs gets a BLAS (deformable meshes only
+// get one, for the full mesh), and each BLAS a hit group
+// record in the shader table, with SRVs for its LOD's index
+// buffer and the mesh's vertices.  UpdateTLAS() picks the
+// LOD each instance uses.
+//
+// Meshes are looked up by their content hash first, so a
+// mesh with the same vertices & indices as one that already
+// has BLASes (or another in the same set) shares them and
+// their hit group records, needing no new SRVs or records,
+// and a mesh that already has them is left alone entirely.
+// A hash match is only shared once both meshes' kept CPU
+// data shows they really are the same, so meshes without
+// it always get BLASes of their own.
+// Every BLAS that is needed is then built by a single
+// CreateBLASes() call, and compacted together by a single
+// CompactBLASes() call, so the GPU round trips compaction
+// takes are paid once per set, not once per mesh.
+// --------------------------------------------------------
+void RayTracing::CreateBLAS(const std::vector<std::shared_ptr<Mesh>>& meshes)
+{
+	// Don't bother if DXR isn't available
+	if (!dxrAvailable)
+		return;
+
+	// Find each mesh's BLASes, or that it needs them.  BLASes still to
+	// be built are cached right away (empty for now, but with their
+	// records written), so later meshes in the set share them too.
+	std::vector<std::shared_ptr<Mesh>> buildMeshes;
+	std::vector<int> buildLODs;
+	std::vector<BLASHandle*> buildHandles;
+	for (const std::shared_ptr<Mesh>& mesh : meshes)
+	{
+		// Nothing to do if this exact mesh is set up already
+		auto existing = meshBLASes.find(mesh.get());
+		if (existing != meshBLASes.end())
+		{
+			if (!existing->second.Owner.expired())
+				continue;
+
+			// A released mesh was at the same address
+			ReleaseMeshBLAS(existing->second, retiredBuffers, retiredHitGroupRecords);
+			meshBLASes.erase(existing);
+		}
+
+		// Deformable meshes only trace their full LOD, as only that is refit
+		int lodCount = mesh->IsDeformable() ? 1 : max(mesh->GetLODCount(), 1);
+
+		// Look for BLASes built from the same data, forgetting any released since
+		// (deformable meshes change, so always get BLASes of their own)
+		std::shared_ptr<MeshLODs> lods;
+		std::vector<CachedBLAS>& cached = blasCache[mesh->GetContentHash()];
+		for (size_t i = 0; i < cached.size() && !lods && !mesh->IsDeformable(); i++)
+		{
+			std::shared_ptr<MeshLODs> cachedLODs = cached[i].LODs.lock();
+			if (!cachedLODs)
+			{
+				cached.erase(cached.begin() + i);
+				i--;
+			}
+			else if (cached[i].VertexCount == mesh->GetVertexCount() &&
+				cached[i].IndexCount == mesh->GetIndexCount() &&
+				(int)cachedLODs->size() == lodCount)
+			{
+				// The hash alone could collide, so compare the data itself
+				std::shared_ptr<Mesh> owner = FindLODsOwner(cachedLODs);
+				if (owner && SameCPUData(*owner, *mesh))
+					lods = cachedLODs;
+			}
+		}
+
+		// A cache hit just needs registering, so entities using this mesh are added to the TLAS
+		if (lods)
+		{
+			blasCacheHits++;
+			meshBLASes[mesh.get()] = { mesh, lods, mesh->GetVertexVersion(), mesh->GetRebuildVersion(), 0 };
+			continue;
+		}
+
+		lods = std::make_shared<MeshLODs>(lodCount);
+		for (int lod = 0; lod < lodCount; lod++)
+		{
+			LODBLAS& lodBLAS = (*lods)[lod];
+			lodBLAS.Record = AllocateHitGroupRecord();
+			WriteHitGroupRecord(*mesh, lod, lodBLAS.Record);
+			buildMeshes.push_back(mesh);
+			buildLODs.push_back(lod);
+			buildHandles.push_back(&lodBLAS.BLAS);
+		}
+		if (!mesh->IsDeformable())
+			cached.push_back({ mesh->GetVertexCount(), mesh->GetIndexCount(), lods });
+		meshBLASes[mesh.get()] = { mesh, lods, mesh->GetVertexVersion(), mesh->GetRebuildVersion(), 0 };
+		blasCacheMisses++;
+	}
+
+	// Build (and compact) every new BLAS together
+	if (buildMeshes.empty())
+		return;
+
+	std::vector<BLASHandle> built = CreateBLASes(buildMeshes, buildLODs);
+	if (BLASCompactionEnabled)
+		CompactBLASes(built);
+
+	for (size_t i = 0; i < built.size(); i++)
+		*buildHandles[i] = built[i];
+}
+
+
+// --------------------------------------------------------
+// Creates the top level accel structure, which is made up
+// of an instance of a BLAS for each entity, each with its
+// own transform, and waits for it to be built.
+// --------------------------------------------------------
+void RayTracing::CreateTLAS(const std::vector<std::shared_ptr<GameEntity>>& entities, std::shared_ptr<Camera> camera)
+{
+	// Don't bother if DXR isn't available
 	if (!dxrAvailable)
 		return;
 
-	// Describe the BLAS instance(s) that make up the TLAS
-	D3D12_RAYTRACING_INSTANCE_DESC instanceDesc = {};
-	instanceDesc.InstanceID = 0;
-	instanceDesc.InstanceContributionToHitGroupIndex = 0;
-	instanceDesc.InstanceMask = 0xFF;
-	instanceDesc.Transform[0][0] = 1; // Setting up a simple identity matrix here
-	instanceDesc.Transform[1][1] = 1;
-	instanceDesc.Transform[2][2] = 1;
-	instanceDesc.AccelerationStructure = BLAS->GetGPUVirtualAddress();
-	instanceDesc.Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
-
-	// The instance description actually needs to be in a buffer
-	// on the GPU, so we need to make that buffer and toss it in
-	// there ourselves (and keep the pointer long enough to finish the work)
-	TLASInstanceDescBuffer = Graphics::CreateBuffer(
-		sizeof(D3D12_RAYTRACING_INSTANCE_DESC),
-		D3D12_HEAP_TYPE_UPLOAD,
-		D3D12_RESOURCE_STATE_GENERIC_READ);
-
-	// Copy the description into the new buffer
+	// Record the build (along with any BLAS builds still pending)
+	UpdateTLAS(entities, camera);
+
+	// All done - execute, wait and reset command list
+	ExecuteAndWait();
+}
+
+
+// --------------------------------------------------------
+// Brings the TLAS in line with the entities.  Their world
+// matrices are gathered on this thread (Transform updates
+// lazily, including through parents, so isn't safe to call
+// from several threads at once), then turned into instance
+// descs in parallel by InstanceTransforms.  Deformable
+// meshes' new vertices are uploaded first, and their BLASes
+// refit if they have any (see MaxBLASUpdates).
+//
+// If the instances are the same as the TLAS was built from,
+// other than their transforms, it's updated in place, which
+// is much quicker than a build.  Anything else (or too many
+// updates in a row) rebuilds it.  Either way, commands are
+// only recorded here, and run with the frame's other work.
+//
+// Each instance uses the BLAS & hit group record of one of
+// its mesh's LODs, picked by how far it is from the camera
+// (see MaxLODErrorPixels), or the full mesh without one.  A
+// change of LOD changes the instance, so rebuilds the TLAS.
+// --------------------------------------------------------
+void RayTracing::UpdateTLAS(const std::vector<std::shared_ptr<GameEntity>>& entities, std::shared_ptr<Camera> camera)
+{
+	if (!dxrAvailable)
+		return;
+
+	// The GPU has finished the last frame that used this index
+	unsigned int frameIndex = Graphics::SwapChainIndex();
+	retiredFrameBuffers[frameIndex].clear();
+	FreeHitGroupRecords(retiredFrameHitGroupRecords[frameIndex]);
+
+	// Let go of BLASes for meshes that have been released.  Earlier
+	// frames may still be tracing them, so each is kept alive until
+	// this frame index comes around again.
+	for (auto it = meshBLASes.begin(); it != meshBLASes.end();)
+	{
+		if (!it->second.Owner.expired())
+		{
+			++it;
+			continue;
+		}
+
+		ReleaseMeshBLAS(it->second, retiredFrameBuffers[frameIndex], retiredFrameHitGroupRecords[frameIndex]);
+		it = meshBLASes.erase(it);
+	}
+
+	// Copy the new vertices of every deformed mesh into place, whether
+	// or not it has a BLAS, as the vertex buffers are what's drawn too
+	for (auto& entity : entities)
+	{
+		std::shared_ptr<Mesh> mesh = entity->GetMesh();
+		if (mesh && mesh->IsDeformable())
+			mesh->RecordVertexUpload(DXRCommandList.Get());
+	}
+
+	// Refit the BLASes of deformed meshes (or rebuild them, if they've
+	// degraded), including any no entity uses right now
+	bool blasesChanged = false;
+	for (auto& meshBLAS : meshBLASes)
+	{
+		MeshBLAS& entry = meshBLAS.second;
+		std::shared_ptr<Mesh> mesh = entry.Owner.lock();
+		if (!mesh || !mesh->IsDeformable())
+			continue;
+
+		mesh->RecordVertexUpload(DXRCommandList.Get());
+		BLASHandle& blas = (*entry.LODs)[0].BLAS;
+		if (!blas.AllowUpdate || mesh->GetVertexVersion() == entry.VertexVersion)
+			continue;
+
+		bool rebuildBLAS = mesh->GetRebuildVersion() != entry.RebuildVersion || entry.UpdatesSinceBuild >= MaxBLASUpdates;
+
+		// Earlier frames' builds are done with the scratch buffer by now
+		if (!BLASScratchBuffer || BLASScratchBuffer->GetDesc().Width < blas.ScratchBytes)
+		{
+			if (BLASScratchBuffer)
+				retiredFrameBuffers[frameIndex].push_back(BLASScratchBuffer);
+
+			BLASScratchBuffer = Graphics::CreateBuffer(
+				blas.ScratchBytes,
+				D3D12_HEAP_TYPE_DEFAULT,
+				D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+				D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+				max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+		}
+
+		D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = DescribeGeometry(*mesh);
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC blasDesc = {};
+		blasDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+		blasDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+		blasDesc.Inputs.pGeometryDescs = &geometryDesc;
+		blasDesc.Inputs.NumDescs = 1;
+		blasDesc.Inputs.Flags =
+			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE |
+			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+		if (!rebuildBLAS)
+		{
+			blasDesc.Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+			blasDesc.SourceAccelerationStructureData = blas.GetAddress();
+		}
+		blasDesc.DestAccelerationStructureData = blas.GetAddress();
+		blasDesc.ScratchAccelerationStructureData = BLASScratchBuffer->GetGPUVirtualAddress();
+		DXRCommandList->BuildRaytracingAccelerationStructure(&blasDesc, 0, 0);
+
+		// The next refit reuses the scratch memory, and the TLAS reads the BLAS
+		D3D12_RESOURCE_BARRIER blasBarriers[2] = {};
+		blasBarriers[0].Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+		blasBarriers[0].UAV.pResource = BLASScratchBuffer.Get();
+		blasBarriers[1].Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+		blasBarriers[1].UAV.pResource = blas.Buffer.Get();
+		DXRCommandList->ResourceBarrier(2, blasBarriers);
+
+		entry.VertexVersion = mesh->GetVertexVersion();
+		entry.RebuildVersion = mesh->GetRebuildVersion();
+		entry.UpdatesSinceBuild = rebuildBLAS ? 0 : entry.UpdatesSinceBuild + 1;
+		blasesChanged = true;
+	}
+
+	// How big a world space distance looks on screen, for picking LODs
+	DirectX::XMFLOAT3 cameraPosition(0, 0, 0);
+	float pixelScale = 0.0f;
+	if (camera)
+	{
+		cameraPosition = camera->GetTransform()->GetPosition();
+		pixelScale = Window::Height() / (2.0f * tanf(camera->GetFieldOfView() * 0.5f));
+	}
+
+	// Describe an instance for each entity with a BLAS, with its
+	// index in the list as its ID (for InstanceID() in shaders)
+	instanceWorlds.clear();
+	instanceDescs.clear();
+	for (size_t i = 0; i < entities.size(); i++)
+	{
+		auto meshBLAS = meshBLASes.find(entities[i]->GetMesh().get());
+		if (meshBLAS == meshBLASes.end())
+			continue;
+
+		const MeshLODs& lods = *meshBLAS->second.LODs;
+		DirectX::XMFLOAT4X4 world = entities[i]->GetTransform()->GetWorldMatrix();
+		int lod = camera && lods.size() > 1 ? SelectLOD(*entities[i]->GetMesh(), (int)lods.size(), world, cameraPosition, pixelScale) : 0;
+		if (!lods[lod].BLAS.Buffer)
+			continue;
+
+		D3D12_RAYTRACING_INSTANCE_DESC instanceDesc = {};
+		instanceDesc.InstanceID = (UINT)i;
+		instanceDesc.InstanceMask = entities[i]->GetInstanceMask();
+		instanceDesc.InstanceContributionToHitGroupIndex = lods[lod].Record.Index;
+		instanceDesc.AccelerationStructure = lods[lod].BLAS.GetAddress();
+		instanceDesc.Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
+		instanceDescs.push_back(instanceDesc);
+		instanceWorlds.push_back(world);
+	}
+	unsigned int instanceCount = (unsigned int)instanceDescs.size();
+	InstanceTransforms::Write(instanceWorlds.data(), instanceCount, instanceDescs.data(), sizeof(D3D12_RAYTRACING_INSTANCE_DESC));
+
+	// Compare with what the TLAS holds: the transform comes first in
+	// each desc, and everything after it has to match for an update.
+	// Refit BLASes need an update too, for their new bounds.
+	const size_t transformBytes = sizeof(instanceDescs[0].Transform);
+	bool rebuild = !TLAS || instanceCount != tlasInstanceDescs.size() || tlasUpdatesSinceBuild >= MaxTLASUpdates;
+	bool changed = rebuild || blasesChanged;
+	for (unsigned int i = 0; i < instanceCount && !rebuild; i++)
+	{
+		const unsigned char* current = (const unsigned char*)&instanceDescs[i];
+		const unsigned char* previous = (const unsigned char*)&tlasInstanceDescs[i];
+		if (memcmp(current + transformBytes, previous + transformBytes, sizeof(D3D12_RAYTRACING_INSTANCE_DESC) - transformBytes) != 0)
+			rebuild = true;
+		else if (memcmp(current, previous, transformBytes) != 0)
+			changed = true;
+	}
+	changed |= rebuild;
+	if (!changed)
+		return;
+
+	// Copy the descs into this frame's upload buffer, which nothing
+	// else is reading, growing it (with room to spare) if need be
+	UINT64 descBytes = (instanceCount > 0 ? instanceCount : 1) * sizeof(D3D12_RAYTRACING_INSTANCE_DESC);
+	Microsoft::WRL::ComPtr<ID3D12Resource>& descBuffer = instanceDescBuffers[frameIndex];
+	if (!descBuffer || descBuffer->GetDesc().Width < descBytes)
+	{
+		UINT64 grownBytes = descBuffer ? descBuffer->GetDesc().Width * 2 : 0;
+		descBuffer = Graphics::CreateBuffer(
+			grownBytes > descBytes ? grownBytes : descBytes,
+			D3D12_HEAP_TYPE_UPLOAD,
+			D3D12_RESOURCE_STATE_GENERIC_READ);
+	}
+
 	unsigned char* mapped = 0;
-	TLASInstanceDescBuffer->Map(0, 0, (void**)&mapped);
-	memcpy(mapped, &instanceDesc, sizeof(D3D12_RAYTRACING_INSTANCE_DESC));
-	TLASInstanceDescBuffer->Unmap(0, 0);
+	descBuffer->Map(0, 0, (void**)&mapped);
+	memcpy(mapped, instanceDescs.data(), instanceCount * sizeof(D3D12_RAYTRACING_INSTANCE_DESC));
+	descBuffer->Unmap(0, 0);
 
-	// Describe our overall input so we can get sizing info
+	// Describe our overall input
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS accelStructInputs = {};
 	accelStructInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
 	accelStructInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-	accelStructInputs.InstanceDescs = TLASInstanceDescBuffer->GetGPUVirtualAddress();
-	accelStructInputs.NumDescs = 1;
-	accelStructInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+	accelStructInputs.InstanceDescs = descBuffer->GetGPUVirtualAddress();
+	accelStructInputs.NumDescs = instanceCount;
+	accelStructInputs.Flags =
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE |
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
 
-	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO accelStructPrebuildInfo = {};
-	DXRDevice->GetRaytracingAccelerationStructurePrebuildInfo(&accelStructInputs, &accelStructPrebuildInfo);
-
-	// Handle alignment requirements ourselves
-	accelStructPrebuildInfo.ScratchDataSizeInBytes = ALIGN(accelStructPrebuildInfo.ScratchDataSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
-	accelStructPrebuildInfo.ResultDataMaxSizeInBytes = ALIGN(accelStructPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
+	if (rebuild)
+	{
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO accelStructPrebuildInfo = {};
+		DXRDevice->GetRaytracingAccelerationStructurePrebuildInfo(&accelStructInputs, &accelStructPrebuildInfo);
+
+		// Handle alignment requirements ourselves, and make sure the
+		// scratch buffer is big enough for updates as well as builds
+		UINT64 scratchBytes = accelStructPrebuildInfo.ScratchDataSizeInBytes > accelStructPrebuildInfo.UpdateScratchDataSizeInBytes ?
+			accelStructPrebuildInfo.ScratchDataSizeInBytes :
+			accelStructPrebuildInfo.UpdateScratchDataSizeInBytes;
+		scratchBytes = ALIGN(scratchBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+		UINT64 resultBytes = ALIGN(accelStructPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+
+		// Create a scratch buffer so the device has a place to temporarily
+		// store data, or reuse the last one (earlier frames' builds run
+		// before this one on the queue, so they're done with it by then)
+		if (!TLASScratchBuffer || TLASScratchBuffer->GetDesc().Width < scratchBytes)
+		{
+			if (TLASScratchBuffer)
+				retiredFrameBuffers[frameIndex].push_back(TLASScratchBuffer);
+
+			TLASScratchBuffer = Graphics::CreateBuffer(
+				scratchBytes,
+				D3D12_HEAP_TYPE_DEFAULT,
+				D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+				D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+				max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+		}
 
-	// Create a scratch buffer so the device has a place to temporarily store data
-	TLASScratchBuffer = Graphics::CreateBuffer(
-		accelStructPrebuildInfo.ScratchDataSizeInBytes,
-		D3D12_HEAP_TYPE_DEFAULT,
-		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
-		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+		// Same goes for the final buffer for the TLAS
+		if (!TLAS || TLAS->GetDesc().Width < resultBytes)
+		{
+			if (TLAS)
+				retiredFrameBuffers[frameIndex].push_back(TLAS);
+
+			TLAS = Graphics::CreateBuffer(
+				resultBytes,
+				D3D12_HEAP_TYPE_DEFAULT,
+				D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
+				D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+				max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+		}
 
-	// Create the final buffer for the TLAS
-	TLAS = Graphics::CreateBuffer(
-		accelStructPrebuildInfo.ResultDataMaxSizeInBytes,
-		D3D12_HEAP_TYPE_DEFAULT,
-		D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
-		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
-		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+		tlasUpdatesSinceBuild = 0;
+	}
+	else
+	{
+		// Only transforms have changed, so update the TLAS in place
+		accelStructInputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+		buildDesc.SourceAccelerationStructureData = TLAS->GetGPUVirtualAddress();
+		tlasUpdatesSinceBuild++;
+	}
 
 	// Describe the final TLAS and set up the build
-	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
 	buildDesc.Inputs = accelStructInputs;
 	buildDesc.ScratchAccelerationStructureData = TLASScratchBuffer->GetGPUVirtualAddress();
 	buildDesc.DestAccelerationStructureData = TLAS->GetGPUVirtualAddress();
 	DXRCommandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, 0);
 
-	// Set up a barrier to wait until the TLAS is actually built to proceed
-	// Note: Probably unnecessary because we're about to execute and wait below,
-	//       but keeping this here in the event we adjust when we execute.
+	// Set up a barrier so rays wait until the TLAS is actually built
 	D3D12_RESOURCE_BARRIER tlasBarrier = {};
 	tlasBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
 	tlasBarrier.UAV.pResource = TLAS.Get();
 	tlasBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
 	DXRCommandList->ResourceBarrier(1, &tlasBarrier);
 
+	// Remember what the TLAS now holds
+	tlasInstanceDescs.swap(instanceDescs);
 
-	// All done - execute, wait and reset command list
-	DXRCommandList->Close();
+	// The scene has changed, so earlier samples no longer match it
+	ResetAccumulation();
+}
 
-	ID3D12CommandList* lists[] = { DXRCommandList.Get() };
-	Graphics::CommandQueue->ExecuteCommandLists(1, lists);
 
-	Graphics::WaitForGPU();
-	Graphics::ResetAllocatorAndCommandList(0);
+// --------------------------------------------------------
+// Starts accumulating samples from scratch on the next frame
+// --------------------------------------------------------
+void RayTracing::ResetAccumulation()
+{
+	accumulatedSamples = 0;
+}
+
+
+// --------------------------------------------------------
+// How many samples the current output is an average of
+// --------------------------------------------------------
+unsigned int RayTracing::GetAccumulatedSamples()
+{
+	return accumulatedSamples;
 }
 
 
 // --------------------------------------------------------
-// Performs the actual raytracing work
+// Performs the actual raytracing work, shading hits with
+// up to MAX_LIGHTS lights (each checked with shadow rays)
+//
+// With accumulation enabled, each frame traces one sample
+// per pixel at a slightly different spot within the pixel,
+// and the output is the average of every sample since the
+// camera (or scene) last changed.  Once the maximum number
+// of samples is reached the image has converged, so only
+// the copy to the back buffer remains.
 // --------------------------------------------------------
-void RayTracing::Raytrace(std::shared_ptr<Camera> camera, Microsoft::WRL::ComPtr<ID3D12Resource> currentBackBuffer)
+void RayTracing::Raytrace(std::shared_ptr<Camera> camera, const std::vector<Light>& lights, Microsoft::WRL::ComPtr<ID3D12Resource> currentBackBuffer)
 {
 	if (!dxrInitialized || !dxrAvailable)
 		return;
 
+	// Any change to the camera or lights starts accumulation over
+	DirectX::XMFLOAT4X4 view = camera->GetView();
+	DirectX::XMFLOAT4X4 proj = camera->GetProjection();
+	if (!AccumulationEnabled ||
+		memcmp(&view, &accumulatedView, sizeof(DirectX::XMFLOAT4X4)) != 0 ||
+		memcmp(&proj, &accumulatedProjection, sizeof(DirectX::XMFLOAT4X4)) != 0 ||
+		lights.size() != accumulatedLights.size() ||
+		(!lights.empty() && memcmp(lights.data(), accumulatedLights.data(), sizeof(Light) * lights.size()) != 0))
+	{
+		accumulatedSamples = 0;
+		accumulatedView = view;
+		accumulatedProjection = proj;
+		accumulatedLights = lights;
+	}
+	bool converged = AccumulationEnabled && accumulatedSamples >= MaxAccumulatedSamples;
+
 	// Transition the output-related resources to the proper states
 	D3D12_RESOURCE_BARRIER outputBarriers[2] = {};
 	{
@@ -732,24 +1653,38 @@ void RayTracing::Raytrace(std::shared_ptr<Camera> camera, Microsoft::WRL::ComPtr
 		outputBarriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
 		outputBarriers[1].Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
 
-		DXRCommandList->ResourceBarrier(2, outputBarriers);
+		// A converged output is left as is, ready to copy
+		DXRCommandList->ResourceBarrier(converged ? 1 : 2, outputBarriers);
 	}
 
-	// Grab and fill a constant buffer
-	RaytracingSceneData sceneData = {};
-	sceneData.cameraPosition = camera->GetTransform()->GetPosition();
+	// ACTUAL RAYTRACING HERE
+	if (!converged)
+	{
+		// Grab and fill a constant buffer
+		RaytracingSceneData sceneData = {};
+		sceneData.cameraPosition = camera->GetTransform()->GetPosition();
+
+		DirectX::XMMATRIX v = DirectX::XMLoadFloat4x4(&view);
+		DirectX::XMMATRIX p = DirectX::XMLoadFloat4x4(&proj);
+		DirectX::XMMATRIX vp = DirectX::XMMatrixMultiply(v, p);
+		DirectX::XMStoreFloat4x4(&sceneData.inverseViewProjection, XMMatrixInverse(0, vp));
+
+		// The first sample goes through the middle of each pixel (exactly
+		// like without accumulation), and the rest spread out around it
+		sceneData.sampleIndex = accumulatedSamples;
+		if (accumulatedSamples > 0)
+		{
+			sceneData.pixelJitter.x = Halton(accumulatedSamples, 2) - 0.5f;
+			sceneData.pixelJitter.y = Halton(accumulatedSamples, 3) - 0.5f;
+		}
 
-	DirectX::XMFLOAT4X4 view = camera->GetView();
-	DirectX::XMFLOAT4X4 proj = camera->GetProjection();
-	DirectX::XMMATRIX v = DirectX::XMLoadFloat4x4(&view);
-	DirectX::XMMATRIX p = DirectX::XMLoadFloat4x4(&proj);
-	DirectX::XMMATRIX vp = DirectX::XMMatrixMultiply(v, p);
-	DirectX::XMStoreFloat4x4(&sceneData.inverseViewProjection, XMMatrixInverse(0, vp));
+		// Only as many lights as the shader has room for
+		sceneData.lightCount = lights.size() < MAX_LIGHTS ? (int)lights.size() : MAX_LIGHTS;
+		if (sceneData.lightCount > 0)
+			memcpy(sceneData.lights, lights.data(), sizeof(Light) * sceneData.lightCount);
 
-	D3D12_GPU_DESCRIPTOR_HANDLE cbuffer = Graphics::FillNextConstantBufferAndGetGPUDescriptorHandle(&sceneData, sizeof(RaytracingSceneData));
+		D3D12_GPU_DESCRIPTOR_HANDLE cbuffer = Graphics::FillNextConstantBufferAndGetGPUDescriptorHandle(&sceneData, sizeof(RaytracingSceneData));
 
-	// ACTUAL RAYTRACING HERE
-	{
 		// Set the CBV/SRV/UAV descriptor heap
 		ID3D12DescriptorHeap* heap[] = { Graphics::CBVSRVDescriptorHeap.Get() };
 		DXRCommandList->SetDescriptorHeaps(1, heap);
@@ -760,7 +1695,7 @@ void RayTracing::Raytrace(std::shared_ptr<Camera> camera, Microsoft::WRL::ComPtr
 
 		// Set the global root sig so we can also set descriptor tables
 		DXRCommandList->SetComputeRootSignature(GlobalRaytracingRootSig.Get());
-		DXRCommandList->SetComputeRootDescriptorTable(0,			// First table is just output UAV
+		DXRCommandList->SetComputeRootDescriptorTable(0,			// First table is the output & accumulation UAVs
 			RaytracingOutputUAV_GPU);
 		DXRCommandList->SetComputeRootShaderResourceView(1,			// Second is SRV for accel structure (as root SRV, no table needed)
 			TLAS->GetGPUVirtualAddress());
@@ -773,14 +1708,15 @@ void RayTracing::Raytrace(std::shared_ptr<Camera> camera, Microsoft::WRL::ComPtr
 		dispatchDesc.RayGenerationShaderRecord.StartAddress = ShaderTable->GetGPUVirtualAddress();
 		dispatchDesc.RayGenerationShaderRecord.SizeInBytes = ShaderTableRecordSize;
 
-		// Miss shader location in shader table (we could have a whole sub-table of just these, but only 1 for this demo)
+		// Miss shader table location in shader table: regular rays use the first,
+		// and shadow rays the second (see ShadowMissIndex in the shader)
 		dispatchDesc.MissShaderTable.StartAddress = ShaderTable->GetGPUVirtualAddress() + ShaderTableRecordSize; // Offset by 1 record
-		dispatchDesc.MissShaderTable.SizeInBytes = ShaderTableRecordSize; // Assuming sizes here (might want to verify later)
+		dispatchDesc.MissShaderTable.SizeInBytes = ShaderTableRecordSize * 2; // Assuming sizes here (might want to verify later)
 		dispatchDesc.MissShaderTable.StrideInBytes = ShaderTableRecordSize;
 
 		// Hit group location in shader table (we could have multiple types of hit shaders, but only 1 for this demo)
-		dispatchDesc.HitGroupTable.StartAddress = ShaderTable->GetGPUVirtualAddress() + ShaderTableRecordSize * 2; // Offset by 2 records
-		dispatchDesc.HitGroupTable.SizeInBytes = ShaderTableRecordSize; // Assuming sizes here (might want to verify later)
+		dispatchDesc.HitGroupTable.StartAddress = ShaderTable->GetGPUVirtualAddress() + ShaderTableRecordSize * 3; // Offset by 3 records
+		dispatchDesc.HitGroupTable.SizeInBytes = ShaderTableRecordSize * max(hitGroupRecordCount, 1u); // Every BLAS's record
 		dispatchDesc.HitGroupTable.StrideInBytes = ShaderTableRecordSize;
 
 		// Set number of rays to match screen size
@@ -790,15 +1726,25 @@ void RayTracing::Raytrace(std::shared_ptr<Camera> camera, Microsoft::WRL::ComPtr
 
 		// GO!
 		DXRCommandList->DispatchRays(&dispatchDesc);
-	}
 
-	// Final transitions
-	{
+		// This frame's sample is now part of the average, which
+		// the next frame's rays must wait for before reading
+		if (AccumulationEnabled)
+			accumulatedSamples++;
+
+		D3D12_RESOURCE_BARRIER accumulationBarrier = {};
+		accumulationBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+		accumulationBarrier.UAV.pResource = AccumulationBuffer.Get();
+		DXRCommandList->ResourceBarrier(1, &accumulationBarrier);
+
 		// Transition the raytracing output to COPY SOURCE
 		outputBarriers[1].Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
 		outputBarriers[1].Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE;
 		DXRCommandList->ResourceBarrier(1, &outputBarriers[1]);
+	}
 
+	// Final transitions
+	{
 		// Copy the raytracing output into the back buffer
 		DXRCommandList->CopyResource(currentBackBuffer.Get(), RaytracingOutput.Get());
 
@@ -4,12 +4,57 @@
 #include <wrl/client.h>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "Mesh.h"
+#include "GameEntity.h"
 #include "Camera.h"
+#include "Lights.h"
 
 namespace RayTracing
 {
+	// --------------------------------------------------------
+	// A bottom level accel structure made by CreateBLASes().
+	// Every BLAS from the same call shares one buffer, so each
+	// is a range of it, and keeps the buffer alive.
+	// --------------------------------------------------------
+	struct BLASHandle
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> Buffer;
+		UINT64 Offset = 0;
+		UINT64 Size = 0;
+		bool AllowCompaction = false;				// Built with ALLOW_COMPACTION?
+		bool AllowUpdate = false;					// Built with ALLOW_UPDATE (for deformable meshes)?
+		UINT64 ScratchBytes = 0;					// Enough to rebuild or update it in place
+		unsigned int MemoryStatsIndex = 0;			// Its entry in GetMemoryStats().BLASes
+
+		D3D12_GPU_VIRTUAL_ADDRESS GetAddress() const { return Buffer ? Buffer->GetGPUVirtualAddress() + Offset : 0; }
+	};
+
+	// Memory used by one BLAS, as built and after any compaction
+	struct BLASMemoryStats
+	{
+		unsigned long long MeshHash;			// Mesh::GetContentHash() of its mesh
+		unsigned int LOD;						// Which of the mesh's LODs (0 is the full mesh)
+		unsigned int TriangleCount;
+		UINT64 BuiltBytes;						// ResultDataMaxSizeInBytes
+		UINT64 CurrentBytes;					// The compacted size, once compacted
+		bool Compacted;
+		bool Released;							// No mesh uses it any more
+	};
+
+	// Memory used by every accel structure built so far
+	struct AccelStructMemoryStats
+	{
+		std::vector<BLASMemoryStats> BLASes;
+		UINT64 BLASBuiltBytes;					// Totals are of BLASes still in use
+		UINT64 BLASCurrentBytes;
+		UINT64 TLASBytes;
+		UINT64 ScratchBytes;					// BLAS & TLAS scratch buffers
+		unsigned int BLASCacheHits;				// Meshes given another mesh's BLASes, having the same data
+		unsigned int BLASCacheMisses;			// Meshes that needed BLASes of their own
+	};
+
 	// --- GLOBAL VARS ---
 	// Raytracing-specific versions of base DX12 objects
 	inline Microsoft::WRL::ComPtr<ID3D12Device5> DXRDevice;
@@ -33,19 +78,50 @@ namespace RayTracing
 	// Accel structure requirements
 	inline Microsoft::WRL::ComPtr<ID3D12Resource> TLASScratchBuffer;
 	inline Microsoft::WRL::ComPtr<ID3D12Resource> BLASScratchBuffer;
-	inline Microsoft::WRL::ComPtr<ID3D12Resource> TLASInstanceDescBuffer;
 	inline Microsoft::WRL::ComPtr<ID3D12Resource> TLAS;
-	inline Microsoft::WRL::ComPtr<ID3D12Resource> BLAS;
+
+	// Updating the TLAS in place is quicker than rebuilding it, but
+	// it gets slower to trace as instances move away from where they
+	// were built, so it's rebuilt after this many updates in a row
+	inline unsigned int MaxTLASUpdates = 60;
+
+	// Scratch memory batched BLAS builds aim to fit in.  It's only
+	// exceeded when a single mesh needs more, and the scratch buffer
+	// is kept between calls and only ever grows.
+	inline UINT64 BLASScratchBudget = 32 * 1024 * 1024;
+
+	// Should BLASes be built so they can be compacted, and be compacted
+	// by CreateBLAS()?  Takes an extra GPU round trip, but BLASes usually
+	// need far less memory than their worst case size.
+	inline bool BLASCompactionEnabled = false;
+
+	// Instances use the coarsest LOD of their mesh whose simplification
+	// error would cover less than this many pixels on screen, measured
+	// from the near side of the instance's bounds
+	inline float MaxLODErrorPixels = 0.5f;
+
+	// Deformable meshes' BLASes are updated in place whenever their
+	// vertices change.  They're rebuilt instead when the mesh had to
+	// rebuild its CPU BVH (see MeshOptions::MaxRefitDegradation), or
+	// after this many updates in a row, for meshes without a BVH.
+	inline unsigned int MaxBLASUpdates = 120;
 
 	// Actual output resource
 	inline Microsoft::WRL::ComPtr<ID3D12Resource> RaytracingOutput;
 	inline D3D12_CPU_DESCRIPTOR_HANDLE RaytracingOutputUAV_CPU;
 	inline D3D12_GPU_DESCRIPTOR_HANDLE RaytracingOutputUAV_GPU;
 
-	// Other SRVs for geometry
-	// - Larger application will need these FOR EACH MESH
-	inline D3D12_GPU_DESCRIPTOR_HANDLE indexBufferSRV;
-	inline D3D12_GPU_DESCRIPTOR_HANDLE vertexBufferSRV;
+	// Running average of every sample since the view last changed,
+	// in full precision (its UAV directly follows the output's)
+	inline Microsoft::WRL::ComPtr<ID3D12Resource> AccumulationBuffer;
+	inline D3D12_CPU_DESCRIPTOR_HANDLE AccumulationUAV_CPU;
+	inline D3D12_GPU_DESCRIPTOR_HANDLE AccumulationUAV_GPU;
+
+	// Progressive accumulation settings: while enabled, each frame
+	// with an unchanged camera & scene adds a jittered sample, up to
+	// the maximum, after which no more rays are traced at all
+	inline bool AccumulationEnabled = true;
+	inline unsigned int MaxAccumulatedSamples = 256;
 
 	// --- FUNCTIONS ---
 	HRESULT Initialize(
@@ -57,11 +133,36 @@ namespace RayTracing
 		unsigned int outputHeight);
 	void Raytrace(
 		std::shared_ptr<Camera> camera, 
+		const std::vector<Light>& lights,
 		Microsoft::WRL::ComPtr<ID3D12Resource> currentBackBuffer);
 
+	// Accumulation control (camera & light changes are detected automatically,
+	// but anything else that changes the scene needs to reset it)
+	void ResetAccumulation();
+	unsigned int GetAccumulatedSamples();
+
+	// Builds a BLAS for each mesh, all recorded together with shared
+	// scratch memory.  Results are in the same order as the meshes.
+	// lods optionally picks which LOD of each mesh to build (default 0).
+	std::vector<BLASHandle> CreateBLASes(const std::vector<std::shared_ptr<Mesh>>& meshes, const std::vector<int>& lods = std::vector<int>());
+
+	// Copies BLASes built with compaction allowed into one tightly sized
+	// buffer, replacing the handles.  Executes all recorded commands and
+	// waits for the GPU, twice.
+	void CompactBLASes(std::vector<BLASHandle>& blases);
+
+	AccelStructMemoryStats GetMemoryStats();
+
+	// Records this frame's TLAS build (or in place update, when only
+	// transforms have changed) from every entity whose mesh has a BLAS,
+	// with LODs picked by distance from the camera (if there is one).
+	// Call each frame before Raytrace(); does nothing if nothing moved.
+	void UpdateTLAS(const std::vector<std::shared_ptr<GameEntity>>& entities, std::shared_ptr<Camera> camera = 0);
+
 	// Helper functions for each initalization step
 	void CreateBLAS(std::shared_ptr<Mesh> mesh);
-	void CreateTLAS();
+	void CreateBLAS(const std::vector<std::shared_ptr<Mesh>>& meshes);	// Builds & compacts them all together
+	void CreateTLAS(const std::vector<std::shared_ptr<GameEntity>>& entities, std::shared_ptr<Camera> camera = 0);
 	void CreateRaytracingRootSignatures();
 	void CreateRaytracingPipelineState(std::wstring raytracingShaderLibraryFile);
 	void CreateShaderTable();
@@ -8,11 +8,12 @@ struct Vertex
     float3 localPosition;
     float2 uv;
     float3 normal;
-    float3 tangent;
+    float4 tangent; // w is handedness
 };
 
-// 11 floats total per vertex * 4 bytes each
-static const uint VertexSizeInBytes = 11 * 4; 
+// Vertex buffer layouts (must match VertexFormat in Vertex.h)
+static const uint VertexFormatFull = 0;		// 12 floats total per vertex * 4 bytes each
+static const uint VertexFormatPacked = 1;	// 3 floats & 3 packed uints per vertex * 4 bytes each
 
 
 // Payload for rays (data that is "sent along" with each ray during raytrace)
@@ -22,6 +23,36 @@ struct RayPayload
 	float3 color;
 };
 
+// Payload for shadow rays, which only need to know if anything was in the way
+struct ShadowPayload
+{
+	bool visible;
+};
+
+// Must match the definitions in Lights.h
+#define MAX_LIGHTS 128
+#define LIGHT_TYPE_DIRECTIONAL	0
+#define LIGHT_TYPE_POINT		1
+#define LIGHT_TYPE_SPOT			2
+
+struct Light
+{
+	int		Type;
+	float3	Direction;
+	float	Range;
+	float3	Position;
+	float	Intensity;
+	float3	Color;
+	float	SpotFalloff;
+	float3	Padding;
+};
+
+// Light that reaches everywhere, even in shadow
+static const float3 AmbientLight = float3(0.1f, 0.1f, 0.1f);
+
+// Index of the shadow miss shader in the miss shader table
+static const uint ShadowMissIndex = 1;
+
 // Note: We'll be using the built-in BuiltInTriangleIntersectionAttributes struct
 // for triangle attributes, so no need to define our own.  It contains a single float2.
 
@@ -33,6 +64,20 @@ cbuffer SceneData : register(b0)
 {
 	matrix inverseViewProjection;
 	float3 cameraPosition;
+	uint sampleIndex;
+	float2 pixelJitter;
+	int lightCount;
+	Light lights[MAX_LIGHTS];
+};
+
+// Per-mesh data from the local root signature (root constants)
+cbuffer MeshData : register(b1)
+{
+	uint vertexFormat;
+	uint positionStride;
+	uint attributeStride;
+	uint attributeOffset;
+	uint indexStride;
 };
 
 
@@ -41,12 +86,19 @@ cbuffer SceneData : register(b0)
 // Output UAV 
 RWTexture2D<float4> OutputColor				: register(u0);
 
+// Running average of all samples so far (full precision)
+RWTexture2D<float4> AccumulatedColor		: register(u1);
+
 // The actual scene we want to trace through (a TLAS)
 RaytracingAccelerationStructure SceneTLAS	: register(t0);
 
 // Geometry buffers
+// - Attributes are everything after the position, and may either be in
+//   their own buffer or interleaved with the positions (in which case
+//   both SRVs are the same buffer and the attribute offset skips the position)
 ByteAddressBuffer IndexBuffer        		: register(t1);
 ByteAddressBuffer VertexBuffer				: register(t2);
+ByteAddressBuffer AttributeBuffer			: register(t3);
 
 
 // === Helpers ===
@@ -57,8 +109,83 @@ uint3 LoadIndices(uint triangleIndex)
 	// What is the start index of this triangle's indices?
 	uint indicesStart = triangleIndex * 3;
 
-	// Adjust by the byte size before loading
-	return IndexBuffer.Load3(indicesStart * 4); // 4 bytes per index
+	// 32-bit indices can be loaded directly
+	if (indexStride == 4)
+		return IndexBuffer.Load3(indicesStart * 4); // 4 bytes per index
+
+	// 16-bit indices: raw loads must be dword aligned, so grab the two dwords
+	// holding this triangle's three indices (the buffer is padded to allow this)
+	uint byteOffset = indicesStart * 2;
+	uint2 dwords = IndexBuffer.Load2(byteOffset & ~3);
+
+	// Either the triangle starts at the beginning or the middle of the first dword
+	if ((byteOffset & 3) == 0)
+		return uint3(dwords.x & 0xFFFF, dwords.x >> 16, dwords.y & 0xFFFF);
+	else
+		return uint3(dwords.x >> 16, dwords.y & 0xFFFF, dwords.y >> 16);
+}
+
+
+// Sign extends the low "bits" bits of a uint and converts to [-1, 1]
+// (mirrors DequantizeSnorm() in VertexPacking.cpp)
+float DequantizeSnorm(uint packed, float scale, uint bits)
+{
+	int quantized = asint(packed << (32 - bits)) >> (32 - bits);
+	return max(quantized / scale, -1.0f);
+}
+
+
+// Unfolds octahedral coordinates into a unit vector
+// (mirrors OctahedralUnproject() in VertexPacking.cpp)
+float3 OctahedralUnproject(float2 oct)
+{
+	float3 v = float3(oct, 1.0f - abs(oct.x) - abs(oct.y));
+	float t = saturate(-v.z);
+	v.x += v.x >= 0.0f ? -t : t;
+	v.y += v.y >= 0.0f ? -t : t;
+	return normalize(v);
+}
+
+
+// Loads a single vertex from the geometry buffers, decoding it if necessary
+Vertex LoadVertex(uint vertexIndex)
+{
+	Vertex vert;
+
+	// Position is always full precision
+	vert.localPosition = asfloat(VertexBuffer.Load3(vertexIndex * positionStride));
+
+	uint dataIndex = vertexIndex * attributeStride + attributeOffset;
+	if (vertexFormat == VertexFormatPacked)
+	{
+		// Everything else is packed (see VertexPacking.h)
+		uint3 packed = AttributeBuffer.Load3(dataIndex);
+
+		// Normal: 16-bit octahedral x & y
+		vert.normal = OctahedralUnproject(float2(
+			DequantizeSnorm(packed.x, 32767.0f, 16),
+			DequantizeSnorm(packed.x >> 16, 32767.0f, 16)));
+
+		// Tangent: 16-bit & 15-bit octahedral x & y, handedness in the top bit
+		vert.tangent.xyz = OctahedralUnproject(float2(
+			DequantizeSnorm(packed.y, 32767.0f, 16),
+			DequantizeSnorm(packed.y >> 16, 16383.0f, 15)));
+		vert.tangent.w = (packed.y & 0x80000000) ? -1.0f : 1.0f;
+
+		// UV: two halfs
+		vert.uv = f16tof32(uint2(packed.z, packed.z >> 16));
+		return vert;
+	}
+
+	// Full precision, so just grab each piece in order
+	vert.uv = asfloat(AttributeBuffer.Load2(dataIndex));
+	dataIndex += 2 * 4; // 2 floats * 4 bytes per float
+
+	vert.normal = asfloat(AttributeBuffer.Load3(dataIndex));
+	dataIndex += 3 * 4; // 3 floats * 4 bytes per float
+
+	vert.tangent = asfloat(AttributeBuffer.Load4(dataIndex));
+	return vert;
 }
 
 
@@ -80,23 +207,11 @@ Vertex InterpolateVertices(uint triangleIndex, float2 barycentrics)
 	// Loop through the barycentric data and interpolate
 	for (uint i = 0; i < 3; i++)
 	{
-		// Get the index of the first piece of data for this vertex
-		uint dataIndex = indices[i] * VertexSizeInBytes;
-
-		// Grab the position and offset
-		vert.localPosition += asfloat(VertexBuffer.Load3(dataIndex)) * barycentricData[i];
-		dataIndex += 3 * 4; // 3 floats * 4 bytes per float
-
-		// UV
-		vert.uv += asfloat(VertexBuffer.Load2(dataIndex)) * barycentricData[i];
-		dataIndex += 2 * 4; // 2 floats * 4 bytes per float
-
-		// Normal
-		vert.normal += asfloat(VertexBuffer.Load3(dataIndex)) * barycentricData[i];
-		dataIndex += 3 * 4; // 3 floats * 4 bytes per float
-
-		// Tangent (no offset at the end, since we start over after looping)
-		vert.tangent += asfloat(VertexBuffer.Load3(dataIndex)) * barycentricData[i];
+		Vertex corner = LoadVertex(indices[i]);
+		vert.localPosition += corner.localPosition * barycentricData[i];
+		vert.uv += corner.uv * barycentricData[i];
+		vert.normal += corner.normal * barycentricData[i];
+		vert.tangent += corner.tangent * barycentricData[i];
 	}
 
 	// Final interpolated vertex data is ready
@@ -107,8 +222,9 @@ Vertex InterpolateVertices(uint triangleIndex, float2 barycentrics)
 // Calculates an origin and direction from the camera for specific pixel indices
 RayDesc CalcRayFromCamera(float2 rayIndices)
 {
-	// Offset to the middle of the pixel
-	float2 pixel = rayIndices + 0.5f;
+	// Offset to the middle of the pixel, then jittered
+	// within it when accumulating samples
+	float2 pixel = rayIndices + 0.5f + pixelJitter;
 	float2 screenPos = pixel / DispatchRaysDimensions().xy * 2.0f - 1.0f;
 	screenPos.y = -screenPos.y;
 
@@ -126,6 +242,68 @@ RayDesc CalcRayFromCamera(float2 rayIndices)
 }
 
 
+// Is anything between a point and a light?  Shadow rays end at the first
+// hit they find and skip the closest hit shader entirely, so the payload
+// starts out "blocked" and only the shadow miss shader marks it visible
+bool IsOccluded(float3 origin, float3 direction, float maxDistance)
+{
+	RayDesc ray;
+	ray.Origin = origin;
+	ray.Direction = direction;
+	ray.TMin = 0.01f;
+	ray.TMax = maxDistance;
+
+	ShadowPayload payload;
+	payload.visible = false;
+
+	TraceRay(
+		SceneTLAS,
+		RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH | RAY_FLAG_SKIP_CLOSEST_HIT_SHADER,
+		0xFF,
+		0,
+		0,
+		ShadowMissIndex,
+		ray,
+		payload);
+
+	return !payload.visible;
+}
+
+
+// Diffuse light reaching a surface from all unshadowed lights
+// (mirrors CalcLighting() in CPURaytracer.cpp)
+float3 CalcLighting(float3 position, float3 normal)
+{
+	float3 total = AmbientLight;
+	for (int i = 0; i < lightCount; i++)
+	{
+		Light light = lights[i];
+
+		// Direction & distance to the light, and how much of it is left by then
+		float3 toLight = -normalize(light.Direction);
+		float lightDistance = 1000.0f;
+		float attenuation = 1.0f;
+		if (light.Type != LIGHT_TYPE_DIRECTIONAL)
+		{
+			toLight = light.Position - position;
+			lightDistance = length(toLight);
+			toLight /= lightDistance;
+
+			attenuation = saturate(1.0f - lightDistance * lightDistance / (light.Range * light.Range));
+			attenuation *= attenuation;
+			if (light.Type == LIGHT_TYPE_SPOT)
+				attenuation *= pow(saturate(dot(-toLight, normalize(light.Direction))), light.SpotFalloff);
+		}
+
+		// Only trace a shadow ray if there's light to block
+		float nDotL = saturate(dot(normal, toLight));
+		if (nDotL > 0.0f && attenuation > 0.0f && !IsOccluded(position, toLight, lightDistance))
+			total += light.Color * light.Intensity * nDotL * attenuation;
+	}
+	return total;
+}
+
+
 // === Shaders ===
 
 // Ray generation shader - Launched once for each ray we want to generate
@@ -155,8 +333,17 @@ void RayGen()
 		ray,
 		payload);
 
+	// Fold this sample into the running average of the previous ones
+	float3 color = payload.color;
+	if (sampleIndex > 0)
+	{
+		float3 previous = AccumulatedColor[rayIndices].rgb;
+		color = previous + (color - previous) / (sampleIndex + 1);
+	}
+	AccumulatedColor[rayIndices] = float4(color, 1);
+
 	// Set the final color of the buffer
-	OutputColor[rayIndices] = float4(payload.color, 1);
+	OutputColor[rayIndices] = float4(color, 1);
 }
 
 
@@ -170,6 +357,14 @@ void Miss(inout RayPayload payload)
 }
 
 
+// Shadow miss shader - Nothing blocked the shadow ray, so the light is visible
+[shader("miss")]
+void ShadowMiss(inout ShadowPayload payload)
+{
+	payload.visible = true;
+}
+
+
 // Closest hit shader - Runs the first time a ray hits anything
 [shader("closesthit")]
 void ClosestHit(inout RayPayload payload, BuiltInTriangleIntersectionAttributes hitAttributes)
@@ -183,4 +378,12 @@ void ClosestHit(inout RayPayload payload, BuiltInTriangleIntersectionAttributes
 	// Use the resulting data to set the final color
 	// Note: Here is where we would do actual shading!
 	payload.color = interpolatedVert.normal;
+
+	// Light the surface (still colored by its normal) if there are lights
+	if (lightCount > 0)
+	{
+		float3 position = WorldRayOrigin() + WorldRayDirection() * RayTCurrent();
+		float3 normal = normalize(mul((float3x3)ObjectToWorld3x4(), interpolatedVert.normal));
+		payload.color *= CalcLighting(position, normal);
+	}
 }
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "AccelBuildPlanner.h"
+#include "TestHelpers.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------
+// Checks AccelBuildPlanner's plans: exact offsets & batches
+// for small hand worked cases (alignment, splitting builds
+// across batches to fit the budget, and a single build too
+// big for the budget), then the general rules over a few
+// thousand random sets of sizes
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	const unsigned long long MB = 1024 * 1024;
+
+	// Plans the builds and checks the plan passes Validate()
+	AccelBuildPlan PlanAndValidate(const char* name, const std::vector<AccelBuildSizes>& sizes, unsigned long long budget)
+	{
+		AccelBuildPlan plan = AccelBuildPlanner::Plan(sizes, budget);
+		std::string error;
+		bool valid = AccelBuildPlanner::Validate(sizes, plan, error);
+		if (!valid)
+			printf("  %s: %s\n", name, error.c_str());
+		CHECK(valid);
+		return plan;
+	}
+
+	void CheckPlacement(const AccelBuildPlacement& placement, unsigned int batch, unsigned long long scratchOffset, unsigned long long resultOffset)
+	{
+		CHECK(placement.Batch == batch);
+		CHECK(placement.ScratchOffset == scratchOffset);
+		CHECK(placement.ResultOffset == resultOffset);
+	}
+
+	// --------------------------------------------------------
+	// Unaligned sizes are rounded up to 256 bytes, results go
+	// one after another in the order given, and with no budget
+	// the scratch buffer is just big enough for the biggest
+	// build, with the others packed biggest first
+	// --------------------------------------------------------
+	void CheckOffsetsAndAlignment()
+	{
+		std::vector<AccelBuildSizes> sizes = { { 1000, 300 }, { 3000, 10 }, { 2000, 513 } };
+		AccelBuildPlan plan = PlanAndValidate("offsets", sizes, 0);
+
+		CHECK(plan.ResultBytes == 512 + 256 + 768);
+		CHECK(plan.SeparateScratchBytes == 1024 + 3072 + 2048);
+		CHECK(plan.ScratchBytes == 3072);
+		CHECK(plan.BatchCount == 2);
+		CheckPlacement(plan.Builds[0], 1, 2048, 0);
+		CheckPlacement(plan.Builds[1], 0, 0, 512);
+		CheckPlacement(plan.Builds[2], 1, 0, 768);
+
+		// Nothing to build needs no memory at all
+		AccelBuildPlan empty = PlanAndValidate("no builds", {}, 32 * MB);
+		CHECK(empty.Builds.empty());
+		CHECK(empty.BatchCount == 0);
+		CHECK(empty.ScratchBytes == 0);
+		CHECK(empty.ResultBytes == 0);
+
+		// Builds without scratch still get (aligned) results
+		AccelBuildPlan noScratch = PlanAndValidate("no scratch", { { 0, 1000 }, { 0, 1 } }, 32 * MB);
+		CHECK(noScratch.ScratchBytes == 0);
+		CHECK(noScratch.BatchCount == 1);
+		CHECK(noScratch.ResultBytes == 1024 + 256);
+		CheckPlacement(noScratch.Builds[1], 0, 0, 1024);
+	}
+
+	// --------------------------------------------------------
+	// Builds are split into as few batches as fit the budget,
+	// and the scratch buffer is never bigger than every build
+	// needs at once
+	// --------------------------------------------------------
+	void CheckBudgetSplitting()
+	{
+		std::vector<AccelBuildSizes> sizes(4, { 10 * MB, 1 * MB });
+
+		AccelBuildPlan tight = PlanAndValidate("25 MB budget", sizes, 25 * MB);
+		CHECK(tight.ScratchBytes == 25 * MB);
+		CHECK(tight.BatchCount == 2);
+		CheckPlacement(tight.Builds[0], 0, 0, 0);
+		CheckPlacement(tight.Builds[1], 0, 10 * MB, 1 * MB);
+		CheckPlacement(tight.Builds[2], 1, 0, 2 * MB);
+		CheckPlacement(tight.Builds[3], 1, 10 * MB, 3 * MB);
+
+		AccelBuildPlan exact = PlanAndValidate("40 MB budget", sizes, 40 * MB);
+		CHECK(exact.ScratchBytes == 40 * MB);
+		CHECK(exact.BatchCount == 1);
+
+		AccelBuildPlan generous = PlanAndValidate("100 MB budget", sizes, 100 * MB);
+		CHECK(generous.ScratchBytes == 40 * MB);
+		CHECK(generous.BatchCount == 1);
+
+		// An unaligned budget is rounded up, not down
+		AccelBuildPlan unaligned = PlanAndValidate("unaligned budget", { { 256, 1 }, { 256, 1 } }, 300);
+		CHECK(unaligned.ScratchBytes == 512);
+		CHECK(unaligned.BatchCount == 1);
+	}
+
+	// --------------------------------------------------------
+	// A build that needs more than the budget by itself gets
+	// the whole scratch buffer, sized to it, and a batch of its
+	// own.  The rest share the same memory afterwards.
+	// --------------------------------------------------------
+	void CheckOversizedBuild()
+	{
+		std::vector<AccelBuildSizes> sizes = { { 5 * MB, 1 * MB }, { 100 * MB, 1 * MB }, { 5 * MB, 1 * MB } };
+		AccelBuildPlan plan = PlanAndValidate("oversized", sizes, 32 * MB);
+
+		CHECK(plan.ScratchBytes == 100 * MB);
+		CHECK(plan.BatchCount == 2);
+		CheckPlacement(plan.Builds[1], 0, 0, 1 * MB);
+		CheckPlacement(plan.Builds[0], 1, 0, 0);
+		CheckPlacement(plan.Builds[2], 1, 5 * MB, 2 * MB);
+
+		AccelBuildPlan alone = PlanAndValidate("oversized alone", { { 100 * MB + 1, 3 * MB } }, 32 * MB);
+		CHECK(alone.ScratchBytes == 100 * MB + 256);
+		CHECK(alone.BatchCount == 1);
+	}
+
+	// --------------------------------------------------------
+	// Random sets of sizes, from tiny meshes to a few huge
+	// ones: every plan must be valid, never smaller than the
+	// biggest build, within budget otherwise, and a single
+	// batch whenever everything fits the budget at once
+	// --------------------------------------------------------
+	void CheckRandomPlans()
+	{
+		unsigned int seed = 2024;
+		auto random = [&seed](unsigned long long range) { seed = seed * 1664525u + 1013904223u; return (unsigned long long)(seed >> 8) % range; };
+
+		unsigned int failures = 0;
+		for (unsigned int i = 0; i < 2000; i++)
+		{
+			std::vector<AccelBuildSizes> sizes(1 + random(64));
+			unsigned long long largest = 0;
+			for (AccelBuildSizes& size : sizes)
+			{
+				unsigned long long scale = random(4) == 0 ? 64 * MB : 2 * MB;
+				size.ScratchBytes = random(scale);
+				size.ResultBytes = random(scale);
+				largest = size.ScratchBytes > largest ? size.ScratchBytes : largest;
+			}
+			unsigned long long budget = random(128 * MB);
+
+			AccelBuildPlan plan = AccelBuildPlanner::Plan(sizes, budget);
+			std::string error;
+			bool good = AccelBuildPlanner::Validate(sizes, plan, error) &&
+				plan.ScratchBytes >= largest &&
+				plan.ScratchBytes <= plan.SeparateScratchBytes &&
+				(plan.ScratchBytes <= budget + AccelBuildPlanner::Alignment || plan.ScratchBytes <= largest + AccelBuildPlanner::Alignment) &&
+				(plan.SeparateScratchBytes > budget || plan.BatchCount == 1) &&
+				plan.BatchCount > 0;
+			if (!good)
+				failures++;
+		}
+		CHECK(failures == 0);
+		printf("  %u random plans, %u bad\n", 2000u, failures);
+	}
+}
+
+
+int main()
+{
+	printf("Acceleration structure build plans:\n");
+	CheckOffsetsAndAlignment();
+	CheckBudgetSplitting();
+	CheckOversizedBuild();
+	CheckRandomPlans();
+
+	return TestHelpers::Finish("AccelBuildPlannerTests");
+}
@@ -0,0 +1,61 @@
+#include "BVH.h"
+#include "JobSystem.h"
+#include "ProceduralMeshes.h"
+#include "TestHelpers.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// --------------------------------------------------------
+// Builds CPU BVHs over bumpy grids from 2 thousand
+// triangles up to the largest size asked for, and prints
+// how each build went, so build speed & quality can be
+// compared across sizes.  Every tree must hold all of its
+// grid's triangles, with one more leaf than inner nodes.
+//
+// Usage: BVHBenchmark [maxGridSize] [runs]
+// --------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+	unsigned int maxGridSize = argc > 1 ? (unsigned int)atoi(argv[1]) : 1024;
+	unsigned int runs = argc > 2 ? (unsigned int)atoi(argv[2]) : 3;
+
+	JobSystem::Initialize();
+
+	for (unsigned int size = 32; size <= maxGridSize; size *= 2)
+	{
+		std::vector<Vertex> verts;
+		std::vector<unsigned int> indices;
+		ProceduralMeshes::MakeBumpyGrid(size, verts, indices);
+
+		// Best of a few builds, so one-off costs (like first
+		// touching memory) don't skew the smaller sizes
+		BVH bvh;
+		BVHBuildStats best = {};
+		for (unsigned int run = 0; run < runs; run++)
+		{
+			BVHBuildStats stats = bvh.Build(verts.data(), (unsigned int)verts.size(), indices.data(), (unsigned int)indices.size());
+			if (run == 0 || stats.Milliseconds < best.Milliseconds)
+				best = stats;
+		}
+		CHECK(best.Triangles == size * size * 2);
+		CHECK(best.Nodes == best.Leaves * 2 - 1);
+		CHECK(best.SAHCost > 0.0f);
+
+		printf("BVH benchmark: %8u triangles, %7u nodes, depth %2u, SAH cost %6.2f, %8.2fms (%7.1fms per million triangles), %3u subtrees on %u thread(s)\n",
+			best.Triangles,
+			best.Nodes,
+			best.MaxDepth,
+			best.SAHCost,
+			best.Milliseconds,
+			best.Milliseconds * 1000000.0 / best.Triangles,
+			best.Subtrees,
+			best.Threads);
+	}
+
+	JobSystem::ShutDown();
+
+	return TestHelpers::Finish("BVHBenchmark");
+}
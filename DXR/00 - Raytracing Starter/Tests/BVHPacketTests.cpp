@@ -0,0 +1,196 @@
+#include "BVH.h"
+#include "CPURaytracer.h"
+#include "ProceduralMeshes.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cstdio>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks that BVH::TraceClosestPacket finds exactly what
+// BVH::TraceClosest finds for each of its rays (distance,
+// triangle & barycentrics), over 8x8 packets of camera
+// rays that cover the whole range of cases: packets that
+// miss the mesh entirely (culled by the interval test),
+// packets along its silhouette whose first or last rays
+// miss (narrowing the active rays), packets with rays
+// heading both ways along an axis (traced one at a time)
+// and partial packets at the image's edges.  Each packet
+// is then traced through a second BVH, which must only
+// find hits closer than the first one's.
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Not multiples of 8, so the last packets of each row & column are partial
+	const unsigned int Width = 68;
+	const unsigned int Height = 52;
+	const unsigned int PacketWidth = 8;
+
+	// How the packets of a view went
+	struct PacketCounts
+	{
+		unsigned int Packets = 0;
+		unsigned int Partial = 0;			// Fewer than 64 rays
+		unsigned int Incoherent = 0;		// Mixed direction signs, so traced ray by ray
+		unsigned int AllMissed = 0;
+		unsigned int FirstMissed = 0;		// Some hits, but not the first ray
+		unsigned int LastMissed = 0;		// Some hits, but not the last ray
+		unsigned int Rays = 0;
+		unsigned int Hits = 0;
+		unsigned int Mismatches = 0;
+	};
+
+	RaytracingSceneData MakeSceneData(XMFLOAT3 eye, XMFLOAT3 direction, XMFLOAT3 up)
+	{
+		XMFLOAT4X4 view, projection;
+		XMStoreFloat4x4(&view, XMMatrixLookToLH(XMLoadFloat3(&eye), XMLoadFloat3(&direction), XMLoadFloat3(&up)));
+		XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV4, (float)Width / Height, 0.01f, 100.0f));
+		return CPURaytracer::CalcSceneData(view, projection, eye);
+	}
+
+	// --------------------------------------------------------
+	// Traces the packet through the BVH and compares every ray
+	// with tracing it alone, up to the TMax it had beforehand
+	// --------------------------------------------------------
+	unsigned long long TraceAndCompare(const BVH& bvh, BVHRayPacket& packet, BVHHit* hits, PacketCounts& counts)
+	{
+		float tMax[BVHPacketSize];
+		for (unsigned int i = 0; i < packet.Count; i++)
+			tMax[i] = packet.TMax[i];
+
+		unsigned long long hitMask = bvh.TraceClosestPacket(packet, hits);
+		for (unsigned int i = 0; i < packet.Count; i++)
+		{
+			BVHHit expected;
+			bool expectHit = bvh.TraceClosest(packet.Origin, packet.Directions[i], packet.TMin, tMax[i], expected);
+			bool found = (hitMask & (1ull << i)) != 0;
+			bool matches = found == expectHit;
+			if (found && expectHit)
+			{
+				matches =
+					hits[i].T == expected.T &&
+					hits[i].Triangle == expected.Triangle &&
+					hits[i].Barycentrics.x == expected.Barycentrics.x &&
+					hits[i].Barycentrics.y == expected.Barycentrics.y &&
+					packet.TMax[i] == expected.T;
+			}
+			else if (!found)
+				matches = matches && packet.TMax[i] == tMax[i];
+
+			if (!matches)
+				counts.Mismatches++;
+		}
+		return hitMask;
+	}
+
+	// --------------------------------------------------------
+	// Renders a view of the first BVH as packets, tallying what
+	// kinds of packets it made, then traces the same packets on
+	// through the second BVH
+	// --------------------------------------------------------
+	PacketCounts CheckView(const RaytracingSceneData& sceneData, const BVH& first, const BVH& second)
+	{
+		PacketCounts counts;
+		for (unsigned int packetY = 0; packetY < Height; packetY += PacketWidth)
+		{
+			for (unsigned int packetX = 0; packetX < Width; packetX += PacketWidth)
+			{
+				BVHRayPacket packet;
+				packet.Count = 0;
+				for (unsigned int y = packetY; y < packetY + PacketWidth && y < Height; y++)
+				{
+					for (unsigned int x = packetX; x < packetX + PacketWidth && x < Width; x++)
+					{
+						CPURaytracer::Ray ray = CPURaytracer::CalcRayFromCamera(sceneData, x, y, Width, Height);
+						packet.Origin = ray.Origin;
+						packet.TMin = ray.TMin;
+						packet.Directions[packet.Count] = ray.Direction;
+						packet.TMax[packet.Count] = ray.TMax;
+						packet.Count++;
+					}
+				}
+
+				BVHHit hits[BVHPacketSize];
+				unsigned long long hitMask = TraceAndCompare(first, packet, hits, counts);
+				unsigned long long allRays = packet.Count == BVHPacketSize ? ~0ull : (1ull << packet.Count) - 1;
+
+				counts.Packets++;
+				counts.Rays += packet.Count;
+				if (packet.Count < BVHPacketSize)
+					counts.Partial++;
+				if (!BVH::IsCoherent(packet))
+					counts.Incoherent++;
+				if (hitMask == 0)
+					counts.AllMissed++;
+				else if (hitMask != allRays)
+				{
+					if ((hitMask & 1) == 0)
+						counts.FirstMissed++;
+					if ((hitMask & (1ull << (packet.Count - 1))) == 0)
+						counts.LastMissed++;
+				}
+
+				hitMask |= TraceAndCompare(second, packet, hits, counts);
+				for (unsigned int i = 0; i < packet.Count; i++)
+					counts.Hits += (hitMask >> i) & 1;
+			}
+		}
+		return counts;
+	}
+
+	void Print(const char* name, const PacketCounts& counts)
+	{
+		printf("  %s: %u packets (%u partial, %u incoherent, %u missed, %u/%u missed by their first/last ray), %u/%u rays hit, %u mismatches\n",
+			name,
+			counts.Packets,
+			counts.Partial,
+			counts.Incoherent,
+			counts.AllMissed,
+			counts.FirstMissed,
+			counts.LastMissed,
+			counts.Hits,
+			counts.Rays,
+			counts.Mismatches);
+	}
+}
+
+
+int main()
+{
+	// A bumpy grid, with a sphere poking up through its middle
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	ProceduralMeshes::MakeBumpyGrid(64, verts, indices);
+	BVH grid(verts.data(), (unsigned int)verts.size(), indices.data(), (unsigned int)indices.size());
+	ProceduralMeshes::MakeSphere(32, 16, verts, indices);
+	BVH sphere(verts.data(), (unsigned int)verts.size(), indices.data(), (unsigned int)indices.size());
+
+	printf("BVH packets against single rays:\n");
+
+	// From off to one side, with the grid's far corner & edges in view
+	// against the sky, so many packets only partly hit (or miss)
+	PacketCounts angled = CheckView(MakeSceneData(XMFLOAT3(0.7f, 0.4f, -1.0f), XMFLOAT3(-0.5f, -0.35f, 1.0f), XMFLOAT3(0, 1, 0)), grid, sphere);
+	Print("angled view", angled);
+	CHECK(angled.Mismatches == 0);
+	CHECK(angled.Partial > 0);
+	CHECK(angled.AllMissed > 0);
+	CHECK(angled.FirstMissed > 0);
+	CHECK(angled.LastMissed > 0);
+	CHECK(angled.Hits > 0);
+
+	// Straight down onto the middle, so the packets around the center
+	// of the image have rays heading both ways along X or Z
+	PacketCounts overhead = CheckView(MakeSceneData(XMFLOAT3(0.0f, 1.5f, 0.0f), XMFLOAT3(0, -1, 0), XMFLOAT3(0, 0, 1)), sphere, grid);
+	Print("overhead view", overhead);
+	CHECK(overhead.Mismatches == 0);
+	CHECK(overhead.Incoherent > 0);
+	CHECK(overhead.Hits > 0);
+
+	return TestHelpers::Finish("BVHPacketTests");
+}
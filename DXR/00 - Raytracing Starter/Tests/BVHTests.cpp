@@ -0,0 +1,179 @@
+#include "BVH.h"
+#include "JobSystem.h"
+#include "MeshProcessing.h"
+#include "ProceduralMeshes.h"
+#include "RayIntersection.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cstdio>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks BVH::TraceClosest and BVH::TraceAny against
+// testing every triangle of a mesh, for meshes built on a
+// single task, split into subtrees built in parallel, and
+// large enough for the binning itself to be parallel
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Workers to start, so the parallel build paths run on any machine
+	const unsigned int Workers = 3;
+
+	unsigned int seed = 12345;
+	float Random01()
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) / 16777216.0f;
+	}
+
+	float RandomBetween(float min, float max)
+	{
+		return min + (max - min) * Random01();
+	}
+
+	// Closest hit in [tMin, tMax] from testing every triangle
+	bool BruteForceClosest(const std::vector<Vertex>& verts, const std::vector<unsigned int>& indices, XMFLOAT3 origin, XMFLOAT3 direction, float tMin, float tMax, float& closest)
+	{
+		XMVECTOR rayOrigin = XMLoadFloat3(&origin);
+		XMVECTOR rayDir = XMLoadFloat3(&direction);
+		bool found = false;
+		closest = tMax;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			float t;
+			XMFLOAT2 barycentrics;
+			if (RayIntersection::RayTriangle(rayOrigin, rayDir,
+				XMLoadFloat3(&verts[indices[i]].Position),
+				XMLoadFloat3(&verts[indices[i + 1]].Position),
+				XMLoadFloat3(&verts[indices[i + 2]].Position), t, barycentrics) &&
+				t >= tMin && t < closest)
+			{
+				closest = t;
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	// --------------------------------------------------------
+	// Does the hit's own triangle give exactly its distance &
+	// barycentrics?  Where several triangles are hit at the
+	// same distance (along shared edges) either may be found,
+	// so the triangle itself isn't compared with brute force.
+	// --------------------------------------------------------
+	bool HitMatchesTriangle(const std::vector<Vertex>& verts, const std::vector<unsigned int>& indices, XMFLOAT3 origin, XMFLOAT3 direction, const BVHHit& hit)
+	{
+		if ((size_t)hit.Triangle * 3 + 2 >= indices.size())
+			return false;
+
+		float t;
+		XMFLOAT2 barycentrics;
+		const unsigned int* tri = &indices[(size_t)hit.Triangle * 3];
+		return RayIntersection::RayTriangle(XMLoadFloat3(&origin), XMLoadFloat3(&direction),
+			XMLoadFloat3(&verts[tri[0]].Position),
+			XMLoadFloat3(&verts[tri[1]].Position),
+			XMLoadFloat3(&verts[tri[2]].Position), t, barycentrics) &&
+			t == hit.T &&
+			barycentrics.x == hit.Barycentrics.x &&
+			barycentrics.y == hit.Barycentrics.y;
+	}
+
+	// --------------------------------------------------------
+	// Builds a BVH over the mesh and traces rays between random
+	// points around & inside its bounds, some starting part of
+	// the way along.  Closest hits must be at exactly the brute
+	// force distance, and any-hit tests must agree both over
+	// the whole ray and when cut off right at the closest hit.
+	// --------------------------------------------------------
+	void CheckMesh(const char* name, const std::vector<Vertex>& verts, const std::vector<unsigned int>& indices, unsigned int rayCount, bool expectParallel)
+	{
+		BVH bvh;
+		BVHBuildStats stats = bvh.Build(verts.data(), (unsigned int)verts.size(), indices.data(), (unsigned int)indices.size());
+		CHECK(stats.Triangles == indices.size() / 3);
+		CHECK(bvh.GetTriangleCount() == stats.Triangles);
+		CHECK(expectParallel ? stats.Subtrees > 1 && stats.Threads > 1 : stats.Threads == 1);
+
+		XMFLOAT3 boundsMin, boundsMax;
+		MeshProcessing::CalculateBounds(verts.data(), (unsigned int)verts.size(), boundsMin, boundsMax);
+		XMFLOAT3 center((boundsMin.x + boundsMax.x) * 0.5f, (boundsMin.y + boundsMax.y) * 0.5f, (boundsMin.z + boundsMax.z) * 0.5f);
+		XMFLOAT3 extent(boundsMax.x - center.x + 0.01f, boundsMax.y - center.y + 0.01f, boundsMax.z - center.z + 0.01f);
+
+		unsigned int hits = 0;
+		unsigned int mismatches = 0;
+		for (unsigned int r = 0; r < rayCount; r++)
+		{
+			XMFLOAT3 origin(
+				center.x + RandomBetween(-2.0f, 2.0f) * extent.x,
+				center.y + RandomBetween(-2.0f, 2.0f) * extent.y,
+				center.z + RandomBetween(-2.0f, 2.0f) * extent.z);
+			XMFLOAT3 target(
+				center.x + RandomBetween(-1.0f, 1.0f) * extent.x,
+				center.y + RandomBetween(-1.0f, 1.0f) * extent.y,
+				center.z + RandomBetween(-1.0f, 1.0f) * extent.z);
+			XMFLOAT3 direction;
+			XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSubtract(XMLoadFloat3(&target), XMLoadFloat3(&origin))));
+			float tMin = r % 4 == 0 ? RandomBetween(0.0f, extent.x) : 0.0f;
+			float tMax = 100.0f;
+
+			float expected;
+			bool expectHit = BruteForceClosest(verts, indices, origin, direction, tMin, tMax, expected);
+			BVHHit hit;
+			bool found = bvh.TraceClosest(origin, direction, tMin, tMax, hit);
+			bool matches = found == expectHit;
+			if (found && expectHit)
+				matches = hit.T == expected && HitMatchesTriangle(verts, indices, origin, direction, hit);
+
+			// Nothing is closer than the closest hit, which TraceAny must also see
+			matches = matches && bvh.TraceAny(origin, direction, tMin, tMax) == expectHit;
+			if (expectHit)
+				matches = matches && !bvh.TraceAny(origin, direction, tMin, expected);
+
+			if (!matches)
+				mismatches++;
+			if (expectHit)
+				hits++;
+		}
+		CHECK(mismatches == 0);
+		CHECK(hits > rayCount / 4);
+
+		printf("  %s: %u triangles, %u subtrees on %u thread(s), %u/%u rays hit, %u mismatches\n",
+			name,
+			stats.Triangles,
+			stats.Subtrees,
+			stats.Threads,
+			hits,
+			rayCount,
+			mismatches);
+	}
+}
+
+
+int main()
+{
+	JobSystem::Initialize(Workers);
+	printf("BVH traversal against brute force:\n");
+
+	// Below MinSubtreeTriangles, so built as one task
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	ProceduralMeshes::MakeBumpyGrid(16, verts, indices);
+	CheckMesh("small grid", verts, indices, 2048, false);
+
+	// Split into subtrees, each built as its own task
+	ProceduralMeshes::MakeSphere(64, 32, verts, indices);
+	CheckMesh("sphere", verts, indices, 2048, true);
+
+	// Also past MinParallelBinTriangles, so the top splits are binned in parallel
+	ProceduralMeshes::MakeBumpyGrid(192, verts, indices);
+	CheckMesh("large grid", verts, indices, 512, true);
+
+	JobSystem::ShutDown();
+
+	return TestHelpers::Finish("BVHTests");
+}
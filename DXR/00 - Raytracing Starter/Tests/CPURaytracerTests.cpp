@@ -0,0 +1,213 @@
+#include "CPURaytracer.h"
+#include "ProceduralMeshes.h"
+#include "JobSystem.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks that rendering through a two-level scene lights
+// and shadows its hits like the flat scene path does (and
+// like the shader does), with normals brought into world
+// space by each instance's object to world matrix
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	const unsigned int Width = 96;
+	const unsigned int Height = 64;
+
+	// A mesh, its BVH and where it's placed (a uniform scale & a translation)
+	struct Model
+	{
+		std::vector<Vertex> Verts;
+		std::vector<unsigned int> Indices;
+		BVH Accel;
+		float Scale;
+		XMFLOAT3 Position;
+	};
+
+	// Copies the model's vertices into world space, keeping normals as they
+	// are, since a uniform scale & translation doesn't change their direction
+	std::vector<Vertex> WorldVertices(const Model& model)
+	{
+		std::vector<Vertex> world = model.Verts;
+		for (Vertex& v : world)
+		{
+			v.Position = XMFLOAT3(
+				v.Position.x * model.Scale + model.Position.x,
+				v.Position.y * model.Scale + model.Position.y,
+				v.Position.z * model.Scale + model.Position.z);
+		}
+		return world;
+	}
+
+	BVHInstance MakeInstance(const Model& model, unsigned int hitGroup)
+	{
+		XMFLOAT4X4 world;
+		XMStoreFloat4x4(&world, XMMatrixScaling(model.Scale, model.Scale, model.Scale) * XMMatrixTranslation(model.Position.x, model.Position.y, model.Position.z));
+
+		BVHInstance instance;
+		instance.SetWorldMatrix(world);
+		instance.InstanceContributionToHitGroupIndex = hitGroup;
+		instance.BLAS = &model.Accel;
+		return instance;
+	}
+
+	RaytracingSceneData MakeSceneData(XMFLOAT3 eye, XMFLOAT3 direction, const std::vector<Light>& lights)
+	{
+		XMFLOAT4X4 view, projection;
+		XMStoreFloat4x4(&view, XMMatrixLookToLH(XMLoadFloat3(&eye), XMLoadFloat3(&direction), XMVectorSet(0, 1, 0, 0)));
+		XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV4, (float)Width / Height, 0.01f, 100.0f));
+		return CPURaytracer::CalcSceneData(view, projection, eye, lights);
+	}
+
+	float Difference(XMFLOAT4 a, XMFLOAT4 b)
+	{
+		return fmaxf(fabsf(a.x - b.x), fmaxf(fabsf(a.y - b.y), fabsf(a.z - b.z)));
+	}
+
+	// --------------------------------------------------------
+	// A sphere above a bumpy floor it shadows, lit by a sun and
+	// a point light, rendered with the meshes in world space
+	// and as instances.  The images must match, apart from a
+	// few pixels on silhouettes (where tracing in object space
+	// rounds differently), and must actually be lit.
+	// --------------------------------------------------------
+	void CheckMatchesFlatScene()
+	{
+		Model sphere;
+		ProceduralMeshes::MakeSphere(32, 16, sphere.Verts, sphere.Indices);
+		sphere.Accel.Build(sphere.Verts.data(), (unsigned int)sphere.Verts.size(), sphere.Indices.data(), (unsigned int)sphere.Indices.size());
+		sphere.Scale = 1.0f;
+		sphere.Position = XMFLOAT3(0.3f, 0.2f, 0.0f);
+
+		Model floor;
+		ProceduralMeshes::MakeBumpyGrid(32, floor.Verts, floor.Indices);
+		floor.Accel.Build(floor.Verts.data(), (unsigned int)floor.Verts.size(), floor.Indices.data(), (unsigned int)floor.Indices.size());
+		floor.Scale = 4.0f;
+		floor.Position = XMFLOAT3(0.0f, -0.6f, 0.5f);
+
+		// The flat scene, with its own BVHs over the world space copies
+		std::vector<Vertex> sphereWorld = WorldVertices(sphere);
+		std::vector<Vertex> floorWorld = WorldVertices(floor);
+		BVH sphereWorldBVH(sphereWorld.data(), (unsigned int)sphereWorld.size(), sphere.Indices.data(), (unsigned int)sphere.Indices.size());
+		BVH floorWorldBVH(floorWorld.data(), (unsigned int)floorWorld.size(), floor.Indices.data(), (unsigned int)floor.Indices.size());
+		std::vector<CPURaytracer::Geometry> flat = {
+			CPURaytracer::MakeGeometry(sphereWorld, sphere.Indices, &sphereWorldBVH),
+			CPURaytracer::MakeGeometry(floorWorld, floor.Indices, &floorWorldBVH) };
+
+		// The same as instances, with hit groups the other way around
+		std::vector<BVHInstance> instances = { MakeInstance(sphere, 1), MakeInstance(floor, 0) };
+		TopLevelBVH tlas;
+		tlas.Build(instances.data(), (unsigned int)instances.size());
+		std::vector<CPURaytracer::Geometry> hitGroups = {
+			CPURaytracer::MakeGeometry(floor.Verts, floor.Indices, &floor.Accel),
+			CPURaytracer::MakeGeometry(sphere.Verts, sphere.Indices, &sphere.Accel) };
+
+		Light sun = {};
+		sun.Type = LIGHT_TYPE_DIRECTIONAL;
+		sun.Direction = XMFLOAT3(0.5f, -1.0f, 0.5f);
+		sun.Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
+		sun.Intensity = 1.0f;
+		Light point = {};
+		point.Type = LIGHT_TYPE_POINT;
+		point.Position = XMFLOAT3(-2.0f, 1.0f, -1.0f);
+		point.Range = 10.0f;
+		point.Color = XMFLOAT3(1.0f, 0.8f, 0.6f);
+		point.Intensity = 1.0f;
+
+		XMFLOAT3 eye(0.0f, 1.0f, -2.5f);
+		XMFLOAT3 direction(0.0f, -0.4f, 1.0f);
+		RaytracingSceneData lit = MakeSceneData(eye, direction, { sun, point });
+		RaytracingSceneData unlit = MakeSceneData(eye, direction, {});
+
+		CPURaytracer::Image flatImage, instancedImage, unlitImage;
+		CPURaytracer::Render(lit, flat, Width, Height, flatImage, 16, false);
+		CPURaytracer::Render(lit, tlas, hitGroups, Width, Height, instancedImage);
+		CPURaytracer::Render(unlit, tlas, hitGroups, Width, Height, unlitImage);
+
+		unsigned int mismatches = 0;
+		unsigned int litPixels = 0;
+		float worstMatch = 0.0f;
+		for (size_t i = 0; i < flatImage.Pixels.size(); i++)
+		{
+			float difference = Difference(flatImage.Pixels[i], instancedImage.Pixels[i]);
+			if (difference > 0.01f)
+				mismatches++;
+			else if (difference > worstMatch)
+				worstMatch = difference;
+			if (Difference(instancedImage.Pixels[i], unlitImage.Pixels[i]) > 0.01f)
+				litPixels++;
+		}
+		CHECK(mismatches < Width * Height / 100);
+		CHECK(litPixels > Width * Height / 4);
+
+		printf("  flat vs instanced: %u/%u pixels differ (the rest by at most %.5f), %u lit\n", mismatches, Width * Height, worstMatch, litPixels);
+	}
+
+	// --------------------------------------------------------
+	// A square facing +Y in object space, stood up as a wall
+	// facing -X by its instance's rotation, in front of a light
+	// shining along +X.  Only a normal rotated like the shader's
+	// mul((float3x3)ObjectToWorld3x4(), normal) faces the light.
+	// --------------------------------------------------------
+	void CheckWorldSpaceNormals()
+	{
+		std::vector<Vertex> verts(4);
+		for (unsigned int i = 0; i < 4; i++)
+		{
+			verts[i] = {};
+			verts[i].Position = XMFLOAT3(i & 1 ? 1.0f : -1.0f, 0.0f, i & 2 ? 1.0f : -1.0f);
+			verts[i].Normal = XMFLOAT3(0, 1, 0);
+		}
+		std::vector<unsigned int> indices = { 0, 2, 1, 1, 2, 3 };
+		BVH square(verts.data(), 4, indices.data(), 6);
+
+		// Object Y becomes world -X, object X becomes world Y
+		BVHInstance wall;
+		float transform[3][4] = { { 0, -1, 0, 0 }, { 1, 0, 0, 0 }, { 0, 0, 1, 0 } };
+		for (unsigned int row = 0; row < 3; row++)
+			for (unsigned int col = 0; col < 4; col++)
+				wall.Transform[row][col] = transform[row][col];
+		wall.BLAS = &square;
+
+		TopLevelBVH tlas;
+		tlas.Build(&wall, 1);
+		std::vector<CPURaytracer::Geometry> hitGroups = { CPURaytracer::MakeGeometry(verts, indices, &square) };
+
+		Light sun = {};
+		sun.Type = LIGHT_TYPE_DIRECTIONAL;
+		sun.Direction = XMFLOAT3(1.0f, 0.0f, 0.0f);
+		sun.Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
+		sun.Intensity = 1.0f;
+		RaytracingSceneData sceneData = MakeSceneData(XMFLOAT3(-3.0f, 0.0f, 0.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), { sun });
+
+		// Colored by the object space normal, lit fully plus ambient
+		CPURaytracer::Image image;
+		CPURaytracer::Render(sceneData, tlas, hitGroups, Width, Height, image);
+		XMFLOAT4 center = image.Pixels[(size_t)(Height / 2) * Width + Width / 2];
+		CHECK(Difference(center, XMFLOAT4(0.0f, 1.1f, 0.0f, 1.0f)) < 1e-4f);
+
+		printf("  rotated wall: center pixel (%.3f, %.3f, %.3f)\n", center.x, center.y, center.z);
+	}
+}
+
+
+int main()
+{
+	JobSystem::Initialize();
+	printf("Two-level CPU rendering:\n");
+	CheckMatchesFlatScene();
+	CheckWorldSpaceNormals();
+	JobSystem::ShutDown();
+
+	return TestHelpers::Finish("CPURaytracerTests");
+}
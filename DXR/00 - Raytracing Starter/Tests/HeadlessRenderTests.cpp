@@ -0,0 +1,197 @@
+#include "CPURaytracer.h"
+#include "ProceduralMeshes.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks the image HeadlessRender saved of its generated
+// sphere against an exact sphere, seen through the same
+// camera and lit by the same light: misses must be the
+// sky color, and hits must be the normal times the light
+// reaching them.  Pixels right on the silhouette, where
+// the triangles and the exact sphere disagree, are skipped.
+//
+// Usage: HeadlessRenderTests image.ppm width height
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Allowed difference per 8-bit channel, for the triangles'
+	// interpolated normals being a little off the exact ones
+	const int Tolerance = 12;
+
+	// Rays closer than this to the silhouette aren't compared
+	const float SilhouetteMargin = 0.03f;
+
+	struct Pixel
+	{
+		int R, G, B;
+	};
+
+	// Same conversion as CPURaytracer::WritePPM()
+	int ToUnorm8(float value)
+	{
+		if (!(value > 0.0f)) return 0;
+		if (value >= 1.0f) return 255;
+		return (int)(value * 255.0f + 0.5f);
+	}
+
+	Pixel ToPixel(XMFLOAT3 color)
+	{
+		return { ToUnorm8(color.x), ToUnorm8(color.y), ToUnorm8(color.z) };
+	}
+
+	bool Matches(const Pixel& a, const Pixel& b)
+	{
+		return abs(a.R - b.R) <= Tolerance && abs(a.G - b.G) <= Tolerance && abs(a.B - b.B) <= Tolerance;
+	}
+
+	// Reads a binary (P6) PPM of the given size, or nothing if it's anything else
+	std::vector<Pixel> ReadPPM(const char* file, unsigned int width, unsigned int height)
+	{
+		FILE* ppm = fopen(file, "rb");
+		if (!ppm)
+			return std::vector<Pixel>();
+
+		unsigned int fileWidth = 0;
+		unsigned int fileHeight = 0;
+		unsigned int maxValue = 0;
+		std::vector<unsigned char> bytes((size_t)width * height * 3);
+		bool valid =
+			fscanf(ppm, "P6 %u %u %u", &fileWidth, &fileHeight, &maxValue) == 3 &&
+			fileWidth == width && fileHeight == height && maxValue == 255 &&
+			fgetc(ppm) == '\n' &&
+			fread(bytes.data(), 1, bytes.size(), ppm) == bytes.size() &&
+			fgetc(ppm) == EOF;
+		fclose(ppm);
+		if (!valid)
+			return std::vector<Pixel>();
+
+		std::vector<Pixel> pixels((size_t)width * height);
+		for (size_t i = 0; i < pixels.size(); i++)
+			pixels[i] = { bytes[i * 3 + 0], bytes[i * 3 + 1], bytes[i * 3 + 2] };
+		return pixels;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	if (argc < 4)
+	{
+		printf("Usage: HeadlessRenderTests image.ppm width height\n");
+		return 1;
+	}
+	unsigned int width = (unsigned int)atoi(argv[2]);
+	unsigned int height = (unsigned int)atoi(argv[3]);
+
+	std::vector<Pixel> image = ReadPPM(argv[1], width, height);
+	CHECK(!image.empty());
+	if (image.empty())
+		return TestHelpers::Finish("HeadlessRenderTests");
+
+	// The sphere HeadlessRender generates, framed the same way
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	ProceduralMeshes::MakeSphere(64, 32, verts, indices);
+	XMVECTOR boundsMin = XMLoadFloat3(&verts[0].Position);
+	XMVECTOR boundsMax = boundsMin;
+	for (const Vertex& vert : verts)
+	{
+		boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&vert.Position));
+		boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&vert.Position));
+	}
+	XMVECTOR center = XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f);
+	float boundsRadius = XMVectorGetX(XMVector3Length(XMVectorSubtract(boundsMax, boundsMin))) * 0.5f;
+	float fov = XM_PIDIV4;
+	float distance = boundsRadius / sinf(fov * 0.5f);
+	XMVECTOR eye = XMVectorSubtract(center, XMVectorSet(0, 0, distance, 0));
+
+	XMFLOAT4X4 view;
+	XMFLOAT4X4 projection;
+	XMFLOAT3 cameraPosition;
+	XMStoreFloat4x4(&view, XMMatrixLookToLH(eye, XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 1, 0, 0)));
+	XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(fov, (float)width / height, distance * 0.01f, distance + boundsRadius * 2.0f));
+	XMStoreFloat3(&cameraPosition, eye);
+	RaytracingSceneData sceneData = CPURaytracer::CalcSceneData(view, projection, cameraPosition);
+
+	// Nothing else in the scene, so nothing on the lit side is in shadow
+	const float radius = 0.5f;
+	XMVECTOR toLight = XMVector3Normalize(XMVectorSet(-0.5f, 1.0f, -0.5f, 0.0f));
+	Pixel sky = ToPixel(CPURaytracer::Miss());
+
+	unsigned int compared = 0;
+	unsigned int mismatches = 0;
+	unsigned int hits = 0;
+	unsigned int brightlyLit = 0;
+	for (unsigned int y = 0; y < height; y++)
+	{
+		for (unsigned int x = 0; x < width; x++)
+		{
+			CPURaytracer::Ray ray = CPURaytracer::CalcRayFromCamera(sceneData, x, y, width, height);
+			XMVECTOR origin = XMLoadFloat3(&ray.Origin);
+			XMVECTOR direction = XMVector3Normalize(XMLoadFloat3(&ray.Direction));
+
+			// Closest the ray gets to the center
+			XMVECTOR toCenter = XMVectorSubtract(center, origin);
+			float along = XMVectorGetX(XMVector3Dot(toCenter, direction));
+			float missDistance = XMVectorGetX(XMVector3Length(XMVectorSubtract(toCenter, XMVectorScale(direction, along))));
+			if (fabsf(missDistance - radius) < SilhouetteMargin)
+				continue;
+
+			Pixel expected = sky;
+			if (missDistance < radius)
+			{
+				float t = along - sqrtf(radius * radius - missDistance * missDistance);
+				XMVECTOR normal = XMVectorScale(XMVectorSubtract(XMVectorMultiplyAdd(direction, XMVectorReplicate(t), origin), center), 1.0f / radius);
+				float nDotL = XMVectorGetX(XMVector3Dot(normal, toLight));
+				float light = 0.1f + (nDotL > 0.0f ? nDotL : 0.0f);
+
+				XMFLOAT3 color;
+				XMStoreFloat3(&color, XMVectorScale(normal, light));
+				expected = ToPixel(color);
+				hits++;
+			}
+
+			const Pixel& actual = image[(size_t)y * width + x];
+			if (!Matches(actual, expected))
+			{
+				if (mismatches < 8)
+					printf("  pixel (%u, %u) is (%d, %d, %d), expected (%d, %d, %d)\n", x, y, actual.R, actual.G, actual.B, expected.R, expected.G, expected.B);
+				mismatches++;
+			}
+			if (missDistance < radius && actual.G > 200)
+				brightlyLit++;
+			compared++;
+		}
+	}
+
+	// Corners are sky, exactly, and the middle is the sphere
+	const Pixel& corner = image[0];
+	const Pixel& middle = image[(size_t)(height / 2) * width + width / 2];
+	CHECK(corner.R == sky.R && corner.G == sky.G && corner.B == sky.B);
+	CHECK(!(middle.R == sky.R && middle.G == sky.G && middle.B == sky.B));
+
+	CHECK(mismatches == 0);
+	CHECK(compared > width * height / 2);
+	CHECK(hits > 0);
+	CHECK(brightlyLit > 0);
+
+	printf("HeadlessRenderTests: %u of %u pixels compared (%u on the sphere, %u brightly lit), %u mismatches\n",
+		compared,
+		width * height,
+		hits,
+		brightlyLit,
+		mismatches);
+
+	return TestHelpers::Finish("HeadlessRenderTests");
+}
@@ -0,0 +1,151 @@
+#include "InstanceTransforms.h"
+#include "TopLevelBVH.h"
+#include "JobSystem.h"
+#include "Parallel.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks that InstanceTransforms (SIMD, and split across
+// the job system's threads) writes exactly the same bits
+// as BVHInstance::SetWorldMatrix(), for many made up
+// transforms, counts & thread counts, and touches nothing
+// else in the descs it writes to
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	const unsigned int InstanceCount = 100000;
+
+	// Same layout as D3D12_RAYTRACING_INSTANCE_DESC: the transform,
+	// then the ID, mask, hit group & flags bitfields and the BLAS
+	struct InstanceDesc
+	{
+		float Transform[3][4];
+		unsigned int InstanceIDAndMask;
+		unsigned int HitGroupIndexAndFlags;
+		unsigned long long AccelerationStructure;
+	};
+	static_assert(sizeof(InstanceDesc) == 64, "Instance descs are 64 bytes");
+
+	// --------------------------------------------------------
+	// World matrices like Transform makes (scale, rotation &
+	// translation, including negative & non-uniform scales),
+	// plus a few with values that only survive a bit exact
+	// copy: negative zero, denormals and huge numbers
+	// --------------------------------------------------------
+	std::vector<XMFLOAT4X4> MakeWorlds(unsigned int count)
+	{
+		unsigned int seed = 2024;
+		auto random = [&seed](float low, float high) { seed = seed * 1664525u + 1013904223u; return low + (high - low) * (seed >> 8) / 16777216.0f; };
+
+		std::vector<XMFLOAT4X4> worlds(count);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			XMMATRIX world =
+				XMMatrixScaling(random(-4, 4), random(0.01f, 4), random(-4, 4)) *
+				XMMatrixRotationY(random(-3.14159265f, 3.14159265f)) *
+				XMMatrixTranslation(random(-500, 500), random(-500, 500), random(-500, 500));
+			XMStoreFloat4x4(&worlds[i], world);
+		}
+
+		const float special[] = { -0.0f, 1e-40f, -1e-42f, 3e38f, -3e38f, 1.0f / 3.0f };
+		for (unsigned int i = 0; i < count && i < 64; i++)
+			for (unsigned int row = 0; row < 4; row++)
+				for (unsigned int col = 0; col < 3; col++)
+					worlds[i].m[row][col] = special[(i + row * 3 + col) % 6];
+		return worlds;
+	}
+
+	double Milliseconds(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+}
+
+
+int main()
+{
+	std::vector<XMFLOAT4X4> worlds = MakeWorlds(InstanceCount);
+
+	// The scalar version everything is checked against
+	std::vector<BVHInstance> expected(InstanceCount);
+	auto scalarStart = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < InstanceCount; i++)
+		expected[i].SetWorldMatrix(worlds[i]);
+	double scalarMs = Milliseconds(scalarStart);
+
+	JobSystem::Initialize();
+
+	// Writes the first "count" transforms into descs filled with a
+	// marker byte, then checks every byte of every desc
+	std::vector<InstanceDesc> descs(InstanceCount);
+	auto check = [&](unsigned int count, unsigned int threads)
+		{
+			memset(descs.data(), 0xCD, descs.size() * sizeof(InstanceDesc));
+			InstanceTransforms::Write(worlds.data(), count, descs.data(), sizeof(InstanceDesc), threads);
+
+			for (unsigned int i = 0; i < InstanceCount; i++)
+			{
+				// Transforms past the count, and the rest of every desc, must be untouched
+				const unsigned char* bytes = (const unsigned char*)&descs[i];
+				for (size_t b = i < count ? sizeof(descs[i].Transform) : 0; b < sizeof(InstanceDesc); b++)
+					if (bytes[b] != 0xCD) return false;
+				if (i < count && memcmp(descs[i].Transform, expected[i].Transform, sizeof(descs[i].Transform)) != 0)
+					return false;
+			}
+			return true;
+		};
+
+	unsigned int counts[] = { 0, 1, 2, 3, 4095, 4096, 4097, 12345, InstanceCount };
+	unsigned int threadCounts[] = { 1, 2, 3, 7, 0 };
+	unsigned int failures = 0;
+	for (unsigned int count : counts)
+	{
+		for (unsigned int threads : threadCounts)
+		{
+			if (!check(count, threads))
+			{
+				printf("  mismatch with %u instances on %u thread(s)\n", count, threads);
+				failures++;
+			}
+		}
+	}
+	CHECK(failures == 0);
+
+	// Straight into BVHInstances too, as their transforms come first
+	std::vector<BVHInstance> instances(InstanceCount);
+	InstanceTransforms::Write(worlds.data(), InstanceCount, instances.data(), sizeof(BVHInstance));
+	bool sameInstances = true;
+	for (unsigned int i = 0; i < InstanceCount; i++)
+		sameInstances &= memcmp(instances[i].Transform, expected[i].Transform, sizeof(expected[i].Transform)) == 0;
+	CHECK(sameInstances);
+
+	auto singleStart = std::chrono::high_resolution_clock::now();
+	InstanceTransforms::Write(worlds.data(), InstanceCount, descs.data(), sizeof(InstanceDesc), 1);
+	double singleMs = Milliseconds(singleStart);
+
+	auto parallelStart = std::chrono::high_resolution_clock::now();
+	InstanceTransforms::Write(worlds.data(), InstanceCount, descs.data(), sizeof(InstanceDesc));
+	double parallelMs = Milliseconds(parallelStart);
+	JobSystem::ShutDown();
+
+	printf("Instance transforms: %u instances, scalar %.2fms, SIMD %.2fms, SIMD on %u thread(s) %.2fms\n",
+		InstanceCount,
+		scalarMs,
+		singleMs,
+		Parallel::ThreadCountFor(InstanceCount, InstanceTransforms::MinInstancesPerThread),
+		parallelMs);
+
+	return TestHelpers::Finish("InstanceTransformsTests");
+}
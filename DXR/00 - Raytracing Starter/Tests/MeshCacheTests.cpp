@@ -0,0 +1,151 @@
+#include "MeshCache.h"
+#include "MeshData.h"
+#include "JobSystem.h"
+#include "TestHelpers.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// A small quad, enough to be cached
+	void WriteQuadObj(const char* file)
+	{
+		std::ofstream obj(file, std::ios::trunc);
+		obj << "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n";
+		obj << "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\n";
+		obj << "vn 0 0 1\n";
+		obj << "f 1/1/1 2/2/1 3/3/1 4/4/1\n";
+	}
+
+	// A bumpy grid of quads, with enough triangles to simplify into LODs
+	void WriteGridObj(const char* file, unsigned int size)
+	{
+		std::ofstream obj(file, std::ios::trunc);
+		for (unsigned int y = 0; y <= size; y++)
+			for (unsigned int x = 0; x <= size; x++)
+				obj << "v " << x << " " << sinf(x * 0.7f) * cosf(y * 0.5f) << " " << y << "\n";
+		for (unsigned int y = 0; y < size; y++)
+		{
+			for (unsigned int x = 0; x < size; x++)
+			{
+				unsigned int corner = y * (size + 1) + x + 1;
+				obj << "f " << corner << " " << corner + 1 << " " << corner + size + 2 << " " << corner + size + 1 << "\n";
+			}
+		}
+	}
+
+	// Any temporary files left behind by writing a cache?
+	bool TempFilesLeft(const std::string& cacheFile)
+	{
+		for (const auto& entry : std::filesystem::directory_iterator("."))
+		{
+			std::string name = entry.path().filename().string();
+			if (name.size() > cacheFile.size() && name.compare(0, cacheFile.size(), cacheFile) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	bool SameData(const MeshData& a, const MeshData& b)
+	{
+		return a.VertexCount == b.VertexCount &&
+			a.IndexCount == b.IndexCount &&
+			a.ContentHash == b.ContentHash &&
+			memcmp(a.Vertices, b.Vertices, sizeof(Vertex) * a.VertexCount) == 0 &&
+			memcmp(a.Indices, b.Indices, sizeof(unsigned int) * a.IndexCount) == 0;
+	}
+}
+
+
+int main()
+{
+	JobSystem::Initialize();
+
+	const char* objFile = "meshcache_test.obj";
+	std::wstring wideObjFile = std::filesystem::path(objFile).wstring();
+	std::string cacheFile = std::string(objFile) + ".meshcache";
+	std::filesystem::remove(cacheFile);
+	WriteQuadObj(objFile);
+
+	// The first load parses the OBJ and writes the cache
+	std::shared_ptr<MeshData> cold = MeshData::Load(wideObjFile.c_str());
+	CHECK(cold->IndexCount == 6);
+	CHECK(!cold->CacheFile);
+	CHECK(std::filesystem::exists(cacheFile));
+	CHECK(!TempFilesLeft(cacheFile));
+
+	// The second comes straight from the cache, with the same data
+	std::shared_ptr<MeshData> warm = MeshData::Load(wideObjFile.c_str());
+	CHECK(warm->CacheFile);
+	CHECK(SameData(*cold, *warm));
+	warm.reset();
+
+	// A cache for different processing isn't used
+	MappedFile mapped;
+	CHECK(MeshCache::Open(wideObjFile.c_str(), MeshCache::FlagOptimizedVertexOrder, mapped) == 0);
+	CHECK(MeshCache::Open(wideObjFile.c_str(), 0, mapped) != 0);
+	mapped.Close();
+
+	// Corrupt one byte of the vertex data, which the header can't catch,
+	// but the content hash can
+	{
+		std::fstream cache(cacheFile, std::ios::in | std::ios::out | std::ios::binary);
+		cache.seekp(sizeof(MeshCacheHeader) + 4);
+		char byte = 0x7f;
+		cache.write(&byte, 1);
+	}
+	CHECK(MeshCache::Open(wideObjFile.c_str(), 0, mapped) == 0);
+
+	// So the OBJ is parsed again (rewriting the cache)
+	std::shared_ptr<MeshData> reloaded = MeshData::Load(wideObjFile.c_str());
+	CHECK(!reloaded->CacheFile);
+	CHECK(SameData(*cold, *reloaded));
+	CHECK(MeshCache::Open(wideObjFile.c_str(), 0, mapped) != 0);
+	mapped.Close();
+	CHECK(!TempFilesLeft(cacheFile));
+
+	// LODs are cached along with the data, and used when asked for the same way
+	WriteGridObj(objFile, 24);
+	MeshOptions lodOptions;
+	lodOptions.LODCount = 3;
+	std::shared_ptr<MeshData> lodCold = MeshData::Load(wideObjFile.c_str(), lodOptions);
+	CHECK(!lodCold->CacheFile);
+	CHECK(!lodCold->LODIndices.empty());
+
+	std::shared_ptr<MeshData> lodWarm = MeshData::Load(wideObjFile.c_str(), lodOptions);
+	CHECK(lodWarm->CacheFile);
+	CHECK(SameData(*lodCold, *lodWarm));
+	CHECK(lodWarm->LODIndices == lodCold->LODIndices);
+	CHECK(lodWarm->LODErrors == lodCold->LODErrors);
+	lodWarm.reset();
+
+	// Asking for different LODs still uses the cached data, with new LODs
+	MeshOptions fewerLODs;
+	fewerLODs.LODCount = 1;
+	std::shared_ptr<MeshData> fewer = MeshData::Load(wideObjFile.c_str(), fewerLODs);
+	CHECK(fewer->CacheFile);
+	CHECK(fewer->LODIndices.size() == 1);
+	CHECK(fewer->LODIndices[0] == lodCold->LODIndices[0]);
+	fewer.reset();
+
+	// Corrupting the last LOD index is caught by the LOD hash
+	{
+		std::fstream cache(cacheFile, std::ios::in | std::ios::out | std::ios::binary);
+		cache.seekp(-1, std::ios::end);
+		char byte = 0x7f;
+		cache.write(&byte, 1);
+	}
+	CHECK(MeshCache::Open(wideObjFile.c_str(), 0, mapped) == 0);
+
+	std::filesystem::remove(objFile);
+	std::filesystem::remove(cacheFile);
+	JobSystem::ShutDown();
+	return TestHelpers::Finish("MeshCacheTests");
+}
@@ -0,0 +1,237 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "ObjLoader.h"
+#include "JobSystem.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Times ObjLoader against the getline/sscanf loop it
+// replaced in Mesh's OBJ constructor, on sphere.obj (if
+// it's given and exists) and on a large generated OBJ.
+// Both must produce exactly the same triangles.
+//
+// Usage: ObjLoaderBenchmark [gridSize] [sphere.obj] [runs]
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// The triangles either path produces: three corners each,
+	// with the file's values (no handedness or UV conversion)
+	struct ObjTriangles
+	{
+		std::vector<XMFLOAT3> Positions;
+		std::vector<XMFLOAT2> UVs;
+		std::vector<XMFLOAT3> Normals;
+	};
+
+	// --------------------------------------------------------
+	// The original loader's parsing loop, minus its vertex
+	// conversion.  Only handles v/vt/vn corners, triangles and
+	// quads, and lines under 100 characters.
+	// --------------------------------------------------------
+	void LoadWithGetline(const char* file, ObjTriangles& triangles)
+	{
+		triangles = {};
+		std::ifstream obj(file);
+		if (!obj.is_open()) return;
+
+		std::vector<XMFLOAT3> positions;
+		std::vector<XMFLOAT3> normals;
+		std::vector<XMFLOAT2> uvs;
+		char chars[100];
+
+		auto AddCorner = [&](unsigned int p, unsigned int t, unsigned int n)
+			{
+				triangles.Positions.push_back(positions[p - 1]);
+				triangles.UVs.push_back(uvs[t - 1]);
+				triangles.Normals.push_back(normals[n - 1]);
+			};
+
+		while (obj.good())
+		{
+			obj.getline(chars, 100);
+
+			if (chars[0] == 'v' && chars[1] == 'n')
+			{
+				XMFLOAT3 norm{};
+				sscanf(chars, "vn %f %f %f", &norm.x, &norm.y, &norm.z);
+				normals.push_back(norm);
+			}
+			else if (chars[0] == 'v' && chars[1] == 't')
+			{
+				XMFLOAT2 uv{};
+				sscanf(chars, "vt %f %f", &uv.x, &uv.y);
+				uvs.push_back(uv);
+			}
+			else if (chars[0] == 'v')
+			{
+				XMFLOAT3 pos{};
+				sscanf(chars, "v %f %f %f", &pos.x, &pos.y, &pos.z);
+				positions.push_back(pos);
+			}
+			else if (chars[0] == 'f')
+			{
+				unsigned int i[12]{};
+				int facesRead = sscanf(
+					chars,
+					"f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u",
+					&i[0], &i[1], &i[2],
+					&i[3], &i[4], &i[5],
+					&i[6], &i[7], &i[8],
+					&i[9], &i[10], &i[11]);
+
+				AddCorner(i[0], i[1], i[2]);
+				AddCorner(i[3], i[4], i[5]);
+				AddCorner(i[6], i[7], i[8]);
+				if (facesRead == 12)
+				{
+					AddCorner(i[0], i[1], i[2]);
+					AddCorner(i[6], i[7], i[8]);
+					AddCorner(i[9], i[10], i[11]);
+				}
+			}
+		}
+	}
+
+	// Expands ObjLoader's corners into the same layout as above
+	void LoadWithObjLoader(const char* file, ObjTriangles& triangles, unsigned int maxThreads)
+	{
+		triangles = {};
+		ObjData data;
+		if (!ObjLoader::Load(std::filesystem::path(file).wstring().c_str(), data, maxThreads))
+			return;
+
+		triangles.Positions.reserve(data.Corners.size());
+		triangles.UVs.reserve(data.Corners.size());
+		triangles.Normals.reserve(data.Corners.size());
+		for (const ObjCorner& corner : data.Corners)
+		{
+			triangles.Positions.push_back(data.Positions[corner.Position]);
+			triangles.UVs.push_back(data.UVs[corner.UV]);
+			triangles.Normals.push_back(data.Normals[corner.Normal]);
+		}
+	}
+
+	bool SameTriangles(const ObjTriangles& a, const ObjTriangles& b)
+	{
+		return a.Positions.size() == b.Positions.size() &&
+			memcmp(a.Positions.data(), b.Positions.data(), sizeof(XMFLOAT3) * a.Positions.size()) == 0 &&
+			memcmp(a.UVs.data(), b.UVs.data(), sizeof(XMFLOAT2) * a.UVs.size()) == 0 &&
+			memcmp(a.Normals.data(), b.Normals.data(), sizeof(XMFLOAT3) * a.Normals.size()) == 0;
+	}
+
+	// --------------------------------------------------------
+	// Writes a gridSize x gridSize grid of bumpy quads, with
+	// v/vt/vn corners, in the style of an exported OBJ
+	// --------------------------------------------------------
+	void WriteGridObj(const char* file, unsigned int gridSize)
+	{
+		FILE* obj = fopen(file, "w");
+		if (!obj) return;
+
+		fprintf(obj, "# %ux%u grid for ObjLoaderBenchmark\n", gridSize, gridSize);
+		for (unsigned int y = 0; y <= gridSize; y++)
+		{
+			for (unsigned int x = 0; x <= gridSize; x++)
+			{
+				float u = (float)x / gridSize;
+				float v = (float)y / gridSize;
+				fprintf(obj, "v %.6f %.6f %.6f\n", u - 0.5f, 0.05f * sinf(u * 40.0f) * cosf(v * 30.0f), v - 0.5f);
+				fprintf(obj, "vt %.6f %.6f\n", u, v);
+				fprintf(obj, "vn %.6f %.6f %.6f\n", 0.0f, 1.0f, 0.0f);
+			}
+		}
+
+		for (unsigned int y = 0; y < gridSize; y++)
+		{
+			for (unsigned int x = 0; x < gridSize; x++)
+			{
+				unsigned int i = y * (gridSize + 1) + x + 1;
+				unsigned int corners[4] = { i, i + 1, i + gridSize + 2, i + gridSize + 1 };
+				fprintf(obj, "f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u\n",
+					corners[0], corners[0], corners[0],
+					corners[1], corners[1], corners[1],
+					corners[2], corners[2], corners[2],
+					corners[3], corners[3], corners[3]);
+			}
+		}
+		fclose(obj);
+	}
+
+	// Best time of several runs, in milliseconds
+	template<typename Func>
+	double BestOf(unsigned int runs, Func func)
+	{
+		double best = 0.0;
+		for (unsigned int run = 0; run < runs; run++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			func();
+			auto end = std::chrono::high_resolution_clock::now();
+			double ms = std::chrono::duration<double, std::milli>(end - start).count();
+			if (run == 0 || ms < best)
+				best = ms;
+		}
+		return best;
+	}
+
+	void Benchmark(const char* name, const char* file, unsigned int runs)
+	{
+		std::error_code error;
+		double megabytes = std::filesystem::file_size(file, error) / (1024.0 * 1024.0);
+		if (error)
+		{
+			printf("%s: skipped (%s not found)\n", name, file);
+			return;
+		}
+
+		ObjTriangles reference, loaded, loadedSingle;
+		double getlineMs = BestOf(runs, [&]() { LoadWithGetline(file, reference); });
+		double singleMs = BestOf(runs, [&]() { LoadWithObjLoader(file, loadedSingle, 1); });
+		double parallelMs = BestOf(runs, [&]() { LoadWithObjLoader(file, loaded, 0); });
+
+		CHECK(!reference.Positions.empty());
+		CHECK(SameTriangles(reference, loaded));
+		CHECK(SameTriangles(reference, loadedSingle));
+
+		printf("%s: %.1f MB, %zu triangles, best of %u\n", name, megabytes, reference.Positions.size() / 3, runs);
+		printf("  getline/sscanf      %9.2fms %8.1f MB/s\n", getlineMs, megabytes * 1000.0 / getlineMs);
+		printf("  ObjLoader, 1 thread %9.2fms %8.1f MB/s %6.2fx\n", singleMs, megabytes * 1000.0 / singleMs, getlineMs / singleMs);
+		printf("  ObjLoader, %2u thr.  %9.2fms %8.1f MB/s %6.2fx\n", JobSystem::GetThreadCount() + 1, parallelMs, megabytes * 1000.0 / parallelMs, getlineMs / parallelMs);
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	unsigned int gridSize = argc > 1 ? (unsigned int)atoi(argv[1]) : 512;
+	const char* sphereFile = argc > 2 ? argv[2] : "sphere.obj";
+	unsigned int runs = argc > 3 ? (unsigned int)atoi(argv[3]) : 5;
+
+	JobSystem::Initialize();
+
+	Benchmark("sphere.obj", sphereFile, runs);
+
+	std::string gridFile = "objloader_benchmark_grid.obj";
+	WriteGridObj(gridFile.c_str(), gridSize);
+	Benchmark("generated grid", gridFile.c_str(), runs);
+	std::filesystem::remove(gridFile);
+
+	JobSystem::ShutDown();
+	return TestHelpers::Finish("ObjLoaderBenchmark");
+}
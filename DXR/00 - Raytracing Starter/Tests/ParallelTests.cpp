@@ -0,0 +1,80 @@
+#include "Parallel.h"
+#include "JobSystem.h"
+#include "TestHelpers.h"
+
+#include <atomic>
+#include <vector>
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Every index must run exactly once
+	void CheckEachIndexOnce(size_t count)
+	{
+		std::vector<std::atomic<int>> runs(count);
+		Parallel::Run(count, [&](size_t i) { runs[i]++; });
+		for (size_t i = 0; i < count; i++)
+			CHECK(runs[i] == 1);
+	}
+
+	// Ranges must cover [0, count) with no gaps or overlaps
+	void CheckRanges(size_t count, unsigned int threads)
+	{
+		std::vector<std::atomic<int>> covered(count);
+		Parallel::ForRanges(count, threads, [&](unsigned int, size_t start, size_t end)
+			{
+				for (size_t i = start; i < end; i++)
+					covered[i]++;
+			});
+		for (size_t i = 0; i < count; i++)
+			CHECK(covered[i] == 1);
+	}
+
+	// Runs nested inside runs (and inside other jobs) must finish even
+	// when every worker is busy waiting on an inner run
+	void CheckNested()
+	{
+		const size_t outer = 16;
+		const size_t inner = 64;
+		std::atomic<size_t> total = 0;
+		Parallel::Run(outer, [&](size_t)
+			{
+				Parallel::Run(inner, [&](size_t) { total++; });
+			});
+		CHECK(total == outer * inner);
+
+		std::future<size_t> job = JobSystem::Submit([&]()
+			{
+				std::atomic<size_t> count = 0;
+				Parallel::ForRanges(1000, 8, [&](unsigned int, size_t start, size_t end) { count += end - start; });
+				return count.load();
+			});
+		CHECK(job.get() == 1000);
+	}
+}
+
+
+int main()
+{
+	// Without workers, everything runs on this thread
+	CHECK(Parallel::ThreadCountFor(1000000, 1) == 1);
+	CheckEachIndexOnce(7);
+	CheckRanges(1000, 4);
+
+	// Thread counts follow the job system, and work is shared with it
+	JobSystem::Initialize(3);
+	CHECK(Parallel::ThreadCountFor(1000000, 1) == 4);
+	CHECK(Parallel::ThreadCountFor(1000000, 1, 2) == 2);
+	CHECK(Parallel::ThreadCountFor(10, 4) == 2);
+	CHECK(Parallel::ThreadCountFor(0, 4) == 1);
+	CheckEachIndexOnce(0);
+	CheckEachIndexOnce(1);
+	CheckEachIndexOnce(1000);
+	CheckRanges(1000, 4);
+	CheckRanges(3, 8);
+	CheckNested();
+	JobSystem::ShutDown();
+
+	return TestHelpers::Finish("ParallelTests");
+}
@@ -0,0 +1,126 @@
+#include "RayQuery.h"
+#include "JobSystem.h"
+#include "ProceduralMeshes.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Casts a frame's worth of gameplay queries against a field
+// of sphere instances: ground snapping rays straight down,
+// then line of sight checks between random points.  The
+// snaps are timed one at a time on the calling thread, and
+// then as a batch shared with the job system's workers,
+// which must find exactly the same hits.
+//
+// Usage: RayQueryBenchmark [fieldSize] [rays]
+// --------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+	unsigned int fieldSize = argc > 1 ? (unsigned int)atoi(argv[1]) : 64;
+	unsigned int rayCount = argc > 2 ? (unsigned int)atoi(argv[2]) : 64 * 1024;
+
+	JobSystem::Initialize();
+
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	ProceduralMeshes::MakeSphere(64, 32, verts, indices);
+	BVH sphere(verts.data(), (unsigned int)verts.size(), indices.data(), (unsigned int)indices.size());
+
+	// Every 4th instance is "foliage"
+	auto makeField = [&](float lift)
+		{
+			std::vector<BVHInstance> field(fieldSize * fieldSize);
+			for (unsigned int i = 0; i < field.size(); i++)
+			{
+				float x = (float)(i % fieldSize);
+				float z = (float)(i / fieldSize);
+				XMFLOAT4X4 world;
+				XMStoreFloat4x4(&world, XMMatrixScaling(1.5f, 1.0f, 1.5f) *
+					XMMatrixTranslation(x * 2.0f - fieldSize, sinf(x * 0.3f) * cosf(z * 0.3f) + lift, z * 2.0f - fieldSize));
+				field[i].SetWorldMatrix(world);
+				field[i].InstanceID = i;
+				field[i].InstanceMask = (i % 4 == 0) ? 0x02 : 0x01;
+				field[i].BLAS = &sphere;
+			}
+			return field;
+		};
+
+	RayQueryScene scene;
+	TopLevelBuildStats build = scene.Update(makeField(0.0f));
+	TopLevelBuildStats refit = scene.Update(makeField(0.1f));
+	CHECK(refit.Refit);
+	printf("Ray query benchmark: %u instances, build %.2fms, refit %.2fms\n",
+		scene.GetInstanceCount(),
+		build.Milliseconds,
+		refit.Milliseconds);
+
+	// Ground snapping ignores foliage, line of sight sees everything
+	std::vector<RayQueryDesc> snapRays(rayCount);
+	std::vector<RayQueryDesc> sightRays(rayCount);
+	unsigned int seed = 12345;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+	for (unsigned int i = 0; i < rayCount; i++)
+	{
+		snapRays[i].Origin = XMFLOAT3((random() * 2.0f - 1.0f) * fieldSize, 10.0f, (random() * 2.0f - 1.0f) * fieldSize);
+		snapRays[i].Direction = XMFLOAT3(0, -1, 0);
+		snapRays[i].TMax = 20.0f;
+		snapRays[i].InstanceInclusionMask = 0x01;
+
+		XMFLOAT3 from((random() * 2.0f - 1.0f) * fieldSize, 1.5f, (random() * 2.0f - 1.0f) * fieldSize);
+		XMFLOAT3 to((random() * 2.0f - 1.0f) * fieldSize, 1.5f, (random() * 2.0f - 1.0f) * fieldSize);
+		XMVECTOR toTarget = XMVectorSubtract(XMLoadFloat3(&to), XMLoadFloat3(&from));
+		sightRays[i].Origin = from;
+		XMStoreFloat3(&sightRays[i].Direction, XMVector3Normalize(toTarget));
+		sightRays[i].TMax = XMVectorGetX(XMVector3Length(toTarget));
+	}
+
+	std::vector<RayQueryHit> singleHits(rayCount);
+	std::vector<RayQueryHit> hits(rayCount);
+	std::vector<unsigned char> occluded(rayCount);
+
+	// One at a time on this thread, for comparison
+	auto singleStart = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < rayCount; i++)
+		scene.CastRay(snapRays[i], singleHits[i]);
+	auto singleEnd = std::chrono::high_resolution_clock::now();
+	double singleMs = std::chrono::duration<double, std::milli>(singleEnd - singleStart).count();
+
+	RayQueryStats snap = scene.CastRays(snapRays.data(), rayCount, hits.data());
+	RayQueryStats sight = scene.CheckOcclusion(sightRays.data(), rayCount, occluded.data());
+
+	unsigned int mismatches = 0;
+	for (unsigned int i = 0; i < rayCount; i++)
+		if (hits[i].Entity != singleHits[i].Entity || hits[i].T != singleHits[i].T || hits[i].PrimitiveIndex != singleHits[i].PrimitiveIndex)
+			mismatches++;
+	CHECK(mismatches == 0);
+	CHECK(snap.Rays == rayCount);
+	CHECK(sight.Rays == rayCount);
+
+	printf("Ray query benchmark: %u ground snaps in %.2fms (%.2f Mrays/s) on %u thread(s), %u hit; one at a time took %.2fms (%.2fx)\n",
+		snap.Rays,
+		snap.Milliseconds,
+		snap.Rays / (snap.Milliseconds * 1000.0),
+		snap.Threads,
+		snap.Hits,
+		singleMs,
+		singleMs / snap.Milliseconds);
+	printf("Ray query benchmark: %u line of sight checks in %.2fms (%.2f Mrays/s) on %u thread(s), %u blocked\n",
+		sight.Rays,
+		sight.Milliseconds,
+		sight.Rays / (sight.Milliseconds * 1000.0),
+		sight.Threads,
+		sight.Hits);
+
+	JobSystem::ShutDown();
+
+	return TestHelpers::Finish("RayQueryBenchmark");
+}
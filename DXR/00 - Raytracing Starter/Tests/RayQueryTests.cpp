@@ -0,0 +1,193 @@
+#include "RayQuery.h"
+#include "JobSystem.h"
+#include "ProceduralMeshes.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks that batches of ray queries, shared out in chunks
+// between the calling thread and the job system's workers,
+// give exactly what casting each ray alone gives: closest
+// hits from CastRays() against CastRay(), and occlusion
+// from CheckOcclusion() against IsOccluded().  Batches
+// range from empty, through less than one chunk, to many
+// chunks with a partial one at the end, over a field of
+// instances with a mix of masks, before and after a refit.
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Workers to start, so batches really are shared out
+	const unsigned int Workers = 3;
+
+	const unsigned int FieldSize = 12;
+
+	unsigned int seed = 12345;
+	float Random(float min, float max)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return min + (max - min) * ((seed >> 8) / 16777216.0f);
+	}
+
+	// --------------------------------------------------------
+	// A grid of sphere instances, lifted by height, with every
+	// 3rd one in a second mask group and IDs that differ from
+	// their positions in the list
+	// --------------------------------------------------------
+	std::vector<BVHInstance> MakeField(const BVH& sphere, float height)
+	{
+		std::vector<BVHInstance> field(FieldSize * FieldSize);
+		for (unsigned int i = 0; i < field.size(); i++)
+		{
+			float x = (float)(i % FieldSize) * 2.0f - FieldSize;
+			float z = (float)(i / FieldSize) * 2.0f - FieldSize;
+			XMFLOAT4X4 world;
+			XMStoreFloat4x4(&world, XMMatrixScaling(1.5f, 1.0f, 1.5f) * XMMatrixTranslation(x, height + sinf(x) * 0.5f, z));
+
+			field[i].SetWorldMatrix(world);
+			field[i].InstanceID = 1000 + i * 3;
+			field[i].InstanceMask = i % 3 == 0 ? 0x02 : 0x01;
+			field[i].BLAS = &sphere;
+		}
+		return field;
+	}
+
+	// Rays between random points in & around the field, with a mix of masks & lengths
+	std::vector<RayQueryDesc> MakeRays(unsigned int count)
+	{
+		std::vector<RayQueryDesc> rays(count);
+		for (RayQueryDesc& ray : rays)
+		{
+			XMFLOAT3 from(Random(-1.2f, 1.2f) * FieldSize, Random(-1.0f, 3.0f), Random(-1.2f, 1.2f) * FieldSize);
+			XMFLOAT3 to(Random(-1.0f, 1.0f) * FieldSize, Random(-0.5f, 1.5f), Random(-1.0f, 1.0f) * FieldSize);
+			XMVECTOR toTarget = XMVectorSubtract(XMLoadFloat3(&to), XMLoadFloat3(&from));
+			ray.Origin = from;
+			XMStoreFloat3(&ray.Direction, XMVector3Normalize(toTarget));
+			ray.TMin = Random(0.0f, 1.0f) < 0.25f ? Random(0.0f, 2.0f) : 0.0f;
+			ray.TMax = XMVectorGetX(XMVector3Length(toTarget)) * Random(0.5f, 1.5f);
+			float mask = Random(0.0f, 1.0f);
+			ray.InstanceInclusionMask = mask < 0.6f ? 0xFF : mask < 0.8f ? 0x01 : mask < 0.95f ? 0x02 : 0x00;
+		}
+		return rays;
+	}
+
+	// --------------------------------------------------------
+	// Casts a batch both ways and compares every result.  The
+	// stats must count the rays, and their hits, exactly, and
+	// batches of a single chunk must stay on the calling thread.
+	// --------------------------------------------------------
+	void CheckBatch(const RayQueryScene& scene, unsigned int count)
+	{
+		std::vector<RayQueryDesc> rays = MakeRays(count);
+
+		// Filled with garbage first, so anything left unwritten shows up
+		std::vector<RayQueryHit> hits(count, { -1.0f, 0xDEADBEEF, 0xDEADBEEF, XMFLOAT2(-1.0f, -1.0f) });
+		std::vector<unsigned char> occluded(count, 0xCC);
+		RayQueryStats cast = scene.CastRays(rays.data(), count, hits.data());
+		RayQueryStats occlusion = scene.CheckOcclusion(rays.data(), count, occluded.data());
+
+		unsigned int castMismatches = 0;
+		unsigned int occlusionMismatches = 0;
+		unsigned int expectedHits = 0;
+		unsigned int expectedOccluded = 0;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			RayQueryHit expected;
+			bool hit = scene.CastRay(rays[i], expected);
+			if (hit != hits[i].Hit() ||
+				expected.T != hits[i].T ||
+				expected.Entity != hits[i].Entity ||
+				expected.PrimitiveIndex != hits[i].PrimitiveIndex ||
+				expected.Barycentrics.x != hits[i].Barycentrics.x ||
+				expected.Barycentrics.y != hits[i].Barycentrics.y)
+				castMismatches++;
+			expectedHits += hit ? 1 : 0;
+
+			bool blocked = scene.IsOccluded(rays[i]);
+			if (occluded[i] != (blocked ? 1 : 0))
+				occlusionMismatches++;
+			expectedOccluded += blocked ? 1 : 0;
+		}
+
+		CHECK(castMismatches == 0);
+		CHECK(occlusionMismatches == 0);
+		CHECK(cast.Rays == count);
+		CHECK(cast.Hits == expectedHits);
+		CHECK(occlusion.Rays == count);
+		CHECK(occlusion.Hits == expectedOccluded);
+		CHECK(expectedOccluded >= expectedHits);
+		if (count <= 64)
+		{
+			CHECK(cast.Threads == (count > 0 ? 1u : 0u));
+			CHECK(occlusion.Threads == (count > 0 ? 1u : 0u));
+		}
+		else
+			CHECK(cast.Threads >= 1 && cast.Threads <= Workers + 1);
+
+		printf("  %5u rays: %5u hit on %u thread(s), %5u occluded on %u thread(s), %u/%u mismatches\n",
+			count,
+			cast.Hits,
+			cast.Threads,
+			occlusion.Hits,
+			occlusion.Threads,
+			castMismatches,
+			occlusionMismatches);
+	}
+
+	void CheckBatches(const RayQueryScene& scene)
+	{
+		const unsigned int counts[] = { 0, 1, 17, 63, 64, 65, 1000, 4099 };
+		for (unsigned int count : counts)
+			CheckBatch(scene, count);
+	}
+}
+
+
+int main()
+{
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	ProceduralMeshes::MakeSphere(16, 8, verts, indices);
+	BVH sphere(verts.data(), (unsigned int)verts.size(), indices.data(), (unsigned int)indices.size());
+
+	JobSystem::Initialize(Workers);
+
+	RayQueryScene scene;
+	printf("Ray query batches against single rays:\n");
+
+	// Nothing in the scene yet, so nothing can be hit
+	scene.Update(std::vector<BVHInstance>());
+	CHECK(scene.GetInstanceCount() == 0);
+	CheckBatch(scene, 100);
+
+	TopLevelBuildStats build = scene.Update(MakeField(sphere, 0.0f));
+	CHECK(!build.Refit);
+	CHECK(scene.GetInstanceCount() == FieldSize * FieldSize);
+	CheckBatches(scene);
+
+	// Same BLASes, moved up a little, so the top level is refit
+	TopLevelBuildStats refit = scene.Update(MakeField(sphere, 0.25f));
+	CHECK(refit.Refit);
+	CheckBatches(scene);
+
+	// A ray straight down onto one instance reports its ID
+	RayQueryDesc down;
+	down.Origin = XMFLOAT3(2.0f * 5 - FieldSize, 10.0f, 2.0f * 7 - FieldSize);
+	down.Direction = XMFLOAT3(0, -1, 0);
+	down.TMax = 20.0f;
+	RayQueryHit hit;
+	CHECK(scene.CastRay(down, hit));
+	CHECK(hit.Entity == 1000 + (7 * FieldSize + 5) * 3);
+
+	JobSystem::ShutDown();
+
+	return TestHelpers::Finish("RayQueryTests");
+}
@@ -0,0 +1,124 @@
+#include "BVH.h"
+#include "JobSystem.h"
+#include "MeshData.h"
+#include "ProceduralMeshes.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Swirls a bumpy grid further and further around its
+// center, refitting its BVH at each step and comparing
+// that with a full rebuild: time, SAH cost, and the hits
+// of a set of rays through both trees, which must match.
+// Shows where a deformable mesh with default options
+// would rebuild instead.
+//
+// Usage: RefitBenchmark [gridSize] [steps]
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	const float TwoPi = 6.283185307f;
+
+	// Rays traced through both trees at each step
+	const unsigned int RayCount = 4096;
+
+	// --------------------------------------------------------
+	// Twists the grid around Y by up to angle radians, more
+	// the further out each vertex is
+	// --------------------------------------------------------
+	void Swirl(const std::vector<Vertex>& flat, float angle, std::vector<Vertex>& verts)
+	{
+		for (size_t i = 0; i < flat.size(); i++)
+		{
+			float x = flat[i].Position.x;
+			float z = flat[i].Position.z;
+			float twist = angle * 2.0f * sqrtf(x * x + z * z);
+			verts[i].Position = XMFLOAT3(x * cosf(twist) - z * sinf(twist), flat[i].Position.y, x * sinf(twist) + z * cosf(twist));
+		}
+	}
+
+	// --------------------------------------------------------
+	// Rays from above down onto the grid, counting those whose
+	// closest hits differ between the two trees
+	// --------------------------------------------------------
+	unsigned int CountMismatches(const BVH& refitBVH, const BVH& rebuiltBVH)
+	{
+		unsigned int mismatches = 0;
+		for (unsigned int r = 0; r < RayCount; r++)
+		{
+			float spin = TwoPi * r / RayCount;
+			XMFLOAT3 origin(sinf(spin * 7.0f) * 0.4f, 1.0f, cosf(spin * 5.0f) * 0.4f);
+			XMFLOAT3 target(sinf(spin * 3.0f) * 0.5f, 0.0f, cosf(spin * 11.0f) * 0.5f);
+			XMFLOAT3 direction;
+			XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSubtract(XMLoadFloat3(&target), XMLoadFloat3(&origin))));
+
+			BVHHit refitHit, rebuiltHit;
+			bool refitFound = refitBVH.TraceClosest(origin, direction, 0.0f, 100.0f, refitHit);
+			bool rebuiltFound = rebuiltBVH.TraceClosest(origin, direction, 0.0f, 100.0f, rebuiltHit);
+			if (refitFound != rebuiltFound || (refitFound && fabsf(refitHit.T - rebuiltHit.T) > 1e-5f))
+				mismatches++;
+		}
+		return mismatches;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	unsigned int gridSize = argc > 1 ? (unsigned int)atoi(argv[1]) : 512;
+	unsigned int steps = argc > 2 ? (unsigned int)atoi(argv[2]) : 8;
+	const float maxDegradation = MeshOptions().MaxRefitDegradation;
+
+	JobSystem::Initialize();
+
+	std::vector<Vertex> flat;
+	std::vector<unsigned int> indices;
+	ProceduralMeshes::MakeBumpyGrid(gridSize, flat, indices);
+	unsigned int vertCount = (unsigned int)flat.size();
+	unsigned int indexCount = (unsigned int)indices.size();
+
+	BVH refitBVH;
+	BVHBuildStats build = refitBVH.Build(flat.data(), vertCount, indices.data(), indexCount);
+	printf("Refits of a %ux%u grid: %u triangles, built in %.2fms with SAH cost %.2f\n", gridSize, gridSize, build.Triangles, build.Milliseconds, build.SAHCost);
+
+	std::vector<Vertex> verts = flat;
+	for (unsigned int step = 1; step <= steps; step++)
+	{
+		float angle = TwoPi * step / steps;
+		Swirl(flat, angle, verts);
+
+		BVHBuildStats refit = refitBVH.Refit(verts.data(), vertCount, indices.data(), indexCount);
+		BVH rebuiltBVH;
+		BVHBuildStats rebuild = rebuiltBVH.Build(verts.data(), vertCount, indices.data(), indexCount);
+		unsigned int mismatches = CountMismatches(refitBVH, rebuiltBVH);
+		CHECK(refit.Refit);
+		CHECK(mismatches == 0);
+
+		float degradation = refit.SAHCost / build.SAHCost;
+		printf("  %3.0f degree swirl: refit %.2fms (SAH cost %.2f, %.2fx as built), rebuild %.2fms (SAH cost %.2f), refit %.1fx faster, %u/%u ray mismatches%s\n",
+			XMConvertToDegrees(angle),
+			refit.Milliseconds,
+			refit.SAHCost,
+			degradation,
+			rebuild.Milliseconds,
+			rebuild.SAHCost,
+			refit.Milliseconds > 0.0 ? rebuild.Milliseconds / refit.Milliseconds : 0.0,
+			mismatches,
+			RayCount,
+			degradation > maxDegradation ? " - a deformable mesh would rebuild here" : "");
+	}
+
+	JobSystem::ShutDown();
+
+	return TestHelpers::Finish("RefitBenchmark");
+}
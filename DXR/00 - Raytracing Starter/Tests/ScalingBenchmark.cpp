@@ -0,0 +1,120 @@
+#include "CPURaytracer.h"
+#include "JobSystem.h"
+#include "ProceduralMeshes.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Renders a bumpy grid with the horizon across the middle
+// of the view, so sky-only tiles are nearly free and the
+// rest are not, using 1 thread and then doubling up to
+// every core (at most 64, or as many threads as asked
+// for).  Prints the speedup of each, along with how busy
+// the threads were and how often they had to steal tiles
+// from each other.  Every thread count must render exactly
+// the same image.
+//
+// Usage: ScalingBenchmark [width] [height] [gridSize] [threads] [runs]
+// --------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+	unsigned int width = argc > 1 ? (unsigned int)atoi(argv[1]) : 1280;
+	unsigned int height = argc > 2 ? (unsigned int)atoi(argv[2]) : 720;
+	unsigned int gridSize = argc > 3 ? (unsigned int)atoi(argv[3]) : 512;
+	unsigned int maxThreads = argc > 4 ? (unsigned int)atoi(argv[4]) : 0;
+	unsigned int runs = argc > 5 ? (unsigned int)atoi(argv[5]) : 3;
+
+	// Renders run on the job system's workers plus this thread
+	JobSystem::Initialize(maxThreads > 1 ? maxThreads - 1 : 0);
+
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	ProceduralMeshes::MakeBumpyGrid(gridSize, verts, indices);
+	BVH bvh(verts.data(), (unsigned int)verts.size(), indices.data(), (unsigned int)indices.size());
+	WideBVH wideBVH(bvh);
+
+	std::vector<CPURaytracer::Geometry> scene = { CPURaytracer::MakeGeometry(verts, indices, &bvh, &wideBVH) };
+
+	// Just above one edge of the grid, looking across it
+	XMFLOAT3 gridCameraPos(0.0f, 0.05f, -0.55f);
+	XMFLOAT4X4 gridView, gridProjection;
+	XMStoreFloat4x4(&gridView, XMMatrixLookToLH(XMLoadFloat3(&gridCameraPos), XMVectorSet(0.0f, -0.05f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)));
+	XMStoreFloat4x4(&gridProjection, XMMatrixPerspectiveFovLH(XM_PIDIV4, (float)width / height, 0.01f, 100.0f));
+	RaytracingSceneData sceneData = CPURaytracer::CalcSceneData(gridView, gridProjection, gridCameraPos);
+
+	// Powers of two, then every core if that isn't one
+	unsigned int cores = JobSystem::GetThreadCount() + 1;
+	if (maxThreads > 0 && cores > maxThreads) cores = maxThreads;
+	if (cores > 64) cores = 64;
+	std::vector<unsigned int> threadCounts;
+	for (unsigned int threads = 1; threads < cores; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(cores);
+
+	CPURaytracer::Image singleThreadImage;
+	double singleThreadMilliseconds = 0.0;
+	for (unsigned int threads : threadCounts)
+	{
+		// Best of a few renders, to skip any warm up
+		CPURaytracer::Image image;
+		CPURaytracer::RenderStats best = {};
+		for (unsigned int run = 0; run < runs; run++)
+		{
+			CPURaytracer::RenderStats stats = CPURaytracer::Render(sceneData, scene, width, height, image, 16, true, threads);
+			if (run == 0 || stats.Milliseconds < best.Milliseconds)
+				best = stats;
+		}
+		CHECK(best.Threads == threads);
+		if (threads == 1)
+		{
+			singleThreadMilliseconds = best.Milliseconds;
+			singleThreadImage = image;
+		}
+
+		unsigned int differences = 0;
+		for (size_t i = 0; i < image.Pixels.size(); i++)
+		{
+			const XMFLOAT4& a = image.Pixels[i];
+			const XMFLOAT4& b = singleThreadImage.Pixels[i];
+			if (a.x != b.x || a.y != b.y || a.z != b.z || a.w != b.w)
+				differences++;
+		}
+		CHECK(differences == 0);
+
+		// Busy time of the average & least busy threads, as a
+		// fraction of the whole render
+		double totalBusy = 0.0;
+		double leastBusy = best.Milliseconds;
+		for (double busy : best.ThreadBusyMilliseconds)
+		{
+			totalBusy += busy;
+			if (busy < leastBusy) leastBusy = busy;
+		}
+		double averageBusy = totalBusy / best.Threads;
+
+		double speedup = singleThreadMilliseconds / best.Milliseconds;
+		printf("Scaling benchmark (%u triangle grid, %ux%u): %2u thread(s) %8.2fms, %5.2fx speedup (%5.1f%% efficiency), threads busy %5.1f%% on average (least %5.1f%%), %4u steals over %u tiles\n",
+			(unsigned int)indices.size() / 3,
+			width,
+			height,
+			best.Threads,
+			best.Milliseconds,
+			speedup,
+			100.0 * speedup / best.Threads,
+			100.0 * averageBusy / best.Milliseconds,
+			100.0 * leastBusy / best.Milliseconds,
+			best.Steals,
+			best.Tiles);
+	}
+
+	JobSystem::ShutDown();
+
+	return TestHelpers::Finish("ScalingBenchmark");
+}
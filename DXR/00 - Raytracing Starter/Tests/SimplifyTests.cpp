@@ -0,0 +1,198 @@
+#include "MeshProcessing.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <utility>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks that MeshProcessing::Simplify keeps open borders
+// on the border and UV seams closed, while still moving
+// vertices along both
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	typedef std::pair<unsigned int, unsigned int> Edge;
+
+	bool SamePosition(const Vertex& a, const Vertex& b)
+	{
+		return memcmp(&a.Position, &b.Position, sizeof(XMFLOAT3)) == 0;
+	}
+
+	// Directed edges with no opposite edge (by index)
+	std::vector<Edge> FindOpenEdges(const std::vector<unsigned int>& indices)
+	{
+		std::set<Edge> edges;
+		for (size_t i = 0; i < indices.size(); i += 3)
+			for (size_t e = 0; e < 3; e++)
+				edges.insert({ indices[i + e], indices[i + (e + 1) % 3] });
+
+		std::vector<Edge> open;
+		for (const Edge& edge : edges)
+			if (!edges.count({ edge.second, edge.first }))
+				open.push_back(edge);
+		return open;
+	}
+
+	unsigned int CountUsed(const std::vector<unsigned int>& indices, unsigned int numVerts, const std::vector<bool>& subset)
+	{
+		std::vector<bool> used(numVerts, false);
+		for (unsigned int i : indices)
+			used[i] = true;
+
+		unsigned int count = 0;
+		for (unsigned int v = 0; v < numVerts; v++)
+			count += used[v] && subset[v];
+		return count;
+	}
+
+	std::vector<unsigned int> Simplify(const std::vector<Vertex>& verts, const std::vector<unsigned int>& indices, float fraction)
+	{
+		std::vector<unsigned int> result(indices.size());
+		unsigned int target = (unsigned int)(indices.size() * fraction) / 3 * 3;
+		unsigned int count = MeshProcessing::Simplify(result.data(), verts.data(), (unsigned int)verts.size(),
+			indices.data(), (unsigned int)indices.size(), target);
+		result.resize(count);
+		return result;
+	}
+
+	// --------------------------------------------------------
+	// An open, gently curved size x size grid on the XZ plane.
+	// Its open edges must stay on the grid's outline.
+	// --------------------------------------------------------
+	void TestOpenGrid()
+	{
+		const unsigned int size = 32;
+		std::vector<Vertex> verts((size + 1) * (size + 1));
+		std::vector<bool> onBorder(verts.size());
+		for (unsigned int y = 0; y <= size; y++)
+		{
+			for (unsigned int x = 0; x <= size; x++)
+			{
+				float u = (float)x / size;
+				float v = (float)y / size;
+				Vertex& vert = verts[y * (size + 1) + x];
+				vert = {};
+				vert.Position = XMFLOAT3(u - 0.5f, 0.01f * sinf(u * 3.0f) * sinf(v * 3.0f), v - 0.5f);
+				vert.UV = XMFLOAT2(u, v);
+				onBorder[y * (size + 1) + x] = x == 0 || y == 0 || x == size || y == size;
+			}
+		}
+
+		std::vector<unsigned int> indices;
+		for (unsigned int y = 0; y < size; y++)
+		{
+			for (unsigned int x = 0; x < size; x++)
+			{
+				unsigned int i = y * (size + 1) + x;
+				indices.insert(indices.end(), { i, i + size + 1, i + 1, i + 1, i + size + 1, i + size + 2 });
+			}
+		}
+
+		std::vector<unsigned int> result = Simplify(verts, indices, 0.1f);
+		printf("Open grid: %zu -> %zu triangles, %u -> %u border vertices\n",
+			indices.size() / 3,
+			result.size() / 3,
+			CountUsed(indices, (unsigned int)verts.size(), onBorder),
+			CountUsed(result, (unsigned int)verts.size(), onBorder));
+
+		CHECK(result.size() <= indices.size() / 5);
+
+		// Border vertices slid along the border...
+		CHECK(CountUsed(result, (unsigned int)verts.size(), onBorder) < CountUsed(indices, (unsigned int)verts.size(), onBorder));
+
+		// ...but the border is still exactly the outline, corners included
+		bool outlineKept = true;
+		for (const Edge& edge : FindOpenEdges(result))
+			outlineKept &= onBorder[edge.first] && onBorder[edge.second];
+		CHECK(outlineKept);
+
+		unsigned int corners[4] = { 0, size, size * (size + 1), (size + 1) * (size + 1) - 1 };
+		std::vector<bool> isCorner(verts.size(), false);
+		for (unsigned int c : corners) isCorner[c] = true;
+		CHECK(CountUsed(result, (unsigned int)verts.size(), isCorner) == 4);
+	}
+
+	// --------------------------------------------------------
+	// A closed torus whose UVs wrap around in both directions,
+	// so its first & last rows and columns are seams: pairs of
+	// vertices at the same position with different UVs.  The
+	// seams must stay closed (every open edge has a twin edge
+	// running the other way at the same positions).
+	// --------------------------------------------------------
+	void TestSeamedTorus()
+	{
+		const unsigned int rings = 48;
+		const unsigned int sides = 24;
+		const float pi = 3.14159265f;
+
+		std::vector<Vertex> verts((rings + 1) * (sides + 1));
+		std::vector<bool> onSeam(verts.size());
+		for (unsigned int r = 0; r <= rings; r++)
+		{
+			for (unsigned int s = 0; s <= sides; s++)
+			{
+				// Wrap the last row & column back to exactly the first positions
+				float theta = (r % rings) * 2.0f * pi / rings;
+				float phi = (s % sides) * 2.0f * pi / sides;
+
+				Vertex& vert = verts[r * (sides + 1) + s];
+				vert = {};
+				vert.Position = XMFLOAT3((1.0f + 0.3f * cosf(phi)) * cosf(theta), 0.3f * sinf(phi), (1.0f + 0.3f * cosf(phi)) * sinf(theta));
+				vert.UV = XMFLOAT2((float)r / rings, (float)s / sides);
+				onSeam[r * (sides + 1) + s] = r == 0 || s == 0 || r == rings || s == sides;
+			}
+		}
+
+		std::vector<unsigned int> indices;
+		for (unsigned int r = 0; r < rings; r++)
+		{
+			for (unsigned int s = 0; s < sides; s++)
+			{
+				unsigned int i = r * (sides + 1) + s;
+				indices.insert(indices.end(), { i, i + 1, i + sides + 1, i + 1, i + sides + 2, i + sides + 1 });
+			}
+		}
+
+		std::vector<unsigned int> result = Simplify(verts, indices, 0.25f);
+		printf("Seamed torus: %zu -> %zu triangles, %u -> %u seam vertices\n",
+			indices.size() / 3,
+			result.size() / 3,
+			CountUsed(indices, (unsigned int)verts.size(), onSeam),
+			CountUsed(result, (unsigned int)verts.size(), onSeam));
+
+		CHECK(result.size() <= indices.size() / 3);
+
+		// Seam vertices moved (they used to be locked)...
+		CHECK(CountUsed(result, (unsigned int)verts.size(), onSeam) < CountUsed(indices, (unsigned int)verts.size(), onSeam));
+
+		// ...without opening the seam up
+		std::vector<Edge> open = FindOpenEdges(result);
+		bool seamsClosed = !open.empty();
+		for (const Edge& edge : open)
+		{
+			bool twinned = false;
+			for (const Edge& other : open)
+				twinned |= SamePosition(verts[edge.first], verts[other.second]) && SamePosition(verts[edge.second], verts[other.first]) && edge != other;
+			seamsClosed &= twinned && onSeam[edge.first] && onSeam[edge.second];
+		}
+		CHECK(seamsClosed);
+	}
+}
+
+
+int main()
+{
+	TestOpenGrid();
+	TestSeamedTorus();
+	return TestHelpers::Finish("SimplifyTests");
+}
@@ -0,0 +1,195 @@
+#include "MeshProcessing.h"
+#include "JobSystem.h"
+#include "ProceduralMeshes.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Times MeshProcessing::CalculateTangents against the
+// scalar loop it replaced, and checks that every tangent
+// the old code could produce matches it within tolerance.
+//
+// Usage: TangentBenchmark [gridSize] [runs]
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Largest angle allowed between old and new tangents
+	const float MaxTangentDegrees = 0.01f;
+
+	// --------------------------------------------------------
+	// The original per-vertex tangent code (from Mesh.cpp),
+	// looping over the indices rather than the vertex count,
+	// which only worked when every index had its own vertex
+	// --------------------------------------------------------
+	void CalculateTangentsScalar(Vertex* verts, unsigned int numVerts, const unsigned int* indices, unsigned int numIndices)
+	{
+		for (unsigned int i = 0; i < numVerts; i++)
+			verts[i].Tangent = XMFLOAT4(0, 0, 0, 0);
+
+		for (unsigned int i = 0; i + 2 < numIndices;)
+		{
+			Vertex* v1 = &verts[indices[i++]];
+			Vertex* v2 = &verts[indices[i++]];
+			Vertex* v3 = &verts[indices[i++]];
+
+			float x1 = v2->Position.x - v1->Position.x;
+			float y1 = v2->Position.y - v1->Position.y;
+			float z1 = v2->Position.z - v1->Position.z;
+
+			float x2 = v3->Position.x - v1->Position.x;
+			float y2 = v3->Position.y - v1->Position.y;
+			float z2 = v3->Position.z - v1->Position.z;
+
+			float s1 = v2->UV.x - v1->UV.x;
+			float t1 = v2->UV.y - v1->UV.y;
+
+			float s2 = v3->UV.x - v1->UV.x;
+			float t2 = v3->UV.y - v1->UV.y;
+
+			float r = 1.0f / (s1 * t2 - s2 * t1);
+
+			float tx = (t2 * x1 - t1 * x2) * r;
+			float ty = (t2 * y1 - t1 * y2) * r;
+			float tz = (t2 * z1 - t1 * z2) * r;
+
+			v1->Tangent.x += tx; v1->Tangent.y += ty; v1->Tangent.z += tz;
+			v2->Tangent.x += tx; v2->Tangent.y += ty; v2->Tangent.z += tz;
+			v3->Tangent.x += tx; v3->Tangent.y += ty; v3->Tangent.z += tz;
+		}
+
+		for (unsigned int i = 0; i < numVerts; i++)
+		{
+			XMVECTOR normal = XMLoadFloat3(&verts[i].Normal);
+			XMVECTOR tangent = XMLoadFloat4(&verts[i].Tangent);
+			tangent = XMVector3Normalize(XMVectorSubtract(tangent, XMVectorMultiply(normal, XMVector3Dot(normal, tangent))));
+			XMStoreFloat4(&verts[i].Tangent, tangent);
+		}
+	}
+
+	// --------------------------------------------------------
+	// A size x size bumpy grid with its UVs mirrored in U
+	// across the middle (like a symmetric model), so both
+	// handedness values show up
+	// --------------------------------------------------------
+	void MakeMirroredGrid(unsigned int size, std::vector<Vertex>& verts, std::vector<unsigned int>& indices)
+	{
+		ProceduralMeshes::MakeBumpyGrid(size, verts, indices);
+		for (Vertex& vert : verts)
+			vert.UV.x = vert.UV.x < 0.5f ? vert.UV.x : 1.0f - vert.UV.x;
+	}
+
+	// Best time of several runs, in milliseconds
+	template<typename Func>
+	double BestOf(unsigned int runs, Func func)
+	{
+		double best = 0.0;
+		for (unsigned int run = 0; run < runs; run++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			func();
+			auto end = std::chrono::high_resolution_clock::now();
+			double ms = std::chrono::duration<double, std::milli>(end - start).count();
+			if (run == 0 || ms < best)
+				best = ms;
+		}
+		return best;
+	}
+
+	// --------------------------------------------------------
+	// Compares new tangents against the old ones wherever the
+	// old code produced a finite tangent.  The new ones must
+	// all be unit length, perpendicular to the normal and have
+	// a handedness of exactly +1 or -1.
+	// --------------------------------------------------------
+	void CompareTangents(const std::vector<Vertex>& scalar, const std::vector<Vertex>& processed)
+	{
+		float maxDegrees = 0.0f;
+		unsigned int compared = 0;
+		unsigned int leftHanded = 0;
+		for (size_t i = 0; i < scalar.size(); i++)
+		{
+			XMVECTOR tangent = XMLoadFloat4(&processed[i].Tangent);
+			XMVECTOR normal = XMLoadFloat3(&processed[i].Normal);
+			CHECK(fabsf(XMVectorGetX(XMVector3Length(tangent)) - 1.0f) < 1e-4f);
+			CHECK(fabsf(XMVectorGetX(XMVector3Dot(tangent, normal))) < 1e-4f);
+			CHECK(processed[i].Tangent.w == 1.0f || processed[i].Tangent.w == -1.0f);
+			if (processed[i].Tangent.w < 0.0f)
+				leftHanded++;
+
+			const XMFLOAT4& old = scalar[i].Tangent;
+			if (!std::isfinite(old.x) || !std::isfinite(old.y) || !std::isfinite(old.z))
+				continue;
+
+			// atan2 of the cross & dot products, as acos can't resolve
+			// angles this small from a float cosine
+			XMVECTOR oldTangent = XMLoadFloat4(&old);
+			float sine = XMVectorGetX(XMVector3Length(XMVector3Cross(oldTangent, tangent)));
+			float cosine = XMVectorGetX(XMVector3Dot(oldTangent, tangent));
+			float degrees = XMConvertToDegrees(atan2f(sine, cosine));
+			if (degrees > maxDegrees)
+				maxDegrees = degrees;
+			compared++;
+		}
+
+		CHECK(compared > 0);
+		CHECK(leftHanded > 0);
+		CHECK(maxDegrees <= MaxTangentDegrees);
+		printf("  %u of %zu tangents compared, max difference %.5f degrees (tolerance %.5f), %u left handed\n",
+			compared,
+			scalar.size(),
+			maxDegrees,
+			MaxTangentDegrees,
+			leftHanded);
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	unsigned int gridSize = argc > 1 ? (unsigned int)atoi(argv[1]) : 1024;
+	unsigned int runs = argc > 2 ? (unsigned int)atoi(argv[2]) : 5;
+
+	std::vector<Vertex> source;
+	std::vector<unsigned int> indices;
+	MakeMirroredGrid(gridSize, source, indices);
+	unsigned int numVerts = (unsigned int)source.size();
+	unsigned int numIndices = (unsigned int)indices.size();
+
+	std::vector<Vertex> scalar = source;
+	std::vector<Vertex> processed = source;
+	double scalarMs = BestOf(runs, [&]() { CalculateTangentsScalar(scalar.data(), numVerts, indices.data(), numIndices); });
+
+	// Before the job system starts, CalculateTangents runs on this thread alone
+	unsigned int singleThreads = 0;
+	double singleMs = BestOf(runs, [&]()
+		{
+			singleThreads = MeshProcessing::CalculateTangents(processed.data(), numVerts, indices.data(), numIndices);
+		});
+
+	JobSystem::Initialize();
+	unsigned int threads = 0;
+	double parallelMs = BestOf(runs, [&]()
+		{
+			threads = MeshProcessing::CalculateTangents(processed.data(), numVerts, indices.data(), numIndices);
+		});
+	JobSystem::ShutDown();
+
+	printf("Tangents for a %ux%u grid: %u vertices, %u triangles, best of %u\n", gridSize, gridSize, numVerts, numIndices / 3, runs);
+	printf("  old scalar loop             %9.2fms\n", scalarMs);
+	printf("  CalculateTangents, %2u thr.  %9.2fms %6.2fx\n", singleThreads, singleMs, scalarMs / singleMs);
+	printf("  CalculateTangents, %2u thr.  %9.2fms %6.2fx\n", threads, parallelMs, scalarMs / parallelMs);
+	CompareTangents(scalar, processed);
+
+	return TestHelpers::Finish("TangentBenchmark");
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdio>
+
+// --------------------------------------------------------
+// Bare-bones checks for the test executables, which are
+// run by CTest.  Failures are reported but don't stop the
+// test, and the process exits with the number of failures.
+// --------------------------------------------------------
+namespace TestHelpers
+{
+	inline int& FailureCount()
+	{
+		static int failures = 0;
+		return failures;
+	}
+
+	inline int Finish(const char* testName)
+	{
+		printf("%s: %s (%d failure(s))\n", testName, FailureCount() == 0 ? "passed" : "FAILED", FailureCount());
+		return FailureCount();
+	}
+}
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) \
+		{ \
+			printf("%s(%d): CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+			TestHelpers::FailureCount()++; \
+		} \
+	} while (0)
@@ -0,0 +1,135 @@
+#include "ImageWriter.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks that TileImageWriter makes exactly the same file
+// from tiles queued in a random order, from several threads
+// at once and with only a couple of slots to share, as it
+// does from the whole image written as a single tile
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Not a multiple of the tile size, so the edge tiles are partial
+	const unsigned int Width = 203;
+	const unsigned int Height = 117;
+	const unsigned int TileSize = 16;
+	const unsigned int WriterThreads = 4;
+
+	// --------------------------------------------------------
+	// A gradient with values below 0 and above 1, so clamping
+	// and the unclamped float format are both exercised, and
+	// a different value in every channel of every pixel
+	// --------------------------------------------------------
+	std::vector<XMFLOAT4> MakePixels()
+	{
+		std::vector<XMFLOAT4> pixels(Width * Height);
+		for (unsigned int y = 0; y < Height; y++)
+		{
+			for (unsigned int x = 0; x < Width; x++)
+			{
+				float u = (float)x / Width;
+				float v = (float)y / Height;
+				pixels[y * Width + x] = XMFLOAT4(u * 1.5f - 0.25f, v, (u + v) * 0.5f + x * 0.001f, 1.0f);
+			}
+		}
+		return pixels;
+	}
+
+	std::vector<char> ReadFile(const std::string& file)
+	{
+		std::ifstream in(file, std::ios::binary);
+		return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	// Every tile of the image, shuffled with a fixed seed
+	std::vector<TileRect> ShuffledTiles()
+	{
+		std::vector<TileRect> tiles;
+		for (unsigned int y = 0; y < Height; y += TileSize)
+			for (unsigned int x = 0; x < Width; x += TileSize)
+				tiles.push_back({ x, y, x + TileSize < Width ? x + TileSize : Width, y + TileSize < Height ? y + TileSize : Height });
+
+		unsigned int seed = 12345;
+		for (unsigned int i = (unsigned int)tiles.size() - 1; i > 0; i--)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			unsigned int j = (unsigned int)(((unsigned long long)seed * (i + 1)) >> 32);
+			std::swap(tiles[i], tiles[j]);
+		}
+		return tiles;
+	}
+
+	void CheckFormat(const char* name, ImageFileFormat format, unsigned int bytesPerPixel, const std::vector<XMFLOAT4>& pixels)
+	{
+		std::string oneShotFile = std::string("tile_writer_whole.") + name;
+		std::string tiledFile = std::string("tile_writer_tiled.") + name;
+
+		// The whole image as one tile
+		TileImageWriter oneShot;
+		CHECK(oneShot.Open(oneShotFile.c_str(), Width, Height, format));
+		oneShot.WriteTile({ 0, 0, Width, Height }, pixels.data(), Width);
+		ImageWriterStats oneShotStats = oneShot.Close();
+		CHECK(oneShotStats.Succeeded);
+		CHECK(oneShotStats.Tiles == 1);
+		CHECK(oneShotStats.Bytes == (unsigned long long)Width * Height * bytesPerPixel);
+
+		// Shuffled tiles, shared round robin between several threads,
+		// through few enough slots that they have to wait for them
+		std::vector<TileRect> tiles = ShuffledTiles();
+		TileImageWriter tiled(2);
+		CHECK(tiled.Open(tiledFile.c_str(), Width, Height, format));
+		std::vector<std::thread> threads;
+		for (unsigned int t = 0; t < WriterThreads; t++)
+		{
+			threads.emplace_back([&, t]()
+				{
+					for (size_t i = t; i < tiles.size(); i += WriterThreads)
+						tiled.WriteTile(tiles[i], &pixels[tiles[i].StartY * Width + tiles[i].StartX], Width);
+				});
+		}
+		for (std::thread& thread : threads)
+			thread.join();
+		ImageWriterStats tiledStats = tiled.Close();
+		CHECK(tiledStats.Succeeded);
+		CHECK(tiledStats.Tiles == tiles.size());
+		CHECK(tiledStats.Bytes == oneShotStats.Bytes);
+		CHECK(tiledStats.MaxQueuedTiles <= 2);
+
+		std::vector<char> oneShotBytes = ReadFile(oneShotFile);
+		std::vector<char> tiledBytes = ReadFile(tiledFile);
+		CHECK(oneShotBytes.size() > oneShotStats.Bytes);
+		CHECK(oneShotBytes == tiledBytes);
+
+		printf("  %-4s %zu tiles, %zu bytes, %s\n", name, tiles.size(), tiledBytes.size(), oneShotBytes == tiledBytes ? "identical" : "DIFFERENT");
+		std::filesystem::remove(oneShotFile);
+		std::filesystem::remove(tiledFile);
+	}
+}
+
+
+int main()
+{
+	std::vector<XMFLOAT4> pixels = MakePixels();
+
+	printf("Tiled vs one-shot writes of a %ux%u image:\n", Width, Height);
+	CheckFormat("ppm", ImageFileFormat::PPM, 3, pixels);
+	CheckFormat("srgb", ImageFileFormat::PPMsRGB, 3, pixels);
+	CheckFormat("pfm", ImageFileFormat::PFM, 12, pixels);
+
+	return TestHelpers::Finish("TileImageWriterTests");
+}
@@ -0,0 +1,173 @@
+#include "TileScheduler.h"
+#include "JobSystem.h"
+#include "TestHelpers.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------
+// Checks that TileScheduler::Run renders every tile of
+// images of awkward sizes exactly once, with tiles laid
+// out on the tile grid and clipped to the image, for a
+// range of thread counts (including more threads than the
+// job system has workers, and than there are tiles), and
+// that the per thread totals add up.  Also checks that
+// MortonOrder visits each tile once, along the Z-curve.
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Workers to start, so tiles really are rendered concurrently
+	const unsigned int Workers = 3;
+
+	// Interleaves x & y bit by bit, x in the lowest
+	unsigned int MortonCode(unsigned int x, unsigned int y)
+	{
+		unsigned int code = 0;
+		for (unsigned int bit = 0; bit < 16; bit++)
+			code |= ((x >> bit) & 1) << (bit * 2) | ((y >> bit) & 1) << (bit * 2 + 1);
+		return code;
+	}
+
+	// --------------------------------------------------------
+	// Every tile index must appear once, in increasing Morton
+	// code order, and a square power of two grid must follow
+	// the Z-curve exactly
+	// --------------------------------------------------------
+	void CheckMortonOrder(unsigned int tilesX, unsigned int tilesY)
+	{
+		std::vector<unsigned int> order = TileScheduler::MortonOrder(tilesX, tilesY);
+		CHECK(order.size() == (size_t)tilesX * tilesY);
+
+		std::vector<unsigned int> seen((size_t)tilesX * tilesY, 0);
+		bool ascending = true;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			if (order[i] < seen.size())
+				seen[order[i]]++;
+			if (i > 0 && tilesX > 0)
+				ascending = ascending &&
+					MortonCode(order[i - 1] % tilesX, order[i - 1] / tilesX) < MortonCode(order[i] % tilesX, order[i] / tilesX);
+		}
+		for (unsigned int count : seen)
+			CHECK(count == 1);
+		CHECK(ascending);
+	}
+
+	// --------------------------------------------------------
+	// Runs the scheduler over a width x height image, counting
+	// how many times each pixel is rendered.  Tiles whose top
+	// edge is in the top quarter of the image take a while, so
+	// threads run out of their own tiles at different times
+	// and have to steal.
+	// --------------------------------------------------------
+	TileSchedulerStats CheckRun(unsigned int width, unsigned int height, unsigned int tileSize, unsigned int threads, bool slowTop = false)
+	{
+		std::vector<std::atomic<unsigned int>> covered((size_t)width * height);
+		std::atomic<unsigned int> calls = 0;
+		std::atomic<unsigned int> badTiles = 0;
+		std::atomic<unsigned int> badThreads = 0;
+		unsigned int maxThreads = threads > 0 ? threads : 64;
+
+		TileSchedulerStats stats = TileScheduler::Run(width, height, tileSize, threads, [&](unsigned int thread, const TileRect& tile)
+			{
+				calls++;
+				if (thread >= maxThreads)
+					badThreads++;
+
+				// On the tile grid, clipped to the image, never empty
+				if (tile.StartX % tileSize != 0 || tile.StartY % tileSize != 0 ||
+					tile.StartX >= tile.EndX || tile.StartY >= tile.EndY ||
+					tile.EndX > width || tile.EndY > height ||
+					tile.EndX - tile.StartX != (tile.StartX + tileSize < width ? tileSize : width - tile.StartX) ||
+					tile.EndY - tile.StartY != (tile.StartY + tileSize < height ? tileSize : height - tile.StartY))
+				{
+					badTiles++;
+					return;
+				}
+
+				for (unsigned int y = tile.StartY; y < tile.EndY; y++)
+					for (unsigned int x = tile.StartX; x < tile.EndX; x++)
+						covered[(size_t)y * width + x]++;
+
+				if (slowTop && tile.StartY < height / 4)
+					std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			});
+
+		unsigned int tilesX = (width + tileSize - 1) / tileSize;
+		unsigned int tilesY = (height + tileSize - 1) / tileSize;
+		unsigned int tiles = tilesX * tilesY;
+		CHECK(stats.Tiles == tiles);
+		CHECK(calls == tiles);
+		CHECK(badTiles == 0);
+		CHECK(badThreads == 0);
+		CHECK(stats.Threads >= 1 && stats.Threads <= maxThreads);
+		CHECK(tiles == 0 || stats.Threads <= tiles);
+		if (threads > 0 && threads <= tiles)
+			CHECK(stats.Threads == threads);
+
+		unsigned int missed = 0;
+		for (size_t i = 0; i < covered.size(); i++)
+			if (covered[i] != 1)
+				missed++;
+		CHECK(missed == 0);
+
+		// Per thread totals cover every tile
+		CHECK(stats.TilesRendered.size() == stats.Threads);
+		CHECK(stats.BusyMilliseconds.size() == stats.Threads);
+		CHECK(stats.IdleMilliseconds.size() == stats.Threads);
+		unsigned int rendered = 0;
+		for (unsigned int count : stats.TilesRendered)
+			rendered += count;
+		CHECK(rendered == stats.Tiles);
+
+		printf("  %4ux%-4u in %2u pixel tiles, %2u thread(s) asked for: %3u tiles on %2u thread(s), %2u steals, %u pixels not rendered once\n",
+			width,
+			height,
+			tileSize,
+			threads,
+			stats.Tiles,
+			stats.Threads,
+			stats.Steals,
+			missed);
+		return stats;
+	}
+}
+
+
+int main()
+{
+	printf("Morton order:\n");
+	CheckMortonOrder(1, 1);
+	CheckMortonOrder(7, 3);
+	CheckMortonOrder(3, 11);
+	CheckMortonOrder(80, 45);
+	std::vector<unsigned int> zCurve = TileScheduler::MortonOrder(4, 4);
+	std::vector<unsigned int> expected = { 0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15 };
+	CHECK(zCurve == expected);
+	CHECK(TileScheduler::MortonOrder(0, 5).empty());
+
+	JobSystem::Initialize(Workers);
+	printf("Tile scheduling:\n");
+
+	CheckRun(1, 1, 16, 1);
+	CheckRun(17, 9, 16, 3);
+	CheckRun(100, 37, 16, 5);
+	CheckRun(33, 65, 8, 7);
+	CheckRun(250, 3, 7, 64);
+	CheckRun(129, 131, 16, 0);
+	CheckRun(0, 0, 16, 2);
+
+	// Expensive tiles all at the start of the first thread's share
+	TileSchedulerStats skewed = CheckRun(127, 97, 8, Workers + 1, true);
+	CHECK(skewed.Steals > 0);
+
+	JobSystem::ShutDown();
+
+	return TestHelpers::Finish("TileSchedulerTests");
+}
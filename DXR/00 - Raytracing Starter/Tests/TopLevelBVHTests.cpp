@@ -0,0 +1,183 @@
+#include "TopLevelBVH.h"
+#include "JobSystem.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks that TopLevelBVH's parallel build & refit make
+// exactly the same tree as on a single thread, that the
+// tree is well formed, over a large field of instances,
+// and that the SAH cost shows when a refit has degraded
+//
+// Usage: TopLevelBVHTests [fieldSize]
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// A unit cube as the BLAS every instance shares
+	void BuildCube(BVH& blas, std::vector<Vertex>& verts, std::vector<unsigned int>& indices)
+	{
+		verts.clear();
+		for (unsigned int i = 0; i < 8; i++)
+		{
+			Vertex vert = {};
+			vert.Position = XMFLOAT3(i & 1 ? 0.5f : -0.5f, i & 2 ? 0.5f : -0.5f, i & 4 ? 0.5f : -0.5f);
+			verts.push_back(vert);
+		}
+		indices = { 0,2,1, 1,2,3, 4,5,6, 5,7,6, 0,1,4, 1,5,4, 2,6,3, 3,6,7, 0,4,2, 2,4,6, 1,3,5, 3,7,5 };
+		blas.Build(verts.data(), (unsigned int)verts.size(), indices.data(), (unsigned int)indices.size());
+	}
+
+	// Positions, spins & scales that vary across the field, offset by "time"
+	void PlaceInstances(std::vector<BVHInstance>& instances, unsigned int fieldSize, float time, const BVH& blas)
+	{
+		instances.resize(fieldSize * fieldSize);
+		for (unsigned int i = 0; i < instances.size(); i++)
+		{
+			float x = (float)(i % fieldSize);
+			float z = (float)(i / fieldSize);
+			XMMATRIX world =
+				XMMatrixScaling(0.5f + 0.4f * sinf(x * 0.7f + z * 1.3f), 1.0f, 0.8f) *
+				XMMatrixRotationY(x * 0.3f + z + time) *
+				XMMatrixTranslation(x * 2.0f - fieldSize, sinf(x * 0.1f + time) * cosf(z * 0.1f) * 4.0f, z * 2.0f - fieldSize);
+
+			XMFLOAT4X4 worldMatrix;
+			XMStoreFloat4x4(&worldMatrix, world);
+			instances[i].SetWorldMatrix(worldMatrix);
+			instances[i].InstanceID = i;
+			instances[i].InstanceMask = 1u << (i % 8);
+			instances[i].BLAS = &blas;
+		}
+	}
+
+	bool SameNodes(const TopLevelBVH& a, const TopLevelBVH& b)
+	{
+		return a.GetNodes().size() == b.GetNodes().size() &&
+			memcmp(a.GetNodes().data(), b.GetNodes().data(), sizeof(BVHNode) * a.GetNodes().size()) == 0;
+	}
+
+	bool Contains(const BVHNode& outer, const BVHNode& inner)
+	{
+		return outer.BoundsMin.x <= inner.BoundsMin.x && outer.BoundsMin.y <= inner.BoundsMin.y && outer.BoundsMin.z <= inner.BoundsMin.z &&
+			outer.BoundsMax.x >= inner.BoundsMax.x && outer.BoundsMax.y >= inner.BoundsMax.y && outer.BoundsMax.z >= inner.BoundsMax.z;
+	}
+
+	// --------------------------------------------------------
+	// Walks the tree depth-first, checking that the leaves
+	// cover every instance once, in order, that children are
+	// laid out where traversal expects them and that parents
+	// contain their children
+	// --------------------------------------------------------
+	void CheckStructure(const TopLevelBVH& tlas)
+	{
+		const std::vector<BVHNode>& nodes = tlas.GetNodes();
+		unsigned int nextInstance = 0;
+		unsigned int nextNode = 0;
+		bool wellFormed = true;
+
+		std::vector<unsigned int> stack = { 0 };
+		while (!stack.empty() && wellFormed)
+		{
+			unsigned int n = stack.back();
+			stack.pop_back();
+			wellFormed &= n == nextNode++;
+
+			const BVHNode& node = nodes[n];
+			if (node.Count > 0)
+			{
+				wellFormed &= node.Index == nextInstance;
+				nextInstance += node.Count;
+				continue;
+			}
+
+			wellFormed &= node.Index > n + 1 && node.Index < nodes.size();
+			wellFormed &= Contains(node, nodes[n + 1]) && Contains(node, nodes[node.Index]);
+			stack.push_back(node.Index);
+			stack.push_back(n + 1);
+		}
+
+		CHECK(wellFormed);
+		CHECK(nextNode == nodes.size());
+		CHECK(nextInstance == tlas.GetInstanceCount());
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	unsigned int fieldSize = argc > 1 ? (unsigned int)atoi(argv[1]) : 400;
+
+	BVH blas;
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	BuildCube(blas, verts, indices);
+
+	std::vector<BVHInstance> instances;
+	std::vector<BVHInstance> moved;
+	PlaceInstances(instances, fieldSize, 0.0f, blas);
+	PlaceInstances(moved, fieldSize, 0.5f, blas);
+	unsigned int count = (unsigned int)instances.size();
+
+	// Before the job system starts, everything runs on this thread
+	TopLevelBVH serial;
+	TopLevelBuildStats serialBuild = serial.Build(instances.data(), count);
+	TopLevelBVH serialRefit = serial;
+	TopLevelBuildStats serialRefitStats = serialRefit.Refit(moved.data(), count);
+
+	JobSystem::Initialize();
+	TopLevelBVH parallel;
+	TopLevelBuildStats parallelBuild = parallel.Build(instances.data(), count);
+	CHECK(SameNodes(serial, parallel));
+	CHECK(parallelBuild.MaxDepth == serialBuild.MaxDepth);
+	CheckStructure(parallel);
+
+	TopLevelBuildStats parallelRefitStats = parallel.Refit(moved.data(), count);
+	CHECK(SameNodes(serialRefit, parallel));
+	CheckStructure(parallel);
+
+	// Building again from the moved instances is a new tree, but still valid
+	TopLevelBuildStats movedBuild = parallel.Build(moved.data(), count);
+	CheckStructure(parallel);
+
+	// Refitting without moving anything costs the same as the build...
+	TopLevelBuildStats stillRefit = parallel.Refit(moved.data(), count);
+	CHECK(stillRefit.Refit);
+	CHECK(movedBuild.SAHCost > 0.0f);
+	CHECK(stillRefit.SAHCost == movedBuild.SAHCost);
+
+	// ...but shuffling the instances across the field leaves a refit
+	// far worse than a fresh build, and GetBuildStats() unchanged
+	std::vector<BVHInstance> shuffled = moved;
+	unsigned int seed = 12345;
+	for (unsigned int i = count - 1; i > 0; i--)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		unsigned int j = (unsigned int)(((unsigned long long)seed * (i + 1)) >> 32);
+		std::swap(shuffled[i].Transform, shuffled[j].Transform);
+	}
+	TopLevelBuildStats shuffledRefit = parallel.Refit(shuffled.data(), count);
+	CHECK(parallel.GetBuildStats().SAHCost == movedBuild.SAHCost);
+	CheckStructure(parallel);
+	TopLevelBuildStats shuffledBuild = parallel.Build(shuffled.data(), count);
+	CHECK(shuffledRefit.SAHCost > shuffledBuild.SAHCost * 1.5f);
+	JobSystem::ShutDown();
+
+	printf("Top level: %u instances, %u nodes, depth %u\n", count, parallelBuild.Nodes, parallelBuild.MaxDepth);
+	printf("  build  %2u thread(s) %8.2fms, %2u thread(s) %8.2fms\n", serialBuild.Threads, serialBuild.Milliseconds, parallelBuild.Threads, parallelBuild.Milliseconds);
+	printf("  refit  %2u thread(s) %8.2fms, %2u thread(s) %8.2fms\n", serialRefitStats.Threads, serialRefitStats.Milliseconds, parallelRefitStats.Threads, parallelRefitStats.Milliseconds);
+	printf("  SAH cost: built %.2f, refit in place %.2f, refit shuffled %.2f, rebuilt shuffled %.2f\n", movedBuild.SAHCost, stillRefit.SAHCost, shuffledRefit.SAHCost, shuffledBuild.SAHCost);
+
+	return TestHelpers::Finish("TopLevelBVHTests");
+}
@@ -0,0 +1,133 @@
+#include "CPURaytracer.h"
+#include "JobSystem.h"
+#include "ProceduralMeshes.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Renders on the CPU with single rays through the binary
+// BVH, single rays through the 4-wide BVH and 8x8 packets
+// of camera rays through the binary BVH, printing the rays
+// per second of each.  Uses a sphere, then bumpy grids of
+// up to the largest size asked for (standing in for large
+// scanned meshes) seen from above.  All three must render
+// the same image, apart from a few pixels on edges where
+// the 4-wide BVH's triangles round differently.
+//
+// Usage: TraversalBenchmark [width] [height] [maxGridSize] [runs]
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	RaytracingSceneData MakeSceneData(XMFLOAT3 eye, XMFLOAT3 direction, unsigned int width, unsigned int height)
+	{
+		XMFLOAT4X4 view, projection;
+		XMStoreFloat4x4(&view, XMMatrixLookToLH(XMLoadFloat3(&eye), XMLoadFloat3(&direction), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)));
+		XMStoreFloat4x4(&projection, XMMatrixPerspectiveFovLH(XM_PIDIV4, (float)width / height, 0.01f, 100.0f));
+		return CPURaytracer::CalcSceneData(view, projection, eye);
+	}
+
+	// Pixels more than a rounding error apart
+	unsigned int CountDifferences(const CPURaytracer::Image& a, const CPURaytracer::Image& b)
+	{
+		unsigned int differences = 0;
+		for (size_t i = 0; i < a.Pixels.size(); i++)
+		{
+			if (fabsf(a.Pixels[i].x - b.Pixels[i].x) > 0.01f ||
+				fabsf(a.Pixels[i].y - b.Pixels[i].y) > 0.01f ||
+				fabsf(a.Pixels[i].z - b.Pixels[i].z) > 0.01f)
+				differences++;
+		}
+		return differences;
+	}
+
+	void Compare(const char* name, const RaytracingSceneData& sceneData, const CPURaytracer::Geometry& geometry, unsigned int width, unsigned int height, unsigned int runs)
+	{
+		CPURaytracer::Image images[3];
+		std::vector<CPURaytracer::Geometry> scene(1);
+		double mraysPerSecond[3] = {};
+		unsigned long long packetRays = 0;
+		for (int mode = 0; mode < 3; mode++)
+		{
+			scene[0] = geometry;
+			if (mode == 1) scene[0].Accel = 0;
+			else scene[0].WideAccel = 0;
+
+			// Best of a few renders, to skip any warm up
+			for (unsigned int run = 0; run < runs; run++)
+			{
+				CPURaytracer::RenderStats stats = CPURaytracer::Render(sceneData, scene, width, height, images[mode], 16, mode == 2);
+				double mrays = stats.Rays / (stats.Milliseconds * 1000.0);
+				if (mrays > mraysPerSecond[mode])
+					mraysPerSecond[mode] = mrays;
+				packetRays = stats.PacketRays;
+			}
+		}
+
+		unsigned int wideDifferences = CountDifferences(images[0], images[1]);
+		unsigned int packetDifferences = CountDifferences(images[0], images[2]);
+		CHECK(wideDifferences <= width * height / 100);
+		CHECK(packetDifferences == 0);
+		CHECK(packetRays > 0);
+
+		printf("Traversal benchmark (%s, %ux%u): binary BVH %.2f Mrays/s, 4-wide BVH %.2f Mrays/s (%.2fx), packets %.2f Mrays/s (%.2fx, %.1f%% of rays in packets), %u & %u of %u pixels differ\n",
+			name,
+			width,
+			height,
+			mraysPerSecond[0],
+			mraysPerSecond[1],
+			mraysPerSecond[1] / mraysPerSecond[0],
+			mraysPerSecond[2],
+			mraysPerSecond[2] / mraysPerSecond[0],
+			100.0 * packetRays / ((double)width * height),
+			wideDifferences,
+			packetDifferences,
+			width * height);
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	unsigned int width = argc > 1 ? (unsigned int)atoi(argv[1]) : 1280;
+	unsigned int height = argc > 2 ? (unsigned int)atoi(argv[2]) : 720;
+	unsigned int maxGridSize = argc > 3 ? (unsigned int)atoi(argv[3]) : 1024;
+	unsigned int runs = argc > 4 ? (unsigned int)atoi(argv[4]) : 3;
+
+	JobSystem::Initialize();
+
+	// The sphere, filling most of the view like the sample's starting camera
+	std::vector<Vertex> verts;
+	std::vector<unsigned int> indices;
+	ProceduralMeshes::MakeSphere(64, 32, verts, indices);
+	BVH sphereBVH(verts.data(), (unsigned int)verts.size(), indices.data(), (unsigned int)indices.size());
+	WideBVH sphereWideBVH(sphereBVH);
+	Compare("sphere", MakeSceneData(XMFLOAT3(0.0f, 0.0f, -1.5f), XMFLOAT3(0.0f, 0.0f, 1.0f), width, height),
+		CPURaytracer::MakeGeometry(verts, indices, &sphereBVH, &sphereWideBVH), width, height, runs);
+
+	// Looking down at the grids from above, filling most of the view
+	RaytracingSceneData gridSceneData = MakeSceneData(XMFLOAT3(0.0f, 0.8f, -0.6f), XMFLOAT3(0.0f, -0.8f, 0.6f), width, height);
+	for (unsigned int size = 64; size <= maxGridSize; size *= 4)
+	{
+		ProceduralMeshes::MakeBumpyGrid(size, verts, indices);
+		BVH bvh(verts.data(), (unsigned int)verts.size(), indices.data(), (unsigned int)indices.size());
+		WideBVH wideBVH(bvh);
+
+		std::string name = std::to_string(indices.size() / 3) + " triangle grid";
+		Compare(name.c_str(), gridSceneData, CPURaytracer::MakeGeometry(verts, indices, &bvh, &wideBVH), width, height, runs);
+	}
+
+	JobSystem::ShutDown();
+
+	return TestHelpers::Finish("TraversalBenchmark");
+}
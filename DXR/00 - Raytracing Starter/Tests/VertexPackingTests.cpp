@@ -0,0 +1,118 @@
+#include "VertexPacking.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cstdio>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks the round trip error of PackedVertex, which used
+// to be measured (and printed) every time a packed mesh's
+// buffers were created
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Worst errors allowed.  The octahedral encodings are good
+	// to about a hundredth of a degree, and half float UVs to
+	// 2^-11 of the coordinate's magnitude.
+	const float MaxNormalDegrees = 0.01f;
+	const float MaxTangentDegrees = 0.02f;
+	const float MaxUVError = 1.0f / 1024.0f;
+
+	// Small deterministic generator, so failures can be reproduced
+	float Random(unsigned int& state)
+	{
+		state = state * 1664525u + 1013904223u;
+		return (state >> 8) / 16777216.0f;
+	}
+
+	XMVECTOR RandomUnitVector(unsigned int& state)
+	{
+		XMVECTOR v;
+		do
+		{
+			v = XMVectorSet(Random(state) * 2 - 1, Random(state) * 2 - 1, Random(state) * 2 - 1, 0);
+		} while (XMVectorGetX(XMVector3Dot(v, v)) < 0.01f);
+		return XMVector3Normalize(v);
+	}
+
+	// --------------------------------------------------------
+	// Random vertices with unit normals, perpendicular unit
+	// tangents of either handedness and UVs in [0, 2), plus
+	// the axis aligned cases (the octahedron's corners & seams)
+	// --------------------------------------------------------
+	std::vector<Vertex> MakeVertices(unsigned int count)
+	{
+		std::vector<Vertex> verts;
+		const XMFLOAT3 axes[] = { {1,0,0}, {-1,0,0}, {0,1,0}, {0,-1,0}, {0,0,1}, {0,0,-1} };
+		for (const XMFLOAT3& normal : axes)
+		{
+			for (const XMFLOAT3& tangent : axes)
+			{
+				if (normal.x * tangent.x + normal.y * tangent.y + normal.z * tangent.z != 0.0f)
+					continue;
+
+				Vertex vert = {};
+				vert.Normal = normal;
+				vert.Tangent = XMFLOAT4(tangent.x, tangent.y, tangent.z, verts.size() % 2 ? -1.0f : 1.0f);
+				verts.push_back(vert);
+			}
+		}
+
+		unsigned int state = 12345;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			XMVECTOR normal = RandomUnitVector(state);
+			XMVECTOR tangent = XMVector3Normalize(XMVector3Cross(normal, RandomUnitVector(state)));
+
+			Vertex vert = {};
+			vert.Position = XMFLOAT3(Random(state) * 100 - 50, Random(state) * 100 - 50, Random(state) * 100 - 50);
+			vert.UV = XMFLOAT2(Random(state) * 2, Random(state) * 2);
+			XMStoreFloat3(&vert.Normal, normal);
+			XMStoreFloat4(&vert.Tangent, tangent);
+			vert.Tangent.w = Random(state) < 0.5f ? -1.0f : 1.0f;
+			verts.push_back(vert);
+		}
+		return verts;
+	}
+}
+
+
+int main()
+{
+	std::vector<Vertex> verts = MakeVertices(100000);
+	unsigned int numVerts = (unsigned int)verts.size();
+
+	std::vector<PackedVertex> packedVerts(numVerts);
+	VertexPacking::PackVertices(verts.data(), numVerts, packedVerts.data());
+	VertexPackingError error = VertexPacking::MeasureError(verts.data(), packedVerts.data(), numVerts);
+
+	printf("Packed %u vertices (max error: normal %.4f deg, tangent %.4f deg, uv %.6f, %u handedness flips)\n",
+		numVerts,
+		error.MaxNormalDegrees,
+		error.MaxTangentDegrees,
+		error.MaxUVError,
+		error.HandednessMismatches);
+
+	CHECK(error.MaxNormalDegrees <= MaxNormalDegrees);
+	CHECK(error.MaxTangentDegrees <= MaxTangentDegrees);
+	CHECK(error.MaxUVError <= MaxUVError);
+	CHECK(error.HandednessMismatches == 0);
+
+	// Positions are stored at full precision
+	bool positionsExact = true;
+	for (unsigned int i = 0; i < numVerts; i++)
+	{
+		const XMFLOAT3& a = verts[i].Position;
+		const XMFLOAT3& b = packedVerts[i].Position;
+		positionsExact &= a.x == b.x && a.y == b.y && a.z == b.z;
+	}
+	CHECK(positionsExact);
+
+	return TestHelpers::Finish("VertexPackingTests");
+}
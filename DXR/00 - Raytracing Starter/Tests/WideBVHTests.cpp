@@ -0,0 +1,198 @@
+#include "BVH.h"
+#include "WideBVH.h"
+#include "ProceduralMeshes.h"
+#include "TestHelpers.h"
+
+#include <DirectXMath.h>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Checks that refitting a 4-wide BVH, over a grid swirled
+// further each step, keeps its structure while leaving
+// every triangle block and child's bounds exactly as if it
+// had been made from the moved triangles, and traces the
+// same hits as collapsing the refit binary BVH again
+// --------------------------------------------------------
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	const unsigned int GridSize = 96;
+	const unsigned int Steps = 6;
+	const unsigned int RayCount = 2048;
+	const float TwoPi = 6.283185307f;
+
+	const unsigned int EmptyLane = 0xFFFFFFFF;
+
+	// Same children, counts & triangle IDs: refits only change bounds & positions
+	bool SameStructure(const WideBVH& a, const WideBVH& b)
+	{
+		const std::vector<WideBVHNode>& nodesA = a.GetNodes();
+		const std::vector<WideBVHNode>& nodesB = b.GetNodes();
+		const std::vector<WideBVHTriangles>& trisA = a.GetTriangles();
+		const std::vector<WideBVHTriangles>& trisB = b.GetTriangles();
+		if (nodesA.size() != nodesB.size() || trisA.size() != trisB.size())
+			return false;
+
+		for (size_t n = 0; n < nodesA.size(); n++)
+			if (memcmp(nodesA[n].Child, nodesB[n].Child, sizeof(nodesA[n].Child)) != 0 || memcmp(nodesA[n].Count, nodesB[n].Count, sizeof(nodesA[n].Count)) != 0)
+				return false;
+		for (size_t t = 0; t < trisA.size(); t++)
+			if (memcmp(trisA[t].IDs, trisB[t].IDs, sizeof(trisA[t].IDs)) != 0)
+				return false;
+		return true;
+	}
+
+	// --------------------------------------------------------
+	// Is every triangle block filled from the current vertices
+	// (with the same subtractions as when collapsing), and are
+	// every child's bounds exactly those of the triangles under
+	// it?  Worked out from the vertices & each lane's triangle
+	// ID, independently of how the tree was made.
+	// --------------------------------------------------------
+	bool MatchesTriangles(const WideBVH& wide, const std::vector<Vertex>& verts, const std::vector<unsigned int>& indices)
+	{
+		const std::vector<WideBVHNode>& nodes = wide.GetNodes();
+		const std::vector<WideBVHTriangles>& tris = wide.GetTriangles();
+
+		for (const WideBVHTriangles& block : tris)
+		{
+			for (unsigned int lane = 0; lane < WideBVHWidth && block.IDs[lane] != EmptyLane; lane++)
+			{
+				XMFLOAT3 p0 = verts[indices[block.IDs[lane] * 3 + 0]].Position;
+				XMFLOAT3 p1 = verts[indices[block.IDs[lane] * 3 + 1]].Position;
+				XMFLOAT3 p2 = verts[indices[block.IDs[lane] * 3 + 2]].Position;
+				if (block.V0X[lane] != p0.x || block.V0Y[lane] != p0.y || block.V0Z[lane] != p0.z ||
+					block.E1X[lane] != p1.x - p0.x || block.E1Y[lane] != p1.y - p0.y || block.E1Z[lane] != p1.z - p0.z ||
+					block.E2X[lane] != p2.x - p0.x || block.E2Y[lane] != p2.y - p0.y || block.E2Z[lane] != p2.z - p0.z)
+					return false;
+			}
+		}
+
+		// Children come after their parents, so a backwards pass can total up each subtree
+		std::vector<XMFLOAT3> nodeMin(nodes.size(), XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX));
+		std::vector<XMFLOAT3> nodeMax(nodes.size(), XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+		for (size_t n = nodes.size(); n-- > 0;)
+		{
+			const WideBVHNode& node = nodes[n];
+			for (unsigned int i = 0; i < WideBVHWidth && node.Child[i] != EmptyLane; i++)
+			{
+				XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX);
+				XMFLOAT3 boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				auto grow = [&](XMFLOAT3 low, XMFLOAT3 high)
+					{
+						boundsMin = XMFLOAT3(fminf(boundsMin.x, low.x), fminf(boundsMin.y, low.y), fminf(boundsMin.z, low.z));
+						boundsMax = XMFLOAT3(fmaxf(boundsMax.x, high.x), fmaxf(boundsMax.y, high.y), fmaxf(boundsMax.z, high.z));
+					};
+
+				if (node.Count[i] == 0)
+					grow(nodeMin[node.Child[i]], nodeMax[node.Child[i]]);
+				for (unsigned int b = node.Child[i]; b < node.Child[i] + node.Count[i]; b++)
+					for (unsigned int lane = 0; lane < WideBVHWidth && tris[b].IDs[lane] != EmptyLane; lane++)
+						for (unsigned int c = 0; c < 3; c++)
+							grow(verts[indices[tris[b].IDs[lane] * 3 + c]].Position, verts[indices[tris[b].IDs[lane] * 3 + c]].Position);
+
+				// Compared as values, so -0 matches 0
+				if (node.MinX[i] != boundsMin.x || node.MinY[i] != boundsMin.y || node.MinZ[i] != boundsMin.z ||
+					node.MaxX[i] != boundsMax.x || node.MaxY[i] != boundsMax.y || node.MaxZ[i] != boundsMax.z)
+					return false;
+
+				grow(nodeMin[n], nodeMax[n]);
+				nodeMin[n] = boundsMin;
+				nodeMax[n] = boundsMax;
+			}
+		}
+		return true;
+	}
+
+	// Rays from above down onto the grid, which must hit the same triangles at the same distances
+	unsigned int CountMismatches(const WideBVH& a, const WideBVH& b)
+	{
+		unsigned int mismatches = 0;
+		for (unsigned int r = 0; r < RayCount; r++)
+		{
+			float spin = TwoPi * r / RayCount;
+			XMFLOAT3 origin(sinf(spin * 7.0f) * 0.4f, 1.0f, cosf(spin * 5.0f) * 0.4f);
+			XMFLOAT3 target(sinf(spin * 3.0f) * 0.5f, 0.0f, cosf(spin * 11.0f) * 0.5f);
+			XMFLOAT3 direction;
+			XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSubtract(XMLoadFloat3(&target), XMLoadFloat3(&origin))));
+
+			BVHHit hitA, hitB;
+			bool foundA = a.TraceClosest(origin, direction, 0.0f, 100.0f, hitA);
+			bool foundB = b.TraceClosest(origin, direction, 0.0f, 100.0f, hitB);
+			if (foundA != foundB || (foundA && (hitA.T != hitB.T || hitA.Triangle != hitB.Triangle)))
+				mismatches++;
+		}
+		return mismatches;
+	}
+}
+
+
+int main()
+{
+	std::vector<Vertex> flat;
+	std::vector<unsigned int> indices;
+	ProceduralMeshes::MakeBumpyGrid(GridSize, flat, indices);
+	unsigned int vertCount = (unsigned int)flat.size();
+	unsigned int indexCount = (unsigned int)indices.size();
+
+	BVH bvh(flat.data(), vertCount, indices.data(), indexCount);
+	WideBVH refitWide(bvh);
+	WideBVH original = refitWide;
+	CHECK(MatchesTriangles(original, flat, indices));
+	printf("Wide BVH refits: %u triangles, %u nodes\n", refitWide.GetBuildStats().Triangles, refitWide.GetBuildStats().Nodes);
+
+	std::vector<Vertex> verts = flat;
+	for (unsigned int step = 1; step <= Steps; step++)
+	{
+		// Twist the grid around Y, more the further out it is
+		float angle = TwoPi * step / Steps;
+		for (unsigned int i = 0; i < vertCount; i++)
+		{
+			float x = flat[i].Position.x;
+			float z = flat[i].Position.z;
+			float twist = angle * 2.0f * sqrtf(x * x + z * z);
+			verts[i].Position = XMFLOAT3(x * cosf(twist) - z * sinf(twist), flat[i].Position.y, x * sinf(twist) + z * cosf(twist));
+		}
+
+		bvh.Refit(verts.data(), vertCount, indices.data(), indexCount);
+		WideBVHBuildStats refit = refitWide.Refit(bvh);
+		WideBVH collapsed;
+		WideBVHBuildStats collapse = collapsed.Build(bvh);
+
+		bool sameStructure = SameStructure(refitWide, original);
+		bool matches = MatchesTriangles(refitWide, verts, indices);
+		unsigned int mismatches = CountMismatches(refitWide, collapsed);
+		CHECK(refit.Refit);
+		CHECK(!collapse.Refit);
+		CHECK(sameStructure);
+		CHECK(matches);
+		CHECK(mismatches == 0);
+
+		printf("  step %u: refit %.3fms, collapse %.3fms, %s, %u/%u ray mismatches\n",
+			step,
+			refit.Milliseconds,
+			collapse.Milliseconds,
+			sameStructure && matches ? "tight" : "WRONG",
+			mismatches,
+			RayCount);
+	}
+
+	// A binary BVH over different triangles can't be refit to, so is collapsed instead
+	std::vector<unsigned int> half(indices.begin(), indices.begin() + indexCount / 2);
+	BVH smaller(verts.data(), vertCount, half.data(), (unsigned int)half.size());
+	WideBVHBuildStats fallback = refitWide.Refit(smaller);
+	CHECK(!fallback.Refit);
+	CHECK(fallback.Triangles == indexCount / 6);
+	CHECK(SameStructure(refitWide, WideBVH(smaller)));
+	CHECK(MatchesTriangles(refitWide, verts, half));
+
+	return TestHelpers::Finish("WideBVHTests");
+}
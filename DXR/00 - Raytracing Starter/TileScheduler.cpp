@@ -0,0 +1,200 @@
+#include "TileScheduler.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace TileScheduler
+{
+	// Annonymous namespace to hold helpers
+	// only accessible in this file
+	namespace
+	{
+		// Scaling is measured up to this many cores
+		const unsigned int MaxThreads = 64;
+
+		// --------------------------------------------------------
+		// One thread's remaining tiles: the range [Front, Back)
+		// of the Morton ordered list.  The owner takes from the
+		// front and thieves take from the back, so both keep
+		// working on tiles that are close together on screen.
+		// Padded so each queue has its own cache line.
+		// --------------------------------------------------------
+		struct alignas(64) TileQueue
+		{
+			std::mutex Lock;
+			unsigned int Front = 0;
+			unsigned int Back = 0;
+		};
+
+		// Spreads the low 16 bits of a value out to the even bits
+		unsigned int ExpandBits(unsigned int v)
+		{
+			v &= 0x0000FFFF;
+			v = (v | (v << 8)) & 0x00FF00FF;
+			v = (v | (v << 4)) & 0x0F0F0F0F;
+			v = (v | (v << 2)) & 0x33333333;
+			v = (v | (v << 1)) & 0x55555555;
+			return v;
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Orders tiles along a Z-curve.  Works for any size of
+// grid, as tiles outside it are simply never generated.
+// --------------------------------------------------------
+std::vector<unsigned int> TileScheduler::MortonOrder(unsigned int tilesX, unsigned int tilesY)
+{
+	std::vector<std::pair<unsigned int, unsigned int>> codes;
+	codes.reserve((size_t)tilesX * tilesY);
+	for (unsigned int y = 0; y < tilesY; y++)
+		for (unsigned int x = 0; x < tilesX; x++)
+			codes.push_back({ ExpandBits(x) | (ExpandBits(y) << 1), y * tilesX + x });
+	std::sort(codes.begin(), codes.end());
+
+	std::vector<unsigned int> order(codes.size());
+	for (size_t i = 0; i < codes.size(); i++)
+		order[i] = codes[i].second;
+	return order;
+}
+
+
+// --------------------------------------------------------
+// Renders every tile of the image, returning once they're
+// all done.  The calling thread is one of the workers.
+//
+// width       - Image width in pixels
+// height      - Image height in pixels
+// tileSize    - Width & height of each tile in pixels
+// threadCount - Threads to use (0 for one per core), never
+//               more than there are tiles
+// renderTile  - Called once per tile with the index of the
+//               thread running it (0 to Threads - 1)
+// --------------------------------------------------------
+TileSchedulerStats TileScheduler::Run(
+	unsigned int width,
+	unsigned int height,
+	unsigned int tileSize,
+	unsigned int threadCount,
+	const std::function<void(unsigned int thread, const TileRect& tile)>& renderTile)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (tileSize == 0) tileSize = 16;
+	unsigned int tilesX = (width + tileSize - 1) / tileSize;
+	unsigned int tilesY = (height + tileSize - 1) / tileSize;
+	std::vector<unsigned int> order = MortonOrder(tilesX, tilesY);
+	unsigned int tileCount = (unsigned int)order.size();
+
+	unsigned int threads = threadCount > 0 ?
+		(threadCount < MaxThreads ? threadCount : MaxThreads) :
+		Parallel::ThreadCountFor(tileCount, 1, MaxThreads);
+	if (threads > tileCount) threads = tileCount > 0 ? tileCount : 1;
+
+	// Each thread starts with an even share of the list
+	std::unique_ptr<TileQueue[]> queues(new TileQueue[threads]);
+	for (unsigned int t = 0; t < threads; t++)
+	{
+		queues[t].Front = (unsigned int)((size_t)tileCount * t / threads);
+		queues[t].Back = (unsigned int)((size_t)tileCount * (t + 1) / threads);
+	}
+
+	// Tiles not yet taken by any thread, including any that are
+	// between queues mid-steal, so no thread gives up too early
+	std::atomic<unsigned int> unclaimed = tileCount;
+	std::atomic<unsigned int> steals = 0;
+
+	TileSchedulerStats stats = {};
+	stats.BusyMilliseconds.assign(threads, 0.0);
+	stats.IdleMilliseconds.assign(threads, 0.0);
+	stats.TilesRendered.assign(threads, 0);
+
+	Parallel::Run(threads, [&](size_t threadIndex)
+		{
+			unsigned int self = (unsigned int)threadIndex;
+			TileQueue& own = queues[self];
+			double busy = 0.0;
+			unsigned int rendered = 0;
+
+			while (unclaimed > 0)
+			{
+				// Own tiles first, in order
+				unsigned int tile = tileCount;
+				{
+					std::lock_guard<std::mutex> lock(own.Lock);
+					if (own.Front < own.Back)
+					{
+						tile = order[own.Front++];
+						unclaimed--;
+					}
+				}
+
+				if (tile < tileCount)
+				{
+					TileRect rect;
+					rect.StartX = tile % tilesX * tileSize;
+					rect.StartY = tile / tilesX * tileSize;
+					rect.EndX = rect.StartX + tileSize < width ? rect.StartX + tileSize : width;
+					rect.EndY = rect.StartY + tileSize < height ? rect.StartY + tileSize : height;
+
+					auto tileStart = std::chrono::high_resolution_clock::now();
+					renderTile(self, rect);
+					auto tileEnd = std::chrono::high_resolution_clock::now();
+					busy += std::chrono::duration<double, std::milli>(tileEnd - tileStart).count();
+					rendered++;
+					continue;
+				}
+
+				// Out of tiles, so steal the back half of the next
+				// thread's that has any (rounded up, so a last tile
+				// can be stolen too)
+				bool stole = false;
+				for (unsigned int i = 1; i < threads; i++)
+				{
+					TileQueue& victim = queues[(self + i) % threads];
+					unsigned int stolenFront, stolenBack;
+					{
+						std::lock_guard<std::mutex> lock(victim.Lock);
+						if (victim.Front >= victim.Back)
+							continue;
+
+						stolenBack = victim.Back;
+						stolenFront = victim.Back - (victim.Back - victim.Front + 1) / 2;
+						victim.Back = stolenFront;
+					}
+
+					std::lock_guard<std::mutex> lock(own.Lock);
+					own.Front = stolenFront;
+					own.Back = stolenBack;
+					steals++;
+					stole = true;
+					break;
+				}
+
+				// Whatever's left is in transit between other threads
+				if (!stole)
+					std::this_thread::yield();
+			}
+
+			stats.BusyMilliseconds[self] = busy;
+			stats.TilesRendered[self] = rendered;
+		});
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	stats.Threads = threads;
+	stats.Tiles = tileCount;
+	stats.Steals = steals;
+	stats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	for (unsigned int t = 0; t < threads; t++)
+	{
+		double idle = stats.Milliseconds - stats.BusyMilliseconds[t];
+		stats.IdleMilliseconds[t] = idle > 0.0 ? idle : 0.0;
+	}
+	return stats;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+// A rectangle of pixels, [Start, End) on each axis
+struct TileRect
+{
+	unsigned int StartX;
+	unsigned int StartY;
+	unsigned int EndX;
+	unsigned int EndY;
+};
+
+// How the tiles of the most recent run were shared out
+struct TileSchedulerStats
+{
+	unsigned int Threads;
+	unsigned int Tiles;
+	unsigned int Steals;							// Times a thread took tiles from another
+	double Milliseconds;
+	std::vector<double> BusyMilliseconds;			// Per thread, spent inside renderTile()
+	std::vector<double> IdleMilliseconds;			// Per thread, the rest of the run
+	std::vector<unsigned int> TilesRendered;		// Per thread
+};
+
+// --------------------------------------------------------
+// Splits an image into square tiles and renders them on
+// every core with work stealing.
+//
+// The tiles are put in Morton (Z-curve) order, so tiles
+// next to each other in the list are also close on screen,
+// and each thread starts with its own contiguous run of
+// that list.  Threads take tiles from the front of their
+// own run, and once it's empty they steal the back half of
+// another thread's.  Cheap tiles (like those only showing
+// the sky) then can't leave cores idle while another core
+// is still working through the expensive ones.
+// --------------------------------------------------------
+namespace TileScheduler
+{
+	// Tile indices (y * tilesX + x) sorted into Morton order
+	std::vector<unsigned int> MortonOrder(unsigned int tilesX, unsigned int tilesY);
+
+	TileSchedulerStats Run(
+		unsigned int width,
+		unsigned int height,
+		unsigned int tileSize,
+		unsigned int threadCount,
+		const std::function<void(unsigned int thread, const TileRect& tile)>& renderTile);
+}
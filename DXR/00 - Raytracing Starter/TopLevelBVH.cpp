@@ -0,0 +1,704 @@
+#include "TopLevelBVH.h"
+#include "Parallel.h"
+#include "RayIntersection.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+using namespace DirectX;
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Instances per leaf, and the depth at which ranges become leaves
+	// regardless (which bounds the traversal stack)
+	const unsigned int MaxLeafInstances = 4;
+	const unsigned int MaxTreeDepth = 64;
+
+	// Below this many instances (or nodes on one level) per thread,
+	// work isn't split up
+	const unsigned int MinInstancesPerThread = 16 * 1024;
+	const unsigned int MinNodesPerThread = 4 * 1024;
+
+	// DXR only keeps this many bits of each
+	const unsigned int InstanceIDMask = 0xFFFFFF;
+	const unsigned int InstanceMaskBits = 0xFF;
+
+	// Spreads the low 10 bits of a value out to every third bit
+	unsigned int ExpandBits(unsigned int v)
+	{
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	// 30 bit Morton code of a point already scaled to [0,1]
+	unsigned int MortonCode(float x, float y, float z)
+	{
+		auto quantize = [](float f) { return (unsigned int)std::min(std::max(f * 1024.0f, 0.0f), 1023.0f); };
+		return (ExpandBits(quantize(x)) << 2) | (ExpandBits(quantize(y)) << 1) | ExpandBits(quantize(z));
+	}
+
+	// Transforms a point (or, without translation, a direction) by a 3x4 matrix
+	XMFLOAT3 TransformPoint(const float m[3][4], const XMFLOAT3& p)
+	{
+		return XMFLOAT3(
+			m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+			m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+			m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+	}
+
+	XMFLOAT3 TransformDirection(const float m[3][4], const XMFLOAT3& d)
+	{
+		return XMFLOAT3(
+			m[0][0] * d.x + m[0][1] * d.y + m[0][2] * d.z,
+			m[1][0] * d.x + m[1][1] * d.y + m[1][2] * d.z,
+			m[2][0] * d.x + m[2][1] * d.y + m[2][2] * d.z);
+	}
+
+	// Local space bounds of an instance's BLAS (empty if it has none)
+	void GetBLASBounds(const BVHInstance& desc, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax)
+	{
+		if (!desc.BLAS || desc.BLAS->GetNodes().empty())
+		{
+			boundsMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+			boundsMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			return;
+		}
+		boundsMin = desc.BLAS->GetNodes()[0].BoundsMin;
+		boundsMax = desc.BLAS->GetNodes()[0].BoundsMax;
+	}
+
+	// Center of an instance's world space bounds (the transformed local center)
+	XMFLOAT3 WorldCenter(const BVHInstance& desc)
+	{
+		XMFLOAT3 boundsMin, boundsMax;
+		GetBLASBounds(desc, boundsMin, boundsMax);
+		if (boundsMin.x > boundsMax.x)
+			return XMFLOAT3(desc.Transform[0][3], desc.Transform[1][3], desc.Transform[2][3]);
+
+		XMFLOAT3 center(
+			(boundsMin.x + boundsMax.x) * 0.5f,
+			(boundsMin.y + boundsMax.y) * 0.5f,
+			(boundsMin.z + boundsMax.z) * 0.5f);
+		return TransformPoint(desc.Transform, center);
+	}
+
+	// --------------------------------------------------------
+	// Sorts 30 bit keys (and the values alongside them) with
+	// three 10 bit radix passes.  Each thread counts its own
+	// range of keys into its own histogram, then scatters the
+	// same range, with every bucket's keys from earlier ranges
+	// placed first, so the sort stays stable.
+	// --------------------------------------------------------
+	void RadixSort(std::vector<unsigned int>& keys, std::vector<unsigned int>& values, unsigned int threads)
+	{
+		const unsigned int bucketCount = 1 << 10;
+		size_t count = keys.size();
+		std::vector<unsigned int> keysOut(count);
+		std::vector<unsigned int> valuesOut(count);
+		std::vector<unsigned int> offsets((size_t)bucketCount * threads);
+		for (unsigned int shift = 0; shift < 30; shift += 10)
+		{
+			Parallel::ForRanges(count, threads, [&](unsigned int t, size_t first, size_t end)
+				{
+					unsigned int* counts = &offsets[(size_t)t * bucketCount];
+					std::fill(counts, counts + bucketCount, 0);
+					for (size_t i = first; i < end; i++)
+						counts[(keys[i] >> shift) & (bucketCount - 1)]++;
+				});
+
+			// Bucket by bucket, then range by range within each bucket
+			unsigned int total = 0;
+			for (unsigned int bucket = 0; bucket < bucketCount; bucket++)
+			{
+				for (unsigned int t = 0; t < threads; t++)
+				{
+					unsigned int& offset = offsets[(size_t)t * bucketCount + bucket];
+					unsigned int keysInBucket = offset;
+					offset = total;
+					total += keysInBucket;
+				}
+			}
+
+			Parallel::ForRanges(count, threads, [&](unsigned int t, size_t first, size_t end)
+				{
+					unsigned int* next = &offsets[(size_t)t * bucketCount];
+					for (size_t i = first; i < end; i++)
+					{
+						unsigned int destination = next[(keys[i] >> shift) & (bucketCount - 1)]++;
+						keysOut[destination] = keys[i];
+						valuesOut[destination] = values[i];
+					}
+				});
+			keys.swap(keysOut);
+			values.swap(valuesOut);
+		}
+	}
+
+	// Runs func(i) for every i in [first, end), in parallel if there are enough
+	template<typename Func>
+	void ForEachNode(size_t first, size_t end, Func func)
+	{
+		unsigned int threads = Parallel::ThreadCountFor(end - first, MinNodesPerThread);
+		Parallel::ForRanges(end - first, threads, [&](unsigned int, size_t rangeStart, size_t rangeEnd)
+			{
+				for (size_t i = first + rangeStart; i < first + rangeEnd; i++)
+					func(i);
+			});
+	}
+}
+
+
+// --------------------------------------------------------
+// Converts a row-vector world matrix (like the ones from
+// Transform) to DXR's 3x4 layout, which is its transpose
+// --------------------------------------------------------
+void BVHInstance::SetWorldMatrix(const XMFLOAT4X4& world)
+{
+	for (unsigned int row = 0; row < 3; row++)
+		for (unsigned int col = 0; col < 4; col++)
+			Transform[row][col] = world.m[col][row];
+}
+
+
+// --------------------------------------------------------
+// Builds the top level from scratch over a set of instances,
+// replacing anything built previously.
+//
+// Instances are sorted along a Morton curve through their
+// world space centers, and each range of them is split
+// where its codes first differ, so nearby instances end up
+// in the same subtrees.  Nodes are depth-first, like BVH.
+// Every step (centers, the radix sort, splitting each level
+// and the bounds) is spread across threads, and the result
+// doesn't depend on how many there are.
+//
+// instanceDescs - The instances (copied, so they can change after)
+// count         - How many instances are in the array
+// --------------------------------------------------------
+TopLevelBuildStats TopLevelBVH::Build(const BVHInstance* instanceDescs, unsigned int count)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	instances.clear();
+	nodes.clear();
+	nodeMasks.clear();
+	levelNodes.clear();
+	levelStarts.clear();
+	buildStats = {};
+	if (count == 0)
+		return buildStats;
+
+	// Bounds of the instances' centers, to scale them for the Morton codes
+	unsigned int threads = Parallel::ThreadCountFor(count, MinInstancesPerThread);
+	std::vector<XMFLOAT3> centers(count);
+	std::vector<XMFLOAT3> rangeMins(threads, XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX));
+	std::vector<XMFLOAT3> rangeMaxes(threads, XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+	Parallel::ForRanges(count, threads, [&](unsigned int t, size_t first, size_t end)
+		{
+			XMFLOAT3& rangeMin = rangeMins[t];
+			XMFLOAT3& rangeMax = rangeMaxes[t];
+			for (size_t i = first; i < end; i++)
+			{
+				XMFLOAT3 c = WorldCenter(instanceDescs[i]);
+				centers[i] = c;
+				rangeMin = XMFLOAT3(std::min(rangeMin.x, c.x), std::min(rangeMin.y, c.y), std::min(rangeMin.z, c.z));
+				rangeMax = XMFLOAT3(std::max(rangeMax.x, c.x), std::max(rangeMax.y, c.y), std::max(rangeMax.z, c.z));
+			}
+		});
+
+	XMFLOAT3 centerMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 centerMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (unsigned int t = 0; t < threads; t++)
+	{
+		centerMin = XMFLOAT3(std::min(centerMin.x, rangeMins[t].x), std::min(centerMin.y, rangeMins[t].y), std::min(centerMin.z, rangeMins[t].z));
+		centerMax = XMFLOAT3(std::max(centerMax.x, rangeMaxes[t].x), std::max(centerMax.y, rangeMaxes[t].y), std::max(centerMax.z, rangeMaxes[t].z));
+	}
+	XMFLOAT3 scale(
+		centerMax.x > centerMin.x ? 1.0f / (centerMax.x - centerMin.x) : 0.0f,
+		centerMax.y > centerMin.y ? 1.0f / (centerMax.y - centerMin.y) : 0.0f,
+		centerMax.z > centerMin.z ? 1.0f / (centerMax.z - centerMin.z) : 0.0f);
+
+	// Sort the instances along the curve
+	std::vector<unsigned int> codes(count);
+	std::vector<unsigned int> order(count);
+	Parallel::ForRanges(count, threads, [&](unsigned int, size_t first, size_t end)
+		{
+			for (size_t i = first; i < end; i++)
+			{
+				codes[i] = MortonCode(
+					(centers[i].x - centerMin.x) * scale.x,
+					(centers[i].y - centerMin.y) * scale.y,
+					(centers[i].z - centerMin.z) * scale.z);
+				order[i] = (unsigned int)i;
+			}
+		});
+	RadixSort(codes, order, threads);
+
+	// Instances are stored in leaf order, remembering where they came from
+	instances.resize(count);
+	Parallel::ForRanges(count, threads, [&](unsigned int, size_t first, size_t end)
+		{
+			for (size_t i = first; i < end; i++)
+				instances[i].InstanceIndex = order[i];
+		});
+	UpdateInstances(instanceDescs, threads);
+
+	BuildNodes(codes);
+	UpdateNodeBounds();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	buildStats.Instances = count;
+	buildStats.Nodes = (unsigned int)nodes.size();
+	buildStats.Threads = threads;
+	buildStats.SAHCost = CalculateSAHCost();
+	buildStats.Refit = false;
+	buildStats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	return buildStats;
+}
+
+
+// --------------------------------------------------------
+// Refits the top level to new instance transforms, masks,
+// etc.  Falls back to a full build if the instance count
+// has changed, as the tree no longer fits the instances.
+// GetBuildStats() keeps describing the last full build.
+// --------------------------------------------------------
+TopLevelBuildStats TopLevelBVH::Refit(const BVHInstance* instanceDescs, unsigned int count)
+{
+	if (count != instances.size() || nodes.empty())
+		return Build(instanceDescs, count);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	unsigned int threads = Parallel::ThreadCountFor(count, MinInstancesPerThread);
+	UpdateInstances(instanceDescs, threads);
+	UpdateNodeBounds();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	TopLevelBuildStats stats = buildStats;
+	stats.Threads = threads;
+	stats.SAHCost = CalculateSAHCost();
+	stats.Refit = true;
+	stats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	return stats;
+}
+
+
+// --------------------------------------------------------
+// Copies each instance's details from its description, and
+// calculates its inverse transform and world space bounds
+// --------------------------------------------------------
+void TopLevelBVH::UpdateInstances(const BVHInstance* instanceDescs, unsigned int threads)
+{
+	instanceBoundsMin.resize(instances.size());
+	instanceBoundsMax.resize(instances.size());
+	Parallel::ForRanges(instances.size(), threads, [&](unsigned int, size_t first, size_t end)
+		{
+			for (size_t i = first; i < end; i++)
+			{
+				Instance& instance = instances[i];
+				const BVHInstance& desc = instanceDescs[instance.InstanceIndex];
+				instance.InstanceID = desc.InstanceID & InstanceIDMask;
+				instance.InstanceMask = desc.InstanceMask & InstanceMaskBits;
+				instance.HitGroupIndex = desc.InstanceContributionToHitGroupIndex;
+				instance.BLAS = desc.BLAS;
+				instance.WideBLAS = desc.WideBLAS;
+				memcpy(instance.ObjectToWorld, desc.Transform, sizeof(instance.ObjectToWorld));
+
+				// Invert as a row-vector 4x4, then back to 3x4
+				XMFLOAT4X4 world(
+					desc.Transform[0][0], desc.Transform[1][0], desc.Transform[2][0], 0.0f,
+					desc.Transform[0][1], desc.Transform[1][1], desc.Transform[2][1], 0.0f,
+					desc.Transform[0][2], desc.Transform[1][2], desc.Transform[2][2], 0.0f,
+					desc.Transform[0][3], desc.Transform[1][3], desc.Transform[2][3], 1.0f);
+				XMFLOAT4X4 inverse;
+				XMStoreFloat4x4(&inverse, XMMatrixInverse(0, XMLoadFloat4x4(&world)));
+				for (unsigned int row = 0; row < 3; row++)
+					for (unsigned int col = 0; col < 4; col++)
+						instance.WorldToObject[row][col] = inverse.m[col][row];
+
+				// World bounds from the local center & extents (the extents
+				// are transformed by the absolute value of the matrix)
+				XMFLOAT3 localMin, localMax;
+				GetBLASBounds(desc, localMin, localMax);
+				if (localMin.x > localMax.x)
+				{
+					instanceBoundsMin[i] = localMin;
+					instanceBoundsMax[i] = localMax;
+					continue;
+				}
+
+				XMFLOAT3 center((localMin.x + localMax.x) * 0.5f, (localMin.y + localMax.y) * 0.5f, (localMin.z + localMax.z) * 0.5f);
+				XMFLOAT3 extents((localMax.x - localMin.x) * 0.5f, (localMax.y - localMin.y) * 0.5f, (localMax.z - localMin.z) * 0.5f);
+				XMFLOAT3 worldCenter = TransformPoint(desc.Transform, center);
+				float worldExtents[3];
+				for (unsigned int row = 0; row < 3; row++)
+				{
+					worldExtents[row] =
+						fabsf(desc.Transform[row][0]) * extents.x +
+						fabsf(desc.Transform[row][1]) * extents.y +
+						fabsf(desc.Transform[row][2]) * extents.z;
+				}
+				instanceBoundsMin[i] = XMFLOAT3(worldCenter.x - worldExtents[0], worldCenter.y - worldExtents[1], worldCenter.z - worldExtents[2]);
+				instanceBoundsMax[i] = XMFLOAT3(worldCenter.x + worldExtents[0], worldCenter.y + worldExtents[1], worldCenter.z + worldExtents[2]);
+			}
+		});
+}
+
+
+// --------------------------------------------------------
+// Recalculates every node's bounds and mask from the
+// instances up, a level at a time from the deepest, with
+// each level's nodes split across threads
+// --------------------------------------------------------
+void TopLevelBVH::UpdateNodeBounds()
+{
+	nodeMasks.resize(nodes.size());
+	for (size_t level = levelStarts.size() - 1; level-- > 0;)
+	{
+		ForEachNode(levelStarts[level], levelStarts[level + 1], [&](size_t i)
+			{
+				unsigned int n = levelNodes[i];
+				BVHNode& node = nodes[n];
+				XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX);
+				XMFLOAT3 boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				unsigned int mask = 0;
+				auto grow = [&](const XMFLOAT3& childMin, const XMFLOAT3& childMax)
+					{
+						boundsMin = XMFLOAT3(std::min(boundsMin.x, childMin.x), std::min(boundsMin.y, childMin.y), std::min(boundsMin.z, childMin.z));
+						boundsMax = XMFLOAT3(std::max(boundsMax.x, childMax.x), std::max(boundsMax.y, childMax.y), std::max(boundsMax.z, childMax.z));
+					};
+
+				if (node.Count > 0)
+				{
+					for (unsigned int i = node.Index; i < node.Index + node.Count; i++)
+					{
+						grow(instanceBoundsMin[i], instanceBoundsMax[i]);
+						mask |= instances[i].InstanceMask;
+					}
+				}
+				else
+				{
+					const BVHNode& left = nodes[n + 1];
+					const BVHNode& right = nodes[node.Index];
+					grow(left.BoundsMin, left.BoundsMax);
+					grow(right.BoundsMin, right.BoundsMax);
+					mask = nodeMasks[n + 1] | nodeMasks[node.Index];
+				}
+
+				node.BoundsMin = boundsMin;
+				node.BoundsMax = boundsMax;
+				nodeMasks[n] = (unsigned char)mask;
+			});
+	}
+}
+
+
+// --------------------------------------------------------
+// Builds the nodes for the sorted instances a level at a
+// time, splitting every range on a level in parallel: each
+// at the highest bit where its Morton codes differ (or in
+// half, if they're all the same).
+//
+// The nodes still end up depth-first, like BVH: subtree
+// sizes are totalled from the bottom level up, which gives
+// every node's position from the top level down, and then
+// they're all written out at once.  The result is exactly
+// what a recursive depth-first build would make.  Bounds
+// are filled in afterwards.
+// --------------------------------------------------------
+void TopLevelBVH::BuildNodes(const std::vector<unsigned int>& codes)
+{
+	// A range of sorted instances, in breadth-first order
+	struct BuildRange
+	{
+		unsigned int Start = 0;
+		unsigned int End = 0;
+		unsigned int FirstChild = 0;	// Index of the left child's range (right is next), or 0 for leaves
+		unsigned int Size = 0;			// Nodes in the subtree
+		unsigned int Node = 0;			// Depth-first node index
+	};
+	std::vector<BuildRange> ranges;
+	ranges.reserve(codes.size() * 2 / MaxLeafInstances + 1);
+	ranges.push_back({ 0, (unsigned int)codes.size() });
+
+	levelStarts.assign(1, 0);
+	std::vector<unsigned int> splits;
+	for (unsigned int depth = 0; ; depth++)
+	{
+		unsigned int levelStart = levelStarts.back();
+		unsigned int levelEnd = (unsigned int)ranges.size();
+		levelStarts.push_back(levelEnd);
+
+		// Find where each range splits (or that it's a leaf)
+		splits.resize(levelEnd - levelStart);
+		ForEachNode(levelStart, levelEnd, [&](size_t i)
+			{
+				unsigned int start = ranges[i].Start;
+				unsigned int end = ranges[i].End;
+				unsigned int& split = splits[i - levelStart];
+				split = 0;
+				if (end - start <= MaxLeafInstances || depth + 1 >= MaxTreeDepth)
+					return;
+
+				split = start + (end - start) / 2;
+				unsigned int firstCode = codes[start];
+				unsigned int lastCode = codes[end - 1];
+				if (firstCode != lastCode)
+				{
+					// Everything shares the bits above this one, so the ones
+					// with it set are all at the end of the range
+					unsigned int bit = 31 - std::countl_zero(firstCode ^ lastCode);
+					split = (unsigned int)(std::partition_point(codes.begin() + start, codes.begin() + end,
+						[bit](unsigned int code) { return ((code >> bit) & 1) == 0; }) - codes.begin());
+				}
+			});
+
+		// The children of this level's inner nodes make up the next level
+		unsigned int nextLevelEnd = levelEnd;
+		for (unsigned int i = levelStart; i < levelEnd; i++)
+		{
+			ranges[i].FirstChild = splits[i - levelStart] ? nextLevelEnd : 0;
+			nextLevelEnd += splits[i - levelStart] ? 2 : 0;
+		}
+		if (nextLevelEnd == levelEnd)
+			break;
+
+		ranges.resize(nextLevelEnd);
+		ForEachNode(levelStart, levelEnd, [&](size_t i)
+			{
+				BuildRange& range = ranges[i];
+				if (range.FirstChild == 0)
+					return;
+
+				unsigned int split = splits[i - levelStart];
+				ranges[range.FirstChild] = { range.Start, split };
+				ranges[range.FirstChild + 1] = { split, range.End };
+			});
+	}
+	unsigned int levels = (unsigned int)levelStarts.size() - 1;
+
+	// Subtree sizes, from the bottom up
+	for (unsigned int level = levels; level-- > 0;)
+	{
+		ForEachNode(levelStarts[level], levelStarts[level + 1], [&](size_t i)
+			{
+				BuildRange& range = ranges[i];
+				range.Size = 1;
+				if (range.FirstChild)
+					range.Size += ranges[range.FirstChild].Size + ranges[range.FirstChild + 1].Size;
+			});
+	}
+
+	// Depth-first positions, from the top down: left children
+	// follow their parent, and right children follow the left subtree
+	ranges[0].Node = 0;
+	for (unsigned int level = 0; level < levels; level++)
+	{
+		ForEachNode(levelStarts[level], levelStarts[level + 1], [&](size_t i)
+			{
+				const BuildRange& range = ranges[i];
+				if (range.FirstChild == 0)
+					return;
+
+				ranges[range.FirstChild].Node = range.Node + 1;
+				ranges[range.FirstChild + 1].Node = range.Node + 1 + ranges[range.FirstChild].Size;
+			});
+	}
+
+	// Write the nodes, and remember which are on each level for refits
+	nodes.resize(ranges.size());
+	levelNodes.resize(ranges.size());
+	ForEachNode(0, ranges.size(), [&](size_t i)
+		{
+			const BuildRange& range = ranges[i];
+			nodes[range.Node] = range.FirstChild ?
+				BVHNode{ XMFLOAT3(0, 0, 0), ranges[range.FirstChild + 1].Node, XMFLOAT3(0, 0, 0), 0 } :
+				BVHNode{ XMFLOAT3(0, 0, 0), range.Start, XMFLOAT3(0, 0, 0), range.End - range.Start };
+			levelNodes[i] = range.Node;
+		});
+
+	buildStats.MaxDepth = levels - 1;
+}
+
+
+// --------------------------------------------------------
+// Finds the closest hit along a ray.  Leaves transform the
+// ray into each instance's object space and trace its BLAS.
+// The direction isn't normalized, so distances along the
+// ray are the same in both spaces (as in DXR).
+// --------------------------------------------------------
+bool TopLevelBVH::TraceClosest(XMFLOAT3 origin, XMFLOAT3 direction, float tMin, float tMax, unsigned int instanceInclusionMask, TopLevelHit& hit) const
+{
+	instanceInclusionMask &= InstanceMaskBits;
+	if (nodes.empty() || (nodeMasks[0] & instanceInclusionMask) == 0)
+		return false;
+
+	XMFLOAT3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	float entry;
+	if (!RayIntersection::RayBox(origin, invDir, nodes[0].BoundsMin, nodes[0].BoundsMax, tMin, tMax, entry))
+		return false;
+
+	bool found = false;
+	float closest = tMax;
+	unsigned int stack[MaxTreeDepth];
+	unsigned int stackSize = 0;
+	unsigned int current = 0;
+	while (true)
+	{
+		const BVHNode& node = nodes[current];
+		if (node.Count > 0)
+		{
+			for (unsigned int i = node.Index; i < node.Index + node.Count; i++)
+			{
+				const Instance& instance = instances[i];
+				if ((instance.InstanceMask & instanceInclusionMask) == 0 || !(instance.WideBLAS || instance.BLAS))
+					continue;
+
+				XMFLOAT3 objectOrigin = TransformPoint(instance.WorldToObject, origin);
+				XMFLOAT3 objectDirection = TransformDirection(instance.WorldToObject, direction);
+				BVHHit blasHit;
+				bool hitBLAS = instance.WideBLAS ?
+					instance.WideBLAS->TraceClosest(objectOrigin, objectDirection, tMin, closest, blasHit) :
+					instance.BLAS->TraceClosest(objectOrigin, objectDirection, tMin, closest, blasHit);
+				if (hitBLAS)
+				{
+					closest = blasHit.T;
+					hit.T = blasHit.T;
+					hit.InstanceIndex = instance.InstanceIndex;
+					hit.InstanceID = instance.InstanceID;
+					hit.HitGroupIndex = instance.HitGroupIndex;
+					hit.PrimitiveIndex = blasHit.Triangle;
+					hit.Barycentrics = blasHit.Barycentrics;
+					memcpy(hit.ObjectToWorld, instance.ObjectToWorld, sizeof(hit.ObjectToWorld));
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			// Visit whichever children the ray hits (and that have matching
+			// instances), nearest first
+			unsigned int left = current + 1;
+			unsigned int right = node.Index;
+			float leftEntry, rightEntry;
+			bool hitLeft = (nodeMasks[left] & instanceInclusionMask) &&
+				RayIntersection::RayBox(origin, invDir, nodes[left].BoundsMin, nodes[left].BoundsMax, tMin, closest, leftEntry);
+			bool hitRight = (nodeMasks[right] & instanceInclusionMask) &&
+				RayIntersection::RayBox(origin, invDir, nodes[right].BoundsMin, nodes[right].BoundsMax, tMin, closest, rightEntry);
+			if (hitLeft && hitRight)
+			{
+				if (rightEntry < leftEntry)
+					std::swap(left, right);
+				stack[stackSize++] = right;
+				current = left;
+				continue;
+			}
+			if (hitLeft) { current = left; continue; }
+			if (hitRight) { current = right; continue; }
+		}
+
+		if (stackSize == 0)
+			break;
+		current = stack[--stackSize];
+	}
+	return found;
+}
+
+
+// --------------------------------------------------------
+// Checks for any hit along a ray, returning as soon as one
+// instance's BLAS reports one
+// --------------------------------------------------------
+bool TopLevelBVH::TraceAny(XMFLOAT3 origin, XMFLOAT3 direction, float tMin, float tMax, unsigned int instanceInclusionMask) const
+{
+	instanceInclusionMask &= InstanceMaskBits;
+	if (nodes.empty() || (nodeMasks[0] & instanceInclusionMask) == 0)
+		return false;
+
+	XMFLOAT3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	float entry;
+	if (!RayIntersection::RayBox(origin, invDir, nodes[0].BoundsMin, nodes[0].BoundsMax, tMin, tMax, entry))
+		return false;
+
+	unsigned int stack[MaxTreeDepth];
+	unsigned int stackSize = 0;
+	unsigned int current = 0;
+	while (true)
+	{
+		const BVHNode& node = nodes[current];
+		if (node.Count > 0)
+		{
+			for (unsigned int i = node.Index; i < node.Index + node.Count; i++)
+			{
+				const Instance& instance = instances[i];
+				if ((instance.InstanceMask & instanceInclusionMask) == 0 || !(instance.WideBLAS || instance.BLAS))
+					continue;
+
+				XMFLOAT3 objectOrigin = TransformPoint(instance.WorldToObject, origin);
+				XMFLOAT3 objectDirection = TransformDirection(instance.WorldToObject, direction);
+				bool hitBLAS = instance.WideBLAS ?
+					instance.WideBLAS->TraceAny(objectOrigin, objectDirection, tMin, tMax) :
+					instance.BLAS->TraceAny(objectOrigin, objectDirection, tMin, tMax);
+				if (hitBLAS)
+					return true;
+			}
+		}
+		else
+		{
+			unsigned int left = current + 1;
+			unsigned int right = node.Index;
+			float leftEntry, rightEntry;
+			bool hitLeft = (nodeMasks[left] & instanceInclusionMask) &&
+				RayIntersection::RayBox(origin, invDir, nodes[left].BoundsMin, nodes[left].BoundsMax, tMin, tMax, leftEntry);
+			bool hitRight = (nodeMasks[right] & instanceInclusionMask) &&
+				RayIntersection::RayBox(origin, invDir, nodes[right].BoundsMin, nodes[right].BoundsMax, tMin, tMax, rightEntry);
+			if (hitLeft && hitRight)
+			{
+				stack[stackSize++] = right;
+				current = left;
+				continue;
+			}
+			if (hitLeft) { current = left; continue; }
+			if (hitRight) { current = right; continue; }
+		}
+
+		if (stackSize == 0)
+			break;
+		current = stack[--stackSize];
+	}
+	return false;
+}
+
+
+// --------------------------------------------------------
+// Expected cost of tracing a random ray through the top
+// level, like BVH::CalculateSAHCost(), with each instance
+// counted as one test (its BLAS isn't part of the cost)
+// --------------------------------------------------------
+float TopLevelBVH::CalculateSAHCost() const
+{
+	if (nodes.empty())
+		return 0.0f;
+
+	auto area = [](const BVHNode& node)
+		{
+			float x = std::max(node.BoundsMax.x - node.BoundsMin.x, 0.0f);
+			float y = std::max(node.BoundsMax.y - node.BoundsMin.y, 0.0f);
+			float z = std::max(node.BoundsMax.z - node.BoundsMin.z, 0.0f);
+			return 2.0f * (x * y + y * z + z * x);
+		};
+
+	float rootArea = std::max(area(nodes[0]), FLT_MIN);
+	double cost = 0.0;
+	for (const BVHNode& node : nodes)
+		cost += (node.Count > 0 ? node.Count : 1) * area(node) / rootArea;
+	return (float)cost;
+}
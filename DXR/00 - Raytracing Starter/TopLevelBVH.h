@@ -0,0 +1,126 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+#include "BVH.h"
+#include "WideBVH.h"
+
+// --------------------------------------------------------
+// One instance of a bottom level BVH, mirroring
+// D3D12_RAYTRACING_INSTANCE_DESC.  Many instances can
+// share the same BVHs (typically one set per Mesh).
+// --------------------------------------------------------
+struct BVHInstance
+{
+	float Transform[3][4];							// Object to world, laid out like the D3D12 desc
+	unsigned int InstanceID = 0;					// Only the low 24 bits are kept
+	unsigned int InstanceMask = 0xFF;				// Only the low 8 bits are kept
+	unsigned int InstanceContributionToHitGroupIndex = 0;
+	const BVH* BLAS = 0;							// Required, and gives the instance's bounds
+	const WideBVH* WideBLAS = 0;					// Traced instead of BLAS when set
+
+	// Fills in Transform from a world matrix (as in Transform::GetWorldMatrix)
+	void SetWorldMatrix(const DirectX::XMFLOAT4X4& world);
+};
+
+// Closest hit found by TopLevelBVH::TraceClosest(), with the same
+// values a DXR hit shader would get from the matching intrinsics
+struct TopLevelHit
+{
+	float T;								// RayTCurrent()
+	unsigned int InstanceIndex;				// InstanceIndex()
+	unsigned int InstanceID;				// InstanceID()
+	unsigned int HitGroupIndex;				// Instance's contribution to the hit group index
+	unsigned int PrimitiveIndex;			// PrimitiveIndex()
+	DirectX::XMFLOAT2 Barycentrics;			// BuiltInTriangleIntersectionAttributes
+	float ObjectToWorld[3][4];				// ObjectToWorld3x4()
+};
+
+// Details of the most recent build or refit
+struct TopLevelBuildStats
+{
+	unsigned int Instances;
+	unsigned int Nodes;
+	unsigned int MaxDepth;
+	unsigned int Threads;
+	float SAHCost;				// Expected cost of a ray, in node & instance tests
+	bool Refit;
+	double Milliseconds;
+};
+
+// --------------------------------------------------------
+// The top level of a two-level CPU acceleration structure,
+// matching the GPU's TLAS: a BVH over the world space
+// bounds of BLAS instances.
+//
+// It's built from Morton codes of the instances' centers
+// (a linear BVH), which is quick enough to rebuild every
+// frame for hundreds of thousands of instances, and can be
+// refit even faster when only the transforms have changed.
+// --------------------------------------------------------
+class TopLevelBVH
+{
+public:
+	TopLevelBuildStats Build(const BVHInstance* instanceDescs, unsigned int count);
+
+	// Updates the transforms of the instances from the last build (which
+	// must be given in the same order) and the bounds of every node.  The
+	// tree's structure is kept, so it degrades if instances move far:
+	// compare the SAH cost this returns with GetBuildStats().SAHCost to
+	// decide when to rebuild.
+	TopLevelBuildStats Refit(const BVHInstance* instanceDescs, unsigned int count);
+
+	// --------------------------------------------------------
+	// Closest hit in [tMin, tMax], if any.  Like TraceRay(),
+	// an instance is only considered if its InstanceMask and
+	// the ray's instanceInclusionMask share a bit.
+	// --------------------------------------------------------
+	bool TraceClosest(
+		DirectX::XMFLOAT3 origin,
+		DirectX::XMFLOAT3 direction,
+		float tMin,
+		float tMax,
+		unsigned int instanceInclusionMask,
+		TopLevelHit& hit) const;
+
+	// Is anything hit in [tMin, tMax]?  Stops at the first hit, like
+	// TraceRay() with RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH.
+	bool TraceAny(
+		DirectX::XMFLOAT3 origin,
+		DirectX::XMFLOAT3 direction,
+		float tMin,
+		float tMax,
+		unsigned int instanceInclusionMask) const;
+
+	unsigned int GetInstanceCount() const { return (unsigned int)instances.size(); }
+	const std::vector<BVHNode>& GetNodes() const { return nodes; }
+	TopLevelBuildStats GetBuildStats() const { return buildStats; }
+
+private:
+	// An instance as traced, in leaf order
+	struct Instance
+	{
+		float WorldToObject[3][4];
+		float ObjectToWorld[3][4];
+		unsigned int InstanceIndex;
+		unsigned int InstanceID;
+		unsigned int InstanceMask;
+		unsigned int HitGroupIndex;
+		const BVH* BLAS;
+		const WideBVH* WideBLAS;
+	};
+	std::vector<Instance> instances;
+	std::vector<DirectX::XMFLOAT3> instanceBoundsMin;
+	std::vector<DirectX::XMFLOAT3> instanceBoundsMax;
+	std::vector<BVHNode> nodes;
+	std::vector<unsigned char> nodeMasks;		// Every instance mask in each subtree
+	std::vector<unsigned int> levelNodes;		// Node indices grouped by depth, root first...
+	std::vector<unsigned int> levelStarts;		// ...with level L at [levelStarts[L], levelStarts[L + 1])
+	TopLevelBuildStats buildStats{};
+
+	void UpdateInstances(const BVHInstance* instanceDescs, unsigned int threads);
+	void UpdateNodeBounds();
+	void BuildNodes(const std::vector<unsigned int>& codes);
+	float CalculateSAHCost() const;
+};
@@ -10,7 +10,33 @@
 struct Vertex
 {
 	DirectX::XMFLOAT3 Position;	    // The local position of the vertex
-	DirectX::XMFLOAT2 UV;			// The color of the vertex
+	DirectX::XMFLOAT2 UV;			// Texture coordinate of the vertex
 	DirectX::XMFLOAT3 Normal;		// Normal for lighting
-	DirectX::XMFLOAT3 Tangent;		// Tangent for normal mapping
-};
\ No newline at end of file
+	DirectX::XMFLOAT4 Tangent;		// Tangent for normal mapping (w is handedness: +1 or -1)
+};
+
+// --------------------------------------------------------
+// A compressed version of the vertex above (24 bytes vs 48)
+//
+// See VertexPacking.h for the encoding of each member, and
+// InterpolateVertices() in Raytracing.hlsl for the decoding
+// --------------------------------------------------------
+struct PackedVertex
+{
+	DirectX::XMFLOAT3 Position;		// Full precision local position
+	unsigned int Normal;			// Octahedral encoded, 16 bits per component
+	unsigned int Tangent;			// Octahedral encoded (16 + 15 bits) plus a handedness bit
+	unsigned int UV;				// Two half floats
+};
+
+
+// --------------------------------------------------------
+// The layouts a mesh's vertex buffer can have on the GPU
+//
+// Note: These values are read by the shaders, too!
+// --------------------------------------------------------
+enum class VertexFormat
+{
+	Full = 0,
+	Packed = 1
+};
@@ -0,0 +1,232 @@
+#include "VertexPacking.h"
+
+#include <DirectXPackedVector.h>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace VertexPacking
+{
+	// Annonymous namespace to hold helpers
+	// only accessible in this file
+	namespace
+	{
+		// Largest magnitudes of the signed integer ranges we quantize to
+		const float Snorm16Scale = 32767.0f;
+		const float Snorm15Scale = 16383.0f;
+
+		float Clamp(float value, float low, float high)
+		{
+			return value < low ? low : (value > high ? high : value);
+		}
+
+		// Sign that treats zero as positive, as the octahedral fold requires
+		float SignNotZero(float value)
+		{
+			return value >= 0.0f ? 1.0f : -1.0f;
+		}
+
+		// Quantizes a [-1, 1] value into the low "bits" bits of an unsigned int
+		unsigned int QuantizeSnorm(float value, float scale, unsigned int bits)
+		{
+			int quantized = (int)std::lround(Clamp(value, -1.0f, 1.0f) * scale);
+			return (unsigned int)quantized & ((1u << bits) - 1);
+		}
+
+		// Sign extends the low "bits" bits of an unsigned int back into [-1, 1]
+		float DequantizeSnorm(unsigned int packed, float scale, unsigned int bits)
+		{
+			int quantized = (int)(packed << (32 - bits)) >> (32 - bits);
+			return Clamp(quantized / scale, -1.0f, 1.0f);
+		}
+
+		// --------------------------------------------------------
+		// Projects a unit vector onto an octahedron and unfolds
+		// it into the [-1, 1] square
+		// --------------------------------------------------------
+		XMFLOAT2 OctahedralProject(XMFLOAT3 v)
+		{
+			float sum = std::fabs(v.x) + std::fabs(v.y) + std::fabs(v.z);
+			if (sum == 0.0f)
+				return XMFLOAT2(0, 0);
+
+			XMFLOAT2 oct(v.x / sum, v.y / sum);
+			if (v.z < 0.0f)
+			{
+				// Fold the lower hemisphere over the diagonals
+				oct = XMFLOAT2(
+					(1.0f - std::fabs(oct.y)) * SignNotZero(oct.x),
+					(1.0f - std::fabs(oct.x)) * SignNotZero(oct.y));
+			}
+			return oct;
+		}
+
+		// --------------------------------------------------------
+		// Reverses OctahedralProject, returning a unit vector
+		// --------------------------------------------------------
+		XMFLOAT3 OctahedralUnproject(XMFLOAT2 oct)
+		{
+			XMFLOAT3 v(oct.x, oct.y, 1.0f - std::fabs(oct.x) - std::fabs(oct.y));
+			float t = v.z < 0.0f ? -v.z : 0.0f;
+			v.x += v.x >= 0.0f ? -t : t;
+			v.y += v.y >= 0.0f ? -t : t;
+
+			XMStoreFloat3(&v, XMVector3Normalize(XMLoadFloat3(&v)));
+			return v;
+		}
+
+		// Angle between two vectors in degrees (atan2 rather than acos,
+		// which loses all precision for the tiny angles we care about)
+		float AngleBetween(XMFLOAT3 a, XMFLOAT3 b)
+		{
+			XMVECTOR va = XMLoadFloat3(&a);
+			XMVECTOR vb = XMLoadFloat3(&b);
+			float sine = XMVectorGetX(XMVector3Length(XMVector3Cross(va, vb)));
+			float cosine = XMVectorGetX(XMVector3Dot(va, vb));
+			return XMConvertToDegrees(std::atan2(sine, cosine));
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Encodes a unit vector as octahedral coordinates: x in
+// the low 16 bits and y in the high 16 bits
+// --------------------------------------------------------
+unsigned int VertexPacking::EncodeNormal(XMFLOAT3 normal)
+{
+	XMFLOAT2 oct = OctahedralProject(normal);
+	return
+		QuantizeSnorm(oct.x, Snorm16Scale, 16) |
+		(QuantizeSnorm(oct.y, Snorm16Scale, 16) << 16);
+}
+
+
+// --------------------------------------------------------
+// Decodes a unit vector packed by EncodeNormal()
+// --------------------------------------------------------
+XMFLOAT3 VertexPacking::DecodeNormal(unsigned int packed)
+{
+	return OctahedralUnproject(XMFLOAT2(
+		DequantizeSnorm(packed, Snorm16Scale, 16),
+		DequantizeSnorm(packed >> 16, Snorm16Scale, 16)));
+}
+
+
+// --------------------------------------------------------
+// Encodes a tangent and its handedness: octahedral x in
+// the low 16 bits, y in the next 15 bits, and the top bit
+// set when the handedness (w) is negative
+// --------------------------------------------------------
+unsigned int VertexPacking::EncodeTangent(XMFLOAT4 tangent)
+{
+	XMFLOAT2 oct = OctahedralProject(XMFLOAT3(tangent.x, tangent.y, tangent.z));
+	return
+		QuantizeSnorm(oct.x, Snorm16Scale, 16) |
+		(QuantizeSnorm(oct.y, Snorm15Scale, 15) << 16) |
+		(tangent.w < 0.0f ? 0x80000000u : 0u);
+}
+
+
+// --------------------------------------------------------
+// Decodes a tangent packed by EncodeTangent()
+// --------------------------------------------------------
+XMFLOAT4 VertexPacking::DecodeTangent(unsigned int packed)
+{
+	XMFLOAT3 t = OctahedralUnproject(XMFLOAT2(
+		DequantizeSnorm(packed, Snorm16Scale, 16),
+		DequantizeSnorm(packed >> 16, Snorm15Scale, 15)));
+	return XMFLOAT4(t.x, t.y, t.z, (packed & 0x80000000u) ? -1.0f : 1.0f);
+}
+
+
+// --------------------------------------------------------
+// Encodes a UV as two half floats: u in the low 16 bits
+// and v in the high 16 bits
+// --------------------------------------------------------
+unsigned int VertexPacking::EncodeUV(XMFLOAT2 uv)
+{
+	return
+		(unsigned int)PackedVector::XMConvertFloatToHalf(uv.x) |
+		((unsigned int)PackedVector::XMConvertFloatToHalf(uv.y) << 16);
+}
+
+
+// --------------------------------------------------------
+// Decodes a UV packed by EncodeUV()
+// --------------------------------------------------------
+XMFLOAT2 VertexPacking::DecodeUV(unsigned int packed)
+{
+	return XMFLOAT2(
+		PackedVector::XMConvertHalfToFloat((PackedVector::HALF)(packed & 0xFFFF)),
+		PackedVector::XMConvertHalfToFloat((PackedVector::HALF)(packed >> 16)));
+}
+
+
+// --------------------------------------------------------
+// Packs a single vertex
+// --------------------------------------------------------
+PackedVertex VertexPacking::Pack(const Vertex& vert)
+{
+	PackedVertex packed{};
+	packed.Position = vert.Position;
+	packed.Normal = EncodeNormal(vert.Normal);
+	packed.Tangent = EncodeTangent(vert.Tangent);
+	packed.UV = EncodeUV(vert.UV);
+	return packed;
+}
+
+
+// --------------------------------------------------------
+// Unpacks a single vertex
+// --------------------------------------------------------
+Vertex VertexPacking::Unpack(const PackedVertex& packed)
+{
+	Vertex vert{};
+	vert.Position = packed.Position;
+	vert.Normal = DecodeNormal(packed.Normal);
+	vert.Tangent = DecodeTangent(packed.Tangent);
+	vert.UV = DecodeUV(packed.UV);
+	return vert;
+}
+
+
+// --------------------------------------------------------
+// Packs an entire array of vertices
+//
+// verts       - The full precision vertices
+// numVerts    - How many vertices are in the array
+// packedVerts - Array of at least numVerts to hold the results
+// --------------------------------------------------------
+void VertexPacking::PackVertices(const Vertex* verts, unsigned int numVerts, PackedVertex* packedVerts)
+{
+	for (unsigned int i = 0; i < numVerts; i++)
+		packedVerts[i] = Pack(verts[i]);
+}
+
+
+// --------------------------------------------------------
+// Unpacks every vertex and compares it to the original,
+// tracking the worst case error of each attribute
+// --------------------------------------------------------
+VertexPackingError VertexPacking::MeasureError(const Vertex* verts, const PackedVertex* packedVerts, unsigned int numVerts)
+{
+	VertexPackingError error{};
+	for (unsigned int i = 0; i < numVerts; i++)
+	{
+		const Vertex& original = verts[i];
+		Vertex decoded = Unpack(packedVerts[i]);
+
+		error.MaxNormalDegrees = std::fmax(error.MaxNormalDegrees, AngleBetween(original.Normal, decoded.Normal));
+		error.MaxTangentDegrees = std::fmax(error.MaxTangentDegrees, AngleBetween(
+			XMFLOAT3(original.Tangent.x, original.Tangent.y, original.Tangent.z),
+			XMFLOAT3(decoded.Tangent.x, decoded.Tangent.y, decoded.Tangent.z)));
+		error.MaxUVError = std::fmax(error.MaxUVError, std::fmax(
+			std::fabs(original.UV.x - decoded.UV.x),
+			std::fabs(original.UV.y - decoded.UV.y)));
+
+		if ((original.Tangent.w < 0.0f) != (decoded.Tangent.w < 0.0f))
+			error.HandednessMismatches++;
+	}
+	return error;
+}
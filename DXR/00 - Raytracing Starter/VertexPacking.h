@@ -0,0 +1,46 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+#include "Vertex.h"
+
+// --------------------------------------------------------
+// Worst case differences between a set of vertices and
+// their packed versions, for checking the encoding quality
+// --------------------------------------------------------
+struct VertexPackingError
+{
+	float MaxNormalDegrees;
+	float MaxTangentDegrees;
+	float MaxUVError;
+	unsigned int HandednessMismatches;
+};
+
+// --------------------------------------------------------
+// Encoding & decoding for PackedVertex.  The decode side
+// is mirrored in Raytracing.hlsl, so changes here need to
+// be made there as well.
+// --------------------------------------------------------
+namespace VertexPacking
+{
+	// Unit vectors as two 16-bit snorm octahedral coordinates
+	unsigned int EncodeNormal(DirectX::XMFLOAT3 normal);
+	DirectX::XMFLOAT3 DecodeNormal(unsigned int packed);
+
+	// Unit vectors with handedness as 16-bit and 15-bit snorm
+	// octahedral coordinates, with the sign in the top bit
+	unsigned int EncodeTangent(DirectX::XMFLOAT4 tangent);
+	DirectX::XMFLOAT4 DecodeTangent(unsigned int packed);
+
+	// Two half floats
+	unsigned int EncodeUV(DirectX::XMFLOAT2 uv);
+	DirectX::XMFLOAT2 DecodeUV(unsigned int packed);
+
+	// Whole vertices
+	PackedVertex Pack(const Vertex& vert);
+	Vertex Unpack(const PackedVertex& packed);
+	void PackVertices(const Vertex* verts, unsigned int numVerts, PackedVertex* packedVerts);
+
+	// Round trip error of an entire set of vertices
+	VertexPackingError MeasureError(const Vertex* verts, const PackedVertex* packedVerts, unsigned int numVerts);
+}
@@ -0,0 +1,549 @@
+#include "WideBVH.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <xmmintrin.h>
+
+using namespace DirectX;
+
+// Annonymous namespace to hold helpers
+// only accessible in this file
+namespace
+{
+	// Each wide node replaces at least one binary level, so the wide tree
+	// is no deeper than the binary one, and each visit pushes at most
+	// all but one of its children
+	const unsigned int MaxTreeDepth = 64;
+	const unsigned int StackSize = MaxTreeDepth * (WideBVHWidth - 1) + 1;
+
+	const unsigned int EmptyChild = 0xFFFFFFFF;
+
+	float SurfaceArea(const BVHNode& node)
+	{
+		float x = node.BoundsMax.x - node.BoundsMin.x;
+		float y = node.BoundsMax.y - node.BoundsMin.y;
+		float z = node.BoundsMax.z - node.BoundsMin.z;
+		return 2.0f * (x * y + y * z + z * x);
+	}
+
+	// --------------------------------------------------------
+	// Fills one lane of a triangle block from a triangle's
+	// three positions, with the same subtractions the scalar
+	// test does, so the results match
+	// --------------------------------------------------------
+	void SetTriangleLane(WideBVHTriangles& block, unsigned int lane, const XMFLOAT3* p)
+	{
+		block.V0X[lane] = p[0].x;
+		block.V0Y[lane] = p[0].y;
+		block.V0Z[lane] = p[0].z;
+		block.E1X[lane] = p[1].x - p[0].x;
+		block.E1Y[lane] = p[1].y - p[0].y;
+		block.E1Z[lane] = p[1].z - p[0].z;
+		block.E2X[lane] = p[2].x - p[0].x;
+		block.E2Y[lane] = p[2].y - p[0].y;
+		block.E2Z[lane] = p[2].z - p[0].z;
+	}
+
+	struct StackEntry
+	{
+		unsigned int Node;
+		float Entry;
+	};
+
+	// --------------------------------------------------------
+	// A ray splatted across all four lanes, along with which
+	// of each box's planes it enters & leaves through.  Those
+	// depend only on the direction's signs, which saves sorting
+	// every slab, and are offsets (in floats) from MinX to the
+	// near & far planes on each axis.
+	// --------------------------------------------------------
+	struct WideRay
+	{
+		__m128 OriginX, OriginY, OriginZ;
+		__m128 DirX, DirY, DirZ;
+		__m128 InvDirX, InvDirY, InvDirZ;
+		__m128 TMin;
+		unsigned int NearX, NearY, NearZ;
+		unsigned int FarX, FarY, FarZ;
+
+		WideRay(XMFLOAT3 origin, XMFLOAT3 direction, float tMin)
+		{
+			OriginX = _mm_set1_ps(origin.x);
+			OriginY = _mm_set1_ps(origin.y);
+			OriginZ = _mm_set1_ps(origin.z);
+			DirX = _mm_set1_ps(direction.x);
+			DirY = _mm_set1_ps(direction.y);
+			DirZ = _mm_set1_ps(direction.z);
+			InvDirX = _mm_set1_ps(1.0f / direction.x);
+			InvDirY = _mm_set1_ps(1.0f / direction.y);
+			InvDirZ = _mm_set1_ps(1.0f / direction.z);
+			TMin = _mm_set1_ps(tMin);
+
+			NearX = 1.0f / direction.x < 0.0f ? 12 : 0;
+			NearY = 1.0f / direction.y < 0.0f ? 16 : 4;
+			NearZ = 1.0f / direction.z < 0.0f ? 20 : 8;
+			FarX = NearX ^ 12;
+			FarY = NearY ^ 20;
+			FarZ = NearZ ^ 28;
+		}
+	};
+
+	// --------------------------------------------------------
+	// Slab tests all four children of a node, returning a mask
+	// of those hit before tMax, and where the ray enters each.
+	// A NaN from 0 * infinity (a ray in a slab's plane) is the
+	// first operand to min/max, which returns the second
+	// operand instead, so it can't make a box miss or hit.
+	// --------------------------------------------------------
+	int IntersectChildren(const WideRay& ray, const WideBVHNode& node, float tMax, __m128& tNear)
+	{
+		const float* bounds = node.MinX;
+		__m128 tNearX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.NearX), ray.OriginX), ray.InvDirX);
+		__m128 tNearY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.NearY), ray.OriginY), ray.InvDirY);
+		__m128 tNearZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.NearZ), ray.OriginZ), ray.InvDirZ);
+		__m128 tFarX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.FarX), ray.OriginX), ray.InvDirX);
+		__m128 tFarY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.FarY), ray.OriginY), ray.InvDirY);
+		__m128 tFarZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.FarZ), ray.OriginZ), ray.InvDirZ);
+		tNear = _mm_max_ps(tNearZ, _mm_max_ps(tNearY, _mm_max_ps(tNearX, ray.TMin)));
+		__m128 tFar = _mm_min_ps(tFarZ, _mm_min_ps(tFarY, _mm_min_ps(tFarX, _mm_set1_ps(tMax))));
+		return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+	}
+
+	// --------------------------------------------------------
+	// Moller-Trumbore on four triangles at once, returning a
+	// mask of those hit in [tMin, tMax) along with the hits'
+	// distances & barycentrics
+	// --------------------------------------------------------
+	int IntersectTriangles(const WideRay& ray, const WideBVHTriangles& tris, float tMax, __m128& t, __m128& u, __m128& v)
+	{
+		__m128 zero = _mm_setzero_ps();
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 e1X = _mm_load_ps(tris.E1X);
+		__m128 e1Y = _mm_load_ps(tris.E1Y);
+		__m128 e1Z = _mm_load_ps(tris.E1Z);
+		__m128 e2X = _mm_load_ps(tris.E2X);
+		__m128 e2Y = _mm_load_ps(tris.E2Y);
+		__m128 e2Z = _mm_load_ps(tris.E2Z);
+
+		__m128 pX = _mm_sub_ps(_mm_mul_ps(ray.DirY, e2Z), _mm_mul_ps(ray.DirZ, e2Y));
+		__m128 pY = _mm_sub_ps(_mm_mul_ps(ray.DirZ, e2X), _mm_mul_ps(ray.DirX, e2Z));
+		__m128 pZ = _mm_sub_ps(_mm_mul_ps(ray.DirX, e2Y), _mm_mul_ps(ray.DirY, e2X));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1X, pX), _mm_mul_ps(e1Y, pY)), _mm_mul_ps(e1Z, pZ));
+		__m128 invDet = _mm_div_ps(one, det);
+
+		__m128 toOriginX = _mm_sub_ps(ray.OriginX, _mm_load_ps(tris.V0X));
+		__m128 toOriginY = _mm_sub_ps(ray.OriginY, _mm_load_ps(tris.V0Y));
+		__m128 toOriginZ = _mm_sub_ps(ray.OriginZ, _mm_load_ps(tris.V0Z));
+		u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(toOriginX, pX), _mm_mul_ps(toOriginY, pY)), _mm_mul_ps(toOriginZ, pZ)), invDet);
+
+		__m128 qX = _mm_sub_ps(_mm_mul_ps(toOriginY, e1Z), _mm_mul_ps(toOriginZ, e1Y));
+		__m128 qY = _mm_sub_ps(_mm_mul_ps(toOriginZ, e1X), _mm_mul_ps(toOriginX, e1Z));
+		__m128 qZ = _mm_sub_ps(_mm_mul_ps(toOriginX, e1Y), _mm_mul_ps(toOriginY, e1X));
+		v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ray.DirX, qX), _mm_mul_ps(ray.DirY, qY)), _mm_mul_ps(ray.DirZ, qZ)), invDet);
+		t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2X, qX), _mm_mul_ps(e2Y, qY)), _mm_mul_ps(e2Z, qZ)), invDet);
+
+		// Comparisons with NaN are false, so degenerate lanes drop out here
+		__m128 valid = _mm_cmpneq_ps(det, zero);
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(t, ray.TMin));
+		valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(tMax)));
+		return _mm_movemask_ps(valid);
+	}
+}
+
+
+WideBVH::WideBVH(const BVH& bvh)
+{
+	Build(bvh);
+}
+
+
+// --------------------------------------------------------
+// Collapses a binary BVH into this one, replacing anything
+// built previously.  The binary BVH isn't needed after.
+//
+// Each wide node takes a binary node's children and keeps
+// opening up the largest inner child among them until it
+// has four, so the nodes most likely to be visited are the
+// ones folded away.  Any subtree with few enough triangles
+// to fill a single block becomes one leaf, as its triangles
+// are contiguous in the binary BVH's leaf order.
+// --------------------------------------------------------
+WideBVHBuildStats WideBVH::Build(const BVH& bvh)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	nodes.clear();
+	triangles.clear();
+	blockTriangles.clear();
+	buildStats = {};
+	if (bvh.GetNodes().empty())
+		return buildStats;
+
+	// Children always come after their parents, so a backwards pass
+	// can total up every subtree's triangles
+	const std::vector<BVHNode>& binaryNodes = bvh.GetNodes();
+	subtreeTriangles.resize(binaryNodes.size());
+	for (size_t i = binaryNodes.size(); i-- > 0;)
+	{
+		const BVHNode& node = binaryNodes[i];
+		if (node.Count > 0)
+		{
+			subtreeTriangles[i] = { node.Index, node.Count };
+			continue;
+		}
+
+		TriangleRange left = subtreeTriangles[i + 1];
+		TriangleRange right = subtreeTriangles[node.Index];
+		subtreeTriangles[i] = { left.First, left.Count + right.Count };
+	}
+
+	CollapseNode(bvh, 0);
+	subtreeTriangles.clear();
+	subtreeTriangles.shrink_to_fit();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	unsigned int children = 0;
+	for (const WideBVHNode& node : nodes)
+	{
+		for (unsigned int i = 0; i < WideBVHWidth; i++)
+		{
+			if (node.Child[i] == EmptyChild)
+				continue;
+			children++;
+			buildStats.Leaves += node.Count[i] > 0 ? 1 : 0;
+		}
+	}
+
+	buildStats.Triangles = bvh.GetTriangleCount();
+	buildStats.Nodes = (unsigned int)nodes.size();
+	buildStats.TriangleBlocks = (unsigned int)triangles.size();
+	buildStats.ChildFill = (float)children / nodes.size();
+	buildStats.TriangleFill = (float)buildStats.Triangles / triangles.size();
+	buildStats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	return buildStats;
+}
+
+
+// --------------------------------------------------------
+// Makes the wide node for a binary node (and, recursively,
+// all of its descendants), returning its index.  Nodes end
+// up depth-first, like the binary BVH.
+// --------------------------------------------------------
+unsigned int WideBVH::CollapseNode(const BVH& bvh, unsigned int binaryIndex)
+{
+	const std::vector<BVHNode>& binaryNodes = bvh.GetNodes();
+
+	// Open up the largest inner node until the slots are full
+	auto isLeaf = [&](unsigned int index)
+		{
+			return binaryNodes[index].Count > 0 || subtreeTriangles[index].Count <= WideBVHWidth;
+		};
+
+	unsigned int open[WideBVHWidth] = { binaryIndex };
+	unsigned int openCount = 1;
+	while (openCount < WideBVHWidth)
+	{
+		int largest = -1;
+		float largestArea = -1.0f;
+		for (unsigned int i = 0; i < openCount; i++)
+		{
+			const BVHNode& node = binaryNodes[open[i]];
+			if (!isLeaf(open[i]) && SurfaceArea(node) > largestArea)
+			{
+				largest = i;
+				largestArea = SurfaceArea(node);
+			}
+		}
+		if (largest < 0)
+			break;
+
+		unsigned int index = open[largest];
+		open[largest] = index + 1;
+		open[openCount++] = binaryNodes[index].Index;
+	}
+
+	// Reserve this node before its children, then fill in each slot
+	unsigned int wideIndex = (unsigned int)nodes.size();
+	nodes.emplace_back();
+	for (unsigned int i = 0; i < WideBVHWidth; i++)
+	{
+		WideBVHNode& node = nodes[wideIndex];
+		if (i >= openCount)
+		{
+			node.MinX[i] = node.MinY[i] = node.MinZ[i] = FLT_MAX;
+			node.MaxX[i] = node.MaxY[i] = node.MaxZ[i] = -FLT_MAX;
+			node.Child[i] = EmptyChild;
+			node.Count[i] = 0;
+			continue;
+		}
+
+		const BVHNode& child = binaryNodes[open[i]];
+		node.MinX[i] = child.BoundsMin.x;
+		node.MinY[i] = child.BoundsMin.y;
+		node.MinZ[i] = child.BoundsMin.z;
+		node.MaxX[i] = child.BoundsMax.x;
+		node.MaxY[i] = child.BoundsMax.y;
+		node.MaxZ[i] = child.BoundsMax.z;
+
+		if (isLeaf(open[i]))
+		{
+			TriangleRange range = subtreeTriangles[open[i]];
+			node.Child[i] = AddTriangles(bvh, range);
+			node.Count[i] = (range.Count + WideBVHWidth - 1) / WideBVHWidth;
+			continue;
+		}
+
+		// Recursing can reallocate the nodes, so don't hold on to a reference
+		unsigned int childIndex = CollapseNode(bvh, open[i]);
+		nodes[wideIndex].Child[i] = childIndex;
+		nodes[wideIndex].Count[i] = 0;
+	}
+	return wideIndex;
+}
+
+
+// --------------------------------------------------------
+// Packs a range of the binary BVH's triangles into blocks
+// of four, returning the index of the first block
+// --------------------------------------------------------
+unsigned int WideBVH::AddTriangles(const BVH& bvh, TriangleRange range)
+{
+	unsigned int first = (unsigned int)triangles.size();
+	const XMFLOAT3* positions = bvh.GetTrianglePositions();
+	const unsigned int* ids = bvh.GetTriangleIDs();
+
+	for (unsigned int blockStart = 0; blockStart < range.Count; blockStart += WideBVHWidth)
+	{
+		WideBVHTriangles block = {};
+		for (unsigned int lane = 0; lane < WideBVHWidth; lane++)
+		{
+			if (blockStart + lane >= range.Count)
+			{
+				block.IDs[lane] = EmptyChild;
+				continue;
+			}
+
+			unsigned int tri = range.First + blockStart + lane;
+			SetTriangleLane(block, lane, &positions[(size_t)tri * 3]);
+			block.IDs[lane] = ids[tri];
+		}
+		triangles.push_back(block);
+		blockTriangles.push_back(range.First + blockStart);
+	}
+	return first;
+}
+
+
+// --------------------------------------------------------
+// Refits to a binary BVH whose triangles have moved, in
+// O(n) and without collapsing anything: every triangle
+// block is refilled from the binary BVH's new positions,
+// then every child slot's bounds are recalculated from the
+// bottom up.  Nodes are depth-first, so walking the array
+// backwards reaches every child before its parent.
+//
+// The structure is kept from the collapse, so it's not
+// necessarily what collapsing the refit binary BVH would
+// give (which opens the nodes that are largest now), but
+// each child's bounds are the exact bounds of the moved
+// triangles under it, like the binary refit's.
+// --------------------------------------------------------
+WideBVHBuildStats WideBVH::Refit(const BVH& bvh)
+{
+	if (nodes.empty() || bvh.GetTriangleCount() != buildStats.Triangles || blockTriangles.size() != triangles.size())
+		return Build(bvh);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	const XMFLOAT3* positions = bvh.GetTrianglePositions();
+	for (size_t b = 0; b < triangles.size(); b++)
+	{
+		WideBVHTriangles& block = triangles[b];
+		for (unsigned int lane = 0; lane < WideBVHWidth && block.IDs[lane] != EmptyChild; lane++)
+			SetTriangleLane(block, lane, &positions[((size_t)blockTriangles[b] + lane) * 3]);
+	}
+
+	for (size_t n = nodes.size(); n-- > 0;)
+	{
+		WideBVHNode& node = nodes[n];
+		for (unsigned int i = 0; i < WideBVHWidth; i++)
+		{
+			if (node.Child[i] == EmptyChild)
+				continue;
+
+			XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX);
+			XMFLOAT3 boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			auto grow = [&](float minX, float minY, float minZ, float maxX, float maxY, float maxZ)
+				{
+					boundsMin = XMFLOAT3(std::min(boundsMin.x, minX), std::min(boundsMin.y, minY), std::min(boundsMin.z, minZ));
+					boundsMax = XMFLOAT3(std::max(boundsMax.x, maxX), std::max(boundsMax.y, maxY), std::max(boundsMax.z, maxZ));
+				};
+
+			if (node.Count[i] > 0)
+			{
+				// A leaf: its blocks' triangles
+				for (unsigned int b = node.Child[i]; b < node.Child[i] + node.Count[i]; b++)
+				{
+					for (unsigned int lane = 0; lane < WideBVHWidth && triangles[b].IDs[lane] != EmptyChild; lane++)
+					{
+						const XMFLOAT3* p = &positions[((size_t)blockTriangles[b] + lane) * 3];
+						for (unsigned int c = 0; c < 3; c++)
+							grow(p[c].x, p[c].y, p[c].z, p[c].x, p[c].y, p[c].z);
+					}
+				}
+			}
+			else
+			{
+				// An inner node: its (already refit) children, where empty slots' inverted bounds change nothing
+				const WideBVHNode& child = nodes[node.Child[i]];
+				for (unsigned int c = 0; c < WideBVHWidth; c++)
+					grow(child.MinX[c], child.MinY[c], child.MinZ[c], child.MaxX[c], child.MaxY[c], child.MaxZ[c]);
+			}
+
+			node.MinX[i] = boundsMin.x;
+			node.MinY[i] = boundsMin.y;
+			node.MinZ[i] = boundsMin.z;
+			node.MaxX[i] = boundsMax.x;
+			node.MaxY[i] = boundsMax.y;
+			node.MaxZ[i] = boundsMax.z;
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	WideBVHBuildStats stats = buildStats;
+	stats.Refit = true;
+	stats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	return stats;
+}
+
+
+// --------------------------------------------------------
+// Finds the closest triangle hit along a ray.  Each node
+// visit slab tests all four children at once, leaves are
+// tested as soon as they're hit (shrinking the ray), and
+// inner children are pushed so the nearest is popped next.
+// --------------------------------------------------------
+bool WideBVH::TraceClosest(XMFLOAT3 origin, XMFLOAT3 direction, float tMin, float tMax, BVHHit& hit) const
+{
+	if (nodes.empty())
+		return false;
+
+	WideRay ray(origin, direction, tMin);
+	bool found = false;
+	float closest = tMax;
+	StackEntry stack[StackSize];
+	unsigned int stackSize = 0;
+	stack[stackSize++] = { 0, tMin };
+	while (stackSize > 0)
+	{
+		StackEntry entry = stack[--stackSize];
+		if (entry.Entry > closest)
+			continue;
+
+		const WideBVHNode& node = nodes[entry.Node];
+		__m128 tNear;
+		int hitMask = IntersectChildren(ray, node, closest, tNear);
+		if (hitMask == 0)
+			continue;
+
+		float entries[WideBVHWidth];
+		_mm_storeu_ps(entries, tNear);
+
+		// Test leaves right away, and gather the inner children
+		StackEntry inner[WideBVHWidth];
+		unsigned int innerCount = 0;
+		for (unsigned int i = 0; i < WideBVHWidth; i++)
+		{
+			if ((hitMask & (1 << i)) == 0)
+				continue;
+
+			if (node.Count[i] == 0)
+			{
+				inner[innerCount++] = { node.Child[i], entries[i] };
+				continue;
+			}
+
+			for (unsigned int b = node.Child[i]; b < node.Child[i] + node.Count[i]; b++)
+			{
+				const WideBVHTriangles& tris = triangles[b];
+				__m128 t, u, v;
+				int triMask = IntersectTriangles(ray, tris, closest, t, u, v);
+				if (triMask == 0)
+					continue;
+
+				float ts[WideBVHWidth], us[WideBVHWidth], vs[WideBVHWidth];
+				_mm_storeu_ps(ts, t);
+				_mm_storeu_ps(us, u);
+				_mm_storeu_ps(vs, v);
+				for (unsigned int lane = 0; lane < WideBVHWidth; lane++)
+				{
+					if ((triMask & (1 << lane)) && ts[lane] < closest)
+					{
+						closest = ts[lane];
+						hit.T = ts[lane];
+						hit.Triangle = tris.IDs[lane];
+						hit.Barycentrics = XMFLOAT2(us[lane], vs[lane]);
+						found = true;
+					}
+				}
+			}
+		}
+
+		// Push the inner children farthest first, so the nearest is visited next
+		for (unsigned int i = 1; i < innerCount; i++)
+		{
+			StackEntry child = inner[i];
+			unsigned int j = i;
+			for (; j > 0 && inner[j - 1].Entry < child.Entry; j--)
+				inner[j] = inner[j - 1];
+			inner[j] = child;
+		}
+		for (unsigned int i = 0; i < innerCount; i++)
+			stack[stackSize++] = inner[i];
+	}
+	return found;
+}
+
+
+// --------------------------------------------------------
+// Checks for any triangle hit along a ray, stopping at the
+// first one found.  Nothing about the hit is needed, so
+// children are visited in whatever order they're stored.
+// --------------------------------------------------------
+bool WideBVH::TraceAny(XMFLOAT3 origin, XMFLOAT3 direction, float tMin, float tMax) const
+{
+	if (nodes.empty())
+		return false;
+
+	WideRay ray(origin, direction, tMin);
+	unsigned int stack[StackSize];
+	unsigned int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const WideBVHNode& node = nodes[stack[--stackSize]];
+		__m128 tNear;
+		int hitMask = IntersectChildren(ray, node, tMax, tNear);
+		for (unsigned int i = 0; i < WideBVHWidth; i++)
+		{
+			if ((hitMask & (1 << i)) == 0)
+				continue;
+
+			if (node.Count[i] == 0)
+			{
+				stack[stackSize++] = node.Child[i];
+				continue;
+			}
+
+			for (unsigned int b = node.Child[i]; b < node.Child[i] + node.Count[i]; b++)
+			{
+				__m128 t, u, v;
+				if (IntersectTriangles(ray, triangles[b], tMax, t, u, v) != 0)
+					return true;
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+#include "BVH.h"
+
+// Children per node and triangles per leaf block, matching SSE's 4 lanes
+const unsigned int WideBVHWidth = 4;
+
+// --------------------------------------------------------
+// A 4-wide BVH node.  Child bounds are stored as structures
+// of arrays so a single SIMD slab test checks all children
+// at once.  Empty slots have inverted bounds, which no ray
+// can hit.  128 bytes.
+// --------------------------------------------------------
+struct alignas(16) WideBVHNode
+{
+	float MinX[WideBVHWidth];
+	float MinY[WideBVHWidth];
+	float MinZ[WideBVHWidth];
+	float MaxX[WideBVHWidth];
+	float MaxY[WideBVHWidth];
+	float MaxZ[WideBVHWidth];
+	unsigned int Child[WideBVHWidth];	// Inner: node index, leaf: first triangle block
+	unsigned int Count[WideBVHWidth];	// Inner: 0, leaf: triangle block count
+};
+
+// --------------------------------------------------------
+// Four triangles, precomputed for a SIMD Moller-Trumbore
+// test: the first vertex and both edges from it.  Unused
+// lanes are degenerate, so they never report a hit.
+// --------------------------------------------------------
+struct alignas(16) WideBVHTriangles
+{
+	float V0X[WideBVHWidth];
+	float V0Y[WideBVHWidth];
+	float V0Z[WideBVHWidth];
+	float E1X[WideBVHWidth];
+	float E1Y[WideBVHWidth];
+	float E1Z[WideBVHWidth];
+	float E2X[WideBVHWidth];
+	float E2Y[WideBVHWidth];
+	float E2Z[WideBVHWidth];
+	unsigned int IDs[WideBVHWidth];		// Index of each triangle in the original index data
+};
+
+// Details of the most recent collapse
+struct WideBVHBuildStats
+{
+	unsigned int Triangles;
+	unsigned int Nodes;
+	unsigned int Leaves;
+	unsigned int TriangleBlocks;
+	float ChildFill;			// Average children per node (out of WideBVHWidth)
+	float TriangleFill;			// Average triangles per block (out of WideBVHWidth)
+	bool Refit;					// Refit rather than collapsed (see WideBVH::Refit)
+	double Milliseconds;
+};
+
+// --------------------------------------------------------
+// A 4-wide BVH collapsed from a binary one, for faster CPU
+// traversal: each node visit tests four boxes with one set
+// of SIMD instructions, and leaves test four triangles at
+// a time.  Gives the same answers as BVH, other than which
+// of two triangles at exactly the same distance is closest.
+// --------------------------------------------------------
+class WideBVH
+{
+public:
+	WideBVH() = default;
+	WideBVH(const BVH& bvh);
+
+	WideBVHBuildStats Build(const BVH& bvh);
+
+	// Updates every node's bounds and triangle block for the binary BVH
+	// this was collapsed from, after BVH::Refit() has moved its triangles
+	// (or collapses it again, if it no longer matches).  A binary BVH
+	// that was rebuilt instead has a new structure, so needs Build().
+	WideBVHBuildStats Refit(const BVH& bvh);
+
+	// Closest hit in [tMin, tMax], if any (same as BVH::TraceClosest)
+	bool TraceClosest(
+		DirectX::XMFLOAT3 origin,
+		DirectX::XMFLOAT3 direction,
+		float tMin,
+		float tMax,
+		BVHHit& hit) const;
+
+	// Is anything hit in [tMin, tMax]?  (same as BVH::TraceAny)
+	bool TraceAny(
+		DirectX::XMFLOAT3 origin,
+		DirectX::XMFLOAT3 direction,
+		float tMin,
+		float tMax) const;
+
+	const std::vector<WideBVHNode>& GetNodes() const { return nodes; }
+	const std::vector<WideBVHTriangles>& GetTriangles() const { return triangles; }
+	WideBVHBuildStats GetBuildStats() const { return buildStats; }
+
+private:
+	std::vector<WideBVHNode> nodes;
+	std::vector<WideBVHTriangles> triangles;
+	WideBVHBuildStats buildStats{};
+
+	// The first of each block's triangles in the binary BVH's leaf order
+	// (the rest follow it), so refits know where to find them
+	std::vector<unsigned int> blockTriangles;
+
+	// The contiguous range of triangles under each binary node, used while collapsing
+	struct TriangleRange
+	{
+		unsigned int First;
+		unsigned int Count;
+	};
+	std::vector<TriangleRange> subtreeTriangles;
+
+	unsigned int CollapseNode(const BVH& bvh, unsigned int binaryIndex);
+	unsigned int AddTriangles(const BVH& bvh, TriangleRange range);
+};